@@ -0,0 +1,60 @@
+# FindHarfBuzz - attempts to locate the HarfBuzz text shaping library.
+#
+# This module defines the following variables (on success):
+#   HARFBUZZ_INCLUDE_DIRS - where to find hb.h and hb-ft.h
+#   HARFBUZZ_LIBRARIES    - libraries to link against
+#   HARFBUZZ_FOUND        - if the library was successfully located
+#
+# It is trying pkg-config and a few standard installation locations, but can
+# be customized with the following variables:
+#   HARFBUZZ_ROOT_DIR     - root directory of a HarfBuzz installation
+#                           Headers are expected to be found in
+#                           <HARFBUZZ_ROOT_DIR>/include/harfbuzz/hb.h
+#                           This variable can either be a cmake or environment
+#                           variable.
+
+# default search dirs
+SET(_harfbuzz_SEARCH_DIRS
+    "/usr"
+    "/usr/local")
+
+# check environment variable
+SET(_harfbuzz_ENV_ROOT_DIR "$ENV{HARFBUZZ_ROOT_DIR}")
+
+IF(NOT HARFBUZZ_ROOT_DIR AND _harfbuzz_ENV_ROOT_DIR)
+    SET(HARFBUZZ_ROOT_DIR "${_harfbuzz_ENV_ROOT_DIR}")
+ENDIF(NOT HARFBUZZ_ROOT_DIR AND _harfbuzz_ENV_ROOT_DIR)
+
+# put user specified location at beginning of search
+IF(HARFBUZZ_ROOT_DIR)
+    SET(_harfbuzz_SEARCH_DIRS "${HARFBUZZ_ROOT_DIR}"
+                              ${_harfbuzz_SEARCH_DIRS})
+ENDIF(HARFBUZZ_ROOT_DIR)
+
+# use pkg-config for hints, if available
+FIND_PACKAGE(PkgConfig QUIET)
+IF(PKG_CONFIG_FOUND)
+    PKG_CHECK_MODULES(_harfbuzz_PC QUIET harfbuzz)
+ENDIF(PKG_CONFIG_FOUND)
+
+# locate header and library
+FIND_PATH(HARFBUZZ_INCLUDE_DIR "hb-ft.h"
+    HINTS ${_harfbuzz_PC_INCLUDE_DIRS}
+    PATHS ${_harfbuzz_SEARCH_DIRS}
+    PATH_SUFFIXES "include/harfbuzz" "harfbuzz")
+
+FIND_LIBRARY(HARFBUZZ_LIBRARY harfbuzz
+    HINTS ${_harfbuzz_PC_LIBRARY_DIRS}
+    PATHS ${_harfbuzz_SEARCH_DIRS}
+    PATH_SUFFIXES "lib" "lib64")
+
+INCLUDE(FindPackageHandleStandardArgs)
+FIND_PACKAGE_HANDLE_STANDARD_ARGS(HarfBuzz DEFAULT_MSG
+    HARFBUZZ_LIBRARY HARFBUZZ_INCLUDE_DIR)
+
+IF(HARFBUZZ_FOUND)
+    SET(HARFBUZZ_INCLUDE_DIRS "${HARFBUZZ_INCLUDE_DIR}")
+    SET(HARFBUZZ_LIBRARIES "${HARFBUZZ_LIBRARY}")
+
+    MESSAGE(STATUS "HARFBUZZ_INCLUDE_DIR = ${HARFBUZZ_INCLUDE_DIR}")
+ENDIF(HARFBUZZ_FOUND)
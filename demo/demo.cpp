@@ -19,9 +19,7 @@
 // SOFTWARE.
 
 #include <chrono>
-#include <iomanip>
 #include <iostream>
-#include <sstream>
 
 #include <cmath>
 
@@ -33,6 +31,8 @@
 
 #include "textogl/font.hpp"
 #include "textogl/static_text.hpp"
+#include "textogl/text_effect.hpp"
+#include "textogl/text_template.hpp"
 
 int main(int argc, char * argv[])
 {
@@ -59,10 +59,34 @@ int main(int argc, char * argv[])
     textogl::Font_sys font(argv[1], 32);
     textogl::Font_sys font2(argv[2], 72);
 
+    textogl::Text_template dynamic_text(font, "Dynamic text: {fps:8} fps");
+    const auto fps_slot = dynamic_text.get_slot_index("fps");
+
+    textogl::Number_format fps_format;
+    fps_format.precision = 3;
+
     textogl::Static_text static_text(font, u8"Static Text, with unicode: ø∅Ø💩‽");
     textogl::Static_text static_text2(font2, "Multiple fonts");
     textogl::Static_text rotating_text(font, "Rotation");
     textogl::Static_text text_3d(font2, "3D");
+    textogl::Static_text wave_text(font, "Wavy text, animated on the GPU");
+
+    // this never changes, so draw it from a cached texture
+    static_text2.set_impostor(true);
+
+    textogl::Text_style outlined;
+    outlined.outline_width = 1.5f;
+    outlined.shadow_color = textogl::Color{0.0f, 0.0f, 0.0f, 0.5f};
+    outlined.shadow_offset = textogl::Vec2<float>{3.0f, 3.0f};
+    outlined.shadow_softness = 1.0f;
+
+    // params: amplitude, speed, wavelength (in glyphs)
+    textogl::Text_effect wave(R"(
+        void effect(inout vec2 pos, inout vec4 color, float glyph, float line)
+        {
+            pos.y += params.x * sin(time * params.y + glyph / params.z);
+        }
+    )");
 
     std::vector<textogl::Static_text> static_arr;
     for(int i = 0; i < 10; ++i)
@@ -87,6 +111,8 @@ int main(int argc, char * argv[])
         -0.05f,  0.0f,   -0.25f, 1.0f
     };
 
+    const auto start = std::chrono::high_resolution_clock::now();
+
     bool running = true;
     float angle = 0.0f;
     while(running)
@@ -110,7 +136,6 @@ int main(int argc, char * argv[])
         }
 
         static int frame_count = 0;
-        static std::ostringstream fps_format;
 
         static auto last_frame = std::chrono::high_resolution_clock::now();
         auto now = std::chrono::high_resolution_clock::now();
@@ -124,8 +149,7 @@ int main(int argc, char * argv[])
             last_frame = now;
             frame_count = 0;
 
-            fps_format.str("");
-            fps_format<<"Dynamic text: "<<std::setprecision(3)<<std::fixed<<fps<<" fps";
+            dynamic_text.set_slot_float(fps_slot, fps, fps_format);
         }
         ++frame_count;
 
@@ -134,12 +158,12 @@ int main(int argc, char * argv[])
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         // Red dynamic text, in UL corner
-        font.render_text(fps_format.str(), textogl::Color{1.0f, 0.0f, 0.0f, 1.0f},
+        dynamic_text.render_text(textogl::Color{1.0f, 0.0f, 0.0f, 1.0f},
                 textogl::Vec2<float>{(float)win.getSize().x, (float)win.getSize().y},
                 textogl::Vec2<float>{0.0f, 0.0f}, textogl::ORIGIN_VERT_TOP | textogl::ORIGIN_HORIZ_LEFT);
 
-        // Green static text, @ 0, 75
-        static_text.render_text(textogl::Color{0.0f, 1.0f, 0.0f, 1.0f}, textogl::Vec2<float>{(float)win.getSize().x, (float)win.getSize().y},
+        // Green outlined static text with a drop shadow, @ 0, 75
+        static_text.render_text_styled(outlined, textogl::Color{0.0f, 1.0f, 0.0f, 1.0f}, textogl::Vec2<float>{(float)win.getSize().x, (float)win.getSize().y},
                 textogl::Vec2<float>{0.0f, 75.0f}, textogl::ORIGIN_VERT_TOP | textogl::ORIGIN_HORIZ_LEFT);
 
         // blue larger font @ 0, 150
@@ -166,6 +190,11 @@ int main(int argc, char * argv[])
 
         text_3d.render_text_mat(textogl::Color{0.0, 0.0f, 0.0f, 1.0f}, projection * rotation * view);
 
+        // waving text, @ 0, 400. only the time changes each frame
+        wave_text.render_text_effect(wave, std::chrono::duration<float>(now - start).count(), textogl::Vec4<float>{8.0f, 4.0f, 2.0f, 0.0f},
+                textogl::Color{0.5f, 0.0f, 0.5f, 1.0f}, textogl::Vec2<float>{(float)win.getSize().x, (float)win.getSize().y},
+                textogl::Vec2<float>{0.0f, 400.0f}, textogl::ORIGIN_VERT_TOP | textogl::ORIGIN_HORIZ_LEFT);
+
         win.display();
     }
 
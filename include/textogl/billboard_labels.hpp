@@ -0,0 +1,135 @@
+/// @file
+/// @brief Camera-facing labels in a 3D scene
+
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef BILLBOARD_LABELS_HPP
+#define BILLBOARD_LABELS_HPP
+
+#include "font.hpp"
+
+/// OpenGL Font rendering types
+
+/// @ingroup textogl
+namespace textogl
+{
+#ifndef USE_OPENGL_ES
+    /// Set of labels placed in a 3D scene, always facing the camera
+
+    /// Each label is anchored to a point in world space, and drawn in screen
+    /// pixels around where that point projects to, so it always faces the
+    /// camera and stays the same size at any distance. Every glyph is a single
+    /// record in an instance buffer, carrying its label's anchor, offset,
+    /// scale, and color, and the vertex shader places it. All labels are drawn
+    /// together, with one instanced draw for each atlas texture holding their
+    /// glyphs (usually just one), and only the view projection matrix as a
+    /// uniform.
+    ///
+    /// Changing a label's anchor, offset, scale, or color only rewrites its
+    /// records. Changes are gathered up and uploaded by the next render.
+    /// Labels are drawn over the scene, without depth testing
+    /// @note Labels can draw from up to 255 atlas textures. Glyphs that would
+    /// need more are left out, until glyphs are evicted or the font is resized
+    /// or compacted
+    /// @note Requires OpenGL 3.3. Not available on OpenGL ES
+    class Billboard_labels
+    {
+    public:
+        /// Create an empty set of labels
+        /// @param font Font_sys object containing desired font. This
+        ///        Billboard_labels will retain a shared_ptr to the Font_sys,
+        ///        and rebuilds itself if it is resized
+        explicit Billboard_labels(Font_sys & font);
+        ~Billboard_labels();
+
+        /// Switch to a new Font_sys, keeping the labels
+        void set_font_sys(Font_sys & font ///< Font_sys object containing desired font
+                          );
+
+        /// Add a label
+
+        /// @returns Label id, for the other calls. Ids of removed labels are reused
+        std::size_t add_label(const std::string & utf8_input,       ///< Text to render, in UTF-8 encoding
+                              const Vec3<float> & anchor,           ///< Position in world space
+                              const Color & color,                  ///< Text Color
+                              const Vec2<float> & offset = {0.0f, 0.0f}, ///< Offset from the anchor's position on screen, in pixels. +Y is down
+                              const float scale = 1.0f,             ///< Scale for the text's size on screen
+                              const int align_flags = 0             ///< Text Alignment around the anchor. Should be #Text_origin flags bitwise-OR'd together
+                              );
+
+        /// Remove a label
+
+        /// @throws std::out_of_range if \p id is not a label
+        void remove_label(const std::size_t id ///< Label id
+                          );
+
+        /// Remove all labels
+        void clear();
+
+        /// Get the number of labels
+        std::size_t get_num_labels() const;
+
+        /// Change a label's text
+
+        /// Only this label is laid out again, but if its number of glyphs
+        /// changes, the records of the labels after it are uploaded again too
+        /// @throws std::out_of_range if \p id is not a label
+        void set_text(const std::size_t id,          ///< Label id
+                      const std::string & utf8_input ///< Text to render, in UTF-8 encoding
+                      );
+
+        /// Move a label
+        /// @throws std::out_of_range if \p id is not a label
+        void set_anchor(const std::size_t id,      ///< Label id
+                        const Vec3<float> & anchor ///< Position in world space
+                        );
+
+        /// Change a label's color
+        /// @throws std::out_of_range if \p id is not a label
+        void set_color(const std::size_t id, ///< Label id
+                       const Color & color   ///< Text Color
+                       );
+
+        /// Change a label's placement on screen
+        /// @throws std::out_of_range if \p id is not a label
+        void set_offset(const std::size_t id,       ///< Label id
+                        const Vec2<float> & offset, ///< Offset from the anchor's position on screen, in pixels. +Y is down
+                        const float scale = 1.0f    ///< Scale for the text's size on screen
+                        );
+
+        /// Render all labels
+        void render(const Mat4<float> & view_projection, ///< View projection matrix, placing anchors on screen
+                    const Vec2<float> & win_size         ///< Viewport dimensions, for pixel sizing. A Vec2 with X = width and Y = height
+                    );
+
+        /// Get memory currently allocated for internal data, in bytes
+
+        /// Does not include the OpenGL instance buffer
+        std::size_t get_memory_usage() const;
+
+    private:
+        struct Impl; ///< Private internal implementation
+        std::unique_ptr<Impl> pimpl; ///< Pointer to private internal implementation
+    };
+#endif
+}
+
+#endif // BILLBOARD_LABELS_HPP
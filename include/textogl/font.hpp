@@ -24,10 +24,27 @@
 #ifndef FONT_HPP
 #define FONT_HPP
 
+#include <chrono>
+#include <functional>
+#include <future>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include <cstdint>
+
+#ifdef TEXTOGL_USE_PMR
+#include <memory_resource>
+#endif
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+/// Defined when Font_sys::Async_load can be used with co_await
+#define TEXTOGL_HAS_COROUTINES
+#endif
+#endif
+
 #include "types.hpp"
 
 /// @ingroup textogl
@@ -47,18 +64,132 @@ namespace textogl
         ORIGIN_VERT_CENTER    = 0x0C  ///< Vertical text origin at center
     };
 
+    /// Named sets of code points for Font_sys::preload
+    enum Glyph_set: int
+    {
+        GLYPHS_ASCII,     ///< Printable ASCII (U+0020 - U+007E)
+        GLYPHS_LATIN1,    ///< Printable ASCII and Latin-1 Supplement (U+00A0 - U+00FF)
+        /// CJK Symbols and Punctuation, Hiragana, Katakana, Halfwidth and
+        /// Fullwidth Forms, and CJK Unified Ideographs (U+4E00 - U+9FFF).
+        /// @note The ideographs alone are about 21,000 glyphs
+        GLYPHS_CJK_COMMON
+    };
+
+    /// Inclusive range of code points
+    struct Code_point_range
+    {
+        uint32_t first; ///< First code point in the range
+        uint32_t last;  ///< Last code point in the range
+    };
+
+    /// Formatting for Font_sys::render_integer and Font_sys::render_float
+    struct Number_format
+    {
+        unsigned int precision = 0;   ///< Digits after the decimal point. At most 9. Ignored for integers
+        unsigned int min_digits = 1;  ///< Pad the integer part with leading zeros to at least this many digits. At most 32
+        bool group_thousands = false; ///< Separate groups of 3 integer digits with ','
+        bool show_plus = false;       ///< Write '+' before numbers greater than 0
+        /// Give every digit the advance of the widest digit (tabular figures)
+
+        /// Keeps columns of numbers lined up, and keeps the digits of a
+        /// changing number from shifting around. Digits are centered in
+        /// the extra space
+        bool fixed_width = false;
+    };
+
+    /// Outline, drop shadow, and glow for Static_text::render_text_styled
+
+    /// All parts are drawn in the same pass as the text itself, by sampling
+    /// the glyph's coverage around each pixel. Sizes are in pixels of the
+    /// text's own geometry, before any model view projection, and are meant
+    /// to be small (a few pixels): larger sizes need more atlas space (see
+    /// Font_sys::set_style_padding), and outlines get lumpy
+    struct Text_style
+    {
+        Color outline_color{0.0f, 0.0f, 0.0f, 1.0f}; ///< Outline color
+        float outline_width = 0.0f;                  ///< Outline width. 0 for no outline
+        Color shadow_color{0.0f, 0.0f, 0.0f, 0.0f};  ///< Shadow color. Fully transparent (the default) for no shadow
+        Vec2<float> shadow_offset{0.0f, 0.0f};       ///< Shadow offset from the text. +Y is down
+        float shadow_softness = 0.0f;                ///< Shadow blur radius. 0 for a hard shadow
+        Color glow_color{1.0f, 1.0f, 1.0f, 1.0f};    ///< Glow color
+        float glow_radius = 0.0f;                    ///< How far the glow spreads. 0 for no glow
+    };
+
+    /// Vertex layouts for Font_sys::layout_text
+
+    /// Every layout starts with the vertex position, as 2 floats. Positions
+    /// are in pixels, relative to the origin selected by the #Text_origin
+    /// flags, with +Y pointing down. Texture coordinates are normalized to the
+    /// atlas texture. Fields are tightly packed, in the order listed.
+    enum Vertex_format: int
+    {
+        VERTEX_POS2F_UV2F,        ///< Position, texture coordinates as 2 floats. 16 bytes
+        VERTEX_POS2F_UV2F_ATLAS,  ///< Position, texture coordinates as 2 floats, atlas texture as a uint32. 20 bytes
+        VERTEX_POS2F_UV2US,       ///< Position, texture coordinates as 2 normalized uint16s. 12 bytes
+        VERTEX_POS2F_UV2US_ATLAS  ///< Position, texture coordinates as 2 normalized uint16s, atlas texture as a uint32. 16 bytes
+    };
+
+    /// Get the size of a single vertex, in bytes
+    std::size_t vertex_size(const Vertex_format format ///< Vertex layout
+                            );
+
+    /// Range of vertices sharing an atlas texture
+    struct Vertex_range
+    {
+        unsigned int atlas_texture; ///< OpenGL texture for the vertices in this range
+        std::size_t start;          ///< Index of the first vertex
+        std::size_t num_vertices;   ///< Number of vertices
+        bool color_atlas;           ///< \c true if \ref atlas_texture is an RGBA color atlas, as from Font_sys::is_color_atlas
+    };
+
+    /// Receives glyph quads from Font_sys::layout_text
+    class Vertex_sink
+    {
+    public:
+        virtual ~Vertex_sink() = default;
+
+        /// Receive vertices
+
+        /// Called once for each atlas texture used by the text, with all of
+        /// the vertices using that texture. Each glyph is a pair of triangles
+        /// (for use with GL_TRIANGLES). Use Font_sys::is_color_atlas to tell
+        /// how to sample \p atlas_texture.
+        virtual void write(const unsigned int atlas_texture, ///< OpenGL texture for these vertices
+                           const void * vertices,            ///< Vertex data, in the format requested. Only valid for the duration of the call
+                           const std::size_t num_vertices    ///< Number of vertices
+                           ) = 0;
+    };
+
     /// Container for font and text rendering
 
     /// Contains everything needed for rendering from the specified font at the
     /// specified size. Unicode is supported for all glyphs provided by the
     /// specified font.
     ///
-    /// Rendering data is created by unicode code page (block of 256 code-points),
-    /// as it is used. Only those pages that are used are built. The 1st page
-    /// (Basic Latin and Latin-1 Supplement) is always created.
+    /// Glyphs are rendered as they are used, into shared atlas textures. Only
+    /// those glyphs that are used are built.
     class Font_sys
     {
     public:
+        /// Glyph atlas statistics, as returned by \ref get_atlas_stats
+        struct Atlas_stats
+        {
+            std::size_t num_textures; ///< Number of atlas textures
+            std::size_t num_glyphs;   ///< Number of glyphs resident in atlases
+            std::size_t num_cells;    ///< Total glyph capacity of all atlases
+            std::size_t memory_usage; ///< Texture memory used by atlases, in bytes
+            std::size_t num_subpixel_glyphs;   ///< Number of resident glyphs that are extra subpixel variants. See \ref set_subpixel_positioning
+            std::size_t subpixel_memory_usage; ///< Texture memory used by subpixel variants' cells, in bytes. Included in \ref memory_usage
+        };
+
+        class Async_load;
+
+        /// Identifies an OpenGL context
+
+        /// Any value unique to the context may be used, such as the
+        /// windowing library's context pointer. See \ref set_current_context
+        using Context_handle = const void *;
+
         /// Load a font file at a specified size
         Font_sys(const std::string & font_path, ///< Path to font file to use
                  const unsigned int font_size   ///< Font size (in pixels)
@@ -71,6 +202,144 @@ namespace textogl
                  const unsigned int font_size      ///< Font size (in pixels)
                  );
 
+#ifdef TEXTOGL_USE_PMR
+        /// Load a font file at a specified size, using a memory resource
+
+        /// All internal data (glyph tables, atlas bookkeeping, and scratch
+        /// memory for building text) is allocated from \p resource, which must
+        /// outlive this object and any Static_text objects using it
+        Font_sys(const std::string & font_path,        ///< Path to font file to use
+                 const unsigned int font_size,         ///< Font size (in pixels)
+                 std::pmr::memory_resource * resource ///< Resource to allocate from. nullptr for std::pmr::get_default_resource
+                 );
+        /// Load a font at a specified size from memory, using a memory resource
+
+        /// data is not copied, so the client is responsible for maintaining the data for the lifetime of this object.
+        /// All internal data is allocated from \p resource, which must
+        /// outlive this object and any Static_text objects using it
+        Font_sys(const unsigned char * font_data,      ///< Font file data (in memory)
+                 const std::size_t font_data_size,     ///< Font file data's size in memory
+                 const unsigned int font_size,         ///< Font size (in pixels)
+                 std::pmr::memory_resource * resource ///< Resource to allocate from. nullptr for std::pmr::get_default_resource
+                 );
+#endif
+
+        /// @name Asynchronous loading
+        /// Loading a font on the rendering thread blocks it while the file is
+        /// read and parsed. These do that, as well as rendering an initial set
+        /// of glyphs, on a worker thread instead, so that several fonts can
+        /// load at once. OpenGL objects are created on the rendering thread
+        /// when the returned Async_load is polled.
+        /// @{
+
+        /// Load a font file at a specified size, on a worker thread
+        static Async_load load_async(const std::string & font_path,                      ///< Path to font file to use
+                                     const unsigned int font_size,                       ///< Font size (in pixels)
+                                     const std::vector<Code_point_range> & glyphs = {{0x20, 0x7E}} ///< Glyphs to render while loading. Printable ASCII by default
+                                     );
+
+        /// Load a font at a specified size from memory, on a worker thread
+
+        /// data is not copied, so the client is responsible for maintaining the data for the lifetime of the loaded font
+        static Async_load load_async(const unsigned char * font_data,                    ///< Font file data (in memory)
+                                     const std::size_t font_data_size,                   ///< Font file data's size in memory
+                                     const unsigned int font_size,                       ///< Font size (in pixels)
+                                     const std::vector<Code_point_range> & glyphs = {{0x20, 0x7E}} ///< Glyphs to render while loading. Printable ASCII by default
+                                     );
+
+        /// @}
+
+        /// @name Shared resources
+        /// The text shader program and Freetype library are shared by all
+        /// Font_sys objects in an OpenGL context, created with the first and
+        /// destroyed with the last.
+        ///
+        /// Applications using more than one context must tell textogl which
+        /// one is current on each thread with \ref set_current_context. A
+        /// Font_sys belongs to the context it was created in, and must be
+        /// destroyed with that context current. It may also be rendered in
+        /// any other context sharing objects with it (in the same share
+        /// group), which creates shared resources for that context too.
+        /// These are kept until \ref release_shared_resources is called in
+        /// it.
+        ///
+        /// Shared resources may be created and destroyed from several
+        /// threads at once. Each Font_sys and Static_text object may only
+        /// be used by one thread at a time.
+        /// @{
+
+        /// Set the OpenGL context current on the calling thread
+
+        /// This only identifies the context to textogl. It must also be made
+        /// current with the windowing library. The default is \c nullptr,
+        /// which is fine for applications with only one context
+        static void set_current_context(Context_handle context ///< Context handle
+                                        );
+
+        /// Get the context set by \ref set_current_context on the calling thread
+        static Context_handle get_current_context();
+
+        /// Destroy unused shared resources for the current context
+
+        /// Call before destroying a context that rendered fonts created in
+        /// other contexts. Resources still used by fonts created in the
+        /// current context are kept
+        static void release_shared_resources();
+
+        /// Set a directory to cache the compiled text shader program in
+
+        /// When set, the program binary is saved after it is first compiled,
+        /// and loaded instead of compiling on later runs. The cache is tagged
+        /// with the OpenGL vendor, renderer, and version strings, and is
+        /// ignored (and rewritten) if they change or the driver rejects it.
+        /// Must be set before the first Font_sys is created to take effect.
+        /// @note The directory must already exist. Empty (the default) disables caching
+        /// @note Requires OpenGL 4.1 or GL_ARB_get_program_binary, or GL_OES_get_program_binary with OpenGL ES
+        static void set_program_cache_dir(const std::string & dir ///< Cache directory
+                                          );
+
+        /// Keep shared resources after the last Font_sys is destroyed
+
+        /// Avoids recompiling the shader program when all fonts are destroyed
+        /// and recreated, such as when changing font or size settings
+        /// @note When disabled, unused shared resources for the current
+        /// context are destroyed immediately, as by \ref release_shared_resources
+        static void set_keep_shared_resources(const bool keep ///< \c true to keep shared resources alive
+                                              );
+
+        /// @}
+
+#ifndef USE_OPENGL_ES
+        /// @name Background uploads
+        /// Glyphs from \ref preload are normally copied into atlas textures by
+        /// \ref end_frame, on the rendering thread. With an upload thread
+        /// running, they are instead copied through a pixel buffer object
+        /// by a loader context on that thread. The rendering thread reserves
+        /// the atlas cells, and the glyphs become available from the first
+        /// \ref end_frame after the GPU has finished the copy, checked with a
+        /// fence, so it never waits on texture transfers.
+        ///
+        /// The loader context must share objects with every context fonts
+        /// are used in.
+        /// @note Not available with OpenGL ES
+        /// @{
+
+        /// Start the upload thread, shared by all fonts
+
+        /// Does nothing if already running
+        static void start_upload_thread(std::function<void()> make_current,        ///< Called on the upload thread to make the loader context current
+                                        std::function<void()> release_current = {} ///< Called on the upload thread before it exits. Optional
+                                        );
+
+        /// Finish queued uploads and stop the upload thread
+
+        /// Must be called before the loader context is destroyed. Preloads
+        /// are uploaded on the rendering thread again afterward
+        static void stop_upload_thread();
+
+        /// @}
+#endif
+
         /// Resize font
 
         /// Resizes the font without destroying it
@@ -79,6 +348,85 @@ namespace textogl
         void resize(const unsigned int font_size ///< Font size (in pixels)
                     );
 
+        /// Set subpixel glyph positioning
+
+        /// Normally glyphs are drawn at whole pixel positions, with hinted
+        /// advances. With subpixel positioning, advances and kerning are
+        /// unhinted, and each glyph is drawn from a bitmap rasterized at the
+        /// nearest of \p phases horizontal offsets within a pixel, which
+        /// keeps spacing even and stops small text from shimmering as it
+        /// moves. Variants are rendered as they are used, and each takes up
+        /// its own atlas cell (see Atlas_stats::num_subpixel_glyphs).
+        ///
+        /// Color glyphs and glyphs from bitmap fonts are always drawn at
+        /// whole pixels
+        /// @note This will require rebuilding font textures
+        /// @note Any Static_text objects tied to this Font_sys will need to have Static_text::set_font_sys called
+        /// @throws std::invalid_argument if \p phases is greater than 4
+        void set_subpixel_positioning(const unsigned int phases ///< Offsets per pixel, up to 4. 0 or 1 to turn subpixel positioning off (the default)
+                                      );
+
+        /// Reserve room around glyphs for Text_style effects
+
+        /// Styled text needs empty space around each glyph in the atlases,
+        /// as far as its effects reach. Static_text::render_text_styled grows
+        /// this as needed, which flushes the atlases the first time a bigger
+        /// style is drawn; call this up front with the largest style to avoid
+        /// that. The padding never shrinks.
+        /// @note This will require rebuilding font textures, if the padding grows
+        void set_style_padding(const unsigned int padding ///< Padding, in pixels
+                               );
+
+#ifdef TEXTOGL_USE_HARFBUZZ
+        /// Set OpenType features to shape text with
+
+        /// Features use HarfBuzz's syntax, separated by commas, such as
+        /// <tt>"liga=0,smcp,kern"</tt>. Pass an empty string for the font's defaults.
+        /// With features set, all text is shaped, even ASCII
+        /// @note Any Static_text objects tied to this Font_sys will need to have Static_text::set_font_sys called
+        /// @throws std::invalid_argument if a feature can't be parsed
+        void set_shaping_features(const std::string & features ///< Comma separated feature list
+                                  );
+#endif
+
+        /// @name Fallback fonts
+        /// Code points missing from this font are rendered from the first
+        /// fallback font that has them, in the order they were added. Glyphs
+        /// from fallbacks share this font's atlases, so mixed text is still
+        /// drawn in the same calls. Which fonts have which code points is
+        /// found once, when a fallback is added
+        ///
+        /// Adding or clearing fallbacks rebuilds the font's textures, as with
+        /// \ref resize, and Static_text objects tied to this Font_sys will
+        /// need to have Static_text::set_font_sys called
+        /// @note Text shaped with HarfBuzz is split into runs by the font
+        /// each code point is found in, and each run is shaped with its own
+        /// font. Runs are kept in logical order; there is no bidirectional
+        /// reordering between them
+        /// @{
+
+        /// Add a fallback font from a file
+        /// @throws std::system_error for unknown font formats
+        /// @throws std::ios_base::failure if the font can't be read
+        /// @throws std::runtime_error if the font has no unicode charmap, or can't be set to this font's size
+        void add_fallback(const std::string & font_path ///< Path to font file to use
+                          );
+
+        /// Add a fallback font from memory
+
+        /// data is not copied, so the client is responsible for maintaining the data for the lifetime of this object
+        /// @throws std::system_error for unknown font formats
+        /// @throws std::ios_base::failure if the font can't be read
+        /// @throws std::runtime_error if the font has no unicode charmap, or can't be set to this font's size
+        void add_fallback(const unsigned char * font_data, ///< Font file data (in memory)
+                          const std::size_t font_data_size ///< Font file data's size in memory
+                          );
+
+        /// Remove all fallback fonts
+        void clear_fallbacks();
+
+        /// @}
+
         /// Render given text
 
         /// Renders the text supplied in utf8_input parameter
@@ -120,12 +468,321 @@ namespace textogl
                              const Mat4<float> & model_view_projection
                              );
 
+        /// @name Numbers
+        /// Render numbers without building a string first. Digits are
+        /// written directly to a small buffer, and laid out from glyphs
+        /// looked up once per font size, with no UTF-8 decoding or kerning.
+        ///
+        /// Floats too large to fit a 64 bit integer once scaled by the
+        /// precision, and non-finite floats, are written with \c snprintf
+        /// instead, in exponent notation
+        /// @note This will rebuild the OpenGL primitives each call. For
+        /// numbers embedded in other text, use a Text_template
+        /// @{
+
+        /// Render an integer
+        void render_integer(const long long value,         ///< Number to render
+                            const Number_format & format,  ///< Formatting. Text_origin flags apply to the formatted number
+                            const Color & color,           ///< Text Color
+                            const Vec2<float> & win_size,  ///< Window dimensions. A Vec2 with X = width and Y = height
+                            const Vec2<float> & pos,       ///< Render position, in screen pixels
+                            const int align_flags = 0      ///< Text Alignment. Should be #Text_origin flags bitwise-OR'd together
+                            );
+
+        /// Render an integer, using a model view projection matrix
+        void render_integer_mat(const long long value,        ///< Number to render
+                                const Number_format & format, ///< Formatting
+                                const Color & color,          ///< Text Color
+                                /// Model view projection matrix.
+                                /// The text will be rendered as quads, one for each glyph, with vertex coordinates centered on the baselines and sized in pixels.
+                                /// This matrix will be used to transform that geometry
+                                const Mat4<float> & model_view_projection
+                                );
+
+        /// Render a floating point number
+        void render_float(const double value,            ///< Number to render
+                          const Number_format & format,  ///< Formatting. Text_origin flags apply to the formatted number
+                          const Color & color,           ///< Text Color
+                          const Vec2<float> & win_size,  ///< Window dimensions. A Vec2 with X = width and Y = height
+                          const Vec2<float> & pos,       ///< Render position, in screen pixels
+                          const int align_flags = 0      ///< Text Alignment. Should be #Text_origin flags bitwise-OR'd together
+                          );
+
+        /// Render a floating point number, using a model view projection matrix
+        void render_float_mat(const double value,           ///< Number to render
+                              const Number_format & format, ///< Formatting
+                              const Color & color,          ///< Text Color
+                              /// Model view projection matrix.
+                              /// The text will be rendered as quads, one for each glyph, with vertex coordinates centered on the baselines and sized in pixels.
+                              /// This matrix will be used to transform that geometry
+                              const Mat4<float> & model_view_projection
+                              );
+
+        /// @}
+
+        /// @name Preloading
+        /// Glyphs are normally rendered the first time they are used, which
+        /// can cause a hitch when a lot of new text appears at once. These
+        /// render glyphs ahead of time, such as during startup or a loading
+        /// screen.
+        ///
+        /// Glyphs are rasterized on \p num_threads worker threads, each with
+        /// its own FreeType face, roughly in the order given. Each call to
+        /// \ref end_frame uploads whatever glyphs are ready to the atlases in
+        /// a single batch. Once all of them are uploaded (or
+        /// \ref finish_preload is called), the returned future becomes ready,
+        /// holding the number of glyphs loaded.
+        ///
+        /// Duplicates, glyphs already loaded, and code points the font has no
+        /// glyph for are skipped. If the font is resized (or anything else
+        /// that rebuilds its textures changes, such as fallbacks, subpixel
+        /// positioning, or style padding) before the glyphs are uploaded, they
+        /// are discarded.
+        /// @warning The future will not become ready on its own. Don't wait
+        /// on it from the rendering thread without calling \ref end_frame or
+        /// \ref finish_preload
+        /// @note For fonts loaded from memory, the font data is read by the
+        /// worker threads
+        /// @{
+
+        /// Preload ranges of code points
+        std::future<std::size_t> preload(const std::vector<Code_point_range> & ranges, ///< Code points to load
+                                         const unsigned int num_threads = 0            ///< Number of worker threads. 0 to use std::thread::hardware_concurrency
+                                         );
+
+        /// Preload all code points in a string
+        std::future<std::size_t> preload(const std::string & utf8_sample, ///< Sample text, in UTF-8 encoding
+                                         const unsigned int num_threads = 0 ///< Number of worker threads. 0 to use std::thread::hardware_concurrency
+                                         );
+
+        /// Preload a named set of code points
+        std::future<std::size_t> preload(const Glyph_set set,              ///< Set to load
+                                         const unsigned int num_threads = 0 ///< Number of worker threads. 0 to use std::thread::hardware_concurrency
+                                         );
+
+        /// Wait for all preloads to finish, and upload their glyphs
+        void finish_preload();
+
+        /// @}
+
+        /// @name Usage profiles
+        /// Rather than maintaining a list of glyphs to \ref preload, the
+        /// code points actually used in one run can be recorded into a
+        /// profile, and preloaded from it on the next.
+        /// @{
+
+        /// Start or stop recording glyph usage
+
+        /// While enabled, each code point is recorded the first time it is used
+        /// to build or render text. Only glyphs looked up by code point are
+        /// recorded. Glyphs from text shaped with HarfBuzz, which are looked up
+        /// by glyph index, are not (with shaping features set, that is all
+        /// text). Nor are the extra variants rendered for
+        /// \ref set_subpixel_positioning. Those are still rendered on first
+        /// use in the next run
+        void record_usage(const bool enable ///< \c true to start recording, \c false to stop
+                          );
+
+        /// Save recorded glyph usage to a profile
+
+        /// Code points are saved in the order they were first used, along
+        /// with the font and size they were used with
+        /// @throws std::ios_base::failure if the file can't be written
+        void save_usage_profile(const std::string & path ///< File to write
+                                ) const;
+
+        /// Preload glyphs from a profile saved by \ref save_usage_profile
+
+        /// Code points are loaded in the order they were first used. See
+        /// \ref preload for details. A profile recorded with a different
+        /// font is ignored. One recorded at a different size is still used.
+        /// @returns Future as from \ref preload. Ready with 0 if the profile
+        /// doesn't exist, can't be read, or is for a different font
+        std::future<std::size_t> preload_usage_profile(const std::string & path,         ///< File to read
+                                                       const unsigned int num_threads = 0 ///< Number of worker threads. 0 to use std::thread::hardware_concurrency
+                                                       );
+
+        /// @}
+
+        /// Build glyph quads for text, for use with external renderers
+
+        /// Vertices are passed to \p sink, grouped by atlas texture. No
+        /// OpenGL drawing is done, but glyphs are rendered into the atlases
+        /// as needed, so an OpenGL context is still required.
+        ///
+        /// The vertices remain valid until glyphs are evicted or moved, which
+        /// can only happen when \ref set_atlas_memory_limit or \ref compact_atlas
+        /// are used. Check \ref get_atlas_generation to detect this.
+        /// @returns Total number of vertices written
+        std::size_t layout_text(const std::string & utf8_input, ///< Text to build, in UTF-8 encoding. For best performance, normalize the string before rendering
+                                const Vertex_format format,     ///< Vertex layout to write
+                                Vertex_sink & sink,             ///< Destination for the vertices
+                                const int align_flags = 0       ///< Text Alignment. Should be #Text_origin flags bitwise-OR'd together
+                                );
+
+        /// Build glyph quads for text into a buffer, for use with external renderers
+
+        /// Same as the Vertex_sink overload, but writes directly into a
+        /// caller-owned buffer (which may be a mapped OpenGL buffer). Vertices
+        /// are grouped by atlas texture, as described by \p ranges.
+        ///
+        /// If \p buffer is too small, nothing is written. Call with a null
+        /// \p buffer to get the required size.
+        /// @returns Number of vertices needed for the text
+        std::size_t layout_text(const std::string & utf8_input,    ///< Text to build, in UTF-8 encoding. For best performance, normalize the string before rendering
+                                const Vertex_format format,        ///< Vertex layout to write
+                                void * buffer,                     ///< Buffer to write vertices into
+                                const std::size_t buffer_size,     ///< Size of \p buffer, in bytes
+                                std::vector<Vertex_range> & ranges, ///< Filled with the range of vertices using each atlas texture. Existing contents are replaced
+                                const int align_flags = 0          ///< Text Alignment. Should be #Text_origin flags bitwise-OR'd together
+                                );
+
+        /// Get the OpenGL textures for all glyph atlases
+
+        /// Atlases are single-channel textures: \c GL_R8 on desktop OpenGL and
+        /// \c GL_ALPHA on OpenGL ES, with mipmaps, except for color atlases
+        /// (see \ref is_color_atlas). Atlases are created and deleted as
+        /// glyphs are loaded, evicted, and compacted.
+        std::vector<unsigned int> get_atlas_textures() const;
+
+        /// Check if an atlas holds color glyphs
+
+        /// Color glyphs (such as emoji from CBDT or sbix fonts) are stored in
+        /// separate \c GL_RGBA8 (\c GL_RGBA on OpenGL ES) atlases, with
+        /// straight alpha. Their color comes from the texture, and only the
+        /// alpha of the text color applies. Other atlases hold glyph coverage
+        /// in the red (alpha on OpenGL ES) channel.
+        /// @returns \c true if \p atlas_texture is a color atlas
+        bool is_color_atlas(const unsigned int atlas_texture ///< Texture from \ref get_atlas_textures or \ref layout_text
+                            ) const;
+
+        /// Get the current atlas generation
+
+        /// Changes whenever glyphs are evicted or moved, or the font is
+        /// resized. Vertices from \ref layout_text built under an older
+        /// generation need to be rebuilt.
+        std::size_t get_atlas_generation() const;
+
+        /// Limit texture memory used for glyph atlases
+
+        /// When a new atlas would exceed the limit, the least recently used
+        /// glyphs are freed to make room instead. Glyphs not used since the
+        /// last call to \ref end_frame are freed first. Glyphs needed by the
+        /// text currently being built are never freed, so the limit can only be
+        /// exceeded when a single string needs more glyphs than the limit allows.
+        ///
+        /// Freed glyphs are rebuilt as needed, including for existing
+        /// Static_text objects.
+        /// @note Shrinking the limit takes effect the next time a glyph is loaded
+        void set_atlas_memory_limit(const std::size_t bytes ///< Limit in bytes. 0 (the default) for no limit
+                                    );
+
+        /// Get texture memory currently used for glyph atlases, in bytes
+        std::size_t get_atlas_memory_usage() const;
+
+        /// Get glyph atlas statistics
+        Atlas_stats get_atlas_stats() const;
+
+        /// Repack glyphs into fewer atlas textures
+
+        /// Evicting glyphs leaves holes in the atlases. This moves glyphs out of
+        /// the emptiest atlases into free cells of the others, using GPU-side
+        /// copies, and frees atlases that are left empty. Work stops once
+        /// \p budget has elapsed and resumes on the next call, so this can be
+        /// called once per frame.
+        ///
+        /// Static_text objects using moved glyphs rebuild themselves on their
+        /// next render.
+        /// @returns \c true when there is nothing left to compact
+        bool compact_atlas(const std::chrono::microseconds & budget ///< Time limit for this call
+                           );
+
+        /// Set the number of threads laying out text for Static_text::set_text_async
+
+        /// Threads are started as text is queued, up to this limit, and share
+        /// a cache of glyph metrics. The default is 1. Lowering the limit
+        /// doesn't stop threads already running
+        void set_layout_threads(const unsigned int num_threads ///< Maximum number of layout threads. At least 1
+                                );
+
+        /// Get memory currently allocated for internal data, in bytes
+
+        /// Includes glyph tables, atlas bookkeeping, and scratch memory for
+        /// building text, but not texture memory, which is reported by
+        /// \ref get_atlas_memory_usage
+        std::size_t get_memory_usage() const;
+
+        /// Mark the end of a frame
+
+        /// Call once per frame, after all text has been rendered. Used to
+        /// track which glyphs are still in use when \ref set_atlas_memory_limit
+        /// is set, and to upload glyphs from \ref preload.
+        void end_frame();
+
     private:
         struct Impl; ///< Private internal implementation
         std::shared_ptr<Impl> pimpl; ///< Pointer to private internal implementation
 
+        /// Create from an already-loaded implementation
+        explicit Font_sys(std::shared_ptr<Impl> impl);
+
         /// @cond INTERNAL
+        friend class Billboard_labels;
         friend class Static_text;
+        friend class Text_effect;
+        friend class Text_grid;
+        friend class Text_template;
+        /// @endcond
+    };
+
+    /// Font being loaded by Font_sys::load_async
+
+    /// All members must be called from the thread with the OpenGL context
+    /// used for rendering. Copies refer to the same load.
+    class Font_sys::Async_load
+    {
+    public:
+        /// Check whether loading is done
+
+        /// Once the worker thread has loaded the font, this creates its
+        /// OpenGL objects and uploads the initial glyphs, then calls any
+        /// callbacks given to \ref then. Call periodically, such as once
+        /// per frame.
+        /// @returns \c true once loading is done, and \ref get won't block
+        bool poll();
+
+        /// Wait for loading to finish, and get the font
+
+        /// @throws Same exceptions as the Font_sys constructors
+        Font_sys get();
+
+        /// Call a function when loading is done
+
+        /// The function is called from \ref poll or \ref get, or immediately if
+        /// loading is already done
+        void then(std::function<void()> callback ///< Function to call
+                  );
+
+#ifdef TEXTOGL_HAS_COROUTINES
+        /// @name Coroutine support
+        /// Allows <tt>Font_sys font = co_await Font_sys::load_async(...);</tt>.
+        /// The coroutine is resumed from \ref poll, so it continues on the
+        /// rendering thread.
+        /// @{
+        bool await_ready() { return poll(); }
+        void await_suspend(std::coroutine_handle<> handle) { then([handle]() { handle.resume(); }); }
+        Font_sys await_resume() { return get(); }
+        /// @}
+#endif
+
+    private:
+        Async_load();
+
+        struct Impl; ///< Private internal implementation
+        std::shared_ptr<Impl> pimpl; ///< Pointer to private internal implementation
+
+        /// @cond INTERNAL
+        friend class Font_sys;
         /// @endcond
     };
 }
@@ -25,12 +25,39 @@
 #define STATIC_TEXT_HPP
 
 #include "font.hpp"
+#include "text_effect.hpp"
 
 /// OpenGL Font rendering types
 
 /// @ingroup textogl
 namespace textogl
 {
+    /// Level of detail settings for Static_text::set_lod
+
+    /// Levels are picked by the text's size on screen: the height of the
+    /// font's em square, in pixels, as projected by the model view projection
+    /// matrix. Set a threshold to 0 to skip its level
+    struct Text_lod
+    {
+        /// Detail levels, from most to least detailed
+        enum Level
+        {
+            FULL,     ///< Every glyph is drawn
+            IMPOSTOR, ///< A cached render of the text is drawn, as with Static_text::set_impostor
+            BAR,      ///< A solid bar is drawn across each line
+            HIDDEN    ///< Nothing is drawn
+        };
+
+        float impostor_below = 0.0f; ///< Draw from a cached texture when the text is smaller than this many pixels
+        float bar_below = 0.0f;      ///< Draw bars when the text is smaller than this many pixels
+        float hide_below = 0.0f;     ///< Draw nothing when the text is smaller than this many pixels
+
+        /// How far past a threshold the text must grow to go back to a more
+        /// detailed level, as a fraction of the threshold. Keeps text near a
+        /// threshold from flickering between levels
+        float hysteresis = 0.15f;
+    };
+
     /// Object for text which does not change often
 
     /// Font_sys::render_text will re-build the OpenGL primitives on each call,
@@ -52,6 +79,24 @@ namespace textogl
                     const std::string & utf8_input
                     );
 
+#ifdef TEXTOGL_USE_PMR
+        /// Create and build text object, using a memory resource
+
+        /// All internal data (the text and the data needed to render it) is
+        /// allocated from \p resource, which must outlive this object.
+        /// Scratch memory for building the text comes from \p font's resource
+        /// @param font Font_sys object containing desired font. This Static_text
+        ///        will retain a shared_ptr to the Font_sys, but will not automatically
+        ///        rebuild when Font_sys::resize is called. Use Static_text::set_font_sys
+        //         to rebuild in that case.
+        /// @param utf8_input Text to render, in UTF-8 encoding. For best performance, normalize the string before rendering
+        /// @param resource Resource to allocate from. nullptr for std::pmr::get_default_resource
+        Static_text(Font_sys & font,
+                    const std::string & utf8_input,
+                    std::pmr::memory_resource * resource
+                    );
+#endif
+
         /// Recreate text object with new Font_sys
 
         /// When Font_sys::resize has been called, call this to rebuild this Static_text with the new size
@@ -64,6 +109,26 @@ namespace textogl
         /// @param utf8_input Text to render, in UTF-8 encoding. For best performance, normalize the string before rendering
         void set_text(const std::string & utf8_input);
 
+        /// Change the text, laying it out on a worker thread
+
+        /// Unlike the rest of Static_text, this may be called from any thread,
+        /// concurrently with rendering (but not with \ref set_font_sys). The
+        /// current text keeps rendering until the new layout is ready, and is
+        /// swapped in by the next render call or \ref commit after that.
+        /// If called again before then, the text from the latest call wins.
+        /// @note Glyphs not yet in the font's atlases are still rendered on
+        ///       the rendering thread, when the text is swapped in
+        /// @param utf8_input Text to render, in UTF-8 encoding. For best performance, normalize the string before rendering
+        void set_text_async(const std::string & utf8_input);
+
+        /// Swap in text from \ref set_text_async, if ready
+
+        /// Called automatically by the render functions. Call explicitly to
+        /// control when the vertex buffer is updated.
+        /// @param wait If \c true, wait for layout to finish rather than skipping it
+        /// @returns \c true if new text was swapped in
+        bool commit(const bool wait = false);
+
         /// Render the previously set text
         void render_text(const Color & color,          ///< Text Color
                          const Vec2<float> & win_size, ///< Window dimensions. A Vec2 with X = width and Y = height
@@ -87,6 +152,98 @@ namespace textogl
                              const Mat4<float> & model_view_projection
                              );
 
+        /// Render the previously set text through a Text_effect
+
+        /// The first call builds a second vertex buffer with each vertex's
+        /// glyph and line index. It is kept up to date by later text changes
+        void render_text_effect(const Text_effect & effect,   ///< Effect to animate the text with
+                                const float time,             ///< Value for the effect's time uniform
+                                const Vec4<float> & params,   ///< Value for the effect's params uniform
+                                const Color & color,          ///< Text Color
+                                const Vec2<float> & win_size, ///< Window dimensions. A Vec2 with X = width and Y = height
+                                const Vec2<float> & pos,      ///< Render position, in screen pixels
+                                const int align_flags = 0     ///< Text Alignment. Should be #Text_origin flags bitwise-OR'd together
+                                );
+
+        /// Render the previously set text through a Text_effect, using a model view projection matrix
+
+        /// See \ref render_text_effect
+        void render_text_effect_mat(const Text_effect & effect, ///< Effect to animate the text with
+                                    const float time,           ///< Value for the effect's time uniform
+                                    const Vec4<float> & params, ///< Value for the effect's params uniform
+                                    const Color & color,        ///< Text Color
+                                    /// Model view projection matrix.
+                                    /// The text will be rendered as quads, one for each glyph, with vertex coordinates centered on the baselines and sized in pixels.
+                                    /// This matrix will be used to transform that geometry
+                                    const Mat4<float> & model_view_projection
+                                    );
+
+        /// Render the previously set text with an outline, shadow, and / or glow
+
+        /// Everything is drawn in one pass. The first call with a style
+        /// bigger than any before rebuilds the text with larger quads, and
+        /// may grow the font's atlas padding (see Font_sys::set_style_padding)
+        void render_text_styled(const Text_style & style,     ///< Outline, shadow, and glow to draw
+                                const Color & color,          ///< Text Color
+                                const Vec2<float> & win_size, ///< Window dimensions. A Vec2 with X = width and Y = height
+                                const Vec2<float> & pos,      ///< Render position, in screen pixels
+                                const int align_flags = 0     ///< Text Alignment. Should be #Text_origin flags bitwise-OR'd together
+                                );
+
+        /// Render the previously set text with an outline, shadow, and / or glow, using a model view projection matrix
+
+        /// See \ref render_text_styled
+        void render_text_styled_mat(const Text_style & style, ///< Outline, shadow, and glow to draw
+                                    const Color & color,      ///< Text Color
+                                    /// Model view projection matrix.
+                                    /// The text will be rendered as quads, one for each glyph, with vertex coordinates centered on the baselines and sized in pixels.
+                                    /// This matrix will be used to transform that geometry
+                                    const Mat4<float> & model_view_projection
+                                    );
+
+        /// Cache the rendered text in a texture
+
+        /// While enabled, \ref render_text, \ref render_text_rotate, and
+        /// \ref render_text_mat render the text into a texture the first time,
+        /// and then draw that texture as a single quad. It is rendered again when
+        /// the text, color, or font changes, or when the text's size on screen
+        /// grows or shrinks by more than \p scale_threshold. Effects and styles
+        /// are always drawn directly.
+        ///
+        /// Textures come from a pool shared by all Static_text objects (see
+        /// \ref set_impostor_memory_limit). Text that doesn't fit is drawn directly
+        void set_impostor(const bool enable,              ///< \c true to cache, \c false to free the cache and draw directly
+                          const float scale_threshold = 1.25f ///< Largest change in on-screen size before rendering again, as a ratio. Should be > 1
+                          );
+
+        /// Set the most texture memory all cached text (see \ref set_impostor) may use
+
+        /// When full, the least recently drawn caches in the current context
+        /// are freed to make room. Lowering the limit doesn't free anything
+        /// until more room is needed
+        static void set_impostor_memory_limit(const std::size_t bytes ///< Limit in bytes. 0 for no limit. Default is 32 MiB
+                                              );
+
+        /// Get the texture memory all cached text (see \ref set_impostor) is using, in bytes
+        static std::size_t get_impostor_memory_usage();
+
+        /// Set level of detail thresholds for \ref render_text_mat
+
+        /// Lets far away text in a 3D scene cost less to draw. Effects and
+        /// styles are always drawn in full. Pass a default Text_lod to disable
+        void set_lod(const Text_lod & lod ///< Thresholds for each level
+                     );
+
+        /// Get the level of detail \ref render_text_mat last drew with
+
+        /// Always Text_lod::FULL if \ref set_lod hasn't been called
+        Text_lod::Level get_lod_level() const;
+
+        /// Get memory currently allocated for internal data, in bytes
+
+        /// Does not include the OpenGL vertex buffer
+        std::size_t get_memory_usage() const;
+
     private:
         struct Impl; ///< Private internal implementation
         std::unique_ptr<Impl, void (*)(Impl *)> pimpl; ///< Pointer to private internal implementation
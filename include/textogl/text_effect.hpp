@@ -0,0 +1,91 @@
+/// @file
+/// @brief Text built from a template with updatable slots
+
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+
+#ifndef TEXT_EFFECT_HPP
+#define TEXT_EFFECT_HPP
+
+#include "font.hpp"
+
+/// OpenGL Font rendering types
+
+/// @ingroup textogl
+namespace textogl
+{
+    /// Per-glyph animation, run in the vertex shader
+
+    /// Static_text::render_text_effect draws text through an effect, so
+    /// animations like waves, typewriter reveals, or fades only change a few
+    /// uniforms each frame. The text stays in its vertex buffer, unchanged.
+    ///
+    /// An effect is a snippet of GLSL defining:
+    ///
+    ///     void effect(inout vec2 pos, inout vec4 color, float glyph, float line)
+    ///
+    /// \c pos is the vertex position, in pixels, with Y down, before the model
+    /// view projection is applied. \c color starts as <tt>vec4(1.0)</tt>, and
+    /// is multiplied with the text color. \c glyph and \c line are the index
+    /// of the vertex's code point in the text (not counting newlines) and of
+    /// its line, both from 0. The snippet can also read two uniforms:
+    /// <tt>float time</tt> and <tt>vec4 params</tt>, set on each render call.
+    /// For example, a wave:
+    ///
+    ///     void effect(inout vec2 pos, inout vec4 color, float glyph, float line)
+    ///     {
+    ///         pos.y += params.x * sin(time * params.y + glyph * params.z);
+    ///     }
+    ///
+    /// The snippet is compiled as GLSL 1.30 on desktop, and GLSL ES 1.00 for
+    /// OpenGL ES.
+    /// @note The shader program is created in the current OpenGL context, and
+    ///       can be used in any context sharing objects with it. It must be
+    ///       destroyed with such a context current
+    class Text_effect
+    {
+    public:
+        /// Compile an effect
+        /// @param glsl_src GLSL source defining the \c effect function, as described above
+        /// @throws std::system_error if the effect fails to compile or link.
+        ///         The message holds the driver's log, with line numbers counted from the start of \p glsl_src
+        explicit Text_effect(const std::string & glsl_src);
+        ~Text_effect();
+
+        /// @name Non-copyable
+        /// @{
+        Text_effect(const Text_effect &) = delete;
+        Text_effect & operator=(const Text_effect &) = delete;
+        /// @}
+
+        /// @name Movable
+        /// @{
+        Text_effect(Text_effect &&);
+        Text_effect & operator=(Text_effect &&);
+        /// @}
+
+    private:
+        struct Impl; ///< Private internal implementation
+        std::unique_ptr<Impl> pimpl; ///< Pointer to private internal implementation
+
+        /// @cond INTERNAL
+        friend class Static_text;
+        /// @endcond
+    };
+}
+
+#endif // TEXT_EFFECT_HPP
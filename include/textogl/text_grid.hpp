@@ -0,0 +1,139 @@
+/// @file
+/// @brief Grid of fixed-pitch text
+
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef TEXT_GRID_HPP
+#define TEXT_GRID_HPP
+
+#include "font.hpp"
+
+/// OpenGL Font rendering types
+
+/// @ingroup textogl
+namespace textogl
+{
+#ifndef USE_OPENGL_ES
+    /// Grid of fixed-pitch text, for terminals and tables
+
+    /// Holds rows x columns of cells, each with one code point and its own
+    /// foreground and background colors. Each cell is a single record in an
+    /// instance buffer, so changing cells only uploads the changed records
+    /// (changes are gathered up and uploaded by the next render), and the
+    /// grid is drawn with instanced draws: one for the backgrounds, if any
+    /// are set, and one for each atlas texture holding the grid's glyphs
+    /// (usually just one).
+    ///
+    /// Cells are as wide as the font's widest glyph and as tall as its line
+    /// height, so this is meant for monospace fonts. Glyphs are not kerned or
+    /// shaped, but do use fallback fonts and color glyphs
+    /// @note A grid can draw from up to 255 atlas textures. Cells whose
+    /// glyphs would need more are left blank, until glyphs are evicted or
+    /// the font is resized or compacted
+    /// @note Requires OpenGL 3.3. Not available on OpenGL ES
+    class Text_grid
+    {
+    public:
+        /// Create an empty grid
+        /// @param font Font_sys object containing desired font. This Text_grid
+        ///        will retain a shared_ptr to the Font_sys, and rebuilds
+        ///        itself if it is resized
+        /// @param rows Number of rows
+        /// @param cols Number of columns
+        Text_grid(Font_sys & font,
+                  const std::size_t rows,
+                  const std::size_t cols
+                  );
+        ~Text_grid();
+
+        /// Switch to a new Font_sys, keeping the grid's contents
+        void set_font_sys(Font_sys & font ///< Font_sys object containing desired font
+                          );
+
+        /// Change the grid's size
+
+        /// Cells that still fit keep their contents. New cells are empty
+        void resize(const std::size_t rows, ///< Number of rows
+                    const std::size_t cols  ///< Number of columns
+                    );
+
+        /// Get the number of rows
+        std::size_t get_rows() const;
+
+        /// Get the number of columns
+        std::size_t get_cols() const;
+
+        /// Get the size of each cell, in pixels
+        Vec2<float> get_cell_size() const;
+
+        /// Set a single cell
+
+        /// @throws std::out_of_range if \p row or \p col are outside of the grid
+        void set_cell(const std::size_t row,        ///< Row
+                      const std::size_t col,        ///< Column
+                      const uint32_t code_pt,       ///< Unicode code point. 0 for an empty cell
+                      const Color & fg,             ///< Text color
+                      const Color & bg = {0.0f, 0.0f, 0.0f, 0.0f} ///< Background color. Fully transparent backgrounds are not drawn
+                      );
+
+        /// Set a run of cells from text
+
+        /// Code points are written to consecutive cells, starting at \p row,
+        /// \p col. Text past the end of the row is dropped. Newlines are not
+        /// treated specially
+        /// @returns Number of cells written
+        /// @throws std::out_of_range if \p row or \p col are outside of the grid
+        std::size_t set_text(const std::size_t row,          ///< Row
+                             const std::size_t col,          ///< Column of the first cell to write
+                             const std::string & utf8_input, ///< Text to write, in UTF-8 encoding
+                             const Color & fg,               ///< Text color
+                             const Color & bg = {0.0f, 0.0f, 0.0f, 0.0f} ///< Background color. Fully transparent backgrounds are not drawn
+                             );
+
+        /// Empty every cell
+        void clear(const Color & bg = {0.0f, 0.0f, 0.0f, 0.0f} ///< Background color for every cell
+                   );
+
+        /// Render the grid
+        void render(const Vec2<float> & win_size, ///< Window dimensions. A Vec2 with X = width and Y = height
+                    const Vec2<float> & pos       ///< Position of the grid's upper left corner, in screen pixels
+                    );
+
+        /// Render the grid, using a model view projection matrix
+        void render_mat(/// Model view projection matrix.
+                        /// The grid's upper left corner is at the origin, with cells sized in pixels and rows going down +Y.
+                        /// This matrix will be used to transform that geometry
+                        const Mat4<float> & model_view_projection
+                        );
+
+        /// Get memory currently allocated for internal data, in bytes
+
+        /// Does not include the OpenGL instance buffer
+        std::size_t get_memory_usage() const;
+
+    private:
+        struct Impl; ///< Private internal implementation
+        std::unique_ptr<Impl> pimpl; ///< Pointer to private internal implementation
+    };
+#endif
+}
+
+#endif // TEXT_GRID_HPP
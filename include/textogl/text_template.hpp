@@ -0,0 +1,153 @@
+/// @file
+/// @brief Text built from a template with updatable slots
+
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef TEXT_TEMPLATE_HPP
+#define TEXT_TEMPLATE_HPP
+
+#include "font.hpp"
+
+/// OpenGL Font rendering types
+
+/// @ingroup textogl
+namespace textogl
+{
+    /// Static text with a few named fields that change often
+
+    /// For text like <tt>"Dynamic text: {fps:8} fps"</tt>, where most of the
+    /// string never changes. The template is split into segments at each slot
+    /// (and each newline), and every segment is laid out and stored in the
+    /// vertex buffer separately, with room reserved for each slot's widest
+    /// value. Setting a slot lays out only the new value and overwrites its
+    /// part of the buffer in place. The segments after it are not rebuilt,
+    /// just drawn with a different offset.
+    ///
+    /// Slots are written as <tt>{name:width}</tt>, where \c width is the most
+    /// code points the slot can hold. Use <tt>{{</tt> and <tt>}}</tt> for
+    /// literal braces. Slots start out empty.
+    ///
+    /// Slots can also hold numbers, formatted as with Font_sys::render_integer.
+    /// Only the part of a slot's vertex data that actually changed is uploaded,
+    /// so with Number_format::fixed_width, a counter ticking from 1234 to 1235
+    /// uploads a single glyph's quad.
+    ///
+    /// Segments are laid out separately, so there is no kerning or shaping
+    /// across segment boundaries, and each segment starts on a whole pixel
+    class Text_template
+    {
+    public:
+        /// Create and build text object
+        /// @param font Font_sys object containing desired font. This Text_template
+        ///        will retain a shared_ptr to the Font_sys, but will not automatically
+        ///        rebuild when Font_sys::resize is called. Use Text_template::set_font_sys
+        ///        to rebuild in that case.
+        /// @param utf8_template Template text, in UTF-8 encoding
+        /// @throws std::invalid_argument if \p utf8_template is malformed,
+        ///         or has two slots with the same name
+        Text_template(Font_sys & font,
+                      const std::string & utf8_template
+                      );
+        ~Text_template();
+
+        /// Recreate text object with new Font_sys
+
+        /// When Font_sys::resize has been called, call this to rebuild this Text_template with the new size
+
+        /// @param font Font_sys object containing desired font.
+        void set_font_sys(Font_sys & font);
+
+        /// Get the index of a slot, for use with the faster overload of \ref set_slot
+        /// @throws std::out_of_range if there is no slot named \p name
+        std::size_t get_slot_index(const std::string & name ///< Slot name
+                                   ) const;
+
+        /// Change a slot's text
+
+        /// Text past the slot's width is dropped. Newlines are ignored
+        /// @throws std::out_of_range if there is no slot named \p name
+        void set_slot(const std::string & name,      ///< Slot name
+                      const std::string & utf8_input ///< Text to put in the slot, in UTF-8 encoding
+                      );
+
+        /// Change a slot's text, by index
+
+        /// Text past the slot's width is dropped. Newlines are ignored
+        /// @throws std::out_of_range if \p index is not a slot index
+        void set_slot(const std::size_t index,       ///< Slot index, as returned by \ref get_slot_index. Slots are numbered in the order they appear in the template
+                      const std::string & utf8_input ///< Text to put in the slot, in UTF-8 encoding
+                      );
+
+        /// Put an integer in a slot
+
+        /// Unlike text, numbers too long for the slot are not cut. The whole
+        /// text is rebuilt to make room instead
+        /// @throws std::out_of_range if \p index is not a slot index
+        void set_slot_integer(const std::size_t index,     ///< Slot index, as returned by \ref get_slot_index
+                              const long long value,       ///< Number to write
+                              const Number_format & format ///< Formatting
+                              );
+
+        /// Put a floating point number in a slot
+
+        /// Unlike text, numbers too long for the slot are not cut. The whole
+        /// text is rebuilt to make room instead
+        /// @throws std::out_of_range if \p index is not a slot index
+        void set_slot_float(const std::size_t index,     ///< Slot index, as returned by \ref get_slot_index
+                            const double value,          ///< Number to write
+                            const Number_format & format ///< Formatting
+                            );
+
+        /// Render the text
+        void render_text(const Color & color,          ///< Text Color
+                         const Vec2<float> & win_size, ///< Window dimensions. A Vec2 with X = width and Y = height
+                         const Vec2<float> & pos,      ///< Render position, in screen pixels
+                         const int align_flags = 0     ///< Text Alignment. Should be #Text_origin flags bitwise-OR'd together
+                         );
+
+        /// Render the text, with rotation
+        void render_text_rotate(const Color & color,          ///< Text Color
+                                const Vec2<float> & win_size, ///< Window dimensions. A Vec2 with X = width and Y = height
+                                const Vec2<float> & pos,      ///< Render position, in screen pixels
+                                const float rotation,         ///< Clockwise text rotation (in radians) around center as defined in align_flags. 0 is vertical
+                                const int align_flags = 0     ///< Text Alignment. Should be #Text_origin flags bitwise-OR'd together
+                                );
+
+        /// Render the text, using a model view projection matrix
+        void render_text_mat(const Color & color, ///< Text Color
+                             /// Model view projection matrix.
+                             /// The text will be rendered as quads, one for each glyph, with vertex coordinates centered on the baselines and sized in pixels.
+                             /// This matrix will be used to transform that geometry
+                             const Mat4<float> & model_view_projection
+                             );
+
+        /// Get memory currently allocated for internal data, in bytes
+
+        /// Does not include the OpenGL vertex buffer
+        std::size_t get_memory_usage() const;
+
+    private:
+        struct Impl; ///< Private internal implementation
+        std::unique_ptr<Impl> pimpl; ///< Pointer to private internal implementation
+    };
+}
+
+#endif // TEXT_TEMPLATE_HPP
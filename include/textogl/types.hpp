@@ -60,6 +60,26 @@ namespace textogl
             /// @}
         };
 
+        /// 3D Vector
+        template<typename T>
+        struct Vec3
+        {
+            union {T x = {}, r;}; ///< X / R component
+            union {T y = {}, g;}; ///< Y / G component
+            union {T z = {}, b;}; ///< Z / B component
+
+            Vec3() = default;
+            Vec3(T x, T y, T z): x(x), y(y), z(z) {}
+
+            /// Access component by index
+
+            /// To pass vector to OpenGL, do: <tt>&vec3[0]</tt>
+            /// @{
+            T & operator[](std::size_t i) { return (&x)[i]; }
+            const T & operator[](std::size_t i) const { return (&x)[i]; }
+            /// @}
+        };
+
         /// 4D Vector
         template<typename T>
         struct Vec4
@@ -150,6 +170,7 @@ namespace textogl
 
         // for template alias specialization
         template<typename T> struct Vec2_t {  using type = Vec2<T>; };
+        template<typename T> struct Vec3_t {  using type = Vec3<T>; };
         template<typename T> struct Vec4_t {  using type = Vec4<T>; };
         template<typename T> struct Mat4_t {  using type = Mat4<T>; };
 
@@ -160,6 +181,11 @@ namespace textogl
         template<> struct Vec2_t<int>          { using type = glm::ivec2; };
         template<> struct Vec2_t<unsigned int> { using type = glm::uvec2; };
 
+        template<> struct Vec3_t<float>        { using type = glm::vec3; };
+        template<> struct Vec3_t<double>       { using type = glm::dvec3; };
+        template<> struct Vec3_t<int>          { using type = glm::ivec3; };
+        template<> struct Vec3_t<unsigned int> { using type = glm::uvec3; };
+
         template<> struct Vec4_t<float>        { using type = glm::vec4; };
         template<> struct Vec4_t<double>       { using type = glm::dvec4; };
         template<> struct Vec4_t<int>          { using type = glm::ivec4; };
@@ -175,6 +201,11 @@ namespace textogl
     /// @note If GLM is available, this is an alias for glm::vec2 / dvec2 / ...
     template<typename T = float> using Vec2 = typename detail::Vec2_t<T>::type;
 
+    /// 3D Vector
+
+    /// @note If GLM is available, this is an alias for glm::vec3 / dvec3 / ...
+    template<typename T = float> using Vec3 = typename detail::Vec3_t<T>::type;
+
     /// 4D Vector
 
     /// @note If GLM is available, this is an alias for glm::vec4 / dvec4 / ...
@@ -0,0 +1,116 @@
+/// @file
+/// @brief Bump allocator for temporary data
+
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "arena.hpp"
+
+#include <algorithm>
+
+namespace textogl
+{
+    Arena::Arena(Memory_resource * upstream, const std::size_t block_size):
+        upstream_(upstream ? upstream : default_resource()),
+        block_size_(block_size)
+    {}
+
+    Arena::~Arena()
+    {
+        free_blocks();
+    }
+
+    void * Arena::do_allocate(const std::size_t bytes, const std::size_t alignment)
+    {
+        // find a block with enough room, starting with the current one
+        for(; block_ < blocks_.size(); ++block_, block_used_ = 0)
+        {
+            auto addr = reinterpret_cast<std::uintptr_t>(blocks_[block_].data) + block_used_;
+            auto padding = (alignment - addr % alignment) % alignment;
+
+            if(block_used_ + padding + bytes <= blocks_[block_].size)
+            {
+                block_used_ += padding + bytes;
+                return reinterpret_cast<void *>(addr + padding);
+            }
+        }
+
+        // out of room. add a new block
+        add_block(std::max(block_size_, bytes + alignment));
+        block_ = blocks_.size() - 1;
+        block_used_ = 0;
+
+        return do_allocate(bytes, alignment);
+    }
+
+    void Arena::do_deallocate(void *, const std::size_t, const std::size_t)
+    {}
+
+#ifdef TEXTOGL_USE_PMR
+    bool Arena::do_is_equal(const Memory_resource & other) const noexcept
+    {
+        return this == &other;
+    }
+#endif
+
+    void Arena::reset()
+    {
+        // merge blocks so the next round fits into one
+        if(blocks_.size() > 1)
+        {
+            auto size = capacity();
+            free_blocks();
+            add_block(size);
+        }
+
+        block_ = 0;
+        block_used_ = 0;
+    }
+
+    std::size_t Arena::capacity() const
+    {
+        std::size_t size = 0;
+        for(auto & block: blocks_)
+            size += block.size;
+        return size;
+    }
+
+    void Arena::add_block(const std::size_t size)
+    {
+        blocks_.reserve(blocks_.size() + 1);
+        blocks_.push_back({static_cast<unsigned char *>(upstream_->allocate(size, alignof(std::max_align_t))), size});
+    }
+
+    void Arena::free_blocks()
+    {
+        for(auto & block: blocks_)
+            upstream_->deallocate(block.data, block.size, alignof(std::max_align_t));
+        blocks_.clear();
+    }
+
+    Arena::Scope::Scope(Arena & arena): arena_(arena), block_(arena.block_), block_used_(arena.block_used_)
+    {}
+
+    Arena::Scope::~Scope()
+    {
+        arena_.block_ = block_;
+        arena_.block_used_ = block_used_;
+    }
+}
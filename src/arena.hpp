@@ -0,0 +1,123 @@
+/// @file
+/// @brief Bump allocator for temporary data
+
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "memory_resource.hpp"
+
+/// @cond INTERNAL
+
+/// @ingroup textogl
+namespace textogl
+{
+    /// Bump allocator for scratch memory
+
+    /// Memory is handed out from large blocks, and is only reclaimed all at
+    /// once, either by \ref Scope going out of scope or by \ref reset.
+    /// Individual deallocations are ignored.
+    class Arena: public Memory_resource
+    {
+    public:
+        /// Create an arena
+        explicit Arena(Memory_resource * upstream = nullptr,  ///< Resource to allocate blocks from. nullptr for \ref default_resource
+                       const std::size_t block_size = 64 * 1024 ///< Minimum size for each block of memory
+                       );
+        ~Arena();
+
+        /// @name Non-copyable, non-movable
+        /// @{
+        Arena(const Arena &) = delete;
+        Arena & operator=(const Arena &) = delete;
+
+        Arena(Arena &&) = delete;
+        Arena & operator=(Arena &&) = delete;
+        /// @}
+
+        /// Free all allocations
+
+        /// If more than one block was needed since the last reset, the blocks
+        /// are replaced by a single block big enough for all of them, so the
+        /// same usage won't need any more allocations
+        void reset();
+
+        /// Total size of all blocks, in bytes
+        std::size_t capacity() const;
+
+        /// Free all allocations made during the lifetime of this object
+        class Scope
+        {
+        public:
+            explicit Scope(Arena & arena);
+            ~Scope();
+
+            /// @name Non-copyable, non-movable
+            /// @{
+            Scope(const Scope &) = delete;
+            Scope & operator=(const Scope &) = delete;
+
+            Scope(Scope &&) = delete;
+            Scope & operator=(Scope &&) = delete;
+            /// @}
+
+        private:
+            Arena & arena_;          ///< Arena to rewind
+            std::size_t block_;      ///< Arena::block_ on creation
+            std::size_t block_used_; ///< Arena::block_used_ on creation
+        };
+
+    private:
+        void * do_allocate(const std::size_t bytes, const std::size_t alignment) override;
+        void do_deallocate(void * p, const std::size_t bytes, const std::size_t alignment) override;
+#ifdef TEXTOGL_USE_PMR
+        bool do_is_equal(const Memory_resource & other) const noexcept override;
+#endif
+
+        /// Allocate a new block from upstream
+        void add_block(const std::size_t size);
+
+        /// Return all blocks to upstream
+        void free_blocks();
+
+        /// Block of memory
+        struct Block
+        {
+            unsigned char * data; ///< Block memory
+            std::size_t size;     ///< Block size in bytes
+        };
+
+        Memory_resource * upstream_; ///< Resource to allocate blocks from
+        std::size_t block_size_;     ///< Minimum size for each block
+        std::vector<Block> blocks_;  ///< Blocks of memory
+        std::size_t block_ = 0;      ///< Index of block currently being allocated from
+        std::size_t block_used_ = 0; ///< Bytes in use in the current block
+    };
+
+}
+/// @endcond INTERNAL
+#endif // ARENA_HPP
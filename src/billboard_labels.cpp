@@ -0,0 +1,575 @@
+/// @file
+/// @brief Camera-facing labels in a 3D scene
+
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "textogl/billboard_labels.hpp"
+#include "font_impl.hpp"
+
+#ifndef USE_OPENGL_ES
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+
+#include <GL/glew.h>
+
+namespace textogl
+{
+    /// Implementation details for billboard labels
+    struct Billboard_labels::Impl
+    {
+        /// Instance record for a single glyph
+        struct Glyph
+        {
+            float anchor_scale[4] = {0.0f, 0.0f, 0.0f, 1.0f}; ///< Label's anchor X, Y, Z, and scale
+            float offset[2] = {0.0f, 0.0f};                   ///< Label's offset, in pixels
+            float quad[4] = {0.0f, 0.0f, 0.0f, 0.0f};         ///< Glyph quad around the label's origin: upper left x, y, lower right x, y. Y is down
+            float tex[4] = {0.0f, 0.0f, 0.0f, 0.0f};          ///< Atlas texture coords of the quad, same layout
+            uint8_t color[4] = {0, 0, 0, 0};                  ///< Label's color. RGBA
+            uint8_t atlas_slot = 0;                           ///< Index of the glyph's atlas into \ref atlases_
+            uint8_t padding[3] = {0, 0, 0};                   ///< Unused. Keeps records 16 byte aligned
+        };
+
+        /// A label, and where its records are
+        struct Label
+        {
+            explicit Label(Memory_resource * resource): text(resource) {}
+
+            Resource_string text;              ///< Text to render, in UTF-8 encoding
+            Vec3<float> anchor;                ///< Position in world space
+            Color color;                       ///< Text Color
+            Vec2<float> offset;                ///< Offset on screen, in pixels
+            float scale = 1.0f;                ///< Scale for the text's size on screen
+            int align_flags = 0;               ///< Text Alignment around the anchor
+            std::size_t first = 0;             ///< Index of the label's first record in \ref records_
+            std::size_t count = 0;             ///< Number of records for the label
+            bool used = false;                 ///< \c false for removed labels, whose ids are in \ref free_ids_
+        };
+
+        static const uint8_t max_atlases = 255; ///< Limit on \ref atlases_, so slots fit in Glyph::atlas_slot
+
+        /// Create an empty set of labels
+        explicit Impl(Font_sys & font);
+        ~Impl();
+
+        /// @name Non-copyable, non-movable
+        /// @{
+        Impl(const Impl &) = delete;
+        Impl & operator=(const Impl &) = delete;
+
+        Impl(Impl &&) = delete;
+        Impl & operator=(Impl &&) = delete;
+        /// @}
+
+        /// Get a label
+        /// @throws std::out_of_range if \p id is not a label
+        Label & label(const std::size_t id);
+
+        /// Lay out a label's text, and append its records to \p out
+
+        /// Glyphs whose atlas has no slot are left out
+        void layout_label(const Label & label,           ///< Label to lay out
+                          Resource_vector<Glyph> & out,  ///< Records to append to. Must not allocate from the font's arena
+                          const bool can_rebuild = true  ///< If \c true, request a \ref rebuild to free slots for left out glyphs, unless the last rebuild was already out of them
+                          );
+
+        /// Copy a label's anchor, offset, scale, and color into a record
+        static void write_label(const Label & label, ///< Label to copy from
+                                Glyph & glyph        ///< Record to write to
+                                );
+
+        /// Replace a label's records with \p glyphs, moving the records after it
+        void replace_records(Label & label,                       ///< Label to replace records for
+                             const Resource_vector<Glyph> & glyphs ///< New records
+                             );
+
+        /// Extend the range of records to upload at the next render
+        void mark_dirty(const std::size_t begin, ///< First record
+                        const std::size_t end    ///< One past the last record
+                        );
+
+        /// Lay out every label again
+
+        /// Needed when glyphs have been evicted or moved, or the font has
+        /// been resized or changed. Uploads every record at the next render
+        void rebuild();
+
+        /// Render all labels
+        void render(const Mat4<float> & view_projection, const Vec2<float> & win_size);
+
+        /// Point the bound vertex array at \ref vbo_'s records
+        void set_attributes() const;
+
+        std::shared_ptr<Font_sys::Impl> font_; ///< Font the labels are drawn with
+
+        Counting_resource resource_; ///< Resource for all internal containers. Declared before the containers so it outlives them
+
+        Resource_vector<Label> labels_;         ///< Labels, indexed by id
+        Resource_vector<std::size_t> free_ids_; ///< Ids of removed labels, for reuse
+        std::size_t num_labels_ = 0;            ///< Number of labels in use
+
+        Resource_vector<Glyph> records_; ///< Instance record for each glyph, as uploaded to \ref vbo_. Each label's are together
+        Resource_vector<Glyph> scratch_; ///< Records for a label being laid out again
+
+        Resource_vector<GLuint> atlases_;                     ///< Atlas textures used by the labels. Glyph::atlas_slot indexes this
+        Resource_vector<Font_sys::Impl::Char_info *> glyphs_; ///< Glyphs used by the labels. May have duplicates, until the next \ref rebuild
+        std::size_t layout_generation_ = 0;                   ///< Font_sys::Impl::layout_generation_ when the labels were laid out
+        bool rebuild_needed_ = false;                         ///< Set when glyphs were dropped for lack of atlas slots
+        std::size_t unique_glyphs_ = 0;                       ///< Size of \ref glyphs_ after the last \ref rebuild
+        bool out_of_slots_ = false;                           ///< Set if the last \ref rebuild couldn't fit every glyph's atlas into \ref atlases_
+
+        std::size_t dirty_begin_ = 0; ///< First record to upload at the next render
+        std::size_t dirty_end_ = 0;   ///< One past the last record to upload. No upload needed when equal to \ref dirty_begin_
+
+        GLuint vao_;                       ///< OpenGL Vertex array object index
+        Font_sys::Context_handle context_; ///< Context \ref vao_ was created in
+        GLuint vbo_;                       ///< OpenGL instance buffer object index
+        std::size_t vbo_capacity_ = 0;     ///< Number of records \ref vbo_ has room for
+    };
+
+    Billboard_labels::Billboard_labels(Font_sys & font): pimpl(new Impl(font)) {}
+    Billboard_labels::~Billboard_labels() = default;
+
+    Billboard_labels::Impl::Impl(Font_sys & font):
+        font_(font.pimpl),
+        resource_(nullptr),
+        labels_(&resource_),
+        free_ids_(&resource_),
+        records_(&resource_),
+        scratch_(&resource_),
+        atlases_(&resource_),
+        glyphs_(&resource_)
+    {
+        font_->common().init_billboard();
+
+        context_ = Font_sys::get_current_context();
+        glGenVertexArrays(1, &vao_);
+        glGenBuffers(1, &vbo_);
+
+        glBindVertexArray(vao_);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+        set_attributes();
+        glBindVertexArray(0);
+
+        layout_generation_ = font_->layout_generation_;
+    }
+
+    Billboard_labels::Impl::~Impl()
+    {
+        glDeleteBuffers(1, &vbo_);
+        glDeleteVertexArrays(1, &vao_);
+    }
+
+    void Billboard_labels::set_font_sys(Font_sys & font)
+    {
+        pimpl->font_ = font.pimpl;
+        pimpl->font_->common().init_billboard();
+        pimpl->rebuild();
+    }
+
+    std::size_t Billboard_labels::add_label(const std::string & utf8_input, const Vec3<float> & anchor, const Color & color,
+            const Vec2<float> & offset, const float scale, const int align_flags)
+    {
+        std::size_t id = pimpl->labels_.size();
+        if(!pimpl->free_ids_.empty())
+        {
+            id = pimpl->free_ids_.back();
+            pimpl->free_ids_.pop_back();
+        }
+        else
+        {
+            pimpl->labels_.emplace_back(&pimpl->resource_);
+        }
+
+        auto & label = pimpl->labels_[id];
+        label.text.assign(utf8_input.data(), utf8_input.size());
+        label.anchor = anchor;
+        label.color = color;
+        label.offset = offset;
+        label.scale = scale;
+        label.align_flags = align_flags;
+        label.used = true;
+        ++pimpl->num_labels_;
+
+        // new labels go after every other label's records
+        label.first = pimpl->records_.size();
+        label.count = 0;
+
+        pimpl->scratch_.clear();
+        pimpl->layout_label(label, pimpl->scratch_);
+        pimpl->replace_records(label, pimpl->scratch_);
+
+        return id;
+    }
+
+    void Billboard_labels::remove_label(const std::size_t id)
+    {
+        auto & label = pimpl->label(id);
+
+        pimpl->scratch_.clear();
+        pimpl->replace_records(label, pimpl->scratch_);
+
+        label.text.clear();
+        label.used = false;
+        pimpl->free_ids_.push_back(id);
+        --pimpl->num_labels_;
+    }
+
+    void Billboard_labels::clear()
+    {
+        pimpl->labels_.clear();
+        pimpl->free_ids_.clear();
+        pimpl->num_labels_ = 0;
+        pimpl->records_.clear();
+        pimpl->glyphs_.clear();
+        pimpl->atlases_.clear();
+        pimpl->dirty_begin_ = pimpl->dirty_end_ = 0;
+    }
+
+    std::size_t Billboard_labels::get_num_labels() const
+    {
+        return pimpl->num_labels_;
+    }
+
+    void Billboard_labels::set_text(const std::size_t id, const std::string & utf8_input)
+    {
+        auto & label = pimpl->label(id);
+        label.text.assign(utf8_input.data(), utf8_input.size());
+
+        pimpl->scratch_.clear();
+        pimpl->layout_label(label, pimpl->scratch_);
+        pimpl->replace_records(label, pimpl->scratch_);
+    }
+
+    void Billboard_labels::set_anchor(const std::size_t id, const Vec3<float> & anchor)
+    {
+        auto & label = pimpl->label(id);
+        label.anchor = anchor;
+
+        for(std::size_t i = label.first; i < label.first + label.count; ++i)
+            Impl::write_label(label, pimpl->records_[i]);
+        pimpl->mark_dirty(label.first, label.first + label.count);
+    }
+
+    void Billboard_labels::set_color(const std::size_t id, const Color & color)
+    {
+        auto & label = pimpl->label(id);
+        label.color = color;
+
+        for(std::size_t i = label.first; i < label.first + label.count; ++i)
+            Impl::write_label(label, pimpl->records_[i]);
+        pimpl->mark_dirty(label.first, label.first + label.count);
+    }
+
+    void Billboard_labels::set_offset(const std::size_t id, const Vec2<float> & offset, const float scale)
+    {
+        auto & label = pimpl->label(id);
+        label.offset = offset;
+        label.scale = scale;
+
+        for(std::size_t i = label.first; i < label.first + label.count; ++i)
+            Impl::write_label(label, pimpl->records_[i]);
+        pimpl->mark_dirty(label.first, label.first + label.count);
+    }
+
+    Billboard_labels::Impl::Label & Billboard_labels::Impl::label(const std::size_t id)
+    {
+        if(id >= labels_.size() || !labels_[id].used)
+            throw std::out_of_range("No label with id: " + std::to_string(id));
+
+        return labels_[id];
+    }
+
+    void Billboard_labels::Impl::layout_label(const Label & label, Resource_vector<Glyph> & out, const bool can_rebuild)
+    {
+        Arena::Scope scope(font_->arena_);
+        Font_sys::Impl::Text_layout layout(&font_->arena_);
+        font_->build_text(label.text.data(), label.text.size(), layout);
+
+        glyphs_.insert(glyphs_.end(), layout.glyphs.begin(), layout.glyphs.end());
+
+        auto origin = Font_sys::Impl::align_offset(label.align_flags, layout.text_box);
+
+        for(const auto & cd: layout.coord_data)
+        {
+            auto slot = std::find(atlases_.begin(), atlases_.end(), cd.tex);
+            if(slot == atlases_.end())
+            {
+                // out of slots. rebuilding drops atlases no longer in use. until then, these glyphs aren't drawn.
+                // if this is the rebuild, or the last one didn't have room either, the labels really do use too many atlases. leave them out
+                if(atlases_.size() == max_atlases)
+                {
+                    if(can_rebuild && !out_of_slots_)
+                        rebuild_needed_ = true;
+                    else
+                        out_of_slots_ = true;
+                    continue;
+                }
+
+                slot = atlases_.insert(atlases_.end(), cd.tex);
+            }
+
+            // each quad is 6 vertices of position and texture coords. see Font_sys::Impl::add_quad
+            for(std::size_t v = cd.start; v < cd.start + cd.num_elements; v += 6)
+            {
+                // the quad's 2nd vertex is its lower right corner, and the 3rd is its upper left
+                const auto & lr = layout.coords[(v + 1) * 2];
+                const auto & lr_tex = layout.coords[(v + 1) * 2 + 1];
+                const auto & ul = layout.coords[(v + 2) * 2];
+                const auto & ul_tex = layout.coords[(v + 2) * 2 + 1];
+
+                Glyph glyph;
+                glyph.quad[0] = ul.x - origin.x;
+                glyph.quad[1] = ul.y - origin.y;
+                glyph.quad[2] = lr.x - origin.x;
+                glyph.quad[3] = lr.y - origin.y;
+                glyph.tex[0] = ul_tex.x;
+                glyph.tex[1] = ul_tex.y;
+                glyph.tex[2] = lr_tex.x;
+                glyph.tex[3] = lr_tex.y;
+                glyph.atlas_slot = static_cast<uint8_t>(slot - atlases_.begin());
+                write_label(label, glyph);
+
+                out.push_back(glyph);
+            }
+        }
+    }
+
+    void Billboard_labels::Impl::write_label(const Label & label, Glyph & glyph)
+    {
+        glyph.anchor_scale[0] = label.anchor.x;
+        glyph.anchor_scale[1] = label.anchor.y;
+        glyph.anchor_scale[2] = label.anchor.z;
+        glyph.anchor_scale[3] = label.scale;
+        glyph.offset[0] = label.offset.x;
+        glyph.offset[1] = label.offset.y;
+
+        for(int i = 0; i < 4; ++i)
+            glyph.color[i] = static_cast<uint8_t>(std::lround(std::min(std::max(label.color[i], 0.0f), 1.0f) * 255.0f));
+    }
+
+    void Billboard_labels::Impl::replace_records(Label & label, const Resource_vector<Glyph> & glyphs)
+    {
+        const std::size_t old_end = label.first + label.count;
+
+        if(glyphs.size() == label.count)
+        {
+            std::copy(glyphs.begin(), glyphs.end(), records_.begin() + label.first);
+            mark_dirty(label.first, old_end);
+            return;
+        }
+
+        records_.erase(records_.begin() + label.first, records_.begin() + old_end);
+        records_.insert(records_.begin() + label.first, glyphs.begin(), glyphs.end());
+
+        // everything after this label moves
+        for(auto & other: labels_)
+        {
+            if(&other != &label && other.first >= old_end)
+                other.first = other.first + glyphs.size() - label.count;
+        }
+
+        label.count = glyphs.size();
+        mark_dirty(label.first, records_.size());
+    }
+
+    void Billboard_labels::Impl::mark_dirty(const std::size_t begin, const std::size_t end)
+    {
+        if(begin >= end)
+            return;
+
+        if(dirty_begin_ == dirty_end_)
+        {
+            dirty_begin_ = begin;
+            dirty_end_ = end;
+        }
+        else
+        {
+            dirty_begin_ = std::min(dirty_begin_, begin);
+            dirty_end_ = std::max(dirty_end_, end);
+        }
+    }
+
+    void Billboard_labels::Impl::rebuild()
+    {
+        records_.clear();
+        atlases_.clear();
+        glyphs_.clear();
+        rebuild_needed_ = false;
+        out_of_slots_ = false;
+
+        for(auto & label: labels_)
+        {
+            label.first = records_.size();
+            if(label.used)
+                layout_label(label, records_, false);
+            label.count = records_.size() - label.first;
+        }
+
+        // each label was its own layout, so glyphs shared between them are listed more than once
+        std::sort(glyphs_.begin(), glyphs_.end());
+        glyphs_.erase(std::unique(glyphs_.begin(), glyphs_.end()), glyphs_.end());
+        unique_glyphs_ = glyphs_.size();
+
+        layout_generation_ = font_->layout_generation_;
+
+        mark_dirty(0, records_.size());
+    }
+
+    void Billboard_labels::render(const Mat4<float> & view_projection, const Vec2<float> & win_size)
+    {
+        pimpl->render(view_projection, win_size);
+    }
+
+    void Billboard_labels::Impl::render(const Mat4<float> & view_projection, const Vec2<float> & win_size)
+    {
+        // glyphs may have been evicted or moved since they were looked up.
+        // set_text adds glyphs without checking for duplicates, so clear those out too once they pile up.
+        // glyphs left out for lack of slots have no records, so count from the unique glyphs when there are more of those
+        if(rebuild_needed_ || glyphs_.size() > 2 * std::max(records_.size(), unique_glyphs_) + 256 || !font_->use_glyphs(glyphs_, layout_generation_))
+            rebuild();
+
+        if(records_.empty())
+            return;
+
+        // save old settings
+        GLint old_vao{0}, old_vbo{0}, old_prog{0};
+        GLint old_blend_src{0}, old_blend_dst{0};
+        GLint old_blend_src_alpha{0}, old_blend_dst_alpha{0};
+        GLint old_active_texture{0}, old_texture_2d{0};
+
+        glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &old_vao);
+        glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &old_vbo);
+        glGetIntegerv(GL_CURRENT_PROGRAM, &old_prog);
+        glGetIntegerv(GL_BLEND_SRC_RGB, &old_blend_src);
+        glGetIntegerv(GL_BLEND_DST_RGB, &old_blend_dst);
+        glGetIntegerv(GL_BLEND_SRC_ALPHA, &old_blend_src_alpha);
+        glGetIntegerv(GL_BLEND_DST_ALPHA, &old_blend_dst_alpha);
+        glGetIntegerv(GL_ACTIVE_TEXTURE, &old_active_texture);
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &old_texture_2d);
+
+        auto old_depth_test = glIsEnabled(GL_DEPTH_TEST);
+        auto old_blend = glIsEnabled(GL_BLEND);
+
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+
+        // grow the buffer to fit, with room to spare so adding labels doesn't reallocate every time
+        if(records_.size() > vbo_capacity_)
+        {
+            vbo_capacity_ = std::max(records_.size(), 2 * vbo_capacity_);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(Glyph) * vbo_capacity_, NULL, GL_DYNAMIC_DRAW);
+            dirty_begin_ = 0;
+            dirty_end_ = records_.size();
+        }
+
+        // upload only the records changed since the last render. removed labels can leave the range past the end
+        dirty_end_ = std::min(dirty_end_, records_.size());
+        if(dirty_begin_ < dirty_end_)
+            glBufferSubData(GL_ARRAY_BUFFER, sizeof(Glyph) * dirty_begin_, sizeof(Glyph) * (dirty_end_ - dirty_begin_), &records_[dirty_begin_]);
+        dirty_begin_ = dirty_end_ = 0;
+
+        // VAOs aren't shared, so in another context use that context's, set up for instancing just for this draw
+        const bool own_vao = context_ == font_->current_context_;
+        auto & common_data = font_->common();
+        if(own_vao)
+        {
+            glBindVertexArray(vao_);
+        }
+        else
+        {
+            glBindVertexArray(common_data.vao);
+            set_attributes();
+        }
+
+        const auto & uniforms = common_data.billboard_uniforms;
+        glUseProgram(common_data.billboard_prog);
+        glUniformMatrix4fv(uniforms.view_projection, 1, GL_FALSE, &view_projection[0][0]);
+        glUniform2f(uniforms.viewport_size, win_size.x, win_size.y);
+
+        glDisable(GL_DEPTH_TEST);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glActiveTexture(GL_TEXTURE0 + font_->max_tu_count_);
+
+        // one pass per atlas. each skips glyphs from other atlases
+        const auto num_records = static_cast<GLsizei>(records_.size());
+        for(std::size_t slot = 0; slot < atlases_.size(); ++slot)
+        {
+            glUniform1i(uniforms.atlas, static_cast<GLint>(slot));
+            glUniform1i(uniforms.color_glyphs, font_->atlases_.at(atlases_[slot]).color);
+            glBindTexture(GL_TEXTURE_2D, atlases_[slot]);
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, num_records);
+        }
+
+        if(!own_vao)
+        {
+            // the shared VAO is used for non-instanced text too
+            for(GLuint i = 0; i < 6; ++i)
+                glVertexAttribDivisor(i, 0);
+            for(GLuint i = 2; i < 6; ++i)
+                glDisableVertexAttribArray(i);
+        }
+
+        // restore old settings
+        glBindVertexArray(old_vao);
+        glBindBuffer(GL_ARRAY_BUFFER, old_vbo);
+        glUseProgram(old_prog);
+
+        if(old_depth_test)
+            glEnable(GL_DEPTH_TEST);
+        else
+            glDisable(GL_DEPTH_TEST);
+
+        if(old_blend)
+            glEnable(GL_BLEND);
+        else
+            glDisable(GL_BLEND);
+
+        glBlendFuncSeparate(old_blend_src, old_blend_dst, old_blend_src_alpha, old_blend_dst_alpha);
+        glActiveTexture(old_active_texture);
+        glBindTexture(GL_TEXTURE_2D, old_texture_2d);
+    }
+
+    void Billboard_labels::Impl::set_attributes() const
+    {
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(Glyph), (const GLvoid *)offsetof(Glyph, anchor_scale));
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Glyph), (const GLvoid *)offsetof(Glyph, offset));
+        glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(Glyph), (const GLvoid *)offsetof(Glyph, quad));
+        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(Glyph), (const GLvoid *)offsetof(Glyph, tex));
+        glVertexAttribPointer(4, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Glyph), (const GLvoid *)offsetof(Glyph, color));
+        glVertexAttribIPointer(5, 1, GL_UNSIGNED_BYTE, sizeof(Glyph), (const GLvoid *)offsetof(Glyph, atlas_slot));
+
+        for(GLuint i = 0; i < 6; ++i)
+        {
+            glEnableVertexAttribArray(i);
+            glVertexAttribDivisor(i, 1);
+        }
+    }
+
+    std::size_t Billboard_labels::get_memory_usage() const
+    {
+        return pimpl->resource_.bytes_in_use();
+    }
+}
+
+#endif
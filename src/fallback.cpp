@@ -0,0 +1,153 @@
+/// @file
+/// @brief Fallback fonts
+
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "font_impl.hpp"
+
+#include <stdexcept>
+
+namespace textogl
+{
+    Font_sys::Impl::Coverage::Coverage(FT_Face face): page_index_(num_pages, 0)
+    {
+        FT_UInt glyph_i = 0;
+        for(FT_ULong code_pt = FT_Get_First_Char(face, &glyph_i); glyph_i != 0; code_pt = FT_Get_Next_Char(face, code_pt, &glyph_i))
+        {
+            if(code_pt >= num_pages * 256)
+                continue;
+
+            auto & page = page_index_[code_pt >> 8];
+            if(!page)
+            {
+                bits_.resize(bits_.size() + 4, 0);
+                page = static_cast<uint16_t>(bits_.size() / 4);
+            }
+
+            bits_[(page - 1) * 4 + ((code_pt >> 6) & 3)] |= uint64_t{1} << (code_pt & 63);
+        }
+    }
+
+    void Font_sys::add_fallback(const std::string & font_path)
+    {
+        Impl::Font_source source;
+        source.path = font_path;
+        pimpl->add_fallback(source);
+    }
+
+    void Font_sys::add_fallback(const unsigned char * font_data, const std::size_t font_data_size)
+    {
+        Impl::Font_source source;
+        source.data = font_data;
+        source.size = font_data_size;
+        pimpl->add_fallback(source);
+    }
+
+    void Font_sys::Impl::add_fallback(const Font_source & source)
+    {
+        FT_Face face = open_face(ft_lib_ ? ft_lib_ : common_->ft_lib, source);
+
+        std::shared_ptr<Fallback_list> fallbacks;
+        try
+        {
+            set_face_size(face, font_size_);
+
+            fallbacks = std::make_shared<Fallback_list>(fallback_list_ ? *fallback_list_ : Fallback_list{});
+            fallbacks->push_back({source, std::make_shared<Coverage>(face)});
+            fallback_faces_.push_back(face);
+        }
+        catch(...)
+        {
+            FT_Done_Face(face);
+            throw;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(layout_mutex_);
+            fallback_list_ = std::move(fallbacks);
+        }
+
+        // the new face may need bigger atlas cells
+        resize(font_size_);
+    }
+
+    void Font_sys::clear_fallbacks()
+    {
+        Impl::close_faces(pimpl->fallback_faces_);
+        {
+            std::lock_guard<std::mutex> lock(pimpl->layout_mutex_);
+            pimpl->fallback_list_.reset();
+        }
+
+        pimpl->resize(pimpl->font_size_);
+    }
+
+    std::vector<float> Font_sys::Impl::size_faces(const std::vector<FT_Face> & faces, const unsigned int font_size)
+    {
+        std::vector<float> scales;
+        for(auto & face: faces)
+            scales.push_back(set_face_size(face, font_size));
+        return scales;
+    }
+
+    std::pair<unsigned int, FT_UInt> Font_sys::Impl::find_glyph(FT_Face face, const std::vector<FT_Face> & fallback_faces,
+            const Fallback_list * fallbacks, const uint32_t code_pt)
+    {
+        FT_UInt glyph_i = FT_Get_Char_Index(face, code_pt);
+        if(glyph_i != 0 || !fallbacks)
+            return {0, glyph_i};
+
+        for(std::size_t i = 0; i < fallbacks->size(); ++i)
+        {
+            if((*fallbacks)[i].coverage->has(code_pt))
+                return {static_cast<unsigned int>(i + 1), FT_Get_Char_Index(fallback_faces[i], code_pt)};
+        }
+
+        return {0, 0};
+    }
+
+    std::vector<FT_Face> Font_sys::Impl::open_fallback_faces(FT_Library lib, const Fallback_list * fallbacks)
+    {
+        std::vector<FT_Face> faces;
+        if(!fallbacks)
+            return faces;
+
+        try
+        {
+            for(auto & fallback: *fallbacks)
+                faces.push_back(open_face(lib, fallback.source));
+        }
+        catch(...)
+        {
+            close_faces(faces);
+            throw;
+        }
+
+        return faces;
+    }
+
+    void Font_sys::Impl::close_faces(std::vector<FT_Face> & faces)
+    {
+        for(auto & face: faces)
+            FT_Done_Face(face);
+        faces.clear();
+    }
+}
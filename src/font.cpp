@@ -23,14 +23,18 @@
 
 #include "font_impl.hpp"
 
+#include <algorithm>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
 #include <limits>
 #include <stdexcept>
 #include <system_error>
+#include <unordered_set>
 
 #include <cmath>
+#include <cstring>
 
 /// Convert a UTF-8 string to a UTF-32 string
 
@@ -38,16 +42,20 @@
 /// invalid byte sequences are detected, they will be replaced by the replacement
 /// character: '�'
 /// @param utf8 UTF-8 string to convert
-/// @returns UTF-32 string corresponding to the input
-std::u32string utf8_to_utf32(const std::string & utf8)
+/// @param utf8_size Size of \p utf8 in bytes
+/// @param utf32 UTF-32 string corresponding to the input. Existing contents are replaced
+void utf8_to_utf32(const char * utf8, const std::size_t utf8_size, textogl::Resource_vector<char32_t> & utf32)
 {
-    std::u32string utf32;
+    utf32.clear();
+    utf32.reserve(utf8_size);
 
     uint32_t code_pt = 0;
     int expected_bytes = 0;
 
-    for(const uint8_t byte: utf8)
+    for(std::size_t i = 0; i < utf8_size; ++i)
     {
+        const uint8_t byte = utf8[i];
+
         // detect invalid bytes
         if(byte == 0xC0 || byte == 0xC1 || byte >= 0xF5)
         {
@@ -125,64 +133,112 @@ std::u32string utf8_to_utf32(const std::string & utf8)
         // end of string but still expecting continuation bytes. use the replacement char
         utf32.push_back(U'�');
     }
+}
 
-    return utf32;
+/// List every code point in a set of ranges
+
+/// Code points beyond U+10FFFF are skipped
+/// @param ranges Code point ranges
+/// @returns Code points, in the order given
+std::vector<uint32_t> expand_ranges(const std::vector<textogl::Code_point_range> & ranges)
+{
+    std::vector<uint32_t> code_pts;
+    for(auto & range: ranges)
+    {
+        for(uint32_t code_pt = range.first; code_pt <= range.last && code_pt <= 0x10FFFF; ++code_pt)
+            code_pts.push_back(code_pt);
+    }
+    return code_pts;
 }
 
 namespace textogl
 {
+    Font_sys::Font_sys(std::shared_ptr<Impl> impl): pimpl(impl)
+    {}
+
     Font_sys::Font_sys(const std::string & font_path, const unsigned int font_size):
         pimpl(std::make_shared<Impl>(font_path, font_size))
     {}
-    Font_sys::Impl::Impl(const std::string & font_path, const unsigned int font_size)
+#ifdef TEXTOGL_USE_PMR
+    Font_sys::Font_sys(const std::string & font_path, const unsigned int font_size, std::pmr::memory_resource * resource):
+        pimpl(std::allocate_shared<Impl>(std::pmr::polymorphic_allocator<Impl>(resource ? resource : std::pmr::get_default_resource()), font_path, font_size, resource))
+    {}
+#endif
+    Font_sys::Impl::Impl(const std::string & font_path, const unsigned int font_size, Memory_resource * resource):
+        resource_(resource),
+        page_map_(0, std::hash<uint32_t>(), std::equal_to<uint32_t>(), &resource_),
+        atlases_(0, std::hash<GLuint>(), std::equal_to<GLuint>(), &resource_),
+        arena_(&resource_),
+        subpixel_glyphs_(0, std::hash<uint64_t>(), std::equal_to<uint64_t>(), &resource_),
+#ifdef TEXTOGL_USE_HARFBUZZ
+        features_(&resource_),
+        shaped_glyphs_(0, std::hash<uint64_t>(), std::equal_to<uint64_t>(), &resource_),
+        shaped_runs_(&resource_),
+        shaped_run_index_(0, std::hash<std::size_t>(), std::equal_to<std::size_t>(), &resource_),
+#endif
+        usage_(&resource_)
     {
-        FT_Open_Args args
-        {
-            FT_OPEN_PATHNAME,
-            nullptr,
-            0,
-            const_cast<char *>(font_path.c_str()),
-            nullptr,
-            nullptr,
-            0,
-            nullptr
-        };
-        init(args, font_size);
+        source_.path = font_path;
+        init(font_size);
     }
 
     Font_sys::Font_sys(const unsigned char * font_data, std::size_t font_data_size, const unsigned int font_size):
         pimpl(std::make_shared<Impl>(font_data, font_data_size, font_size))
     {}
-    Font_sys::Impl::Impl(const unsigned char * font_data, std::size_t font_data_size, const unsigned int font_size)
+#ifdef TEXTOGL_USE_PMR
+    Font_sys::Font_sys(const unsigned char * font_data, std::size_t font_data_size, const unsigned int font_size,
+            std::pmr::memory_resource * resource):
+        pimpl(std::allocate_shared<Impl>(std::pmr::polymorphic_allocator<Impl>(resource ? resource : std::pmr::get_default_resource()), font_data, font_data_size, font_size, resource))
+    {}
+#endif
+    Font_sys::Impl::Impl(const unsigned char * font_data, std::size_t font_data_size, const unsigned int font_size,
+            Memory_resource * resource):
+        resource_(resource),
+        page_map_(0, std::hash<uint32_t>(), std::equal_to<uint32_t>(), &resource_),
+        atlases_(0, std::hash<GLuint>(), std::equal_to<GLuint>(), &resource_),
+        arena_(&resource_),
+        subpixel_glyphs_(0, std::hash<uint64_t>(), std::equal_to<uint64_t>(), &resource_),
+#ifdef TEXTOGL_USE_HARFBUZZ
+        features_(&resource_),
+        shaped_glyphs_(0, std::hash<uint64_t>(), std::equal_to<uint64_t>(), &resource_),
+        shaped_runs_(&resource_),
+        shaped_run_index_(0, std::hash<std::size_t>(), std::equal_to<std::size_t>(), &resource_),
+#endif
+        usage_(&resource_)
+    {
+        source_.data = font_data;
+        source_.size = font_data_size;
+        init(font_size);
+    }
+
+    FT_Face Font_sys::Impl::open_face(FT_Library lib, const Font_source & source)
     {
         FT_Open_Args args
         {
-            FT_OPEN_MEMORY,
-            font_data,
-            static_cast<FT_Long>(font_data_size),
+            FT_OPEN_PATHNAME,
             nullptr,
+            0,
+            const_cast<char *>(source.path.c_str()),
             nullptr,
             nullptr,
             0,
             nullptr
         };
-        init(args, font_size);
-    }
 
-    void Font_sys::Impl::init(FT_Open_Args & args, const unsigned int font_size)
-    {
-        // load freetype, and text shader - only once
-        if(common_ref_cnt_ == 0)
-            common_data_.reset(new Font_common);
+        if(source.data)
+        {
+            args.flags = FT_OPEN_MEMORY;
+            args.memory_base = source.data;
+            args.memory_size = static_cast<FT_Long>(source.size);
+            args.pathname = nullptr;
+        }
 
         // open the font file
-        FT_Error err = FT_Open_Face(common_data_->ft_lib, &args, 0, &face_);
+        FT_Face face;
+        FT_Error err = FT_Open_Face(lib, &args, 0, &face);
 
         if(err != FT_Err_Ok)
         {
-            if(common_ref_cnt_ == 0)
-                common_data_.reset();
-
             if(err == FT_Err_Unknown_File_Format)
             {
                 throw std::system_error(err, std::system_category(), "Unknown format for font file");
@@ -194,14 +250,29 @@ namespace textogl
         }
 
         // select unicode charmap (should be default for most fonts)
-        if(FT_Select_Charmap(face_, FT_ENCODING_UNICODE) != FT_Err_Ok)
+        if(FT_Select_Charmap(face, FT_ENCODING_UNICODE) != FT_Err_Ok)
         {
-            FT_Done_Face(face_);
+            FT_Done_Face(face);
+            throw std::runtime_error("No unicode charmap in font file");
+        }
 
-            if(common_ref_cnt_ == 0)
-                common_data_.reset();
+        return face;
+    }
 
-            throw std::runtime_error("No unicode charmap in font file");
+    void Font_sys::Impl::init(const unsigned int font_size)
+    {
+        // load freetype, and text shader - only once per context
+        context_ = current_context_;
+        common_ = &acquire_common();
+
+        try
+        {
+            face_ = open_face(common_->ft_lib, source_);
+        }
+        catch(...)
+        {
+            release_common(context_);
+            throw;
         }
 
         try
@@ -211,16 +282,68 @@ namespace textogl
         catch(std::runtime_error &)
         {
             FT_Done_Face(face_);
+            release_common(context_);
+            throw;
+        }
 
-            if(common_ref_cnt_ == 0)
-                common_data_.reset();
+        init_gl();
+    }
+
+    Font_sys::Impl::Impl(const Font_source & source, const unsigned int font_size, std::vector<uint32_t> code_pts):
+        resource_(nullptr),
+        page_map_(0, std::hash<uint32_t>(), std::equal_to<uint32_t>(), &resource_),
+        atlases_(0, std::hash<GLuint>(), std::equal_to<GLuint>(), &resource_),
+        arena_(&resource_),
+        source_(source),
+        subpixel_glyphs_(0, std::hash<uint64_t>(), std::equal_to<uint64_t>(), &resource_),
+#ifdef TEXTOGL_USE_HARFBUZZ
+        features_(&resource_),
+        shaped_glyphs_(0, std::hash<uint64_t>(), std::equal_to<uint64_t>(), &resource_),
+        shaped_runs_(&resource_),
+        shaped_run_index_(0, std::hash<std::size_t>(), std::equal_to<std::size_t>(), &resource_),
+#endif
+        usage_(&resource_)
+    {
+        // Font_common can't be created without OpenGL, so use a separate library
+        if(FT_Init_FreeType(&ft_lib_) != FT_Err_Ok)
+            throw std::runtime_error("Error initializing Freetype library");
+
+        try
+        {
+            face_ = open_face(ft_lib_, source_);
+        }
+        catch(...)
+        {
+            FT_Done_FreeType(ft_lib_);
+            throw;
+        }
 
+        try
+        {
+            resize(font_size);
+        }
+        catch(std::runtime_error &)
+        {
+            FT_Done_Face(face_);
+            FT_Done_FreeType(ft_lib_);
             throw;
         }
 
-        // we're not going to throw now, so increment library ref count
-        ++common_ref_cnt_;
+        // render the initial glyphs now. they're uploaded by init_gl
+        auto job = create_preload_job(std::move(code_pts));
+        try
+        {
+            rasterize_glyphs(face_, face_scale_, fallback_faces_, fallback_scales_, *job, job->glyphs);
+        }
+        catch(...)
+        {
+            job->error = std::current_exception();
+        }
+        preload_jobs_.push_back(std::move(job));
+    }
 
+    void Font_sys::Impl::init_gl()
+    {
         // create and set up vertex array and buffer
 #ifndef USE_OPENGL_ES
         glGenVertexArrays(1, &vao_);
@@ -242,19 +365,56 @@ namespace textogl
         glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &max_tu_count_);
         max_tu_count_--;
 
-        // get shader uniform locations
-        glUseProgram(common_data_->prog);
-        glUniform1i(common_data_->uniform_locations["font_page"], max_tu_count_);
-        glUseProgram(0);
+        gl_initialized_ = true;
+
+        // upload anything rendered while loading
+        finish_preloads(false);
     }
 
     Font_sys::Impl::~Impl()
     {
+        // stop the layout worker. pending layouts are abandoned
+        {
+            std::lock_guard<std::mutex> lock(layout_mutex_);
+            layout_stop_ = true;
+        }
+        layout_cv_.notify_all();
+        for(auto & t: layout_threads_)
+            t.join();
+
+        // stop any preloads. their futures are abandoned
+        for(auto & job: preload_jobs_)
+        {
+            job->cancel = true;
+            for(auto & t: job->threads)
+            {
+                if(t.joinable())
+                    t.join();
+            }
+        }
+
+#ifdef TEXTOGL_USE_HARFBUZZ
+        // the HarfBuzz fonts hold references to the faces
+        hb_buffer_destroy(hb_buffer_);
+        hb_font_destroy(hb_font_);
+        for(auto font: fallback_hb_fonts_)
+            hb_font_destroy(font);
+#endif
+
+        close_faces(fallback_faces_);
         FT_Done_Face(face_);
+        if(ft_lib_)
+            FT_Done_FreeType(ft_lib_);
+
+        // an asynchronously loaded font might not have gotten this far
+        if(!gl_initialized_)
+            return;
+
+#ifndef USE_OPENGL_ES
+        cancel_uploads();
+#endif
 
-        // only deallocate shared libs if this is the last Font_sys obj
-        if(--common_ref_cnt_ == 0)
-            common_data_.reset();
+        release_common(context_);
 
         // destroy VAO/VBO
         glDeleteBuffers(1, &vbo_);
@@ -263,55 +423,114 @@ namespace textogl
 #endif
 
         // destroy textures
-        for(auto & i: page_map_)
+        for(auto & i: atlases_)
         {
             glDeleteTextures(1, &i.first);
         }
     }
 
-    Font_sys::Impl::Impl(Impl && other):
-        face_(other.face_),
-        has_kerning_info_(other.has_kerning_info_),
-        cell_bbox_(std::move(other.cell_bbox_)),
-        line_height_(other.line_height_),
-        tex_width_(other.tex_width_),
-        tex_height_(other.tex_height_),
-        page_map_(std::move(other.page_map_)),
-#ifndef USE_OPENGL_ES
-        vao_(other.vao_),
-#endif
-        vbo_(other.vbo_)
+    /// Implementation details for asynchronous font loading
+    struct Font_sys::Async_load::Impl
     {
-        other.face_ = nullptr;
-#ifndef USE_OPENGL_ES
-        other.vao_ = 0;
-#endif
-        other.vbo_ = 0;
-        ++common_ref_cnt_;
+        /// Finish loading, on the rendering thread, once \ref loading is ready
+        void finish();
+
+        std::future<std::shared_ptr<Font_sys::Impl>> loading; ///< Font being loaded on the worker thread
+        std::shared_ptr<Font_sys::Impl> font;                 ///< Loaded font, once done
+        std::exception_ptr error;                             ///< Error from loading, if any
+        bool done = false;                                    ///< \c true once \ref finish has run
+        std::vector<std::function<void()>> callbacks;         ///< Functions to call once done
+    };
+
+    Font_sys::Async_load::Async_load(): pimpl(std::make_shared<Impl>())
+    {}
+
+    Font_sys::Async_load Font_sys::load_async(const std::string & font_path, const unsigned int font_size,
+            const std::vector<Code_point_range> & glyphs)
+    {
+        Impl::Font_source source;
+        source.path = font_path;
+
+        auto code_pts = expand_ranges(glyphs);
+
+        Async_load load;
+        load.pimpl->loading = std::async(std::launch::async, [source, font_size, code_pts]()
+                {
+                    return std::make_shared<Impl>(source, font_size, code_pts);
+                });
+        return load;
+    }
+
+    Font_sys::Async_load Font_sys::load_async(const unsigned char * font_data, std::size_t font_data_size,
+            const unsigned int font_size, const std::vector<Code_point_range> & glyphs)
+    {
+        Impl::Font_source source;
+        source.data = font_data;
+        source.size = font_data_size;
+
+        auto code_pts = expand_ranges(glyphs);
+
+        Async_load load;
+        load.pimpl->loading = std::async(std::launch::async, [source, font_size, code_pts]()
+                {
+                    return std::make_shared<Impl>(source, font_size, code_pts);
+                });
+        return load;
     }
-    Font_sys::Impl & Font_sys::Impl::operator=(Impl && other)
+
+    void Font_sys::Async_load::Impl::finish()
     {
-        if(this != &other)
+        try
         {
-            face_ = other.face_;
-            has_kerning_info_ = other.has_kerning_info_;
-            cell_bbox_ = std::move(other.cell_bbox_);
-            line_height_ = other.line_height_;
-            tex_width_ = other.tex_width_;
-            tex_height_ = other.tex_height_;
-            page_map_ = std::move(other.page_map_);
-#ifndef USE_OPENGL_ES
-            vao_ = other.vao_;
-#endif
-            vbo_ = other.vbo_;
+            font = loading.get();
 
-            other.face_ = nullptr;
-#ifndef USE_OPENGL_ES
-            other.vao_ = 0;
-#endif
-            other.vbo_ = 0;
+            font->context_ = Font_sys::Impl::current_context_;
+            font->common_ = &Font_sys::Impl::acquire_common();
+
+            font->init_gl();
+        }
+        catch(...)
+        {
+            font.reset();
+            error = std::current_exception();
+        }
+
+        done = true;
+
+        auto to_call = std::move(callbacks);
+        callbacks.clear();
+        for(auto & callback: to_call)
+            callback();
+    }
+
+    bool Font_sys::Async_load::poll()
+    {
+        if(!pimpl->done && pimpl->loading.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+            pimpl->finish();
+
+        return pimpl->done;
+    }
+
+    Font_sys Font_sys::Async_load::get()
+    {
+        if(!pimpl->done)
+        {
+            pimpl->loading.wait();
+            pimpl->finish();
         }
-        return *this;
+
+        if(pimpl->error)
+            std::rethrow_exception(pimpl->error);
+
+        return Font_sys(pimpl->font);
+    }
+
+    void Font_sys::Async_load::then(std::function<void()> callback)
+    {
+        if(pimpl->done)
+            callback();
+        else
+            pimpl->callbacks.push_back(std::move(callback));
     }
 
     void Font_sys::resize(const unsigned int font_size)
@@ -321,308 +540,1560 @@ namespace textogl
     void Font_sys::Impl::resize(const unsigned int font_size)
     {
         // select font size
-        if(FT_Set_Pixel_Sizes(face_, 0, font_size) != FT_Err_Ok)
-            throw std::runtime_error("Can't set font size: " + std::to_string(font_size));
+        face_scale_ = set_face_size(face_, font_size);
+        font_size_ = font_size;
 
-        // get bounding box that will fit any glyph, plus 2 px padding
-        // some glyphs overflow the reported box (antialiasing?) so at least one px is needed
-        cell_bbox_.ul.x = FT_MulFix(face_->bbox.xMin, face_->size->metrics.x_scale) / 64 - 2;
-        cell_bbox_.ul.y = FT_MulFix(face_->bbox.yMax, face_->size->metrics.y_scale) / 64 + 2;
-        cell_bbox_.lr.x = FT_MulFix(face_->bbox.xMax, face_->size->metrics.x_scale) / 64 + 2;
-        cell_bbox_.lr.y = FT_MulFix(face_->bbox.yMin, face_->size->metrics.y_scale) / 64 - 2;
+        cell_bbox_ = face_cell_bbox(face_, face_scale_);
+
+        // fallback glyphs share the atlases, so cells need to fit them too
+        fallback_scales_ = size_faces(fallback_faces_, font_size);
+        for(std::size_t i = 0; i < fallback_faces_.size(); ++i)
+        {
+            auto bbox = face_cell_bbox(fallback_faces_[i], fallback_scales_[i]);
+            cell_bbox_.ul.x = std::min(cell_bbox_.ul.x, bbox.ul.x);
+            cell_bbox_.ul.y = std::max(cell_bbox_.ul.y, bbox.ul.y);
+            cell_bbox_.lr.x = std::max(cell_bbox_.lr.x, bbox.lr.x);
+            cell_bbox_.lr.y = std::min(cell_bbox_.lr.y, bbox.lr.y);
+        }
+
+        // room for styled quads to grow into, without reaching the next cell
+        cell_bbox_.ul.x -= style_padding_;
+        cell_bbox_.ul.y += style_padding_;
+        cell_bbox_.lr.x += style_padding_;
+        cell_bbox_.lr.y -= style_padding_;
 
         // get newline height
-        line_height_ = FT_MulFix(face_->height, face_->size->metrics.y_scale) / 64;
+        line_height_ = static_cast<int>(FT_MulFix(face_->height, face_->size->metrics.y_scale) / 64 * face_scale_);
 
         tex_width_ = cell_bbox_.width() * 16;
         tex_height_ = cell_bbox_.height() * 16;
 
         has_kerning_info_ = FT_HAS_KERNING(face_);
 
+#ifndef USE_OPENGL_ES
+        // reserved cells are about to be destroyed
+        cancel_uploads();
+#endif
+
+        for(auto & i: atlases_)
+        {
+            glDeleteTextures(1, &i.first);
+        }
+        atlases_.clear();
         page_map_.clear();
+        number_glyphs_.valid = false;
+        subpixel_glyphs_.clear();
+        atlas_memory_usage_ = 0;
+        ++layout_generation_;
+        ++resize_generation_;
+
+#ifdef TEXTOGL_USE_HARFBUZZ
+        resize_shaping();
+#endif
     }
 
-    void Font_sys::render_text(const std::string & utf8_input, const Color & color,
-            const Vec2<float> & win_size, const Vec2<float> & pos, const int align_flags)
+    float Font_sys::Impl::set_face_size(FT_Face face, const unsigned int font_size)
     {
-        pimpl->render_text(utf8_input, color, win_size, pos, 0.0f, align_flags);
+        if(!FT_IS_SCALABLE(face) && FT_HAS_FIXED_SIZES(face))
+        {
+            // pick the smallest strike at least as big as requested, or the biggest there is
+            const FT_Pos target = static_cast<FT_Pos>(font_size) * 64;
+            int best = 0;
+            for(int i = 1; i < face->num_fixed_sizes; ++i)
+            {
+                auto size = face->available_sizes[i].y_ppem;
+                auto best_size = face->available_sizes[best].y_ppem;
+                if((best_size < target && size > best_size) || (size >= target && size < best_size))
+                    best = i;
+            }
+
+            if(FT_Select_Size(face, best) != FT_Err_Ok)
+                throw std::runtime_error("Can't set font size: " + std::to_string(font_size));
+
+            return static_cast<float>(target) / face->available_sizes[best].y_ppem;
+        }
+
+        if(FT_Set_Pixel_Sizes(face, 0, font_size) != FT_Err_Ok)
+            throw std::runtime_error("Can't set font size: " + std::to_string(font_size));
+
+        return 1.0f;
     }
-    void Font_sys::render_text_rotate(const std::string & utf8_input, const Color & color,
-            const Vec2<float> & win_size, const Vec2<float> & pos, const float rotation,
-            const int align_flags)
+
+    Font_sys::Impl::Bbox<int> Font_sys::Impl::face_cell_bbox(FT_Face face, const float scale)
     {
-        pimpl->render_text(utf8_input, color, win_size, pos, rotation, align_flags);
+        // some glyphs overflow the reported box (antialiasing?) so at least one px is needed
+        Bbox<int> bbox;
+        bbox.ul.x = static_cast<int>(FT_MulFix(face->bbox.xMin, face->size->metrics.x_scale) / 64 * scale) - 2;
+        bbox.ul.y = static_cast<int>(FT_MulFix(face->bbox.yMax, face->size->metrics.y_scale) / 64 * scale) + 2;
+        bbox.lr.x = static_cast<int>(FT_MulFix(face->bbox.xMax, face->size->metrics.x_scale) / 64 * scale) + 2;
+        bbox.lr.y = static_cast<int>(FT_MulFix(face->bbox.yMin, face->size->metrics.y_scale) / 64 * scale) - 2;
+        return bbox;
     }
-    void Font_sys::Impl::render_text(const std::string & utf8_input, const Color & color,
-            const Vec2<float> & win_size, const Vec2<float> & pos, const float rotation,
-            const int align_flags)
-    {
-        // build text buffer objs
-        std::vector<Vec2<float>> coords;
-        std::vector<Font_sys::Impl::Coord_data> coord_data;
-        Font_sys::Impl::Bbox<float> text_box;
-        std::tie(coords, coord_data, text_box) = build_text(utf8_input);
 
-        load_text_vbo(coords);
-
-        render_text_common(color, win_size, pos, align_flags, rotation, text_box, coord_data,
-#ifndef USE_OPENGL_ES
-                    vao_,
-#endif
-                    vbo_);
+    void Font_sys::set_atlas_memory_limit(const std::size_t bytes)
+    {
+        pimpl->atlas_memory_limit_ = bytes;
     }
 
-    void Font_sys::Impl::render_text_common(const Color & color, const Vec2<float> & win_size,
-            const Vec2<float> & pos, const int align_flags, const float rotation,
-            const Bbox<float> & text_box, const std::vector<Coord_data> & coord_data,
-#ifndef USE_OPENGL_ES
-             GLuint vao,
-#endif
-             GLuint vbo)
+    std::size_t Font_sys::get_atlas_memory_usage() const
     {
-        Vec2<float> start_offset{0.0f, 0.0f};
+        return pimpl->atlas_memory_usage_;
+    }
 
-        // offset origin to align to text bounding box
-        int horiz_align = align_flags & 0x3;
-        switch(horiz_align)
+    Font_sys::Atlas_stats Font_sys::get_atlas_stats() const
+    {
+        Atlas_stats stats{pimpl->atlases_.size(), 0, 0, pimpl->atlas_memory_usage_, 0, 0};
+        for(auto & atlas: pimpl->atlases_)
         {
-            case ORIGIN_HORIZ_BASELINE:
-                break;
-            case ORIGIN_HORIZ_LEFT:
-                start_offset.x = text_box.ul.x;
-                break;
-            case ORIGIN_HORIZ_RIGHT:
-                start_offset.x = text_box.lr.x;
-                break;
-            case ORIGIN_HORIZ_CENTER:
-                start_offset.x = text_box.ul.x + text_box.width() / 2.0f;
-                break;
+            stats.num_glyphs += atlas.second.num_used();
+            stats.num_cells += atlas.second.cells.size();
         }
 
-        int vert_align = align_flags & 0xC;
-        switch(vert_align)
+        // variants are never color, so each takes a greyscale cell's share of its atlas
+        for(auto & glyph: pimpl->subpixel_glyphs_)
         {
-            case ORIGIN_VERT_BASELINE:
-                break;
-            case ORIGIN_VERT_TOP:
-                start_offset.y = text_box.ul.y;
-                break;
-            case ORIGIN_VERT_BOTTOM:
-                start_offset.y = text_box.lr.y;
-                break;
-            case ORIGIN_VERT_CENTER:
-                start_offset.y = text_box.lr.y + text_box.height() / 2.0f;
-                break;
+            if(glyph.second.tex != 0)
+                ++stats.num_subpixel_glyphs;
         }
+        stats.subpixel_memory_usage = stats.num_subpixel_glyphs * pimpl->atlas_size(false) / (16 * 16);
 
-        // this is the result of multiplying matrices as follows:
-        // projection(0, win_size.x, win_size.y, 0) * translate(pos) * rotate(rotation, {0,0,1}) * translate(-start_offset)
-        Mat4<float> model_view_projection
-        {
-            2.0f * std::cos(rotation) / win_size.x, -2.0f * std::sin(rotation) / win_size.y, 0.0f, 0.0f,
-           -2.0f * std::sin(rotation) / win_size.x, -2.0f * std::cos(rotation) / win_size.y, 0.0f, 0.0f,
-            0.0f,                                    0.0f,                                   1.0f, 0.0f,
-
-           -1.0f + 2.0f * (pos.x - std::cos(rotation) * start_offset.x + std::sin(rotation) * start_offset.y) / win_size.x,
-                        1.0f - 2.0f * (pos.y - std::sin(rotation) * start_offset.x - std::cos(rotation) * start_offset.y) / win_size.y,
-                        0.0f, 1.0f
-        };
-
-        render_text_common(color, model_view_projection, coord_data,
-#ifndef USE_OPENGL_ES
-                    vao,
-#endif
-                    vbo);
+        return stats;
     }
 
-    void Font_sys::render_text_mat(const std::string & utf8_input, const Color & color, const Mat4<float> & model_view_projection)
+    std::size_t Font_sys::get_memory_usage() const
     {
-        pimpl->render_text(utf8_input, color, model_view_projection);
+        return pimpl->resource_.bytes_in_use();
     }
-    void Font_sys::Impl::render_text(const std::string & utf8_input, const Color & color, const Mat4<float> & model_view_projection)
+
+    void Font_sys::end_frame()
     {
-        std::vector<Vec2<float>> coords;
-        std::vector<Font_sys::Impl::Coord_data> coord_data;
-        std::tie(coords, coord_data, std::ignore) = build_text(utf8_input);
+        pimpl->finish_preloads(false);
 
-        render_text_common(color, model_view_projection, coord_data,
-#ifndef USE_OPENGL_ES
-                    vao_,
-#endif
-                    vbo_);
+        ++pimpl->frame_;
+        pimpl->arena_.reset();
     }
 
-    void Font_sys::Impl::render_text_common(const Color & color, const Mat4<float> & model_view_projection,
-            const std::vector<Coord_data> & coord_data,
-#ifndef USE_OPENGL_ES
-             GLuint vao,
-#endif
-             GLuint vbo)
+    std::future<std::size_t> Font_sys::preload(const std::vector<Code_point_range> & ranges, const unsigned int num_threads)
     {
-        // save old settings
-#ifndef USE_OPENGL_ES
-        GLint old_vao{0};
-#endif
-        GLint old_vbo{0}, old_prog{0};
-        GLint old_blend_src{0}, old_blend_dst{0};
-        GLint old_active_texture{0}, old_texture_2d{0};
+        return pimpl->preload(expand_ranges(ranges), num_threads);
+    }
 
-#ifndef USE_OPENGL_ES
-        glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &old_vao);
-#endif
-        glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &old_vbo);
-        glGetIntegerv(GL_CURRENT_PROGRAM, &old_prog);
-        glGetIntegerv(GL_BLEND_SRC_RGB, &old_blend_src);
-        glGetIntegerv(GL_BLEND_DST_RGB, &old_blend_dst);
-        glGetIntegerv(GL_ACTIVE_TEXTURE, &old_active_texture);
-        glGetIntegerv(GL_TEXTURE_BINDING_2D, &old_texture_2d);
+    std::future<std::size_t> Font_sys::preload(const std::string & utf8_sample, const unsigned int num_threads)
+    {
+        Resource_vector<char32_t> utf32;
+        utf8_to_utf32(utf8_sample.data(), utf8_sample.size(), utf32);
 
-        auto old_depth_test = glIsEnabled(GL_DEPTH_TEST);
-        auto old_blend = glIsEnabled(GL_BLEND);
+        return pimpl->preload(std::vector<uint32_t>(utf32.begin(), utf32.end()), num_threads);
+    }
 
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    std::future<std::size_t> Font_sys::preload(const Glyph_set set, const unsigned int num_threads)
+    {
+        switch(set)
+        {
+            case GLYPHS_ASCII:
+                return preload(std::vector<Code_point_range>{{0x20, 0x7E}}, num_threads);
+            case GLYPHS_LATIN1:
+                return preload(std::vector<Code_point_range>{{0x20, 0x7E}, {0xA0, 0xFF}}, num_threads);
+            case GLYPHS_CJK_COMMON:
+                return preload(std::vector<Code_point_range>
+                {
+                    {0x3000, 0x303F}, // CJK Symbols and Punctuation
+                    {0x3040, 0x309F}, // Hiragana
+                    {0x30A0, 0x30FF}, // Katakana
+                    {0xFF00, 0xFFEF}, // Halfwidth and Fullwidth Forms
+                    {0x4E00, 0x9FFF}  // CJK Unified Ideographs
+                }, num_threads);
+            default:
+                throw std::invalid_argument("Unknown glyph set");
+        }
+    }
+
+    std::unique_ptr<Font_sys::Impl::Preload_job> Font_sys::Impl::create_preload_job(std::vector<uint32_t> code_pts)
+    {
+        // skip duplicates, newlines, and anything already loaded. the order
+        // is kept, so code points listed first are available first
+        std::unordered_set<uint32_t> seen;
+        code_pts.erase(std::remove_if(code_pts.begin(), code_pts.end(), [this, &seen](const uint32_t code_pt)
+                    {
+                        if(code_pt == '\n' || !seen.insert(code_pt).second)
+                            return true;
+
+                        auto page = page_map_.find(code_pt >> 8);
+                        return page != page_map_.end() && page->second.char_info[code_pt & 0xFF].tex != 0;
+                    }), code_pts.end());
+
+        std::unique_ptr<Preload_job> job(new Preload_job);
+        job->source = source_;
+        job->fallbacks = fallback_list_;
+        job->font_size = font_size_;
+        job->subpixel = subpixel_phases_ > 1;
+        job->cell_bbox = cell_bbox_;
+        job->resize_generation = resize_generation_;
+        job->code_pts = std::move(code_pts);
+
+        return job;
+    }
+
+    std::future<std::size_t> Font_sys::Impl::preload(std::vector<uint32_t> code_pts, unsigned int num_threads)
+    {
+        auto job = create_preload_job(std::move(code_pts));
+        auto future = job->promise.get_future();
+
+        if(job->code_pts.empty())
+        {
+            job->promise.set_value(0);
+            return future;
+        }
+
+        // no point in a thread for every handful of glyphs
+        if(num_threads == 0)
+            num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+        num_threads = std::min<std::size_t>(num_threads, (job->code_pts.size() + 63) / 64);
+
+        job->running = num_threads;
+        for(unsigned int i = 0; i < num_threads; ++i)
+        {
+            try
+            {
+                job->threads.emplace_back(preload_worker, std::ref(*job));
+            }
+            catch(std::system_error &)
+            {
+                // couldn't start a thread. make do with the ones we have
+                job->running -= num_threads - i;
+                if(i == 0)
+                    throw;
+                break;
+            }
+        }
+
+        preload_jobs_.push_back(std::move(job));
+        return future;
+    }
+
+    void Font_sys::Impl::preload_worker(Preload_job & job)
+    {
+        FT_Library lib = nullptr;
+        FT_Face face = nullptr;
+        std::vector<FT_Face> fallback_faces;
+        std::vector<Preloaded_glyph> glyphs;
+
+        try
+        {
+            // Freetype objects can't be shared between threads, so each worker gets its own
+            if(FT_Init_FreeType(&lib) != FT_Err_Ok)
+                throw std::runtime_error("Error initializing Freetype library");
+
+            face = open_face(lib, job.source);
+
+            auto scale = set_face_size(face, job.font_size);
+
+            fallback_faces = open_fallback_faces(lib, job.fallbacks.get());
+            auto fallback_scales = size_faces(fallback_faces, job.font_size);
+
+            rasterize_glyphs(face, scale, fallback_faces, fallback_scales, job, glyphs);
+        }
+        catch(...)
+        {
+            std::lock_guard<std::mutex> lock(job.mutex);
+            if(!job.error)
+                job.error = std::current_exception();
+        }
+
+        close_faces(fallback_faces);
+        if(face)
+            FT_Done_Face(face);
+        if(lib)
+            FT_Done_FreeType(lib);
+
+        {
+            std::lock_guard<std::mutex> lock(job.mutex);
+            std::move(glyphs.begin(), glyphs.end(), std::back_inserter(job.glyphs));
+        }
+
+        --job.running;
+    }
+
+    void Font_sys::Impl::rasterize_glyphs(FT_Face face, const float scale, const std::vector<FT_Face> & fallback_faces,
+            const std::vector<float> & fallback_scales, Preload_job & job, std::vector<Preloaded_glyph> & glyphs)
+    {
+        // claim code points in small batches so faster threads take on more of the work
+        const std::size_t batch_size = 32;
+        while(!job.cancel)
+        {
+            auto start = job.next.fetch_add(batch_size);
+            if(start >= job.code_pts.size())
+                break;
+
+            auto end = std::min(start + batch_size, job.code_pts.size());
+            for(auto i = start; i < end; ++i)
+            {
+                // skip code points no font has
+                unsigned int face_i;
+                FT_UInt glyph_i;
+                std::tie(face_i, glyph_i) = find_glyph(face, fallback_faces, job.fallbacks.get(), job.code_pts[i]);
+
+                FT_Face glyph_face = face_i == 0 ? face : fallback_faces[face_i - 1];
+                float glyph_scale = face_i == 0 ? scale : fallback_scales[face_i - 1];
+                if(glyph_i == 0 || FT_Load_Glyph(glyph_face, glyph_i, FT_LOAD_RENDER | FT_LOAD_COLOR | load_flags(job.subpixel)) != FT_Err_Ok)
+                    continue;
+
+                Preloaded_glyph glyph;
+                glyph.code_pt = job.code_pts[i];
+                set_metrics(glyph_face->glyph, glyph_i, glyph_scale, job.subpixel, glyph.info);
+                glyph.info.face_i = face_i;
+                glyph.cell_data = render_cell(glyph_face->glyph, job.cell_bbox, glyph_scale, nullptr);
+
+                glyphs.push_back(std::move(glyph));
+            }
+        }
+    }
+
+    void Font_sys::finish_preload()
+    {
+        pimpl->finish_preloads(true);
+    }
+    void Font_sys::Impl::finish_preloads(const bool wait)
+    {
+#ifndef USE_OPENGL_ES
+        finish_uploads(wait);
+#endif
+
+        for(auto job_i = preload_jobs_.begin(); job_i != preload_jobs_.end();)
+        {
+            auto & job = **job_i;
+
+            // workers add their glyphs before they stop running, so once this
+            // is true, there will be no more
+            bool done = wait || job.running == 0;
+            if(done)
+            {
+                // the job may still be waiting on uploads, having been joined already
+                for(auto & t: job.threads)
+                {
+                    if(t.joinable())
+                        t.join();
+                }
+            }
+
+            // take whatever is ready. upload it now, rather than waiting for
+            // the whole job, so the earliest code points are available first
+            std::vector<Preloaded_glyph> glyphs;
+            bool failed;
+            {
+                std::lock_guard<std::mutex> lock(job.mutex);
+                glyphs.swap(job.glyphs);
+                failed = static_cast<bool>(job.error);
+            }
+
+            // glyphs rendered before a resize are thrown out. any of the size, fallback chain,
+            // positioning mode, or style padding may have changed, and with them the cell size
+            if(!failed && job.resize_generation == resize_generation_ && !glyphs.empty())
+            {
+#ifndef USE_OPENGL_ES
+                // glyphs go to the upload thread, if it's running, rather than being uploaded here
+                std::unique_ptr<Upload_batch> batch;
+                if(upload_thread_.running())
+                {
+                    batch.reset(new Upload_batch(&resource_));
+                    batch->cell_width = job.cell_bbox.width();
+                    batch->cell_height = job.cell_bbox.height();
+                    batch->job = &job;
+                }
+#endif
+                try
+                {
+                    for(auto & glyph: glyphs)
+                    {
+                        Char_info & c = page_map_[glyph.code_pt >> 8].char_info[glyph.code_pt & 0xFF];
+
+                        // may have been loaded since the preload started
+                        if(c.tex != 0)
+                            continue;
+
+#ifndef USE_OPENGL_ES
+                        // color glyphs go to a different kind of atlas, so are always uploaded here
+                        if(batch && !glyph.info.color)
+                        {
+                            // reserve a cell now. the glyph becomes resident once the upload finishes
+                            Upload_batch::Region region{glyph.code_pt, glyph.info, 0, 0};
+                            std::tie(region.tex, region.cell) = alloc_cell();
+                            batch->regions.push_back(region);
+                            batch->data.insert(batch->data.end(), glyph.cell_data.begin(), glyph.cell_data.end());
+                            continue;
+                        }
+#endif
+
+                        c.advance = glyph.info.advance;
+                        c.bbox = glyph.info.bbox;
+                        c.glyph_i = glyph.info.glyph_i;
+                        c.face_i = glyph.info.face_i;
+                        c.color = glyph.info.color;
+                        c.loaded = true;
+                        c.last_frame = frame_;
+
+                        store_glyph(c, glyph.cell_data);
+                        ++job.num_loaded;
+                    }
+
+                    update_mipmaps();
+
+#ifndef USE_OPENGL_ES
+                    // the job isn't finished until its uploads are
+                    if(batch && !batch->regions.empty())
+                    {
+                        uploads_.push_back(std::move(batch));
+                        ++job.pending_uploads;
+                        upload_thread_.submit(*uploads_.back());
+                    }
+#endif
+                }
+                catch(...)
+                {
+#ifndef USE_OPENGL_ES
+                    if(batch)
+                    {
+                        for(auto & region: batch->regions)
+                            atlases_.at(region.tex).free_cells.push_back(region.cell);
+                    }
+#endif
+                    std::lock_guard<std::mutex> lock(job.mutex);
+                    job.error = std::current_exception();
+                    failed = true;
+                }
+            }
+
+            // stop the workers if anything went wrong
+            if(failed && !done)
+            {
+                job.cancel = true;
+                ++job_i;
+                continue;
+            }
+
+            if(!done)
+            {
+                ++job_i;
+                continue;
+            }
+
+#ifndef USE_OPENGL_ES
+            if(job.pending_uploads > 0)
+            {
+                if(wait)
+                {
+                    // the job's last batch was just submitted
+                    finish_uploads(true);
+                }
+                else
+                {
+                    ++job_i;
+                    continue;
+                }
+            }
+#endif
+
+            if(job.error)
+                job.promise.set_exception(job.error);
+            else
+                job.promise.set_value(job.num_loaded);
+
+            job_i = preload_jobs_.erase(job_i);
+        }
+    }
+
+#ifndef USE_OPENGL_ES
+    void Font_sys::Impl::finish_uploads(const bool wait)
+    {
+        bool applied = false;
+        for(auto batch_i = uploads_.begin(); batch_i != uploads_.end();)
+        {
+            auto & batch = **batch_i;
+
+            if(wait)
+                upload_thread_.wait(batch);
+            else if(!upload_thread_.done(batch))
+            {
+                ++batch_i;
+                continue;
+            }
+
+            // the upload thread has issued its commands. check that the GPU has finished them, without blocking unless asked to
+            if(batch.fence)
+            {
+                GLenum status = glClientWaitSync(batch.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? GL_TIMEOUT_IGNORED : 0);
+                if(status == GL_TIMEOUT_EXPIRED)
+                {
+                    ++batch_i;
+                    continue;
+                }
+                glDeleteSync(batch.fence);
+            }
+
+            const std::size_t cell_size = batch.cell_width * batch.cell_height;
+            for(std::size_t i = 0; i < batch.regions.size(); ++i)
+            {
+                auto & region = batch.regions[i];
+                Char_info & c = page_map_[region.code_pt >> 8].char_info[region.code_pt & 0xFF];
+                Atlas & atlas = atlases_.at(region.tex);
+
+                // loaded on demand while the upload was in progress. release the reserved cell
+                if(c.tex != 0)
+                {
+                    atlas.free_cells.push_back(region.cell);
+                    continue;
+                }
+
+                // the upload thread couldn't copy this batch. upload it from here instead
+                if(batch.failed)
+                    upload_cell(region.tex, region.cell, batch.data.data() + i * cell_size);
+
+                c.advance = region.info.advance;
+                c.bbox = region.info.bbox;
+                c.glyph_i = region.info.glyph_i;
+                c.face_i = region.info.face_i;
+                c.color = region.info.color;
+                c.loaded = true;
+                c.last_frame = frame_;
+                c.tex = region.tex;
+                c.cell = region.cell;
+
+                atlas.cells[c.cell] = &c;
+                atlas.dirty = true;
+
+                ++batch.job->num_loaded;
+            }
+
+            --batch.job->pending_uploads;
+            applied = true;
+
+            batch_i = uploads_.erase(batch_i);
+        }
+
+        if(applied)
+            update_mipmaps();
+    }
+
+    void Font_sys::Impl::cancel_uploads()
+    {
+        for(auto & batch: uploads_)
+        {
+            upload_thread_.cancel(*batch);
+            if(batch->fence)
+                glDeleteSync(batch->fence);
+
+            --batch->job->pending_uploads;
+        }
+        uploads_.clear();
+    }
+#endif
+
+    void Font_sys::record_usage(const bool enable)
+    {
+        pimpl->record_usage_ = enable;
+    }
+
+    std::string Font_sys::Impl::font_id() const
+    {
+        return std::string(face_->family_name ? face_->family_name : "") + '\t'
+            + (face_->style_name ? face_->style_name : "") + '\t'
+            + std::to_string(face_->num_glyphs);
+    }
+
+    void Font_sys::save_usage_profile(const std::string & path) const
+    {
+        std::ofstream profile(path);
+        if(!profile)
+            throw std::ios_base::failure("Could not open usage profile for writing: " + path);
+
+        profile<<"textogl usage profile 1\n"
+               <<"font\t"<<pimpl->font_id()<<'\n'
+               <<"size\t"<<pimpl->font_size_<<'\n';
+
+        // resizing forgets what was recorded, so skip any repeats that caused
+        std::unordered_set<uint32_t> seen;
+        profile<<std::hex;
+        for(auto code_pt: pimpl->usage_)
+        {
+            if(seen.insert(code_pt).second)
+                profile<<code_pt<<'\n';
+        }
+
+        if(!profile)
+            throw std::ios_base::failure("Error writing usage profile: " + path);
+    }
+
+    std::future<std::size_t> Font_sys::preload_usage_profile(const std::string & path, const unsigned int num_threads)
+    {
+        std::vector<uint32_t> code_pts;
+
+        // any problem with the profile just means nothing to preload
+        std::ifstream profile(path);
+        std::string line;
+        if(std::getline(profile, line) && line == "textogl usage profile 1"
+                && std::getline(profile, line) && line == "font\t" + pimpl->font_id()
+                && std::getline(profile, line) && line.compare(0, 5, "size\t") == 0)
+        {
+            uint32_t code_pt;
+            while(profile>>std::hex>>code_pt)
+                code_pts.push_back(code_pt);
+        }
+
+        return pimpl->preload(std::move(code_pts), num_threads);
+    }
+
+    void Font_sys::render_text(const std::string & utf8_input, const Color & color,
+            const Vec2<float> & win_size, const Vec2<float> & pos, const int align_flags)
+    {
+        pimpl->render_text(utf8_input, color, win_size, pos, 0.0f, align_flags);
+    }
+    void Font_sys::render_text_rotate(const std::string & utf8_input, const Color & color,
+            const Vec2<float> & win_size, const Vec2<float> & pos, const float rotation,
+            const int align_flags)
+    {
+        pimpl->render_text(utf8_input, color, win_size, pos, rotation, align_flags);
+    }
+    void Font_sys::Impl::render_text(const std::string & utf8_input, const Color & color,
+            const Vec2<float> & win_size, const Vec2<float> & pos, const float rotation,
+            const int align_flags)
+    {
+        // build text buffer objs
+        Arena::Scope scope(arena_);
+        Text_layout layout(&arena_);
+        build_text(utf8_input, layout);
+
+        load_text_vbo(layout.coords);
+
+        render_text_common(color, win_size, pos, align_flags, rotation, layout.text_box, layout.coord_data,
+#ifndef USE_OPENGL_ES
+                    vao_, context_,
+#endif
+                    vbo_);
+    }
+
+    Vec2<float> Font_sys::Impl::align_offset(const int align_flags, const Bbox<float> & text_box)
+    {
+        Vec2<float> start_offset{0.0f, 0.0f};
+
+        // offset origin to align to text bounding box
+        int horiz_align = align_flags & 0x3;
+        switch(horiz_align)
+        {
+            case ORIGIN_HORIZ_BASELINE:
+                break;
+            case ORIGIN_HORIZ_LEFT:
+                start_offset.x = text_box.ul.x;
+                break;
+            case ORIGIN_HORIZ_RIGHT:
+                start_offset.x = text_box.lr.x;
+                break;
+            case ORIGIN_HORIZ_CENTER:
+                start_offset.x = text_box.ul.x + text_box.width() / 2.0f;
+                break;
+        }
+
+        int vert_align = align_flags & 0xC;
+        switch(vert_align)
+        {
+            case ORIGIN_VERT_BASELINE:
+                break;
+            case ORIGIN_VERT_TOP:
+                start_offset.y = text_box.ul.y;
+                break;
+            case ORIGIN_VERT_BOTTOM:
+                start_offset.y = text_box.lr.y;
+                break;
+            case ORIGIN_VERT_CENTER:
+                start_offset.y = text_box.lr.y + text_box.height() / 2.0f;
+                break;
+        }
+
+        return start_offset;
+    }
+
+    void Font_sys::Impl::render_text_common(const Color & color, const Vec2<float> & win_size,
+            const Vec2<float> & pos, const int align_flags, const float rotation,
+            const Bbox<float> & text_box, const Resource_vector<Coord_data> & coord_data,
+#ifndef USE_OPENGL_ES
+             GLuint vao, Font_sys::Context_handle vao_context,
+#endif
+             GLuint vbo, const Effect_draw * effect, const Text_style * style, const Blend blend)
+    {
+        Vec2<float> start_offset = align_offset(align_flags, text_box);
+
+        // this is the result of multiplying matrices as follows:
+        // projection(0, win_size.x, win_size.y, 0) * translate(pos) * rotate(rotation, {0,0,1}) * translate(-start_offset)
+        Mat4<float> model_view_projection
+        {
+            2.0f * std::cos(rotation) / win_size.x, -2.0f * std::sin(rotation) / win_size.y, 0.0f, 0.0f,
+           -2.0f * std::sin(rotation) / win_size.x, -2.0f * std::cos(rotation) / win_size.y, 0.0f, 0.0f,
+            0.0f,                                    0.0f,                                   1.0f, 0.0f,
+
+           -1.0f + 2.0f * (pos.x - std::cos(rotation) * start_offset.x + std::sin(rotation) * start_offset.y) / win_size.x,
+                        1.0f - 2.0f * (pos.y - std::sin(rotation) * start_offset.x - std::cos(rotation) * start_offset.y) / win_size.y,
+                        0.0f, 1.0f
+        };
+
+        render_text_common(color, model_view_projection, coord_data,
+#ifndef USE_OPENGL_ES
+                    vao, vao_context,
+#endif
+                    vbo, effect, style, blend);
+    }
+
+    void Font_sys::render_text_mat(const std::string & utf8_input, const Color & color, const Mat4<float> & model_view_projection)
+    {
+        pimpl->render_text(utf8_input, color, model_view_projection);
+    }
+    void Font_sys::Impl::render_text(const std::string & utf8_input, const Color & color, const Mat4<float> & model_view_projection)
+    {
+        Arena::Scope scope(arena_);
+        Text_layout layout(&arena_);
+        build_text(utf8_input, layout);
+
+        load_text_vbo(layout.coords);
+
+        render_text_common(color, model_view_projection, layout.coord_data,
+#ifndef USE_OPENGL_ES
+                    vao_, context_,
+#endif
+                    vbo_);
+    }
+
+    std::size_t vertex_size(const Vertex_format format)
+    {
+        switch(format)
+        {
+            case VERTEX_POS2F_UV2F:
+                return 4 * sizeof(float);
+            case VERTEX_POS2F_UV2F_ATLAS:
+                return 4 * sizeof(float) + sizeof(uint32_t);
+            case VERTEX_POS2F_UV2US:
+                return 2 * sizeof(float) + 2 * sizeof(uint16_t);
+            case VERTEX_POS2F_UV2US_ATLAS:
+                return 2 * sizeof(float) + 2 * sizeof(uint16_t) + sizeof(uint32_t);
+            default:
+                throw std::invalid_argument("Unknown vertex format");
+        }
+    }
+
+    std::size_t Font_sys::layout_text(const std::string & utf8_input, const Vertex_format format, Vertex_sink & sink,
+            const int align_flags)
+    {
+        return pimpl->layout_text(utf8_input, format, sink, align_flags);
+    }
+    std::size_t Font_sys::Impl::layout_text(const std::string & utf8_input, const Vertex_format format, Vertex_sink & sink,
+            const int align_flags)
+    {
+        auto size = vertex_size(format);
+
+        Arena::Scope scope(arena_);
+        Text_layout layout(&arena_);
+        build_text(utf8_input, layout);
+
+        auto offset = align_offset(align_flags, layout.text_box);
+
+        // one scratch buffer, big enough for the largest range
+        std::size_t max_range = 0;
+        for(const auto & cd: layout.coord_data)
+            max_range = std::max(max_range, cd.num_elements);
+
+        Resource_vector<unsigned char> vertices(max_range * size, 0, &arena_);
+
+        std::size_t num_vertices = 0;
+        for(const auto & cd: layout.coord_data)
+        {
+            write_vertices(layout, cd, format, offset, vertices.data());
+            sink.write(cd.tex, vertices.data(), cd.num_elements);
+            num_vertices += cd.num_elements;
+        }
+
+        return num_vertices;
+    }
+
+    std::size_t Font_sys::layout_text(const std::string & utf8_input, const Vertex_format format, void * buffer,
+            const std::size_t buffer_size, std::vector<Vertex_range> & ranges, const int align_flags)
+    {
+        return pimpl->layout_text(utf8_input, format, buffer, buffer_size, ranges, align_flags);
+    }
+    std::size_t Font_sys::Impl::layout_text(const std::string & utf8_input, const Vertex_format format, void * buffer,
+            const std::size_t buffer_size, std::vector<Vertex_range> & ranges, const int align_flags)
+    {
+        auto size = vertex_size(format);
+
+        Arena::Scope scope(arena_);
+        Text_layout layout(&arena_);
+        build_text(utf8_input, layout);
+
+        std::size_t num_vertices = layout.coords.size() / 2;
+
+        ranges.clear();
+        if(!buffer || num_vertices * size > buffer_size)
+            return num_vertices;
+
+        auto offset = align_offset(align_flags, layout.text_box);
+
+        auto out = static_cast<unsigned char *>(buffer);
+        for(const auto & cd: layout.coord_data)
+        {
+            write_vertices(layout, cd, format, offset, out + cd.start * size);
+            ranges.push_back({cd.tex, cd.start, cd.num_elements, cd.color});
+        }
+
+        return num_vertices;
+    }
+
+    void Font_sys::Impl::write_vertices(const Text_layout & layout, const Coord_data & range, const Vertex_format format,
+            const Vec2<float> & offset, unsigned char * out) const
+    {
+        // memcpy each field, as the destination may not be aligned
+        for(std::size_t i = range.start; i < range.start + range.num_elements; ++i)
+        {
+            float pos[2] = {layout.coords[2 * i].x - offset.x, layout.coords[2 * i].y - offset.y};
+            const Vec2<float> & uv = layout.coords[2 * i + 1];
+
+            std::memcpy(out, pos, sizeof(pos));
+            out += sizeof(pos);
+
+            if(format == VERTEX_POS2F_UV2F || format == VERTEX_POS2F_UV2F_ATLAS)
+            {
+                float uv_f[2] = {uv.x, uv.y};
+                std::memcpy(out, uv_f, sizeof(uv_f));
+                out += sizeof(uv_f);
+            }
+            else
+            {
+                uint16_t uv_us[2] =
+                {
+                    static_cast<uint16_t>(std::lround(uv.x * std::numeric_limits<uint16_t>::max())),
+                    static_cast<uint16_t>(std::lround(uv.y * std::numeric_limits<uint16_t>::max()))
+                };
+                std::memcpy(out, uv_us, sizeof(uv_us));
+                out += sizeof(uv_us);
+            }
+
+            if(format == VERTEX_POS2F_UV2F_ATLAS || format == VERTEX_POS2F_UV2US_ATLAS)
+            {
+                uint32_t tex = range.tex;
+                std::memcpy(out, &tex, sizeof(tex));
+                out += sizeof(tex);
+            }
+        }
+    }
+
+    std::vector<unsigned int> Font_sys::get_atlas_textures() const
+    {
+        std::vector<unsigned int> textures;
+        textures.reserve(pimpl->atlases_.size());
+        for(const auto & i: pimpl->atlases_)
+            textures.push_back(i.first);
+        return textures;
+    }
+
+    bool Font_sys::is_color_atlas(const unsigned int atlas_texture) const
+    {
+        auto atlas = pimpl->atlases_.find(atlas_texture);
+        return atlas != pimpl->atlases_.end() && atlas->second.color;
+    }
+
+    std::size_t Font_sys::get_atlas_generation() const
+    {
+        return pimpl->layout_generation_;
+    }
+
+    void Font_sys::Impl::bind_vertex_array(
+#ifndef USE_OPENGL_ES
+            GLuint vao, Font_sys::Context_handle vao_context,
+#endif
+            GLuint vbo) const
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+#ifndef USE_OPENGL_ES
+        if(vao_context == current_context_)
+        {
+            glBindVertexArray(vao);
+            return;
+        }
+
+        // VAOs aren't shared, so use the current context's, and point it at this buffer
+        glBindVertexArray(common().vao);
+#endif
+
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(Vec2<float>), NULL);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(Vec2<float>), (const GLvoid *)sizeof(Vec2<float>));
+        glEnableVertexAttribArray(1);
+    }
+
+    void Font_sys::Impl::render_text_common(const Color & color, const Mat4<float> & model_view_projection,
+            const Resource_vector<Coord_data> & coord_data,
+#ifndef USE_OPENGL_ES
+             GLuint vao, Font_sys::Context_handle vao_context,
+#endif
+             GLuint vbo, const Effect_draw * effect, const Text_style * style, const Blend blend)
+    {
+        // save old settings
+#ifndef USE_OPENGL_ES
+        GLint old_vao{0};
+#endif
+        GLint old_vbo{0}, old_prog{0};
+        GLint old_blend_src{0}, old_blend_dst{0};
+        GLint old_blend_src_alpha{0}, old_blend_dst_alpha{0};
+        GLint old_active_texture{0}, old_texture_2d{0};
+
+#ifndef USE_OPENGL_ES
+        glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &old_vao);
+#endif
+        glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &old_vbo);
+        glGetIntegerv(GL_CURRENT_PROGRAM, &old_prog);
+        glGetIntegerv(GL_BLEND_SRC_RGB, &old_blend_src);
+        glGetIntegerv(GL_BLEND_DST_RGB, &old_blend_dst);
+        glGetIntegerv(GL_BLEND_SRC_ALPHA, &old_blend_src_alpha);
+        glGetIntegerv(GL_BLEND_DST_ALPHA, &old_blend_dst_alpha);
+        glGetIntegerv(GL_ACTIVE_TEXTURE, &old_active_texture);
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &old_texture_2d);
+
+        auto old_depth_test = glIsEnabled(GL_DEPTH_TEST);
+        auto old_blend = glIsEnabled(GL_BLEND);
+
+        bind_vertex_array(
+#ifndef USE_OPENGL_ES
+                vao, vao_context,
+#endif
+                vbo);
+
+        // set up shader uniforms
+        auto & common_data = common();
+        GLint model_view_projection_uniform = common_data.model_view_projection_uniform;
+        GLint color_glyphs_uniform = common_data.color_glyphs_uniform;
+        if(effect)
+        {
+            model_view_projection_uniform = effect->program.model_view_projection;
+            color_glyphs_uniform = effect->program.color_glyphs;
+
+            glUseProgram(effect->program.prog);
+            glUniform4fv(effect->program.color, 1, &color[0]);
+            glUniform1f(effect->program.time, effect->time);
+            glUniform4fv(effect->program.params, 1, &effect->params[0]);
+
+            // glyph and line indexes come from their own buffer
+            glBindBuffer(GL_ARRAY_BUFFER, effect->glyph_ids_vbo);
+            glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_FALSE, 0, NULL);
+            glEnableVertexAttribArray(2);
+        }
+        else if(style)
+        {
+            common_data.init_style();
+            auto & uniforms = common_data.style_uniforms;
+            model_view_projection_uniform = uniforms.model_view_projection;
+            color_glyphs_uniform = uniforms.color_glyphs;
+
+            glUseProgram(common_data.style_prog);
+            glUniform4fv(uniforms.color, 1, &color[0]);
+            glUniform2f(uniforms.texel_size, 1.0f / tex_width_, 1.0f / tex_height_);
+            glUniform4fv(uniforms.outline_color, 1, &style->outline_color[0]);
+            glUniform1f(uniforms.outline_width, style->outline_width);
+            glUniform4fv(uniforms.shadow_color, 1, &style->shadow_color[0]);
+            glUniform2fv(uniforms.shadow_offset, 1, &style->shadow_offset[0]);
+            glUniform1f(uniforms.shadow_softness, style->shadow_softness);
+            glUniform4fv(uniforms.glow_color, 1, &style->glow_color[0]);
+            glUniform1f(uniforms.glow_radius, style->glow_radius);
+        }
+        else
+        {
+            glUseProgram(common_data.prog);
+            glUniform4fv(common_data.color_uniform, 1, &color[0]);
+        }
+        glUniformMatrix4fv(model_view_projection_uniform, 1, GL_FALSE, &model_view_projection[0][0]);
+        glUniform1i(color_glyphs_uniform, GL_FALSE);
+
+        glDisable(GL_DEPTH_TEST);
+        glEnable(GL_BLEND);
+        switch(blend)
+        {
+            case Blend::STRAIGHT:
+                glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                break;
+            case Blend::TO_PREMULTIPLIED:
+                // alpha accumulates as coverage instead of being scaled by itself
+                glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+                break;
+            case Blend::PREMULTIPLIED:
+                glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+                break;
+        }
+        glActiveTexture(GL_TEXTURE0 + max_tu_count_);
+
+        // draw text, per atlas. color atlases only need a uniform changed, so mixed text is still one draw per atlas
+        bool color_glyphs = false;
+        Vec2<float> offset{0.0f, 0.0f};
+        for(const auto & cd: coord_data)
+        {
+            if(cd.color != color_glyphs)
+            {
+                color_glyphs = cd.color;
+                glUniform1i(color_glyphs_uniform, color_glyphs);
+            }
+
+            // offset ranges get the matrix multiplied by a translation
+            if(cd.offset.x != offset.x || cd.offset.y != offset.y)
+            {
+                offset = cd.offset;
+
+                auto offset_mvp = model_view_projection;
+                for(int i = 0; i < 4; ++i)
+                    offset_mvp[3][i] += model_view_projection[0][i] * offset.x + model_view_projection[1][i] * offset.y;
+
+                glUniformMatrix4fv(model_view_projection_uniform, 1, GL_FALSE, &offset_mvp[0][0]);
+            }
+
+            // bind the atlas texture
+            glBindTexture(GL_TEXTURE_2D, cd.tex);
+            glDrawArrays(GL_TRIANGLES, cd.start, cd.num_elements);
+        }
+
+        // the plain shader doesn't read attribute 2, so leave it off for the next draw
+        if(effect)
+            glDisableVertexAttribArray(2);
+
+        // restore old settings
+#ifndef USE_OPENGL_ES
+        glBindVertexArray(old_vao);
+#endif
+        glBindBuffer(GL_ARRAY_BUFFER, old_vbo);
+        glUseProgram(old_prog);
+
+        if(old_depth_test)
+            glEnable(GL_DEPTH_TEST);
+        else
+            glDisable(GL_DEPTH_TEST);
+
+        if(old_blend)
+            glEnable(GL_BLEND);
+        else
+            glDisable(GL_BLEND);
+
+        glBlendFuncSeparate(old_blend_src, old_blend_dst, old_blend_src_alpha, old_blend_dst_alpha);
+        glActiveTexture(old_active_texture);
+        glBindTexture(GL_TEXTURE_2D, old_texture_2d);
+    }
+
+    Font_sys::Impl::Char_info & Font_sys::Impl::use_glyph(const uint32_t code_pt, Resource_vector<Char_info *> * glyphs)
+    {
+        // get font page struct, creating if needed
+        return use_glyph(page_map_[code_pt >> 8].char_info[code_pt & 0xFF], code_pt, glyphs);
+    }
+
+    Font_sys::Impl::Char_info & Font_sys::Impl::use_glyph(Char_info & c, const uint32_t code_pt, Resource_vector<Char_info *> * glyphs)
+    {
+        if(glyphs && c.last_op != op_)
+            glyphs->push_back(&c);
+
+        c.last_frame = frame_;
+        c.last_op = op_;
+
+        if(record_usage_ && !c.recorded)
+        {
+            c.recorded = true;
+            usage_.push_back(code_pt);
+        }
+
+        // render glyph if not already in an atlas
+        if(c.tex == 0 && !c.failed)
+            load_glyph(code_pt, c);
+
+        return c;
+    }
+
+    bool Font_sys::Impl::use_glyphs(const Resource_vector<Char_info *> & glyphs, const std::size_t generation)
+    {
+        if(generation != layout_generation_)
+            return false;
+
+        ++op_;
+        for(auto & c: glyphs)
+        {
+            c->last_frame = frame_;
+            c->last_op = op_;
+        }
+
+        return true;
+    }
+
+    void Font_sys::Impl::load_glyph(const uint32_t code_pt, Char_info & c)
+    {
+        // find the font that has the glyph
+        FT_UInt glyph_i;
+        std::tie(c.face_i, glyph_i) = find_glyph(face_, fallback_faces_, fallback_list_.get(), code_pt);
+
+        FT_Face face = face_for(c.face_i);
+        FT_GlyphSlot slot = face->glyph;
+
+        // have freetype render the glyph
+        if(FT_Load_Glyph(face, glyph_i, FT_LOAD_RENDER | FT_LOAD_COLOR | load_flags(subpixel_phases_ > 1)) != FT_Err_Ok)
+        {
+            std::cerr<<"Err loading glyph for: "<<std::hex<<std::showbase<<code_pt<<std::dec<<std::noshowbase<<std::endl;
+            c.failed = true;
+            return;
+        }
+
+        set_metrics(slot, glyph_i, scale_for(c.face_i), subpixel_phases_ > 1, c);
+        store_glyph(c, render_cell(slot, cell_bbox_, scale_for(c.face_i), &resource_));
+    }
+
+    Font_sys::Impl::Bbox<int> Font_sys::Impl::bitmap_box(const FT_GlyphSlot slot, const float scale)
+    {
+        const FT_Bitmap * bmp = &slot->bitmap;
+
+        Bbox<int> box;
+        box.ul.x = slot->bitmap_left;
+        box.ul.y = slot->bitmap_top;
+        box.lr.x = (int)bmp->width + slot->bitmap_left;
+        box.lr.y = slot->bitmap_top - (int)bmp->rows;
+
+        // round outward, so the scaled bitmap covers all of the original
+        if(scale != 1.0f)
+        {
+            box.ul.x = static_cast<int>(std::floor(box.ul.x * scale));
+            box.ul.y = static_cast<int>(std::ceil(box.ul.y * scale));
+            box.lr.x = static_cast<int>(std::ceil(box.lr.x * scale));
+            box.lr.y = static_cast<int>(std::floor(box.lr.y * scale));
+        }
+
+        return box;
+    }
+
+    void Font_sys::Impl::set_metrics(const FT_GlyphSlot slot, const FT_UInt glyph_i, const float scale, const bool subpixel, Char_info & c)
+    {
+        // set glyph properties. the linear advance is 16.16, not 26.6
+        c.bbox = bitmap_box(slot, scale);
+        c.advance.x = static_cast<int>(subpixel ? std::lround(slot->linearHoriAdvance * scale / 1024.0f) : std::lround(slot->advance.x * scale));
+        c.advance.y = static_cast<int>(std::lround(slot->advance.y * scale));
+        c.glyph_i = glyph_i;
+        c.color = slot->bitmap.pixel_mode == FT_PIXEL_MODE_BGRA;
+        c.loaded = true;
+    }
+
+    void Font_sys::Impl::store_glyph(Char_info & c, const Resource_vector<unsigned char> & cell_data)
+    {
+        std::tie(c.tex, c.cell) = alloc_cell(c.color);
+        Atlas & atlas = atlases_.at(c.tex);
+        atlas.cells[c.cell] = &c;
+        atlas.dirty = true;
+
+        upload_cell(c.tex, c.cell, cell_data.data());
+    }
+
+    Resource_vector<unsigned char> Font_sys::Impl::render_cell(const FT_GlyphSlot slot, const Bbox<int> & cell_bbox, const float scale, Memory_resource * resource)
+    {
+        const FT_Bitmap * bmp = &slot->bitmap;
+
+        // copy glyph from freetype to cell-sized texture storage
+        // TODO: only FT_PIXEL_MODE_GRAY and FT_PIXEL_MODE_BGRA are handled.
+        // We will probably want to allow other formats at some point
+        const bool color = bmp->pixel_mode == FT_PIXEL_MODE_BGRA;
+        const std::size_t channels = color ? 4 : 1;
+
+        Resource_vector<unsigned char> cell_data(cell_bbox.width() * cell_bbox.height() * channels, 0, resource);
+
+        auto box = bitmap_box(slot, scale);
+        for(long y = 0; y < box.height(); ++y)
+        {
+            for(long x = 0; x < box.width(); ++x)
+            {
+                long cell_y = cell_bbox.ul.y - box.ul.y + y;
+                long cell_x = -cell_bbox.ul.x + box.ul.x + x;
+
+                // some glyphs overflow the font's bbox. clip them to the cell
+                if(cell_y < 0 || cell_y >= cell_bbox.height() || cell_x < 0 || cell_x >= cell_bbox.width())
+                    continue;
+
+                // source pixels covered by this one. just the one unless scaling
+                long src_y0 = y, src_y1 = y + 1, src_x0 = x, src_x1 = x + 1;
+                if(scale != 1.0f)
+                {
+                    src_y0 = static_cast<long>(std::floor(slot->bitmap_top - (box.ul.y - y) / scale));
+                    src_y1 = static_cast<long>(std::ceil(slot->bitmap_top - (box.ul.y - y - 1) / scale));
+                    src_x0 = static_cast<long>(std::floor((box.ul.x + x) / scale - slot->bitmap_left));
+                    src_x1 = static_cast<long>(std::ceil((box.ul.x + x + 1) / scale - slot->bitmap_left));
+                }
+
+                // box filter. color bitmaps are premultiplied, so this is fine for them too
+                unsigned int sum[4] = {0, 0, 0, 0};
+                for(long src_y = std::max(src_y0, 0L); src_y < std::min<long>(src_y1, bmp->rows); ++src_y)
+                {
+                    for(long src_x = std::max(src_x0, 0L); src_x < std::min<long>(src_x1, bmp->width); ++src_x)
+                    {
+                        const unsigned char * src = bmp->buffer + src_y * bmp->pitch + src_x * channels;
+                        for(std::size_t i = 0; i < channels; ++i)
+                            sum[i] += src[i];
+                    }
+                }
+                unsigned int area = static_cast<unsigned int>((src_y1 - src_y0) * (src_x1 - src_x0));
+
+                unsigned char * dst = &cell_data[(cell_y * cell_bbox.width() + cell_x) * channels];
+                if(!color)
+                {
+                    dst[0] = static_cast<unsigned char>(sum[0] / area);
+                    continue;
+                }
+
+                // BGRA, premultiplied, to RGBA with straight alpha, to blend the same as greyscale glyphs
+                unsigned int alpha = sum[3] / area;
+                if(alpha == 0)
+                    continue;
+
+                dst[0] = static_cast<unsigned char>(std::min(sum[2] / area * 255 / alpha, 255u));
+                dst[1] = static_cast<unsigned char>(std::min(sum[1] / area * 255 / alpha, 255u));
+                dst[2] = static_cast<unsigned char>(std::min(sum[0] / area * 255 / alpha, 255u));
+                dst[3] = static_cast<unsigned char>(alpha);
+            }
+        }
+
+        return cell_data;
+    }
+
+    void Font_sys::Impl::upload_cell(const GLuint tex, const std::size_t cell, const unsigned char * cell_data)
+    {
+        GLint old_unpack_alignment{0};
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &old_unpack_alignment);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, tex);
+#ifndef USE_OPENGL_ES
+        GLenum format = atlases_.at(tex).color ? GL_RGBA : GL_RED;
+#else
+        GLenum format = atlases_.at(tex).color ? GL_RGBA : GL_ALPHA;
+#endif
+        glTexSubImage2D(GL_TEXTURE_2D, 0, (cell % 16) * cell_bbox_.width(), (cell / 16) * cell_bbox_.height(),
+                cell_bbox_.width(), cell_bbox_.height(), format, GL_UNSIGNED_BYTE, cell_data);
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, old_unpack_alignment);
+    }
+
+    std::pair<GLuint, std::size_t> Font_sys::Impl::alloc_cell(const bool color)
+    {
+        for(int attempt = 0; ; ++attempt)
+        {
+            // pack into the fullest atlas of the right kind that still has room
+            auto best = atlases_.end();
+            for(auto atlas_i = atlases_.begin(); atlas_i != atlases_.end(); ++atlas_i)
+            {
+                if(atlas_i->second.color == color && !atlas_i->second.free_cells.empty() &&
+                        (best == atlases_.end() || atlas_i->second.num_used() > best->second.num_used()))
+                {
+                    best = atlas_i;
+                }
+            }
+
+            // no room anywhere. make a new atlas if within budget, otherwise evict and try again
+            if(best == atlases_.end())
+            {
+                if(attempt == 0 && atlas_memory_limit_ != 0 && atlas_memory_usage_ + atlas_size(color) > atlas_memory_limit_ && evict_glyphs())
+                    continue;
+
+                best = create_atlas(color);
+            }
+
+            std::size_t cell = best->second.free_cells.back();
+            best->second.free_cells.pop_back();
+            return {best->first, cell};
+        }
+    }
+
+    void Font_sys::Impl::free_cell(Char_info & c)
+    {
+        Atlas & atlas = atlases_.at(c.tex);
+        atlas.cells[c.cell] = nullptr;
+        atlas.free_cells.push_back(c.cell);
+
+        c.tex = 0;
+        c.cell = 0;
+    }
+
+    Resource_map<GLuint, Font_sys::Impl::Atlas>::iterator Font_sys::Impl::create_atlas(const bool color)
+    {
+        GLuint tex;
+        glGenTextures(1, &tex);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, tex);
+
+        // start with a blank texture. glyphs are copied in as they are used
+        Resource_vector<unsigned char> tex_data(tex_width_ * tex_height_ * (color ? 4 : 1), 0, &resource_);
+
+        GLint old_unpack_alignment{0};
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &old_unpack_alignment);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 #ifndef USE_OPENGL_ES
-        glBindVertexArray(vao);
+        if(color)
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, tex_width_, tex_height_, 0, GL_RGBA, GL_UNSIGNED_BYTE, tex_data.data());
+        else
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, tex_width_, tex_height_, 0, GL_RED, GL_UNSIGNED_BYTE, tex_data.data());
 #else
-
-        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(Vec2<float>), NULL);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(Vec2<float>), (const GLvoid *)sizeof(Vec2<float>));
-        glEnableVertexAttribArray(1);
+        if(color)
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex_width_, tex_height_, 0, GL_RGBA, GL_UNSIGNED_BYTE, tex_data.data());
+        else
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, tex_width_, tex_height_, 0, GL_ALPHA, GL_UNSIGNED_BYTE, tex_data.data());
 #endif
+        glPixelStorei(GL_UNPACK_ALIGNMENT, old_unpack_alignment);
 
-        // set up shader uniforms
-        glUseProgram(common_data_->prog);
-        glUniformMatrix4fv(common_data_->uniform_locations["model_view_projection"], 1, GL_FALSE, &model_view_projection[0][0]);
-        glUniform4fv(common_data_->uniform_locations["color"], 1, &color[0]);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        // set params
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-        glDisable(GL_DEPTH_TEST);
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-        glActiveTexture(GL_TEXTURE0 + max_tu_count_);
+        atlas_memory_usage_ += atlas_size(color);
 
-        // draw text, per page
-        for(const auto & cd: coord_data)
+        Atlas atlas(&resource_);
+        atlas.color = color;
+        atlas.cells.resize(16 * 16, nullptr);
+
+        // fill free list so that cells are used in order
+        for(std::size_t i = atlas.cells.size(); i-- > 0;)
+            atlas.free_cells.push_back(i);
+
+        return atlases_.emplace(tex, std::move(atlas)).first;
+    }
+
+    bool Font_sys::Impl::evict_glyphs()
+    {
+        Arena::Scope scope(arena_);
+
+        // collect glyphs that may be freed
+        Resource_vector<Char_info *> candidates(&arena_);
+        for(auto & atlas: atlases_)
         {
-            // bind the page's texture
-            glBindTexture(GL_TEXTURE_2D, page_map_[cd.page_no].tex);
-            glDrawArrays(GL_TRIANGLES, cd.start, cd.num_elements);
+            for(auto & c: atlas.second.cells)
+            {
+                if(c && c->last_op != op_)
+                    candidates.push_back(c);
+            }
         }
 
-        // restore old settings
+        if(candidates.empty())
+            return false;
+
+        // free the oldest 1/8th of them at once, so we aren't doing this for every new glyph
+        auto num_evict = std::max<std::size_t>(candidates.size() / 8, 1);
+        std::partial_sort(candidates.begin(), candidates.begin() + num_evict, candidates.end(),
+                [](const Char_info * a, const Char_info * b)
+                {
+                    return std::tie(a->last_frame, a->last_op) < std::tie(b->last_frame, b->last_op);
+                });
+
+        for(std::size_t i = 0; i < num_evict; ++i)
+            free_cell(*candidates[i]);
+
+        ++layout_generation_;
+
+        return true;
+    }
+
+    void Font_sys::Impl::move_glyph(Char_info & c, const GLuint dst_tex, const std::size_t dst_cell)
+    {
+        GLint src_x = (c.cell % 16) * cell_bbox_.width();
+        GLint src_y = (c.cell / 16) * cell_bbox_.height();
+        GLint dst_x = (dst_cell % 16) * cell_bbox_.width();
+        GLint dst_y = (dst_cell / 16) * cell_bbox_.height();
+
 #ifndef USE_OPENGL_ES
-        glBindVertexArray(old_vao);
+        if(common().has_copy_image)
+        {
+            glCopyImageSubData(c.tex, GL_TEXTURE_2D, 0, src_x, src_y, 0,
+                    dst_tex, GL_TEXTURE_2D, 0, dst_x, dst_y, 0,
+                    cell_bbox_.width(), cell_bbox_.height(), 1);
+        }
+        else
+        {
+            // fall back to blitting between framebuffers
+            GLint old_read_fbo{0}, old_draw_fbo{0};
+            glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &old_read_fbo);
+            glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &old_draw_fbo);
+
+            GLuint fbos[2];
+            glGenFramebuffers(2, fbos);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, fbos[0]);
+            glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, c.tex, 0);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbos[1]);
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, dst_tex, 0);
+
+            glBlitFramebuffer(src_x, src_y, src_x + cell_bbox_.width(), src_y + cell_bbox_.height(),
+                    dst_x, dst_y, dst_x + cell_bbox_.width(), dst_y + cell_bbox_.height(),
+                    GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, old_read_fbo);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, old_draw_fbo);
+            glDeleteFramebuffers(2, fbos);
+        }
+#else
+        // no GPU-side copies for alpha textures in ES 2.0. Render the glyph again instead (below)
+        (void)src_x; (void)src_y; (void)dst_x; (void)dst_y;
 #endif
-        glBindBuffer(GL_ARRAY_BUFFER, old_vbo);
-        glUseProgram(old_prog);
 
-        if(old_depth_test)
-            glEnable(GL_DEPTH_TEST);
-        else
-            glDisable(GL_DEPTH_TEST);
+        Atlas & dst_atlas = atlases_.at(dst_tex);
+        auto free_i = std::find(dst_atlas.free_cells.begin(), dst_atlas.free_cells.end(), dst_cell);
+        dst_atlas.free_cells.erase(free_i);
+        dst_atlas.cells[dst_cell] = &c;
+        dst_atlas.dirty = true;
+
+        free_cell(c);
+        c.tex = dst_tex;
+        c.cell = dst_cell;
+
+#ifdef USE_OPENGL_ES
+        FT_Face face = face_for(c.face_i);
+        if(c.phase != 0 ? render_subpixel(face, c.glyph_i, c.phase)
+                : FT_Load_Glyph(face, c.glyph_i, FT_LOAD_RENDER | FT_LOAD_COLOR | load_flags(subpixel_phases_ > 1)) == FT_Err_Ok)
+            upload_cell(dst_tex, dst_cell, render_cell(face->glyph, cell_bbox_, scale_for(c.face_i), &resource_).data());
+#endif
+    }
 
-        if(old_blend)
-            glEnable(GL_BLEND);
-        else
-            glDisable(GL_BLEND);
+    void Font_sys::Impl::update_mipmaps()
+    {
+        for(auto & atlas: atlases_)
+        {
+            if(atlas.second.dirty)
+            {
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, atlas.first);
+                glGenerateMipmap(GL_TEXTURE_2D);
+                atlas.second.dirty = false;
+            }
+        }
+    }
 
-        glBlendFunc(old_blend_src, old_blend_dst);
-        glActiveTexture(old_active_texture);
-        glBindTexture(GL_TEXTURE_2D, old_texture_2d);
+    Vec2<float> Font_sys::Impl::cell_origin(const std::size_t cell) const
+    {
+        return {(float)((cell % 16) * cell_bbox_.width() - cell_bbox_.ul.x),
+            (float)((cell / 16) * cell_bbox_.height() + cell_bbox_.ul.y)};
     }
 
-    std::unordered_map<uint32_t, Font_sys::Impl::Page>::iterator Font_sys::Impl::load_page(const uint32_t page_no)
+    std::size_t Font_sys::Impl::atlas_size(const bool color) const
     {
-        // this assumes the page has not been created yet
-        auto page_i = page_map_.emplace(std::make_pair(page_no, Page())).first;
-        Page & page = page_i->second;
+        // sum up all mipmap levels
+        std::size_t size = 0;
+        for(std::size_t w = tex_width_, h = tex_height_;; w = std::max<std::size_t>(w / 2, 1), h = std::max<std::size_t>(h / 2, 1))
+        {
+            size += w * h;
+            if(w == 1 && h == 1)
+                break;
+        }
+        return color ? size * 4 : size;
+    }
 
-        // greyscale pixel storage
-        std::vector<char> tex_data(tex_width_ * tex_height_, 0);
+    bool Font_sys::compact_atlas(const std::chrono::microseconds & budget)
+    {
+        return pimpl->compact_atlas(budget);
+    }
+    bool Font_sys::Impl::compact_atlas(const std::chrono::microseconds & budget)
+    {
+#ifndef USE_OPENGL_ES
+        // reserved cells can't be moved. try again once the uploads are done
+        if(!uploads_.empty())
+            return false;
+#endif
 
-        FT_GlyphSlot slot = face_->glyph;
+        auto start_time = std::chrono::steady_clock::now();
+        bool done = false;
 
-        // load each glyph in the page (256 per page)
-        for(uint32_t code_pt = page_no << 8; code_pt < ((page_no + 1) << 8); code_pt++)
+        while(true)
         {
-            unsigned short tbl_row = (code_pt >> 4) & 0xF;
-            unsigned short tbl_col = code_pt & 0xF;
+            // free any empty atlases
+            for(auto atlas_i = atlases_.begin(); atlas_i != atlases_.end();)
+            {
+                if(atlas_i->second.num_used() == 0)
+                {
+                    glDeleteTextures(1, &atlas_i->first);
+                    atlas_memory_usage_ -= atlas_size(atlas_i->second.color);
+                    atlas_i = atlases_.erase(atlas_i);
+                }
+                else
+                    ++atlas_i;
+            }
 
-            // have freetype render the glyph
-            FT_UInt glyph_i = FT_Get_Char_Index(face_, code_pt);
-            if(FT_Load_Glyph(face_, glyph_i, FT_LOAD_RENDER) != FT_Err_Ok)
+            // stop when the glyphs can't fit into any fewer atlases. greyscale and color glyphs are packed separately
+            std::size_t num_glyphs[2] = {0, 0}, num_atlases[2] = {0, 0};
+            for(auto & atlas: atlases_)
             {
-                std::cerr<<"Err loading glyph for: "<<std::hex<<std::showbase<<code_pt;
-                continue;
+                num_glyphs[atlas.second.color] += atlas.second.num_used();
+                ++num_atlases[atlas.second.color];
             }
 
-            FT_Bitmap * bmp = &slot->bitmap;
-            Char_info & c = page.char_info[code_pt & 0xFF];
+            bool color = num_atlases[1] > (num_glyphs[1] + 16 * 16 - 1) / (16 * 16);
+            if(!color && num_atlases[0] <= (num_glyphs[0] + 16 * 16 - 1) / (16 * 16))
+            {
+                done = true;
+                break;
+            }
 
-            // set glyph properties
-            c.origin.x = -cell_bbox_.ul.x + slot->bitmap_left;
-            c.origin.y = cell_bbox_.ul.y - slot->bitmap_top;
-            c.bbox.ul.x = slot->bitmap_left;
-            c.bbox.ul.y = slot->bitmap_top;
-            c.bbox.lr.x = (int)bmp->width + slot->bitmap_left;
-            c.bbox.lr.y = slot->bitmap_top - (int)bmp->rows;
-            c.advance.x = slot->advance.x;
-            c.advance.y = slot->advance.y;
-            c.glyph_i = glyph_i;
+            if(std::chrono::steady_clock::now() - start_time >= budget)
+                break;
 
-            // copy glyph from freetype to texture storage
-            // TODO: we are assuming bmp->pixel_mode == FT_PIXEL_MODE_GRAY here.
-            // We will probably want to allow other formats at some point
-            for(std::size_t y = 0; y < (std::size_t)bmp->rows; ++y)
+            // empty out the emptiest atlas into the fullest of the same kind that has room
+            auto src = atlases_.end(), dst = atlases_.end();
+            for(auto atlas_i = atlases_.begin(); atlas_i != atlases_.end(); ++atlas_i)
+            {
+                if(atlas_i->second.color == color && (src == atlases_.end() || atlas_i->second.num_used() < src->second.num_used()))
+                    src = atlas_i;
+            }
+            for(auto atlas_i = atlases_.begin(); atlas_i != atlases_.end(); ++atlas_i)
             {
-                for(std::size_t x = 0; x < (std::size_t)bmp->width; ++x)
+                if(atlas_i != src && atlas_i->second.color == color && !atlas_i->second.free_cells.empty() &&
+                        (dst == atlases_.end() || atlas_i->second.num_used() > dst->second.num_used()))
                 {
-                    long tbl_img_y = tbl_row * cell_bbox_.height() + cell_bbox_.ul.y - slot->bitmap_top + y;
-                    long tbl_img_x = tbl_col * cell_bbox_.width() - cell_bbox_.ul.x + slot->bitmap_left + x;
-
-                    tex_data[tbl_img_y * tex_width_ + tbl_img_x] = bmp->buffer[y * bmp->width + x];
+                    dst = atlas_i;
                 }
             }
-        }
 
-        // copy data to a new opengl texture
-        glGenTextures(1, &page.tex);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, page.tex);
-#ifndef USE_OPENGL_ES
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, tex_width_, tex_height_, 0, GL_RED, GL_UNSIGNED_BYTE, tex_data.data());
-#else
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, tex_width_, tex_height_, 0, GL_ALPHA, GL_UNSIGNED_BYTE, tex_data.data());
-#endif
+            auto glyph = std::find_if(src->second.cells.begin(), src->second.cells.end(), [](const Char_info * c){ return c != nullptr; });
 
-        glGenerateMipmap(GL_TEXTURE_2D);
-        // set params
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            move_glyph(**glyph, dst->first, dst->second.free_cells.back());
+            ++layout_generation_;
+        }
 
-        return page_i;
+        update_mipmaps();
+
+        return done;
     }
 
-    std::tuple<std::vector<Vec2<float>>, std::vector<Font_sys::Impl::Coord_data>, Font_sys::Impl::Bbox<float>>
-    Font_sys::Impl::build_text(const std::string & utf8_input)
+    void Font_sys::Impl::build_text(const char * utf8_input, const std::size_t utf8_size, Text_layout & layout)
     {
+#ifdef TEXTOGL_USE_HARFBUZZ
+        if(needs_shaping(utf8_input, utf8_size))
+        {
+            build_shaped_text(utf8_input, utf8_size, layout);
+            return;
+        }
+#endif
+
         Vec2<float> pen{0.0f, 0.0f};
 
-        // verts by font page
-        std::unordered_map<uint32_t, std::vector<Vec2<float>>> screen_and_tex_coords;
+        // verts for each glyph, and the atlas texture each glyph is in
+        Resource_vector<Vec2<float>> screen_and_tex_coords(&arena_);
+        Resource_vector<GLuint> quad_tex(&arena_);
+        Resource_vector<GLushort> quad_ids(&arena_);
 
-        Bbox<float> font_box;
+        // every glyph used, for Static_text to keep them resident
+        layout.glyphs.clear();
 
-        font_box.ul.x = std::numeric_limits<float>::max();
-        font_box.ul.y = std::numeric_limits<float>::max();
-        font_box.lr.x = std::numeric_limits<float>::min();
-        font_box.lr.y = std::numeric_limits<float>::min();
+        init_text_box(layout.text_box);
 
         FT_UInt prev_glyph_i = 0;
+        unsigned int prev_face_i = 0;
+
+        ++op_;
 
-        for(auto & code_pt : utf8_to_utf32(utf8_input))
+        Resource_vector<char32_t> utf32(&arena_);
+        utf8_to_utf32(utf8_input, utf8_size, utf32);
+
+        screen_and_tex_coords.reserve(utf32.size() * 12);
+        quad_tex.reserve(utf32.size());
+
+        std::size_t glyph = 0, line = 0;
+        for(auto & code_pt : utf32)
         {
             // handle newlines
             if(code_pt == '\n')
@@ -630,115 +2101,462 @@ namespace textogl
                 pen.x = 0;
                 pen.y += line_height_;
                 prev_glyph_i = 0;
+                ++line;
                 continue;
             }
 
-            // get font page struct
-            uint32_t page_no = code_pt >> 8;
-            auto page_i = page_map_.find(page_no);
+            auto glyph_index = glyph++;
 
-            // load page if not already loaded
-            if(page_i == page_map_.end())
-            {
-                page_i = load_page(code_pt >> 8);
-            }
+            // get glyph info, loading if needed
+            Font_sys::Impl::Char_info & c = use_glyph(code_pt, &layout.glyphs);
 
-            Font_sys::Impl::Page & page = page_i->second;
-            Font_sys::Impl::Char_info & c = page.char_info[code_pt & 0xFF];
+            if(c.tex == 0)
+                continue;
 
-            // add kerning if necessary
-            if(has_kerning_info_ && prev_glyph_i && c.glyph_i)
+            // add kerning if necessary. only between glyphs from the same face
+            if(prev_glyph_i && c.glyph_i && c.face_i == prev_face_i
+                    && (c.face_i == 0 ? has_kerning_info_ : FT_HAS_KERNING(face_for(c.face_i))))
             {
-                FT_Vector kerning = {0, 0};
-                if(FT_Get_Kerning(face_, prev_glyph_i, c.glyph_i, FT_KERNING_DEFAULT, &kerning) != FT_Err_Ok)
-                {
-                    std::cerr<<"Can't load kerning for: "<<std::hex<<std::showbase<<code_pt;
-                }
-                pen.x += kerning.x / 64.0f;
-                pen.y -= kerning.y / 64.0f;
-            }
-
-            std::size_t tex_row = (code_pt >> 4) & 0xF;
-            std::size_t tex_col = code_pt & 0xF;
-
-            // texture coord of glyph's origin
-            Vec2<float> tex_origin = {(float)(tex_col * cell_bbox_.width() - cell_bbox_.ul.x),
-                (float)(tex_row * cell_bbox_.height() + cell_bbox_.ul.y)};
-
-            // push back vertex coords, and texture coords, interleaved, into a map by font page
-            // 1 unit to pixel scale
-            // lower left corner
-            screen_and_tex_coords[page_no].push_back({pen.x + c.bbox.ul.x,
-                    pen.y - c.bbox.lr.y});
-            screen_and_tex_coords[page_no].push_back({(tex_origin.x + c.bbox.ul.x) / tex_width_,
-                    (tex_origin.y - c.bbox.lr.y) / tex_height_});
-            // lower right corner
-            screen_and_tex_coords[page_no].push_back({pen.x + c.bbox.lr.x,
-                    pen.y - c.bbox.lr.y});
-            screen_and_tex_coords[page_no].push_back({(tex_origin.x + c.bbox.lr.x) / tex_width_,
-                    (tex_origin.y - c.bbox.lr.y) / tex_height_});
-            // upper left corner
-            screen_and_tex_coords[page_no].push_back({pen.x + c.bbox.ul.x,
-                    pen.y - c.bbox.ul.y});
-            screen_and_tex_coords[page_no].push_back({(tex_origin.x + c.bbox.ul.x) / tex_width_,
-                    (tex_origin.y - c.bbox.ul.y) / tex_height_});
-
-            // upper left corner
-            screen_and_tex_coords[page_no].push_back({pen.x + c.bbox.ul.x,
-                    pen.y - c.bbox.ul.y});
-            screen_and_tex_coords[page_no].push_back({(tex_origin.x + c.bbox.ul.x) / tex_width_,
-                    (tex_origin.y - c.bbox.ul.y) / tex_height_});
-            // lower right corner
-            screen_and_tex_coords[page_no].push_back({pen.x + c.bbox.lr.x,
-                    pen.y - c.bbox.lr.y});
-            screen_and_tex_coords[page_no].push_back({(tex_origin.x + c.bbox.lr.x) / tex_width_,
-                    (tex_origin.y - c.bbox.lr.y) / tex_height_});
-            // upper right corner
-            screen_and_tex_coords[page_no].push_back({pen.x + c.bbox.lr.x,
-                    pen.y - c.bbox.ul.y});
-            screen_and_tex_coords[page_no].push_back({(tex_origin.x + c.bbox.lr.x) / tex_width_,
-                    (tex_origin.y - c.bbox.ul.y) / tex_height_});
-
-            // expand bounding box for whole string
-            font_box.ul.x = std::min(font_box.ul.x, pen.x + c.bbox.ul.x);
-            font_box.ul.y = std::min(font_box.ul.y, pen.y - c.bbox.ul.y);
-            font_box.lr.x = std::max(font_box.lr.x, pen.x + c.bbox.lr.x);
-            font_box.lr.y = std::max(font_box.lr.y, pen.y - c.bbox.lr.y);
+                auto kern = kerning(face_for(c.face_i), prev_glyph_i, c.glyph_i, subpixel_phases_ > 1);
+                pen.x += kern.x;
+                pen.y += kern.y;
+            }
+
+            auto quad_pen = pen;
+            add_quad(place_glyph(c, code_pt, false, quad_pen, &layout.glyphs), quad_pen, screen_and_tex_coords, quad_tex, layout.text_box, layout.padding);
+            if(layout.want_glyph_ids)
+                add_quad_ids(glyph_index, line, quad_ids);
 
             // advance to next origin
             pen.x += c.advance.x / 64.0f;
             pen.y -= c.advance.y / 64.0f;
 
             prev_glyph_i = c.glyph_i;
+            prev_face_i = c.face_i;
         }
 
-        // reorganize texture data into a contiguous array
-        std::vector<Vec2<float>> coords;
-        std::vector<Font_sys::Impl::Coord_data> coord_data;
+        layout.pen = pen;
+
+        group_quads(screen_and_tex_coords, quad_tex, layout, &quad_ids);
+    }
+
+    void Font_sys::Impl::build_text(const std::vector<Glyph_position> & positions, Text_layout & layout)
+    {
+        Resource_vector<Vec2<float>> screen_and_tex_coords(&arena_);
+        Resource_vector<GLuint> quad_tex(&arena_);
+        Resource_vector<GLushort> quad_ids(&arena_);
+
+        layout.glyphs.clear();
+
+        init_text_box(layout.text_box);
+        layout.pen = Vec2<float>{0.0f, 0.0f};
+
+        ++op_;
 
+        screen_and_tex_coords.reserve(positions.size() * 12);
+        quad_tex.reserve(positions.size());
 
-        for(const auto & page: screen_and_tex_coords)
+        // positions are already laid out. just get the glyphs into atlases
+        for(std::size_t i = 0; i < positions.size(); ++i)
         {
-            coord_data.emplace_back();
-            Font_sys::Impl::Coord_data & c = coord_data.back();
+            auto & position = positions[i];
+            Font_sys::Impl::Char_info & c = use_glyph(position.code_pt, &layout.glyphs);
 
-            c.page_no = page.first;
+            if(c.tex == 0)
+                continue;
+
+            auto quad_pen = position.pen;
+            add_quad(place_glyph(c, position.code_pt, false, quad_pen, &layout.glyphs), quad_pen, screen_and_tex_coords, quad_tex, layout.text_box, layout.padding);
 
-            c.start = coords.size() / 2;
-            coords.insert(coords.end(), page.second.begin(), page.second.end());
-            c.num_elements = coords.size() / 2 - c.start;
+            // newlines aren't in positions, so the line is recovered from the pen's height
+            if(layout.want_glyph_ids)
+                add_quad_ids(i, static_cast<std::size_t>(std::max(std::round(position.pen.y / line_height_), 0.0f)), quad_ids);
         }
 
-        return std::make_tuple(coords, coord_data, font_box);
+        group_quads(screen_and_tex_coords, quad_tex, layout, &quad_ids);
     }
 
-    void Font_sys::Impl::load_text_vbo(const std::vector<Vec2<float>> & coords) const
+    void Font_sys::Impl::init_text_box(Bbox<float> & text_box)
     {
-        glBindBuffer(GL_ARRAY_BUFFER, vbo_);
-#ifndef USE_OPENGL_ES
-        glBindVertexArray(vao_);
+        text_box.ul.x = std::numeric_limits<float>::max();
+        text_box.ul.y = std::numeric_limits<float>::max();
+        text_box.lr.x = std::numeric_limits<float>::min();
+        text_box.lr.y = std::numeric_limits<float>::min();
+    }
+
+    Vec2<float> Font_sys::Impl::kerning(FT_Face face, const FT_UInt prev_glyph_i, const FT_UInt glyph_i, const bool subpixel)
+    {
+        FT_Vector kerning = {0, 0};
+        if(FT_Get_Kerning(face, prev_glyph_i, glyph_i, subpixel ? FT_KERNING_UNFITTED : FT_KERNING_DEFAULT, &kerning) != FT_Err_Ok)
+        {
+            std::cerr<<"Can't load kerning for glyph: "<<glyph_i;
+        }
+        return {kerning.x / 64.0f, -kerning.y / 64.0f};
+    }
+
+    void Font_sys::Impl::add_quad(const Char_info & c, const Vec2<float> & pen, Resource_vector<Vec2<float>> & screen_and_tex_coords,
+            Resource_vector<GLuint> & quad_tex, Bbox<float> & font_box, const int padding) const
+    {
+        // texture coord of glyph's origin
+        Vec2<float> tex_origin = cell_origin(c.cell);
+
+        // padding spreads into the empty space around the glyph in its cell
+        Bbox<int> quad = c.bbox;
+        quad.ul.x -= padding;
+        quad.ul.y += padding;
+        quad.lr.x += padding;
+        quad.lr.y -= padding;
+
+        // push back vertex coords, and texture coords, interleaved
+        // 1 unit to pixel scale
+        // lower left corner
+        screen_and_tex_coords.push_back({pen.x + quad.ul.x,
+                pen.y - quad.lr.y});
+        screen_and_tex_coords.push_back({(tex_origin.x + quad.ul.x) / tex_width_,
+                (tex_origin.y - quad.lr.y) / tex_height_});
+        // lower right corner
+        screen_and_tex_coords.push_back({pen.x + quad.lr.x,
+                pen.y - quad.lr.y});
+        screen_and_tex_coords.push_back({(tex_origin.x + quad.lr.x) / tex_width_,
+                (tex_origin.y - quad.lr.y) / tex_height_});
+        // upper left corner
+        screen_and_tex_coords.push_back({pen.x + quad.ul.x,
+                pen.y - quad.ul.y});
+        screen_and_tex_coords.push_back({(tex_origin.x + quad.ul.x) / tex_width_,
+                (tex_origin.y - quad.ul.y) / tex_height_});
+
+        // upper left corner
+        screen_and_tex_coords.push_back({pen.x + quad.ul.x,
+                pen.y - quad.ul.y});
+        screen_and_tex_coords.push_back({(tex_origin.x + quad.ul.x) / tex_width_,
+                (tex_origin.y - quad.ul.y) / tex_height_});
+        // lower right corner
+        screen_and_tex_coords.push_back({pen.x + quad.lr.x,
+                pen.y - quad.lr.y});
+        screen_and_tex_coords.push_back({(tex_origin.x + quad.lr.x) / tex_width_,
+                (tex_origin.y - quad.lr.y) / tex_height_});
+        // upper right corner
+        screen_and_tex_coords.push_back({pen.x + quad.lr.x,
+                pen.y - quad.ul.y});
+        screen_and_tex_coords.push_back({(tex_origin.x + quad.lr.x) / tex_width_,
+                (tex_origin.y - quad.ul.y) / tex_height_});
+
+        quad_tex.push_back(c.tex);
+
+        // expand bounding box for whole string
+        font_box.ul.x = std::min(font_box.ul.x, pen.x + c.bbox.ul.x);
+        font_box.ul.y = std::min(font_box.ul.y, pen.y - c.bbox.ul.y);
+        font_box.lr.x = std::max(font_box.lr.x, pen.x + c.bbox.lr.x);
+        font_box.lr.y = std::max(font_box.lr.y, pen.y - c.bbox.lr.y);
+    }
+
+    void Font_sys::Impl::add_quad_ids(const std::size_t glyph, const std::size_t line, Resource_vector<GLushort> & quad_ids)
+    {
+        quad_ids.push_back(static_cast<GLushort>(std::min<std::size_t>(glyph, std::numeric_limits<GLushort>::max())));
+        quad_ids.push_back(static_cast<GLushort>(std::min<std::size_t>(line, std::numeric_limits<GLushort>::max())));
+    }
+
+    void Font_sys::Impl::group_quads(const Resource_vector<Vec2<float>> & screen_and_tex_coords, const Resource_vector<GLuint> & quad_tex,
+            Text_layout & layout, const Resource_vector<GLushort> * quad_ids)
+    {
+        // reorganize texture data into a contiguous array, grouped by atlas
+        layout.coords.clear();
+        layout.coords.reserve(screen_and_tex_coords.size());
+        layout.coord_data.clear();
+
+        // indexes are stored per vertex, so follow the same order
+        const bool ids = layout.want_glyph_ids && quad_ids;
+        layout.glyph_ids.clear();
+        if(ids)
+            layout.glyph_ids.reserve(quad_tex.size() * 12);
+
+        for(std::size_t i = 0; i < quad_tex.size(); ++i)
+        {
+            // skip atlases we've already gathered
+            if(std::find_if(layout.coord_data.begin(), layout.coord_data.end(),
+                        [&](const Coord_data & cd){ return cd.tex == quad_tex[i]; }) != layout.coord_data.end())
+            {
+                continue;
+            }
+
+            layout.coord_data.emplace_back();
+            Font_sys::Impl::Coord_data & c = layout.coord_data.back();
+
+            c.tex = quad_tex[i];
+            c.color = atlases_.at(c.tex).color;
+
+            c.start = layout.coords.size() / 2;
+            for(std::size_t j = i; j < quad_tex.size(); ++j)
+            {
+                if(quad_tex[j] == c.tex)
+                {
+                    layout.coords.insert(layout.coords.end(), screen_and_tex_coords.begin() + j * 12, screen_and_tex_coords.begin() + (j + 1) * 12);
+
+                    if(ids)
+                    {
+                        for(int k = 0; k < 6; ++k)
+                            layout.glyph_ids.insert(layout.glyph_ids.end(), quad_ids->begin() + j * 2, quad_ids->begin() + (j + 1) * 2);
+                    }
+                }
+            }
+            c.num_elements = layout.coords.size() / 2 - c.start;
+        }
+
+        update_mipmaps();
+    }
+
+    void Font_sys::Impl::layout_async(std::shared_ptr<Async_layout> layout)
+    {
+#ifdef TEXTOGL_USE_HARFBUZZ
+        // workers only do per code point layout. leaving font_size at 0 has
+        // Static_text::commit build shaped text itself
+        if(needs_shaping(layout->text.data(), layout->text.size()))
+        {
+            layout->promise.set_value();
+            return;
+        }
 #endif
 
+        std::lock_guard<std::mutex> lock(layout_mutex_);
+
+        layout_queue_.push_back(std::move(layout));
+
+        // start workers as needed, up to the limit
+        if(layout_threads_.size() < max_layout_threads_ && layout_queue_.size() > layout_idle_)
+            layout_threads_.emplace_back(&Impl::layout_worker, this);
+
+        layout_cv_.notify_one();
+    }
+
+    void Font_sys::set_layout_threads(const unsigned int num_threads)
+    {
+        std::lock_guard<std::mutex> lock(pimpl->layout_mutex_);
+        pimpl->max_layout_threads_ = std::max(num_threads, 1u);
+    }
+
+    Font_sys::Impl::Metrics_cache::Metrics_cache(const unsigned int font_size, const unsigned int subpixel_phases,
+            std::shared_ptr<const Fallback_list> fallbacks):
+        font_size(font_size),
+        subpixel_phases(subpixel_phases),
+        fallbacks(std::move(fallbacks)),
+        pages_(new std::atomic<Page *>[num_pages]())
+    {}
+
+    Font_sys::Impl::Metrics_cache::~Metrics_cache()
+    {
+        for(std::size_t i = 0; i < num_pages; ++i)
+            delete pages_[i].load(std::memory_order_relaxed);
+    }
+
+    const Font_sys::Impl::Metrics_cache::Metrics * Font_sys::Impl::Metrics_cache::find(const uint32_t code_pt) const
+    {
+        if(code_pt >= num_pages * 256)
+            return nullptr;
+
+        // pages and entries are never changed once published, so a reader only needs to see the publication
+        const Page * page = pages_[code_pt >> 8].load(std::memory_order_acquire);
+        if(!page)
+            return nullptr;
+
+        const Entry & entry = page->entries[code_pt & 0xFF];
+        if(!entry.published.load(std::memory_order_acquire))
+            return nullptr;
+
+        return &entry.metrics;
+    }
+
+    const Font_sys::Impl::Metrics_cache::Metrics * Font_sys::Impl::Metrics_cache::insert(const uint32_t code_pt, const Metrics & metrics)
+    {
+        if(code_pt >= num_pages * 256)
+            return nullptr;
+
+        std::lock_guard<std::mutex> lock(write_mutex_);
+
+        Page * page = pages_[code_pt >> 8].load(std::memory_order_relaxed);
+        if(!page)
+        {
+            page = new Page;
+            pages_[code_pt >> 8].store(page, std::memory_order_release);
+        }
+
+        // another thread may have missed on the same glyph. the first one wins
+        Entry & entry = page->entries[code_pt & 0xFF];
+        if(!entry.published.load(std::memory_order_relaxed))
+        {
+            entry.metrics = metrics;
+            entry.published.store(true, std::memory_order_release);
+        }
+
+        return &entry.metrics;
+    }
+
+    void Font_sys::Impl::layout_worker()
+    {
+        // the worker has its own face, so it never touches face_
+        FT_Library lib = nullptr;
+        FT_Face face = nullptr;
+        unsigned int face_size = 0;
+        std::exception_ptr open_error;
+
+        // fallback faces are opened when a layout uses a new fallback chain
+        std::shared_ptr<const Fallback_list> fallbacks;
+        std::vector<FT_Face> fallback_faces;
+
+        if(FT_Init_FreeType(&lib) == FT_Err_Ok)
+        {
+            try
+            {
+                face = open_face(lib, source_);
+            }
+            catch(...)
+            {
+                open_error = std::current_exception();
+            }
+        }
+        else
+            open_error = std::make_exception_ptr(std::runtime_error("Error initializing Freetype library"));
+
+        bool has_kerning = false;
+        float line_height = 0.0f;
+        float face_scale = 1.0f;
+        std::vector<float> fallback_scales;
+
+        // glyph index and advance, shared by all workers
+        std::shared_ptr<Metrics_cache> cache;
+
+        std::unique_lock<std::mutex> lock(layout_mutex_);
+        while(true)
+        {
+            ++layout_idle_;
+            layout_cv_.wait(lock, [this](){ return layout_stop_ || !layout_queue_.empty(); });
+            --layout_idle_;
+            if(layout_stop_)
+                break;
+
+            auto layout = std::move(layout_queue_.front());
+            layout_queue_.pop_front();
+
+            // the first worker to see a new size, positioning mode, or fallback chain replaces the cache. the old one is freed once every worker is done with it
+            layout->font_size = font_size_;
+            layout->subpixel_phases = subpixel_phases_;
+            layout->fallbacks = fallback_list_;
+            if(!metrics_cache_ || metrics_cache_->font_size != layout->font_size || metrics_cache_->subpixel_phases != layout->subpixel_phases
+                    || metrics_cache_->fallbacks != layout->fallbacks)
+                metrics_cache_ = std::make_shared<Metrics_cache>(layout->font_size, layout->subpixel_phases, layout->fallbacks);
+            cache = metrics_cache_;
+
+            lock.unlock();
+
+            try
+            {
+                if(open_error)
+                    std::rethrow_exception(open_error);
+
+                if(layout->fallbacks != fallbacks)
+                {
+                    close_faces(fallback_faces);
+                    fallback_faces = open_fallback_faces(lib, layout->fallbacks.get());
+                    fallbacks = layout->fallbacks;
+                    face_size = 0;
+                }
+
+                if(layout->font_size != face_size)
+                {
+                    face_scale = set_face_size(face, layout->font_size);
+                    fallback_scales = size_faces(fallback_faces, layout->font_size);
+
+                    face_size = layout->font_size;
+                    has_kerning = FT_HAS_KERNING(face);
+                    line_height = static_cast<int>(FT_MulFix(face->height, face->size->metrics.y_scale) / 64 * face_scale);
+                }
+
+                const bool subpixel = layout->subpixel_phases > 1;
+
+                Resource_vector<char32_t> utf32;
+                utf8_to_utf32(layout->text.data(), layout->text.size(), utf32);
+
+                // same as build_text, without rendering anything
+                Vec2<float> pen{0.0f, 0.0f};
+                FT_UInt prev_glyph_i = 0;
+                unsigned int prev_face_i = 0;
+                for(auto & code_pt: utf32)
+                {
+                    if(code_pt == '\n')
+                    {
+                        pen.x = 0;
+                        pen.y += line_height;
+                        prev_glyph_i = 0;
+                        continue;
+                    }
+
+                    // look up metrics without locking. on a miss, load them with this worker's face
+                    Metrics_cache::Metrics loaded;
+                    const Metrics_cache::Metrics * metrics = cache->find(code_pt);
+                    if(!metrics)
+                    {
+                        std::tie(loaded.face_i, loaded.glyph_i) = find_glyph(face, fallback_faces, fallbacks.get(), code_pt);
+
+                        FT_Face glyph_face = loaded.face_i == 0 ? face : fallback_faces[loaded.face_i - 1];
+                        loaded.ok = FT_Load_Glyph(glyph_face, loaded.glyph_i, load_flags(subpixel)) == FT_Err_Ok;
+                        float scale = loaded.face_i == 0 ? face_scale : fallback_scales[loaded.face_i - 1];
+                        if(loaded.ok)
+                        {
+                            // same as set_metrics
+                            Char_info c;
+                            set_metrics(glyph_face->glyph, loaded.glyph_i, scale, subpixel, c);
+                            loaded.advance = {c.advance.x / 64.0f, -c.advance.y / 64.0f};
+                        }
+
+                        metrics = cache->insert(code_pt, loaded);
+                        if(!metrics)
+                            metrics = &loaded;
+                    }
+
+                    // glyphs that fail to load are skipped, as in build_text
+                    if(!metrics->ok)
+                        continue;
+
+                    FT_UInt glyph_i = metrics->glyph_i;
+                    FT_Face glyph_face = metrics->face_i == 0 ? face : fallback_faces[metrics->face_i - 1];
+
+                    if(prev_glyph_i && glyph_i && metrics->face_i == prev_face_i
+                            && (metrics->face_i == 0 ? has_kerning : FT_HAS_KERNING(glyph_face)))
+                    {
+                        auto kern = kerning(glyph_face, prev_glyph_i, glyph_i, subpixel);
+                        pen.x += kern.x;
+                        pen.y += kern.y;
+                    }
+
+                    layout->glyphs.push_back({static_cast<uint32_t>(code_pt), pen});
+
+                    pen.x += metrics->advance.x;
+                    pen.y += metrics->advance.y;
+                    prev_glyph_i = glyph_i;
+                    prev_face_i = metrics->face_i;
+                }
+
+                layout->promise.set_value();
+            }
+            catch(...)
+            {
+                layout->promise.set_exception(std::current_exception());
+            }
+
+            lock.lock();
+        }
+        lock.unlock();
+
+        close_faces(fallback_faces);
+        if(face)
+            FT_Done_Face(face);
+        if(lib)
+            FT_Done_FreeType(lib);
+    }
+
+    void Font_sys::Impl::load_text_vbo(const Resource_vector<Vec2<float>> & coords) const
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+
         // load text into buffer object
         // call glBufferData with NULL first - this is apparently faster for dynamic data loading
         glBufferData(GL_ARRAY_BUFFER, sizeof(Vec2<float>) * coords.size(), NULL, GL_DYNAMIC_DRAW);
@@ -23,11 +23,214 @@
 
 #include "font_impl.hpp"
 
+#include <fstream>
+#include <iomanip>
+#include <sstream>
 #include <system_error>
 
+#include <cstdio>
+#include <cstring>
+
+#ifdef USE_OPENGL_ES
+#include <EGL/egl.h>
+#include <GLES2/gl2ext.h>
+#endif
+
 // include shader source strings (this file is assembled from shader files by CMake)
 #include "shaders.inl"
 
+namespace
+{
+    const char * program_cache_magic = "textogl program binary 1";
+
+    /// FNV-1a hash, for naming program cache files
+    uint64_t fnv1a(const std::string & str, uint64_t hash = 0xcbf29ce484222325ull)
+    {
+        for(auto c: str)
+        {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    std::string gl_string(GLenum name)
+    {
+        auto str = glGetString(name);
+        return str ? reinterpret_cast<const char *>(str) : "";
+    }
+
+#ifdef USE_OPENGL_ES
+    // OES_get_program_binary entry points aren't part of core OpenGL ES 2.0, so they have to be looked up at runtime
+    const GLenum program_binary_length = GL_PROGRAM_BINARY_LENGTH_OES;
+    const GLenum num_program_binary_formats = GL_NUM_PROGRAM_BINARY_FORMATS_OES;
+
+    PFNGLGETPROGRAMBINARYOESPROC get_program_binary_proc()
+    {
+        static auto proc = reinterpret_cast<PFNGLGETPROGRAMBINARYOESPROC>(eglGetProcAddress("glGetProgramBinaryOES"));
+        return proc;
+    }
+
+    PFNGLPROGRAMBINARYOESPROC program_binary_proc()
+    {
+        static auto proc = reinterpret_cast<PFNGLPROGRAMBINARYOESPROC>(eglGetProcAddress("glProgramBinaryOES"));
+        return proc;
+    }
+
+    void get_program_binary(GLuint prog, GLsizei buf_size, GLsizei * length, GLenum * format, void * binary)
+    {
+        get_program_binary_proc()(prog, buf_size, length, format, binary);
+    }
+
+    void program_binary(GLuint prog, GLenum format, const void * binary, GLsizei length)
+    {
+        program_binary_proc()(prog, format, binary, length);
+    }
+
+    /// Check for OES_get_program_binary support, and at least one binary format
+    bool has_program_binary()
+    {
+        // ES 2.0 only has the space separated extension string
+        auto extensions = glGetString(GL_EXTENSIONS);
+        if(!extensions)
+            return false;
+
+        const char * ext_name = "GL_OES_get_program_binary";
+        const auto ext_len = std::strlen(ext_name);
+        bool supported = false;
+        for(auto ext = reinterpret_cast<const char *>(extensions); !supported && (ext = std::strstr(ext, ext_name)); ext += ext_len)
+        {
+            auto prev = ext == reinterpret_cast<const char *>(extensions) ? ' ' : ext[-1];
+            supported = prev == ' ' && (ext[ext_len] == ' ' || ext[ext_len] == '\0');
+        }
+
+        if(!supported || !get_program_binary_proc() || !program_binary_proc())
+            return false;
+
+        GLint num_formats = 0;
+        glGetIntegerv(num_program_binary_formats, &num_formats);
+        return num_formats > 0;
+    }
+#else
+    const GLenum program_binary_length = GL_PROGRAM_BINARY_LENGTH;
+    const GLenum num_program_binary_formats = GL_NUM_PROGRAM_BINARY_FORMATS;
+
+    void get_program_binary(GLuint prog, GLsizei buf_size, GLsizei * length, GLenum * format, void * binary)
+    {
+        glGetProgramBinary(prog, buf_size, length, format, binary);
+    }
+
+    void program_binary(GLuint prog, GLenum format, const void * binary, GLsizei length)
+    {
+        glProgramBinary(prog, format, binary, length);
+    }
+
+    /// Check for glGetProgramBinary / glProgramBinary support, and at least one binary format
+    bool has_program_binary()
+    {
+        GLint major_version = 0, minor_version = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major_version);
+        glGetIntegerv(GL_MINOR_VERSION, &minor_version);
+        bool supported = major_version > 4 || (major_version == 4 && minor_version >= 1);
+
+        GLint num_extensions = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
+        for(GLint i = 0; !supported && i < num_extensions; ++i)
+        {
+            if(std::string(reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i))) == "GL_ARB_get_program_binary")
+                supported = true;
+        }
+
+        if(!supported)
+            return false;
+
+        GLint num_formats = 0;
+        glGetIntegerv(num_program_binary_formats, &num_formats);
+        return num_formats > 0;
+    }
+#endif
+
+    /// Load a cached program binary
+
+    /// @returns program object, or 0 if the file is missing, doesn't match the driver, or is rejected by it
+    GLuint load_program_binary(const std::string & path, const std::string & identity)
+    {
+        std::ifstream in(path, std::ios::binary);
+        if(!in)
+            return 0;
+
+        std::string magic;
+        std::getline(in, magic);
+
+        std::string line, file_identity;
+        for(int i = 0; i < 3 && std::getline(in, line); ++i)
+            file_identity += (i ? "\n" : "") + line;
+
+        GLenum format = 0;
+        std::size_t size = 0;
+        in>>format>>size;
+        in.get(); // newline
+
+        if(!in || magic != program_cache_magic || file_identity != identity || size == 0)
+            return 0;
+
+        std::vector<char> binary(size);
+        if(!in.read(binary.data(), size))
+            return 0;
+
+        GLuint prog = glCreateProgram();
+        program_binary(prog, format, binary.data(), static_cast<GLsizei>(size));
+
+        // the driver may reject a binary even if the identity matches (after an update with the same version string, for ex.)
+        GLint link_status = GL_FALSE;
+        glGetProgramiv(prog, GL_LINK_STATUS, &link_status);
+        if(link_status != GL_TRUE)
+        {
+            glDeleteProgram(prog);
+            return 0;
+        }
+
+        return prog;
+    }
+
+    /// Save a program binary to the cache. Failure is not an error - the program will just be recompiled next time
+    void save_program_binary(GLuint prog, const std::string & path, const std::string & identity)
+    {
+        GLint size = 0;
+        glGetProgramiv(prog, program_binary_length, &size);
+        if(size <= 0)
+            return;
+
+        std::vector<char> binary(size);
+        GLenum format = 0;
+        GLsizei length = 0;
+        get_program_binary(prog, size, &length, &format, binary.data());
+        if(length <= 0)
+            return;
+
+        // write to a temp file first, so a concurrent reader never sees a partial file
+        auto tmp_path = path + ".tmp";
+        {
+            std::ofstream out(tmp_path, std::ios::binary);
+            if(!out)
+                return;
+
+            out<<program_cache_magic<<"\n"<<identity<<"\n"<<format<<" "<<length<<"\n";
+            out.write(binary.data(), length);
+
+            if(!out)
+            {
+                out.close();
+                std::remove(tmp_path.c_str());
+                return;
+            }
+        }
+
+        if(std::rename(tmp_path.c_str(), path.c_str()) != 0)
+            std::remove(tmp_path.c_str());
+    }
+}
+
 namespace textogl
 {
     Font_sys::Impl::Font_common::Font_common()
@@ -38,11 +241,71 @@ namespace textogl
             throw std::system_error(err, std::system_category(), "Error loading freetype library");
         }
 
+        try
+        {
+            prog = create_program(vert_shader_src, frag_shader_src);
+        }
+        catch(...)
+        {
+            FT_Done_FreeType(ft_lib);
+            throw;
+        }
+
+        // get uniform locations
+        GLint num_uniforms = 0;
+        GLint max_buff_size = 0;
+        glGetProgramiv(prog, GL_ACTIVE_UNIFORMS, &num_uniforms);
+        glGetProgramiv(prog, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_buff_size);
+
+        std::vector<GLchar> uniform(max_buff_size, '\0');
+
+        for(GLuint i = 0; i < static_cast<GLuint>(num_uniforms); ++i)
+        {
+            GLint size; GLenum type;
+            glGetActiveUniform(prog, i, static_cast<GLsizei>(uniform.size()), NULL, &size, &type, uniform.data());
+
+            GLint loc = glGetUniformLocation(prog, uniform.data());
+            if(loc != -1)
+                uniform_locations[uniform.data()] = loc;
+        }
+
+        model_view_projection_uniform = uniform_locations["model_view_projection"];
+        color_uniform = uniform_locations["color"];
+        color_glyphs_uniform = uniform_locations["color_glyphs"];
+
+        // atlases are always bound to the last texture unit
+        GLint max_tu_count = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &max_tu_count);
+        glUseProgram(prog);
+        glUniform1i(uniform_locations["font_page"], max_tu_count - 1);
+        glUseProgram(0);
+
+#ifndef USE_OPENGL_ES
+        // check for GPU-side texture copies, used for atlas compaction
+        GLint major_version = 0, minor_version = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major_version);
+        glGetIntegerv(GL_MINOR_VERSION, &minor_version);
+        has_copy_image = major_version > 4 || (major_version == 4 && minor_version >= 3);
+
+        GLint num_extensions = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
+        for(GLint i = 0; !has_copy_image && i < num_extensions; ++i)
+        {
+            if(std::string(reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i))) == "GL_ARB_copy_image")
+                has_copy_image = true;
+        }
+
+        glGenVertexArrays(1, &vao);
+#endif
+    }
+
+    GLuint Font_sys::Impl::Font_common::compile_program(const char * vert_src, const char * frag_src, const bool retrievable)
+    {
         GLuint vert = glCreateShader(GL_VERTEX_SHADER);
         GLuint frag = glCreateShader(GL_FRAGMENT_SHADER);
 
-        glShaderSource(vert, 1, &vert_shader_src, NULL);
-        glShaderSource(frag, 1, &frag_shader_src, NULL);
+        glShaderSource(vert, 1, &vert_src, NULL);
+        glShaderSource(frag, 1, &frag_src, NULL);
 
         for(auto i : {std::make_pair(vert, "vertex"), std::make_pair(frag, "fragement")})
         {
@@ -61,7 +324,6 @@ namespace textogl
 
                 glDeleteShader(vert);
                 glDeleteShader(frag);
-                FT_Done_FreeType(ft_lib);
 
                 throw std::system_error(compile_status, std::system_category(), std::string("Error compiling ") + i.second + " shader: \n" +
                         std::string(log.data()));
@@ -69,13 +331,21 @@ namespace textogl
         }
 
         // create program and attatch new shaders to it
-        prog = glCreateProgram();
+        GLuint prog = glCreateProgram();
         glAttachShader(prog, vert);
         glAttachShader(prog, frag);
 
         // set attr locations
         glBindAttribLocation(prog, 0, "vert_pos");
         glBindAttribLocation(prog, 1, "vert_tex_coords");
+        glBindAttribLocation(prog, 2, "vert_glyph_ids");
+
+#ifndef USE_OPENGL_ES
+        if(retrievable)
+            glProgramParameteri(prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+#else
+        (void)retrievable;
+#endif
 
         glLinkProgram(prog);
 
@@ -96,38 +366,276 @@ namespace textogl
             log.back() = '\0';
             glGetProgramInfoLog(prog, log_length, NULL, log.data());
 
-            FT_Done_FreeType(ft_lib);
             glDeleteProgram(prog);
 
             throw std::system_error(link_status, std::system_category(), std::string("Error linking shader program:\n") +
                     std::string(log.data()));
         }
 
-        // get uniform locations
-        GLint num_uniforms = 0;
-        GLint max_buff_size = 0;
-        glGetProgramiv(prog, GL_ACTIVE_UNIFORMS, &num_uniforms);
-        glGetProgramiv(prog, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_buff_size);
-
-        std::vector<GLchar> uniform(max_buff_size, '\0');
+        return prog;
+    }
 
-        for(GLuint i = 0; i < static_cast<GLuint>(num_uniforms); ++i)
+    GLuint Font_sys::Impl::Font_common::create_program(const char * vert_src, const char * frag_src)
+    {
+        std::string cache_dir;
         {
-            GLint size; GLenum type;
-            glGetActiveUniform(prog, i, static_cast<GLsizei>(uniform.size()), NULL, &size, &type, uniform.data());
-
-            GLint loc = glGetUniformLocation(prog, uniform.data());
-            if(loc != -1)
-                uniform_locations[uniform.data()] = loc;
+            std::lock_guard<std::mutex> lock(common_mutex_);
+            cache_dir = program_cache_dir_;
         }
+
+        if(cache_dir.empty() || !has_program_binary())
+            return compile_program(vert_src, frag_src);
+
+        // the driver identity is stored in the file, and must match exactly for the binary to be used
+        auto identity = gl_string(GL_VENDOR) + "\n" + gl_string(GL_RENDERER) + "\n" + gl_string(GL_VERSION);
+
+        auto hash = fnv1a(identity, fnv1a(vert_src, fnv1a(frag_src)));
+        std::ostringstream path;
+        path<<cache_dir<<"/textogl-"<<std::hex<<std::setw(16)<<std::setfill('0')<<hash<<".bin";
+
+        GLuint prog = load_program_binary(path.str(), identity);
+        if(prog)
+            return prog;
+
+        prog = compile_program(vert_src, frag_src, true);
+        save_program_binary(prog, path.str(), identity);
+        return prog;
+    }
+
+    Font_sys::Impl::Effect_program Font_sys::Impl::Font_common::create_effect_program(const std::string & effect_src)
+    {
+        // splice the effect in place of the marker line. #line makes compile errors point into the effect's own source
+        const std::string marker = "//TEXTOGL_EFFECT";
+        std::string vert_src = effect_vert_shader_src;
+        vert_src.replace(vert_src.find(marker), marker.size(), "#line 1\n" + effect_src + "\n");
+
+        Effect_program effect;
+        effect.prog = create_program(vert_src.c_str(), effect_frag_shader_src);
+
+        effect.model_view_projection = glGetUniformLocation(effect.prog, "model_view_projection");
+        effect.color = glGetUniformLocation(effect.prog, "color");
+        effect.color_glyphs = glGetUniformLocation(effect.prog, "color_glyphs");
+        effect.time = glGetUniformLocation(effect.prog, "time");
+        effect.params = glGetUniformLocation(effect.prog, "params");
+
+        // atlases are always bound to the last texture unit
+        GLint max_tu_count = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &max_tu_count);
+        glUseProgram(effect.prog);
+        glUniform1i(glGetUniformLocation(effect.prog, "font_page"), max_tu_count - 1);
+        glUseProgram(0);
+
+        return effect;
     }
 
     Font_sys::Impl::Font_common::~Font_common()
     {
         FT_Done_FreeType(ft_lib);
         glDeleteProgram(prog);
+#ifndef USE_OPENGL_ES
+        if(grid_prog)
+            glDeleteProgram(grid_prog);
+        if(billboard_prog)
+            glDeleteProgram(billboard_prog);
+        glDeleteVertexArrays(1, &vao);
+#endif
+        if(style_prog)
+            glDeleteProgram(style_prog);
+        if(solid_tex)
+            glDeleteTextures(1, &solid_tex);
+    }
+
+#ifndef USE_OPENGL_ES
+    void Font_sys::Impl::Font_common::init_grid()
+    {
+        if(grid_prog)
+            return;
+
+        grid_prog = create_program(grid_vert_shader_src, grid_frag_shader_src);
+
+        grid_uniforms.model_view_projection = glGetUniformLocation(grid_prog, "model_view_projection");
+        grid_uniforms.cols = glGetUniformLocation(grid_prog, "cols");
+        grid_uniforms.cell_size = glGetUniformLocation(grid_prog, "cell_size");
+        grid_uniforms.ascender = glGetUniformLocation(grid_prog, "ascender");
+        grid_uniforms.atlas_cell_box = glGetUniformLocation(grid_prog, "atlas_cell_box");
+        grid_uniforms.atlas_size = glGetUniformLocation(grid_prog, "atlas_size");
+        grid_uniforms.atlas = glGetUniformLocation(grid_prog, "atlas");
+        grid_uniforms.color_glyphs = glGetUniformLocation(grid_prog, "color_glyphs");
+
+        // atlases are always bound to the last texture unit
+        GLint max_tu_count = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &max_tu_count);
+        glUseProgram(grid_prog);
+        glUniform1i(glGetUniformLocation(grid_prog, "font_page"), max_tu_count - 1);
+        glUseProgram(0);
+    }
+
+    void Font_sys::Impl::Font_common::init_billboard()
+    {
+        if(billboard_prog)
+            return;
+
+        // glyphs are shaded just as Text_grid's are
+        billboard_prog = create_program(billboard_vert_shader_src, grid_frag_shader_src);
+
+        billboard_uniforms.view_projection = glGetUniformLocation(billboard_prog, "view_projection");
+        billboard_uniforms.viewport_size = glGetUniformLocation(billboard_prog, "viewport_size");
+        billboard_uniforms.atlas = glGetUniformLocation(billboard_prog, "atlas");
+        billboard_uniforms.color_glyphs = glGetUniformLocation(billboard_prog, "color_glyphs");
+
+        // atlases are always bound to the last texture unit
+        GLint max_tu_count = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &max_tu_count);
+        glUseProgram(billboard_prog);
+        glUniform1i(glGetUniformLocation(billboard_prog, "font_page"), max_tu_count - 1);
+        glUseProgram(0);
+    }
+#endif
+
+    void Font_sys::Impl::Font_common::init_style()
+    {
+        if(style_prog)
+            return;
+
+        style_prog = create_program(style_vert_shader_src, style_frag_shader_src);
+
+        style_uniforms.model_view_projection = glGetUniformLocation(style_prog, "model_view_projection");
+        style_uniforms.color = glGetUniformLocation(style_prog, "color");
+        style_uniforms.color_glyphs = glGetUniformLocation(style_prog, "color_glyphs");
+        style_uniforms.texel_size = glGetUniformLocation(style_prog, "texel_size");
+        style_uniforms.outline_color = glGetUniformLocation(style_prog, "outline_color");
+        style_uniforms.outline_width = glGetUniformLocation(style_prog, "outline_width");
+        style_uniforms.shadow_color = glGetUniformLocation(style_prog, "shadow_color");
+        style_uniforms.shadow_offset = glGetUniformLocation(style_prog, "shadow_offset");
+        style_uniforms.shadow_softness = glGetUniformLocation(style_prog, "shadow_softness");
+        style_uniforms.glow_color = glGetUniformLocation(style_prog, "glow_color");
+        style_uniforms.glow_radius = glGetUniformLocation(style_prog, "glow_radius");
+
+        // atlases are always bound to the last texture unit
+        GLint max_tu_count = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &max_tu_count);
+        glUseProgram(style_prog);
+        glUniform1i(glGetUniformLocation(style_prog, "font_page"), max_tu_count - 1);
+        glUseProgram(0);
+    }
+
+    void Font_sys::Impl::Font_common::init_solid()
+    {
+        if(solid_tex)
+            return;
+
+        GLint old_texture_2d{0};
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &old_texture_2d);
+
+        // same format as the grayscale atlases, so it draws in the text color
+        const unsigned char coverage = 0xFF;
+        glGenTextures(1, &solid_tex);
+        glBindTexture(GL_TEXTURE_2D, solid_tex);
+#ifndef USE_OPENGL_ES
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, 1, 1, 0, GL_RED, GL_UNSIGNED_BYTE, &coverage);
+#else
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, 1, 1, 0, GL_ALPHA, GL_UNSIGNED_BYTE, &coverage);
+#endif
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+        glBindTexture(GL_TEXTURE_2D, old_texture_2d);
+    }
+
+    Font_sys::Impl::Font_common & Font_sys::Impl::get_common()
+    {
+        std::unique_lock<std::mutex> lock(common_mutex_);
+
+        auto & entry = common_data_[current_context_];
+        if(!entry.data)
+        {
+            // creating shared data compiles shaders, so don't block other contexts while doing it.
+            // the entry is only for this context, and so only this thread can create it
+            lock.unlock();
+            std::unique_ptr<Font_common> data(new Font_common);
+            lock.lock();
+
+            common_data_[current_context_].data = std::move(data);
+        }
+
+        return *common_data_[current_context_].data;
+    }
+
+    Font_sys::Impl::Font_common & Font_sys::Impl::acquire_common()
+    {
+        auto & data = get_common();
+
+        std::lock_guard<std::mutex> lock(common_mutex_);
+        ++common_data_[current_context_].ref_cnt;
+
+        return data;
+    }
+
+    void Font_sys::Impl::release_common(Font_sys::Context_handle context)
+    {
+        std::unique_ptr<Font_common> data;
+        {
+            std::lock_guard<std::mutex> lock(common_mutex_);
+
+            auto entry = common_data_.find(context);
+            if(entry == std::end(common_data_))
+                return;
+
+            // only deallocate shared libs if this is the last Font_sys obj in the context
+            if(--entry->second.ref_cnt == 0 && !keep_common_)
+            {
+                data = std::move(entry->second.data);
+                common_data_.erase(entry);
+            }
+        }
+        // data is destroyed here, outside of the lock
+    }
+
+    void Font_sys::set_program_cache_dir(const std::string & dir)
+    {
+        std::lock_guard<std::mutex> lock(Impl::common_mutex_);
+        Impl::program_cache_dir_ = dir;
+    }
+
+    void Font_sys::set_keep_shared_resources(const bool keep)
+    {
+        {
+            std::lock_guard<std::mutex> lock(Impl::common_mutex_);
+            Impl::keep_common_ = keep;
+        }
+
+        if(!keep)
+            release_shared_resources();
+    }
+
+    void Font_sys::release_shared_resources()
+    {
+        std::unique_ptr<Impl::Font_common> data;
+        {
+            std::lock_guard<std::mutex> lock(Impl::common_mutex_);
+
+            auto entry = Impl::common_data_.find(Impl::current_context_);
+            if(entry == std::end(Impl::common_data_) || entry->second.ref_cnt != 0)
+                return;
+
+            data = std::move(entry->second.data);
+            Impl::common_data_.erase(entry);
+        }
+    }
+
+    void Font_sys::set_current_context(Context_handle context)
+    {
+        Impl::current_context_ = context;
+    }
+
+    Font_sys::Context_handle Font_sys::get_current_context()
+    {
+        return Impl::current_context_;
     }
 
-    unsigned int Font_sys::Impl::common_ref_cnt_ = 0;
-    std::unique_ptr<Font_sys::Impl::Font_common> Font_sys::Impl::common_data_;
+    std::mutex Font_sys::Impl::common_mutex_;
+    std::unordered_map<Font_sys::Context_handle, Font_sys::Impl::Common_entry> Font_sys::Impl::common_data_;
+    bool Font_sys::Impl::keep_common_ = false;
+    thread_local Font_sys::Context_handle Font_sys::Impl::current_context_ = nullptr;
+    std::string Font_sys::Impl::program_cache_dir_;
 }
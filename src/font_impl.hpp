@@ -25,13 +25,30 @@
 #define FONT_IMPL_HPP
 
 #include "textogl/font.hpp"
+#include "arena.hpp"
+#include "memory_resource.hpp"
 
-#include <tuple>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <list>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
 
+#ifdef TEXTOGL_USE_HARFBUZZ
+#include <hb.h>
+#include <hb-ft.h>
+#include <hb-ot.h>
+#endif
+
 #ifdef USE_OPENGL_ES
 #include <GLES2/gl2.h>
 #else
@@ -40,42 +57,69 @@
 
 /// @cond INTERNAL
 
+/// Convert a UTF-8 string to a UTF-32 string. Defined in font.cpp
+void utf8_to_utf32(const char * utf8, const std::size_t utf8_size, textogl::Resource_vector<char32_t> & utf32);
+
 /// @ingroup textogl
 namespace textogl
 {
     /// Implementation details for font and text rendering
     struct Font_sys::Impl
     {
+        /// Where the font was loaded from, so that more faces can be opened for it
+        struct Font_source
+        {
+            std::string path;                     ///< Path to font file. Empty when loaded from memory
+            const unsigned char * data = nullptr; ///< Font file data, when loaded from memory
+            std::size_t size = 0;                 ///< Size of \ref data, in bytes
+        };
+
         /// Load a font file at a specified size
-        Impl(const std::string & font_path, ///< Path to font file to use
-             const unsigned int font_size   ///< Font size (in pixels)
+        Impl(const std::string & font_path,       ///< Path to font file to use
+             const unsigned int font_size,        ///< Font size (in pixels)
+             Memory_resource * resource = nullptr ///< Resource for internal containers. nullptr for \ref default_resource
              );
         /// Load a font at a specified size from memory
 
         /// data is not copied, so the client is responsible for maintaining the data for the lifetime of this object
-        Impl(const unsigned char * font_data,  ///< Font file data (in memory)
-             const std::size_t font_data_size, ///< Font file data's size in memory
-             const unsigned int font_size      ///< Font size (in pixels)
+        Impl(const unsigned char * font_data,     ///< Font file data (in memory)
+             const std::size_t font_data_size,    ///< Font file data's size in memory
+             const unsigned int font_size,        ///< Font size (in pixels)
+             Memory_resource * resource = nullptr ///< Resource for internal containers. nullptr for \ref default_resource
+             );
+        /// Load a font without OpenGL, for Font_sys::load_async
+
+        /// The font gets its own Freetype library, so this can run on any
+        /// thread. \ref init_gl must be called on the rendering thread before
+        /// the font is used
+        Impl(const Font_source & source,          ///< Font to open
+             const unsigned int font_size,        ///< Font size (in pixels)
+             std::vector<uint32_t> code_pts       ///< Glyphs to render now, and upload in \ref init_gl
              );
         ~Impl();
 
-        /// @name Non-copyable
+        /// @name Non-copyable, non-movable
+        /// Containers hold pointers into \ref resource_, so this can't be moved
         /// @{
         Impl(const Impl &) = delete;
         Impl & operator=(const Impl &) = delete;
-        /// @}
 
-        /// @name Movable
-        /// @{
-        Impl(Impl &&);
-        Impl & operator=(Impl &&);
+        Impl(Impl &&) = delete;
+        Impl & operator=(Impl &&) = delete;
         /// @}
 
         /// Common initialization code
-        void init(FT_Open_Args & args,         ///< Freetype face opening args (set by ctors)
-                  const unsigned int font_size ///< Font size (in pixels)
+
+        /// Opens the font from \ref source_, which must be set by the ctors
+        void init(const unsigned int font_size ///< Font size (in pixels)
                   );
 
+        /// Create OpenGL objects
+
+        /// Called by \ref init, or by Font_sys::Async_load for fonts created
+        /// without OpenGL. Also uploads any glyphs rendered during loading
+        void init_gl();
+
         /// Resize font
 
         /// Resizes the font without destroying it
@@ -113,12 +157,73 @@ namespace textogl
                          const Mat4<float> & model_view_projection
                          );
 
+        /// Render a number formatted by \ref format_integer or \ref format_float
+        void render_number(const char * text,            ///< Formatted number
+                           const std::size_t size,       ///< Size of \p text
+                           const bool fixed_width,       ///< Give every digit the widest digit's advance
+                           const Color & color,          ///< Text Color
+                           const Vec2<float> & win_size, ///< Window dimensions. A Vec2 with X = width and Y = height
+                           const Vec2<float> & pos,      ///< Render position, in screen pixels
+                           const int align_flags         ///< Text Alignment. Should be #Text_origin flags bitwise-OR'd together
+                           );
+
+        /// Render a number formatted by \ref format_integer or \ref format_float, using a model view projection matrix
+        void render_number(const char * text,                        ///< Formatted number
+                           const std::size_t size,                   ///< Size of \p text
+                           const bool fixed_width,                   ///< Give every digit the widest digit's advance
+                           const Color & color,                      ///< Text Color
+                           const Mat4<float> & model_view_projection ///< Model view projection matrix
+                           );
+
+        /// Build glyph quads for text, passing them to a sink
+        std::size_t layout_text(const std::string & utf8_input, ///< Text to build, in UTF-8 encoding
+                                const Vertex_format format,     ///< Vertex layout to write
+                                Vertex_sink & sink,             ///< Destination for the vertices
+                                const int align_flags           ///< Text Alignment. Should be #Text_origin flags bitwise-OR'd together
+                                );
+
+        /// Build glyph quads for text into a buffer
+        std::size_t layout_text(const std::string & utf8_input,    ///< Text to build, in UTF-8 encoding
+                                const Vertex_format format,        ///< Vertex layout to write
+                                void * buffer,                     ///< Buffer to write vertices into
+                                const std::size_t buffer_size,     ///< Size of \p buffer, in bytes
+                                std::vector<Vertex_range> & ranges, ///< Filled with the range of vertices using each atlas texture
+                                const int align_flags              ///< Text Alignment. Should be #Text_origin flags bitwise-OR'd together
+                                );
+
+        /// Shader program and uniform locations for a Text_effect
+        struct Effect_program
+        {
+            GLuint prog = 0;                   ///< OpenGL shader program index
+            GLint model_view_projection = -1;  ///< Location of the model_view_projection uniform
+            GLint color = -1;                  ///< Location of the color uniform
+            GLint color_glyphs = -1;           ///< Location of the color_glyphs uniform
+            GLint time = -1;                   ///< Location of the time uniform
+            GLint params = -1;                 ///< Location of the params uniform
+        };
+
+        /// Effect to draw with, for \ref render_text_common
+        struct Effect_draw
+        {
+            const Effect_program & program; ///< Effect's shader program
+            float time;                     ///< Value for the time uniform
+            Vec4<float> params;             ///< Value for the params uniform
+            GLuint glyph_ids_vbo;           ///< Buffer holding Text_layout::glyph_ids for the text being drawn
+        };
+
+        /// Blending for \ref render_text_common
+        enum class Blend
+        {
+            STRAIGHT,         ///< Straight alpha, over the framebuffer
+            TO_PREMULTIPLIED, ///< Straight alpha, writing premultiplied color and proper alpha. For rendering into transparent textures
+            PREMULTIPLIED     ///< Premultiplied alpha, for drawing textures rendered with TO_PREMULTIPLIED
+        };
+
         /// Container for Freetype library object and shader program
 
-        /// Every Font_sys object can use the same instance of Font_Common,
-        /// so only one should ever be initialized at any given time.
-        /// Access to the single instance provied through Font_sys::common_data_
-        // TODO This is probably not thread-safe. Can we have it shared per-thread?
+        /// One instance is created per OpenGL context (see Font_sys::set_current_context),
+        /// and shared by every Font_sys object used in it.
+        /// Access is provided through \ref common_data_, \ref acquire_common, and \ref get_common
         class Font_common
         {
         public:
@@ -134,9 +239,108 @@ namespace textogl
             Font_common & operator=(Font_common &&) = delete;
             /// @}
 
+            /// Compile and link a shader program
+
+            /// If \ref program_cache_dir_ is set, the program is loaded from a
+            /// cached binary if possible, and a binary is saved otherwise
+            /// @throws std::system_error on compile or link errors
+            static GLuint create_program(const char * vert_src, ///< Vertex shader source
+                                         const char * frag_src  ///< Fragment shader source
+                                         );
+
+            /// Compile and link the shader program for a Text_effect
+
+            /// \p effect_src is spliced into the effect vertex shader. Uniform
+            /// locations are looked up, and font_page is set as for \ref prog
+            /// @throws std::system_error on compile or link errors
+            static Effect_program create_effect_program(const std::string & effect_src ///< GLSL source defining the effect function
+                                                        );
+
+            /// Compile and link a shader program, without the cache
+            static GLuint compile_program(const char * vert_src,         ///< Vertex shader source
+                                          const char * frag_src,         ///< Fragment shader source
+                                          const bool retrievable = false ///< Hint that the program binary will be retrieved. Ignored for OpenGL ES
+                                          );
+
             FT_Library ft_lib; ///< Freetype library object. [See Freetype documentation](https://www.freetype.org/freetype2/docs/reference/ft2-base_interface.html#FT_Library)
             GLuint prog;       ///< OpenGL shader program index
             std::unordered_map<std::string, GLuint> uniform_locations; ///< OpenGL shader program uniform location indexes
+            GLint model_view_projection_uniform; ///< Location of the model_view_projection uniform, looked up once to avoid per-draw allocations
+            GLint color_uniform;                 ///< Location of the color uniform
+            GLint color_glyphs_uniform;          ///< Location of the color_glyphs uniform, set for ranges drawn from color atlases
+#ifndef USE_OPENGL_ES
+            bool has_copy_image; ///< \c true if glCopyImageSubData is available (OpenGL 4.3+ or ARB_copy_image)
+            GLuint vao;          ///< Vertex array object for buffers owned by other contexts. VAOs aren't shared between contexts
+
+            /// Compile the Text_grid shader program, if not already done
+            /// @throws std::system_error on compile or link errors
+            void init_grid();
+
+            GLuint grid_prog = 0; ///< Text_grid shader program. 0 until \ref init_grid is called
+
+            /// Text_grid shader program uniform locations
+            struct Grid_uniforms
+            {
+                GLint model_view_projection; ///< Location of the model_view_projection uniform
+                GLint cols;                  ///< Location of the cols uniform
+                GLint cell_size;             ///< Location of the cell_size uniform
+                GLint ascender;              ///< Location of the ascender uniform
+                GLint atlas_cell_box;        ///< Location of the atlas_cell_box uniform
+                GLint atlas_size;            ///< Location of the atlas_size uniform
+                GLint atlas;                 ///< Location of the atlas uniform
+                GLint color_glyphs;          ///< Location of the color_glyphs uniform
+            } grid_uniforms; ///< Set by \ref init_grid
+
+            /// Compile the Billboard_labels shader program, if not already done
+            /// @throws std::system_error on compile or link errors
+            void init_billboard();
+
+            GLuint billboard_prog = 0; ///< Billboard_labels shader program. 0 until \ref init_billboard is called
+
+            /// Billboard_labels shader program uniform locations
+            struct Billboard_uniforms
+            {
+                GLint view_projection; ///< Location of the view_projection uniform
+                GLint viewport_size;   ///< Location of the viewport_size uniform
+                GLint atlas;           ///< Location of the atlas uniform
+                GLint color_glyphs;    ///< Location of the color_glyphs uniform
+            } billboard_uniforms; ///< Set by \ref init_billboard
+#endif
+
+            /// Compile the Text_style shader program, if not already done
+            /// @throws std::system_error on compile or link errors
+            void init_style();
+
+            GLuint style_prog = 0; ///< Text_style shader program. 0 until \ref init_style is called
+
+            /// Text_style shader program uniform locations
+            struct Style_uniforms
+            {
+                GLint model_view_projection; ///< Location of the model_view_projection uniform
+                GLint color;                 ///< Location of the color uniform
+                GLint color_glyphs;          ///< Location of the color_glyphs uniform
+                GLint texel_size;            ///< Location of the texel_size uniform
+                GLint outline_color;         ///< Location of the outline_color uniform
+                GLint outline_width;         ///< Location of the outline_width uniform
+                GLint shadow_color;          ///< Location of the shadow_color uniform
+                GLint shadow_offset;         ///< Location of the shadow_offset uniform
+                GLint shadow_softness;       ///< Location of the shadow_softness uniform
+                GLint glow_color;            ///< Location of the glow_color uniform
+                GLint glow_radius;           ///< Location of the glow_radius uniform
+            } style_uniforms; ///< Set by \ref init_style
+
+            /// Create \ref solid_tex, if not already done
+            void init_solid();
+
+            /// 1x1 texture with full coverage, for drawing solid shapes with \ref prog. 0 until \ref init_solid is called
+            GLuint solid_tex = 0;
+        };
+
+        /// Font_common and its reference count, for one context
+        struct Common_entry
+        {
+            std::unique_ptr<Font_common> data; ///< Shared data. null until first used in the context
+            unsigned int ref_cnt = 0;          ///< Number of Font_sys objects created in the context
         };
 
         /// Bounding box
@@ -164,9 +368,11 @@ namespace textogl
         /// OpenGL Vertex buffer object data
         struct Coord_data
         {
-            uint32_t page_no;         ///< Unicode code page number for a set of characters
-            std::size_t start;        ///< Starting index into \ref vbo_ for this pages's quads
-            std::size_t num_elements; ///< Number of indexs to render for this page
+            GLuint tex;                     ///< Atlas texture for a set of characters
+            bool color;                     ///< \c true if \ref tex is a color atlas
+            std::size_t start;              ///< Starting index into \ref vbo_ for this atlas's quads
+            std::size_t num_elements;       ///< Number of indexs to render for this atlas
+            Vec2<float> offset{0.0f, 0.0f}; ///< Added to the positions in this range. Lets Text_template move segments without rebuilding them
         };
 
         /// Character info
@@ -174,30 +380,588 @@ namespace textogl
         /// Contains information about a single code-point (character)
         struct Char_info
         {
-            Vec2<int> origin;  ///< Character's origin within \ref bbox
-            Vec2<int> advance; ///< Distance to next char's origin
-            Bbox<int> bbox;    ///< Bounding box for the character
-            FT_UInt glyph_i;   ///< Glyph index
+            Vec2<int> advance;     ///< Distance to next char's origin
+            Bbox<int> bbox;        ///< Bounding box for the character
+            FT_UInt glyph_i;       ///< Glyph index
+            unsigned int face_i = 0; ///< Face the glyph is from. 0 for \ref face_, or 1 + index into \ref fallback_faces_
+            bool color = false;    ///< \c true for color glyphs, which are stored in color atlases
+            unsigned int phase = 0; ///< Subpixel offset the glyph was rasterized at, in 1 / \ref subpixel_phases_ pixels. Nonzero only for variants in \ref subpixel_glyphs_
+            bool loaded = false;   ///< \c true once the glyph has been rendered and the above have been set
+            bool recorded = false; ///< \c true once the glyph has been added to \ref usage_
+            bool failed = false;   ///< \c true if Freetype couldn't render the glyph. It's drawn as nothing, and not tried again until the font is resized
+
+            /// @name Atlas residency
+            /// @{
+            GLuint tex = 0;             ///< Atlas texture holding the glyph's bitmap. 0 when the glyph is not resident
+            std::size_t cell = 0;       ///< Cell index within the atlas
+            std::size_t last_frame = 0; ///< Frame number (see \ref frame_) this glyph was last used in
+            std::size_t last_op = 0;    ///< Operation number (see \ref op_) this glyph was last used in
+            /// @}
         };
 
         /// Font page
 
-        /// Texture for a single Unicode code 'page' (where a page is 256
-        /// consecutive code points)
+        /// Character info for a single Unicode code 'page' (where a page is 256
+        /// consecutive code points). Glyphs are rendered as they are used
         struct Page
         {
-            GLuint tex;               ///< OpenGL Texture index for the page
             Char_info char_info[256]; ///< Info for each code point on the page
         };
 
-        /// Create data for a code page
+        /// Glyphs for writing numbers, looked up once per font size by \ref build_number
+        struct Number_glyphs
+        {
+            Char_info * glyphs['9' - '+' + 1] = {}; ///< Info for each character from '+' to '9', in \ref page_map_
+            float digit_advance = 0.0f;              ///< Widest digit's advance, in pixels. Used for Number_format::fixed_width
+            bool valid = false;                      ///< \c false until looked up, and after the font is resized
+        };
+
+        /// Text quads and drawing data, as built by \ref build_text
+        struct Text_layout
+        {
+            /// Create an empty layout
+            explicit Text_layout(Memory_resource * resource = nullptr ///< Resource to allocate from. nullptr for \ref default_resource
+                                 ): coords(resource), coord_data(resource), pen(0.0f, 0.0f), glyphs(resource), glyph_ids(resource)
+            {}
+
+            Resource_vector<Vec2<float>> coords;     ///< Quad coordinates, ready to be stored into an OpenGL VBO
+            Resource_vector<Coord_data> coord_data;  ///< VBO start and end data for use in glDrawArrays
+            Bbox<float> text_box;                    ///< Bounding box of resulting text
+            Vec2<float> pen;                         ///< Pen position after the text, where any following text would start. 0 for pre-positioned glyphs
+            Resource_vector<Char_info *> glyphs;     ///< Glyphs used by the text, for use with \ref use_glyphs
+
+            int padding = 0;                         ///< Set before building to grow each quad by this many pixels on every side, for Text_style effects. At most \ref style_padding_
+            bool want_glyph_ids = false;             ///< Set before building to have \ref glyph_ids filled in
+            /// Glyph index and line index of each vertex in \ref coords, in pairs. Only filled in if \ref want_glyph_ids is set.
+            /// Glyphs are counted by code point (or by shaped glyph), not counting newlines, and both count from 0
+            Resource_vector<GLushort> glyph_ids;
+        };
+
+        /// Cached render of a block of text, drawn as a single quad
+
+        /// Used by Static_text::set_impostor. Textures come from a pool shared
+        /// by all impostors, limited to \ref memory_limit_. When full, the least
+        /// recently drawn impostors from the current context are freed to make room
+        class Impostor
+        {
+        public:
+            explicit Impostor(Memory_resource * resource = nullptr ///< Resource for internal containers. nullptr for \ref default_resource
+                              );
+            ~Impostor();
+
+            /// @name Non-copyable, non-movable
+            /// @{
+            Impostor(const Impostor &) = delete;
+            Impostor & operator=(const Impostor &) = delete;
+
+            Impostor(Impostor &&) = delete;
+            Impostor & operator=(Impostor &&) = delete;
+            /// @}
+
+            /// Check if the cached render can be drawn
+            /// @returns \c true if there is a render for \p color, at a scale within \p scale_threshold of \p scale
+            bool valid(const Color & color,          ///< Text color
+                       const float scale,            ///< Screen pixels per text pixel
+                       const float scale_threshold   ///< Largest ratio between \p scale and the cached scale
+                       ) const;
+
+            /// Free the cached render, so the next \ref valid call fails
+            void invalidate();
+
+            /// Render text into the cache, replacing any previous render
+            /// @returns \c false if the render didn't fit in the pool. The cache is left invalid
+            bool update(Font_sys::Impl & font,                           ///< Font the text was built with
+                        const Color & color,                             ///< Text Color
+                        const float scale,                               ///< Screen pixels per text pixel to render at
+                        const Bbox<float> & text_box,                    ///< Text's bounding box
+                        const Resource_vector<Coord_data> & coord_data,  ///< Text's coordinate data, as in Text_layout::coord_data
+#ifndef USE_OPENGL_ES
+                        GLuint vao,                                      ///< Text's vertex array object
+                        Font_sys::Context_handle vao_context,            ///< Context \p vao was created in
+#endif
+                        GLuint vbo                                       ///< Text's vertex buffer object
+                        );
+
+            /// Draw the cached render, positioned as the text would be. \ref valid must have returned \c true
+            void render(Font_sys::Impl & font,         ///< Font the text was built with
+                        const Vec2<float> & win_size,  ///< Window dimensions
+                        const Vec2<float> & pos,       ///< Render position, in screen pixels
+                        const int align_flags,         ///< Text Alignment. Should be #Text_origin flags bitwise-OR'd together
+                        const float rotation,          ///< Clockwise text rotation (in radians) around origin as defined in align_flags
+                        const Bbox<float> & text_box   ///< Text's bounding box, for alignment
+                        );
+
+            /// Draw the cached render, using a model view projection matrix. \ref valid must have returned \c true
+            void render(Font_sys::Impl & font,                    ///< Font the text was built with
+                        const Mat4<float> & model_view_projection ///< Model view projection matrix, as for the text
+                        );
+
+            /// Estimate screen pixels per text pixel at the center of a text box, with the current viewport
+            static float effective_scale(const Mat4<float> & model_view_projection, ///< Model view projection matrix the text will be drawn with
+                                         const Bbox<float> & text_box               ///< Text's bounding box
+                                         );
+
+            static std::mutex pool_mutex_;          ///< Lock for the pool's static members
+            static std::size_t memory_limit_;       ///< Most texture memory all impostors may use, in bytes. 0 for no limit
+            static std::size_t memory_usage_;       ///< Texture memory all impostors are using, in bytes
+
+        private:
+            /// Remove from the pool, and delete the texture
+            void release();
+
+            /// Impostors with textures, most recently drawn first
+            static std::list<Impostor *> lru_;
+
+            std::list<Impostor *>::iterator lru_pos_; ///< Position in \ref lru_. Only valid when \ref tex_ is set
+            Font_sys::Context_handle context_;        ///< Context \ref tex_ (and \ref vao_) were created in
+
+            GLuint tex_ = 0;       ///< Rendered text. 0 when there's none
+            std::size_t bytes_ = 0; ///< Size of \ref tex_
+            bool valid_ = false;   ///< \c true when a render is cached. Text with no glyphs has no \ref tex_
+            Color color_;          ///< Color the text was rendered with
+            float scale_ = 1.0f;   ///< Screen pixels per text pixel the text was rendered at
+
+#ifndef USE_OPENGL_ES
+            GLuint vao_ = 0; ///< OpenGL Vertex array object index for \ref vbo_
+#endif
+            GLuint vbo_ = 0; ///< Single quad showing \ref tex_
+            Resource_vector<Coord_data> coord_data_; ///< Draws \ref vbo_ with \ref tex_
+        };
+
+        /// Glyph atlas
+
+        /// Texture divided into a grid of 16x16 cells, each \ref cell_bbox_
+        /// sized. Each cell holds the bitmap for a single glyph from any page.
+        /// Color glyphs (such as emoji) are kept in separate RGBA atlases, so
+        /// the common greyscale atlases stay 1 byte per pixel
+        struct Atlas
+        {
+            /// Create an atlas with no cells
+            explicit Atlas(Memory_resource * resource = nullptr ///< Resource to allocate from. nullptr for \ref default_resource
+                           ): cells(resource), free_cells(resource)
+            {}
+
+            Resource_vector<Char_info *> cells;      ///< Glyph held in each cell. nullptr for free cells
+            Resource_vector<std::size_t> free_cells; ///< Indexes of free cells
+            bool color = false;                      ///< \c true for RGBA atlases holding color glyphs
+            bool dirty = false;                      ///< \c true when mipmaps need to be regenerated
+
+            /// Get the number of cells in use
+            std::size_t num_used() const
+            {
+                return cells.size() - free_cells.size();
+            }
+        };
+
+        /// Set of code points a face has glyphs for
+
+        /// Built once from the face's charmap, then never modified, so it can
+        /// be shared between threads. Stored as a 256 bit bitmap for each page
+        /// of 256 code points with any glyphs, so lookups are O(1)
+        class Coverage
+        {
+        public:
+            /// Build coverage from a face's selected charmap
+            explicit Coverage(FT_Face face);
+
+            /// Check if the face has a glyph for a code point
+            bool has(const uint32_t code_pt) const
+            {
+                if(code_pt >= num_pages * 256)
+                    return false;
+
+                auto page = page_index_[code_pt >> 8];
+                return page && (bits_[(page - 1) * 4 + ((code_pt >> 6) & 3)] >> (code_pt & 63) & 1);
+            }
+
+        private:
+            static const std::size_t num_pages = 0x110000 / 256; ///< Number of pages needed to cover Unicode
+
+            std::vector<uint16_t> page_index_; ///< For each page, 1 + index of its bitmap in \ref bits_, or 0 if the face has none of its glyphs
+            std::vector<uint64_t> bits_;       ///< Bitmap for each page with any glyphs, 4 words each
+        };
+
+        /// Fallback font and its coverage
+        struct Fallback_font
+        {
+            Font_source source;                      ///< Where the font was loaded from, so workers can open it
+            std::shared_ptr<const Coverage> coverage; ///< Code points the font has glyphs for
+        };
+
+        /// Fallback fonts, in the order to check them
+        using Fallback_list = std::vector<Fallback_font>;
+
+        /// Add a font to the end of the fallback chain
+        void add_fallback(const Font_source & source ///< Font to add
+                          );
+
+        /// Find the face and glyph index to render a code point with
+
+        /// @param face Main face, checked first
+        /// @param fallback_faces Faces opened from \p fallbacks, in the same order
+        /// @param fallbacks Fallback fonts. May be nullptr
+        /// @param code_pt Code point to look up
+        /// @returns Face index, as in Char_info::face_i, and glyph index.
+        ///          If no face has the glyph, the main face's missing glyph (0) is returned
+        static std::pair<unsigned int, FT_UInt> find_glyph(FT_Face face, const std::vector<FT_Face> & fallback_faces,
+                                                           const Fallback_list * fallbacks, const uint32_t code_pt);
+
+        /// Get a face by Char_info::face_i
+        FT_Face face_for(const unsigned int face_i) const
+        {
+            return face_i == 0 ? face_ : fallback_faces_[face_i - 1];
+        }
+
+        /// Open faces for each fallback font
+        static std::vector<FT_Face> open_fallback_faces(FT_Library lib,              ///< Freetype library to open the faces with
+                                                        const Fallback_list * fallbacks ///< Fonts to open. May be nullptr
+                                                        );
+
+        /// Size faces opened by \ref open_fallback_faces
+        /// @returns Scale for each face, as returned by \ref set_face_size
+        static std::vector<float> size_faces(const std::vector<FT_Face> & faces, ///< Faces to size
+                                             const unsigned int font_size         ///< Font size (in pixels)
+                                             );
+
+        /// Close faces opened by \ref open_fallback_faces
+        static void close_faces(std::vector<FT_Face> & faces);
+
+        /// Glyph rasterized by a preload worker
+        struct Preloaded_glyph
+        {
+            uint32_t code_pt;                         ///< Code point
+            Char_info info;                           ///< Glyph metrics. Atlas residency is not set
+            Resource_vector<unsigned char> cell_data; ///< Cell bitmap, as returned by \ref render_cell
+        };
+
+        /// Preload in progress
+
+        /// Workers only access this, never the Impl, and the Impl joins them
+        /// before destroying it
+        struct Preload_job
+        {
+            Font_source source;                   ///< Font to open
+            std::shared_ptr<const Fallback_list> fallbacks; ///< Fallback fonts to open
+            unsigned int font_size;               ///< Font size (in pixels)
+            bool subpixel = false;                ///< Render for subpixel positioning
+            Bbox<int> cell_bbox;                  ///< Atlas cell size
+            std::size_t resize_generation = 0;    ///< \ref resize_generation_ when the job was created. The glyphs are thrown out if it has changed
+            std::vector<uint32_t> code_pts;       ///< Code points to load
+            std::atomic<std::size_t> next{0};     ///< Index into \ref code_pts of the next code point to be claimed by a worker
+            std::atomic<unsigned int> running{0}; ///< Number of workers still running
+            std::atomic<bool> cancel{false};      ///< Set to stop workers early
+            std::mutex mutex;                     ///< Guards \ref glyphs and \ref error
+            std::vector<Preloaded_glyph> glyphs;  ///< Rasterized glyphs
+            std::exception_ptr error;             ///< First error thrown by a worker, or while uploading
+            std::size_t num_loaded = 0;           ///< Number of glyphs uploaded so far
+            std::size_t pending_uploads = 0;      ///< Number of batches given to \ref upload_thread_ and not yet finished
+            std::vector<std::thread> threads;     ///< Worker threads
+            std::promise<std::size_t> promise;    ///< Set once the glyphs are uploaded
+        };
+
+#ifndef USE_OPENGL_ES
+        /// Glyphs to copy into reserved atlas cells on \ref upload_thread_
+        struct Upload_batch
+        {
+            /// Destination for a single glyph
+            struct Region
+            {
+                uint32_t code_pt; ///< Code point
+                Char_info info;   ///< Glyph metrics. Atlas residency is not set
+                GLuint tex;       ///< Atlas texture
+                std::size_t cell; ///< Reserved cell index
+            };
+
+            /// Create an empty batch
+            explicit Upload_batch(Memory_resource * resource ///< Resource to allocate from
+                                  ): regions(resource), data(resource)
+            {}
+
+            /// Upload state. Guarded by Upload_thread::mutex
+            enum class State {QUEUED, UPLOADING, DONE};
+
+            Resource_vector<Region> regions;     ///< Glyphs in the batch
+            Resource_vector<unsigned char> data; ///< Cell data for each region, back to back
+            GLsizei cell_width;                  ///< Cell width, in pixels
+            GLsizei cell_height;                 ///< Cell height, in pixels
+            Preload_job * job;                   ///< Preload the glyphs came from
+            State state = State::QUEUED;         ///< Upload state
+            GLsync fence = nullptr;              ///< Signaled once the upload is complete. Set when \ref state is DONE
+            bool failed = false;                 ///< Set if the upload thread couldn't copy the data. It is then uploaded from the rendering thread
+        };
+
+        /// Thread copying glyphs into atlases from a loader context
+
+        /// A single instance, \ref upload_thread_, is shared by all fonts.
+        /// Batches are owned by the font that submitted them, which must
+        /// \ref cancel or \ref wait for them before destroying them
+        class Upload_thread
+        {
+        public:
+            ~Upload_thread();
+
+            /// Start the thread. Does nothing if already running
+            void start(std::function<void()> make_current,   ///< Called on the thread to make the loader context current
+                       std::function<void()> release_current ///< Called on the thread before it exits. May be empty
+                       );
+
+            /// Finish any queued batches and stop the thread
+            void stop();
+
+            /// Check if the thread is accepting batches
+            bool running();
+
+            /// Queue a batch for uploading
+            void submit(Upload_batch & batch);
+
+            /// Remove a batch from the queue, or wait for it if it is already being uploaded
+            void cancel(Upload_batch & batch);
+
+            /// Wait for a batch to reach Upload_batch::State::DONE
+            void wait(Upload_batch & batch);
+
+            /// Check if a batch has reached Upload_batch::State::DONE
+            bool done(Upload_batch & batch);
+
+        private:
+            /// Thread function
+            void run(std::function<void()> make_current, std::function<void()> release_current);
+
+            /// Copy a batch into its atlases and insert its fence. Marks the batch failed instead if the PBO can't be written
+            static void upload(Upload_batch & batch, const GLuint pbo);
+
+            std::mutex mutex_;                 ///< Guards everything below, and Upload_batch::state
+            std::condition_variable cv_;       ///< Signaled when \ref queue_, \ref stopping_, or a batch's state changes
+            std::deque<Upload_batch *> queue_; ///< Batches waiting to be uploaded
+            std::thread thread_;               ///< Upload thread
+            bool running_ = false;             ///< \c true while the thread is accepting batches
+            bool stopping_ = false;            ///< Set to have the thread exit once \ref queue_ is empty
+        };
+
+        /// Apply finished uploads from \ref uploads_ to the atlases
+        void finish_uploads(const bool wait ///< If \c true, wait for all uploads to finish. Otherwise skip unfinished ones
+                            );
+
+        /// Cancel all of \ref uploads_, leaving their reserved cells unused
+        void cancel_uploads();
+#endif
+
+        /// Open a new face for a font, with the unicode charmap selected
+        /// @throws std::system_error for unknown font formats
+        /// @throws std::ios_base::failure if the font can't be read
+        /// @throws std::runtime_error if the font has no unicode charmap
+        static FT_Face open_face(FT_Library lib,            ///< Freetype library to open the face with
+                                 const Font_source & source ///< Font to open
+                                 );
+
+        /// Set up a preload for the current font and size
+
+        /// Removes duplicates, newlines, and glyphs already loaded from \p code_pts
+        std::unique_ptr<Preload_job> create_preload_job(std::vector<uint32_t> code_pts ///< Code points to load
+                                                        );
 
-        /// Creates texture and layout information for the given code page
-        /// @param page_no The Unicode page number to build
-        /// @returns iterator into \ref page_map_ containing the page data
-        /// @note This assumes the page hasn't been created yet. Do not call
-        ///       if the page already exists in \ref page_map_
-        std::unordered_map<uint32_t, Page>::iterator load_page(const uint32_t page_no);
+        /// Start rasterizing glyphs on worker threads
+        std::future<std::size_t> preload(std::vector<uint32_t> code_pts, ///< Code points to load. May contain duplicates
+                                         unsigned int num_threads        ///< Number of worker threads. 0 for hardware_concurrency
+                                         );
+
+        /// Preload worker thread
+        static void preload_worker(Preload_job & job);
+
+        /// Rasterize glyphs claimed from a preload job, until none are left
+        static void rasterize_glyphs(FT_Face face,                        ///< Face to render with, already sized
+                                     const float scale,                   ///< Scale for \p face, as returned by \ref set_face_size
+                                     const std::vector<FT_Face> & fallback_faces, ///< Faces opened from Preload_job::fallbacks, already sized
+                                     const std::vector<float> & fallback_scales,  ///< Scale for each of \p fallback_faces
+                                     Preload_job & job,                   ///< Job to claim code points from
+                                     std::vector<Preloaded_glyph> & glyphs ///< Rendered glyphs are appended here
+                                     );
+
+        /// Upload glyphs from finished preloads and complete their futures
+        void finish_preloads(const bool wait ///< If \c true, wait for running preloads to finish. Otherwise skip them
+                             );
+
+        /// Get a string identifying the font face, for usage profiles
+        std::string font_id() const;
+
+        /// Get info for a code point, rendering it into an atlas if needed
+
+        /// Marks the glyph as used in the current frame and operation, so it
+        /// will not be evicted while the current operation is in progress
+        /// @param code_pt The code point to get
+        /// @param glyphs If given, the glyph is appended to this on its first
+        ///        use in the current operation
+        /// @returns Reference to the character info
+        Char_info & use_glyph(const uint32_t code_pt, Resource_vector<Char_info *> * glyphs = nullptr);
+
+        /// Same as \ref use_glyph, for a code point whose info has already been looked up
+        Char_info & use_glyph(Char_info & c, const uint32_t code_pt, Resource_vector<Char_info *> * glyphs);
+
+        /// Mark glyphs as used by the current frame and operation
+
+        /// @param glyphs Glyphs used by a layout, as returned by \ref build_text
+        /// @param generation Value of \ref layout_generation_ when the layout was built
+        /// @returns \c false if any of the glyphs may have moved or been
+        ///          evicted, in which case the layout must be rebuilt
+        bool use_glyphs(const Resource_vector<Char_info *> & glyphs, const std::size_t generation);
+
+        /// Set a face's size
+
+        /// Bitmap-only fonts, such as color emoji fonts, only come in fixed
+        /// sizes, so the nearest size at least as big as \p font_size is
+        /// selected, and glyphs are scaled down from it when rendered
+        /// @throws std::runtime_error if the size can't be set
+        /// @returns Scale to apply to glyphs rendered by the face. 1 for scalable fonts
+        static float set_face_size(FT_Face face,                ///< Face to size
+                                   const unsigned int font_size ///< Font size (in pixels)
+                                   );
+
+        /// Grow \ref style_padding_ to at least \p padding, re-creating the atlases if it changes
+        void set_style_padding(const unsigned int padding ///< Padding, in pixels
+                               );
+
+        /// Get the quad and atlas padding a style needs, in pixels
+        static unsigned int style_padding(const Text_style & style);
+
+        /// Get a bounding box that will fit any glyph from a face, plus 2px padding
+        static Bbox<int> face_cell_bbox(FT_Face face,     ///< Face, already sized
+                                        const float scale ///< Scale returned by \ref set_face_size
+                                        );
+
+        /// Get the scale for a face by Char_info::face_i
+        float scale_for(const unsigned int face_i) const
+        {
+            return face_i == 0 ? face_scale_ : fallback_scales_[face_i - 1];
+        }
+
+        /// Get the bounding box of a rendered glyph's bitmap, after scaling
+        static Bbox<int> bitmap_box(const FT_GlyphSlot slot, ///< Freetype glyph slot holding a rendered glyph
+                                    const float scale        ///< Scale returned by \ref set_face_size
+                                    );
+
+        /// Render a glyph and copy it into a free atlas cell
+        void load_glyph(const uint32_t code_pt, ///< Code point to render
+                        Char_info & c           ///< Info to fill in for the code point
+                        );
+
+        /// Set glyph metrics from a rendered glyph
+        static void set_metrics(const FT_GlyphSlot slot, ///< Freetype glyph slot holding a rendered glyph
+                                const FT_UInt glyph_i,   ///< Glyph index
+                                const float scale,       ///< Scale returned by \ref set_face_size
+                                const bool subpixel,     ///< Use the unhinted advance, for subpixel positioning
+                                Char_info & c            ///< Info to fill in
+                                );
+
+        /// Freetype load flags to render glyphs with
+        static FT_Int32 load_flags(const bool subpixel ///< \c true for subpixel positioning, which only hints vertically
+                                   );
+
+        /// Pick the glyph to draw at a pen position
+
+        /// With subpixel positioning off, \p pen is left as is and \p c is
+        /// returned. Otherwise \p pen.x is snapped to a whole pixel, and the
+        /// variant of \p c rasterized at the nearest phase of the remainder
+        /// is returned, loading it if needed
+        /// @returns Glyph to pass to \ref add_quad
+        const Char_info & place_glyph(const Char_info & c,                        ///< Glyph, already resident
+                                      const uint32_t id,                          ///< Code point, or glyph index for shaped text
+                                      const bool shaped,                          ///< \c true if \p id is a glyph index
+                                      Vec2<float> & pen,                          ///< Glyph origin. Snapped as described above
+                                      Resource_vector<Char_info *> * glyphs       ///< If not null, the variant is added as in \ref use_glyph
+                                      );
+
+        /// Render a glyph at a subpixel offset and copy it into a free atlas cell
+        void load_subpixel_glyph(const Char_info & base,   ///< Glyph at phase 0, already loaded
+                                 const unsigned int phase, ///< Offset, in 1 / \ref subpixel_phases_ pixels
+                                 Char_info & c             ///< Info to fill in for the variant
+                                 );
+
+        /// Render a glyph at a subpixel offset into a face's glyph slot
+        /// @returns \c false if the glyph can't be loaded or has no outline
+        bool render_subpixel(FT_Face face,             ///< Face, already sized
+                             const FT_UInt glyph_i,    ///< Glyph index
+                             const unsigned int phase  ///< Offset, in 1 / \ref subpixel_phases_ pixels
+                             ) const;
+
+        /// Copy a rendered glyph into cell-sized texture storage
+
+        /// Color (BGRA) bitmaps are converted to RGBA, with straight alpha.
+        /// Scaled glyphs are box filtered down to size here, once, so
+        /// nothing is scaled when drawing
+        /// @param slot Freetype glyph slot holding a rendered glyph
+        /// @param cell_bbox Cell size, as in \ref cell_bbox_
+        /// @param scale Scale returned by \ref set_face_size
+        /// @param resource Resource to allocate the data from
+        /// @returns Pixel data for a single atlas cell. Greyscale, or RGBA for color glyphs
+        static Resource_vector<unsigned char> render_cell(const FT_GlyphSlot slot, const Bbox<int> & cell_bbox, const float scale, Memory_resource * resource);
+
+        /// Copy rendered glyph data into a free atlas cell
+        void store_glyph(Char_info & c,                                   ///< Glyph to store. Metrics must already be set
+                         const Resource_vector<unsigned char> & cell_data ///< Data as returned by \ref render_cell
+                         );
+
+        /// Copy pixel data into an atlas cell
+        void upload_cell(const GLuint tex,                  ///< Atlas texture
+                         const std::size_t cell,            ///< Cell index
+                         const unsigned char * cell_data    ///< Data as returned by \ref render_cell
+                         );
+
+        /// Find a free atlas cell for a glyph
+
+        /// Prefers the fullest atlas with room, then evicts glyphs or creates
+        /// a new atlas if needed
+        /// @returns Atlas texture and cell index
+        std::pair<GLuint, std::size_t> alloc_cell(const bool color = false ///< Find a cell in a color atlas
+                                                  );
+
+        /// Remove a glyph from its atlas cell
+        void free_cell(Char_info & c);
+
+        /// Create a new, empty atlas texture
+        Resource_map<GLuint, Atlas>::iterator create_atlas(const bool color ///< Create an RGBA atlas for color glyphs
+                                                           );
+
+        /// Free least recently used glyphs to make room in the atlases
+
+        /// Glyphs not used in the current frame are freed first, then any not
+        /// used by the current operation
+        /// @returns \c true if any glyphs were freed
+        bool evict_glyphs();
+
+        /// Move a glyph to a different atlas cell, using a GPU-side copy
+        void move_glyph(Char_info & c,             ///< Glyph to move
+                        const GLuint dst_tex,      ///< Destination atlas texture
+                        const std::size_t dst_cell ///< Destination cell index
+                        );
+
+        /// Regenerate mipmaps for any atlas modified since the last call
+        void update_mipmaps();
+
+        /// Get the pixel coordinates of a glyph's origin within its atlas
+        Vec2<float> cell_origin(const std::size_t cell) const;
+
+        /// Size of a single atlas's texture, including mipmaps
+        std::size_t atlas_size(const bool color ///< Get the size of a color atlas
+                               ) const;
+
+        /// Repack glyphs into fewer atlases
+
+        /// @param budget Time limit for this call
+        /// @returns \c true if there is nothing left to compact
+        bool compact_atlas(const std::chrono::microseconds & budget);
+
+        /// Get the offset from the baseline origin to the origin chosen by align_flags
+        static Vec2<float> align_offset(const int align_flags,       ///< Text Alignment. Should be #Text_origin flags bitwise-OR'd together
+                                        const Bbox<float> & text_box ///< Text's bounding box
+                                        );
+
+        /// Convert a range of built quads to a public vertex format
+        void write_vertices(const Text_layout & layout,  ///< Layout built by \ref build_text
+                            const Coord_data & range,    ///< Range of \p layout to write
+                            const Vertex_format format,  ///< Vertex layout to write
+                            const Vec2<float> & offset,  ///< Offset to subtract from each position
+                            unsigned char * out          ///< Destination. Must have room for range.num_elements vertices
+                            ) const;
 
         /// Common font rendering routine
 
@@ -208,11 +972,15 @@ namespace textogl
                                 const int align_flags,                      ///< Text Alignment. Should be #Text_origin flags bitwise-OR'd together
                                 const float rotation,                       ///< Clockwise text rotation (in radians) around origin as defined in align_flags. 0 is vertical
                                 const Bbox<float> & text_box,               ///< Text's bounding box
-                                const std::vector<Coord_data> & coord_data, ///< Pre-calculated coordinate data as returned by \ref build_text
+                                const Resource_vector<Coord_data> & coord_data, ///< Pre-calculated coordinate data as returned by \ref build_text
 #ifndef USE_OPENGL_ES
                                 GLuint vao,                                 ///< OpenGL vertex array object
+                                Font_sys::Context_handle vao_context,       ///< Context \p vao was created in
 #endif
-                                GLuint vbo                                  ///< OpenGL vertex buffer object
+                                GLuint vbo,                                 ///< OpenGL vertex buffer object
+                                const Effect_draw * effect = nullptr,       ///< Animation effect to draw with. nullptr for the plain shader
+                                const Text_style * style = nullptr,         ///< Style to draw with. Ignored if \p effect is set. Quads should be padded for it (see \ref style_padding)
+                                const Blend blend = Blend::STRAIGHT         ///< How to blend with the framebuffer
                                 );
 
         /// Common font rendering routine
@@ -220,41 +988,352 @@ namespace textogl
         /// Rendering calls common to Font_sys and Static_text
         void render_text_common(const Color & color,                        ///< Text Color
                                 const Mat4<float> & model_view_projection,  ///< Model view projection matrix to transform text by
-                                const std::vector<Coord_data> & coord_data, ///< Pre-calculated coordinate data as returned by \ref build_text
+                                const Resource_vector<Coord_data> & coord_data, ///< Pre-calculated coordinate data as returned by \ref build_text
 #ifndef USE_OPENGL_ES
                                 GLuint vao,                                 ///< OpenGL vertex array object
+                                Font_sys::Context_handle vao_context,       ///< Context \p vao was created in
 #endif
-                                GLuint vbo                                  ///< OpenGL vertex buffer object
+                                GLuint vbo,                                 ///< OpenGL vertex buffer object
+                                const Effect_draw * effect = nullptr,       ///< Animation effect to draw with. nullptr for the plain shader
+                                const Text_style * style = nullptr,         ///< Style to draw with. Ignored if \p effect is set. Quads should be padded for it (see \ref style_padding)
+                                const Blend blend = Blend::STRAIGHT         ///< How to blend with the framebuffer
                                );
 
         /// Build buffer of quads for and coordinate data for text display
 
-        /// @param utf8_input Text to build data for
-        /// @returns A tuple of
-        /// * Quad coordinates, ready to be stored into an OpenGL VBO
-        /// * VBO start and end data for use in glDrawArrays
-        /// * Bounding box of resulting text
-        std::tuple<std::vector<Vec2<float>>, std::vector<Coord_data>, Bbox<float>>
-        build_text(const std::string & utf8_input);
+        /// Temporary data is allocated from \ref arena_, and is only freed by the caller's Arena::Scope, so the layout can be allocated from it too
+        void build_text(const char * utf8_input,    ///< Text to build data for
+                        const std::size_t utf8_size, ///< Size of \p utf8_input in bytes
+                        Text_layout & layout         ///< Layout to fill in. Existing contents are replaced
+                        );
+
+        /// Glyph placed by \ref layout_worker
+        struct Glyph_position
+        {
+            uint32_t code_pt; ///< Code point
+            Vec2<float> pen;  ///< Origin, relative to the text's origin
+        };
+
+        /// Text being laid out by \ref layout_worker, for Static_text::set_text_async
+
+        /// Shared between the requesting thread and the worker, so uses the default allocator
+        struct Async_layout
+        {
+            std::string text;                    ///< Text to lay out, in UTF-8 encoding
+            unsigned int font_size = 0;          ///< Font size the text was laid out at
+            unsigned int subpixel_phases = 1;    ///< Subpixel positioning the text was laid out with, as in \ref subpixel_phases_
+            std::shared_ptr<const Fallback_list> fallbacks; ///< Fallback fonts the text was laid out with
+            std::vector<Glyph_position> glyphs;  ///< Glyph positions. Glyphs that fail to load are skipped
+            std::promise<void> promise;          ///< Set by the worker when done
+            std::future<void> future = promise.get_future(); ///< Ready once \ref glyphs is set
+        };
+
+        /// Build buffer of quads for and coordinate data for glyphs positioned by \ref layout_worker
+
+        /// Temporary data is allocated from \ref arena_, and is only freed by the caller's Arena::Scope, so the layout can be allocated from it too
+        void build_text(const std::vector<Glyph_position> & positions, ///< Glyphs to build data for
+                        Text_layout & layout                           ///< Layout to fill in. Existing contents are replaced
+                        );
+
+        /// @name Numbers
+        /// @{
+
+        /// Largest text \ref format_integer and \ref format_float can write, in bytes
+        static const std::size_t max_number_size = 64;
+
+        /// Write an integer as text
+        /// @returns Number of bytes written. Not null terminated
+        static std::size_t format_integer(const long long value,        ///< Number to write
+                                          const Number_format & format, ///< Formatting
+                                          char * out                    ///< Destination. Must have room for \ref max_number_size bytes
+                                          );
+
+        /// Write a floating point number as text
+        /// @returns Number of bytes written. Not null terminated
+        static std::size_t format_float(const double value,           ///< Number to write
+                                        const Number_format & format, ///< Formatting
+                                        char * out                    ///< Destination. Must have room for \ref max_number_size bytes
+                                        );
+
+        /// Build buffer of quads and coordinate data for a formatted number
+
+        /// Like \ref build_text, but for ASCII only, without kerning or
+        /// shaping, and with digits, signs, and separators looked up through
+        /// \ref number_glyphs_
+        void build_number(const char * text,      ///< Text to build data for. ASCII only
+                          const std::size_t size, ///< Size of \p text
+                          const bool fixed_width, ///< Give every digit the widest digit's advance
+                          Text_layout & layout    ///< Layout to fill in. Existing contents are replaced
+                          );
+
+        /// @}
+
+        /// Reset a text box so that any glyph will expand it
+        static void init_text_box(Bbox<float> & text_box);
+
+        /// Get kerning between two glyphs, in pixels
+        static Vec2<float> kerning(FT_Face face,              ///< Face, already sized
+                                   const FT_UInt prev_glyph_i, ///< Previous glyph index
+                                   const FT_UInt glyph_i,      ///< Current glyph index
+                                   const bool subpixel         ///< Get unfitted kerning, for subpixel positioning
+                                   );
+
+        /// Add the quad for a resident glyph to a layout in progress
+        void add_quad(const Char_info & c,                                 ///< Glyph
+                      const Vec2<float> & pen,                             ///< Glyph origin
+                      Resource_vector<Vec2<float>> & screen_and_tex_coords, ///< Interleaved vertex and texture coordinates are appended here
+                      Resource_vector<GLuint> & quad_tex,                  ///< Glyph's atlas texture is appended here
+                      Bbox<float> & text_box,                              ///< Expanded to hold the glyph. Not affected by \p padding
+                      const int padding = 0                                ///< Grow the quad by this many pixels on every side, as in Text_layout::padding
+                      ) const;
+
+        /// Record the glyph and line index of a quad, for Text_layout::glyph_ids
+        static void add_quad_ids(const std::size_t glyph,             ///< Glyph index
+                                 const std::size_t line,              ///< Line index
+                                 Resource_vector<GLushort> & quad_ids ///< Indexes are appended here. Saturates at 65535
+                                 );
+
+        /// Sort quads by atlas into a layout's coords and coord_data
+        void group_quads(const Resource_vector<Vec2<float>> & screen_and_tex_coords, ///< Coordinates from \ref add_quad
+                         const Resource_vector<GLuint> & quad_tex,                  ///< Atlas textures from \ref add_quad
+                         Text_layout & layout,                                      ///< Layout to fill in
+                         const Resource_vector<GLushort> * quad_ids = nullptr       ///< Indexes from \ref add_quad_ids, to fill in Text_layout::glyph_ids. May be nullptr if not wanted
+                         );
+
+        /// Glyph metrics for layout workers, for a single font size and fallback chain
+
+        /// Reads are lock-free. Glyph metrics are stored in 256 entry pages,
+        /// like \ref page_map_. Pages and entries are published once, with
+        /// release stores, and never changed afterward, so readers only need
+        /// acquire loads to see complete entries. Inserts are serialized.
+        /// Nothing is freed until the cache is destroyed, which happens
+        /// when the font size or fallbacks change and no worker still holds it
+        class Metrics_cache
+        {
+        public:
+            /// Metrics for one code point
+            struct Metrics
+            {
+                FT_UInt glyph_i = 0;   ///< Glyph index
+                unsigned int face_i = 0; ///< Face the glyph is from, as in Char_info::face_i
+                Vec2<float> advance;   ///< Distance to next glyph's origin, in pixels
+                bool ok = false;       ///< \c false if the glyph failed to load
+            };
+
+            /// Create an empty cache
+            Metrics_cache(const unsigned int font_size,                 ///< Font size the metrics are for
+                          const unsigned int subpixel_phases,           ///< Subpixel positioning the metrics are for
+                          std::shared_ptr<const Fallback_list> fallbacks ///< Fallback fonts the metrics are for
+                          );
+            ~Metrics_cache();
+
+            /// @name Non-copyable, non-movable
+            /// @{
+            Metrics_cache(const Metrics_cache &) = delete;
+            Metrics_cache & operator=(const Metrics_cache &) = delete;
+            /// @}
+
+            /// Look up metrics, without locking
+            /// @returns Metrics, or nullptr if not cached yet
+            const Metrics * find(const uint32_t code_pt) const;
+
+            /// Add metrics, unless another thread already has
+            /// @returns Cached metrics, or nullptr if \p code_pt is outside of Unicode
+            const Metrics * insert(const uint32_t code_pt, const Metrics & metrics);
+
+            const unsigned int font_size;                         ///< Font size the metrics are for
+            const unsigned int subpixel_phases;                   ///< Subpixel positioning the metrics are for
+            const std::shared_ptr<const Fallback_list> fallbacks; ///< Fallback fonts the metrics are for
+
+        private:
+            /// Cached metrics
+            struct Entry
+            {
+                std::atomic<bool> published{false}; ///< Set once \ref metrics is filled in
+                Metrics metrics;                    ///< Metrics
+            };
+
+            /// Metrics for a page of 256 code points
+            struct Page
+            {
+                Entry entries[256]; ///< Entry for each code point on the page
+            };
+
+            static const std::size_t num_pages = 0x110000 / 256; ///< Number of pages needed to cover Unicode
+
+            std::unique_ptr<std::atomic<Page *>[]> pages_; ///< Page table. null for pages with nothing cached
+            std::mutex write_mutex_;                      ///< Serializes inserts
+        };
+
+        /// Queue text to be laid out by \ref layout_worker, starting it if needed
+        void layout_async(std::shared_ptr<Async_layout> layout);
+
+        /// Layout worker thread
+
+        /// Lays out text with its own face, without rendering glyphs or
+        /// touching the atlases, so it can run alongside the rendering
+        /// thread. Workers share \ref metrics_cache_
+        void layout_worker();
+
+#ifdef TEXTOGL_USE_HARFBUZZ
+        /// Glyph placed by HarfBuzz
+        struct Shaped_glyph
+        {
+            unsigned int face_i; ///< Face the glyph is from, as in Char_info::face_i
+            FT_UInt glyph_i;     ///< Glyph index
+            Vec2<float> offset;  ///< Offset from the pen position to the glyph's origin, in pixels
+            Vec2<float> advance; ///< Distance to move the pen after the glyph, in pixels
+        };
+
+        /// Single line of text shaped by HarfBuzz, cached in \ref shaped_runs_
+        struct Shaped_run
+        {
+            /// Create an empty run
+            explicit Shaped_run(Memory_resource * resource ///< Resource to allocate from
+                                ): text(resource), glyphs(resource)
+            {}
+
+            Resource_string text;                ///< Text of the run, in UTF-8 encoding
+            std::size_t hash = 0;                ///< Hash of \ref text, as used in \ref shaped_run_index_
+            Resource_vector<Shaped_glyph> glyphs; ///< Shaped glyphs, in visual order
+        };
+
+        /// Shaped runs, most recently used first
+        using Shaped_run_list = std::list<Shaped_run, Resource_allocator<Shaped_run>>;
+
+        /// Create HarfBuzz objects for \ref face_ and \ref fallback_faces_, or update them for a new size
+
+        /// Called by \ref resize, which is also called when fallbacks change.
+        /// Clears \ref shaped_glyphs_ and \ref shaped_runs_
+        void resize_shaping();
+
+        /// Get the HarfBuzz font for a face, by Char_info::face_i
+        hb_font_t * hb_font_for(const unsigned int face_i) const
+        {
+            return face_i == 0 ? hb_font_ : fallback_hb_fonts_[face_i - 1];
+        }
+
+        /// Check if a face has a glyph for a code point, by Char_info::face_i
+        bool face_has(const unsigned int face_i, const uint32_t code_pt) const
+        {
+            return face_i == 0 ? FT_Get_Char_Index(face_, code_pt) != 0 : (*fallback_list_)[face_i - 1].coverage->has(code_pt);
+        }
+
+        /// Check if text needs to be shaped
+
+        /// Pure ASCII text in a font with no GSUB or GPOS tables, and no
+        /// features set, lays out the same without HarfBuzz, so it is built
+        /// by the faster per code point path instead
+        bool needs_shaping(const char * utf8_input,    ///< Text to check
+                           const std::size_t utf8_size ///< Size of \p utf8_input in bytes
+                           ) const;
+
+        /// Shape a single line of text, or get it from \ref shaped_runs_
+
+        /// The line is split into runs by the face each code point is found
+        /// in, as for per code point text, and each run is shaped with that
+        /// face's HarfBuzz font. Code points with no script of their own
+        /// (spaces, punctuation, combining marks) stay in the current run if
+        /// its face has them, so they're shaped along with their neighbors
+        /// @returns Shaped glyphs. Valid until the next call
+        const Resource_vector<Shaped_glyph> & shape_run(const char * utf8_input,    ///< Text to shape. Must not contain newlines
+                                                        const std::size_t utf8_size ///< Size of \p utf8_input in bytes
+                                                        );
+
+        /// Build buffer of quads for and coordinate data for text display, shaping it with HarfBuzz
+
+        /// Temporary data is allocated from \ref arena_, and is only freed by the caller's Arena::Scope, so the layout can be allocated from it too
+        void build_shaped_text(const char * utf8_input,    ///< Text to build data for
+                               const std::size_t utf8_size, ///< Size of \p utf8_input in bytes
+                               Text_layout & layout         ///< Layout to fill in. Existing contents are replaced
+                               );
+
+        /// Get info for a glyph index, rendering it into an atlas if needed
+
+        /// Same as \ref use_glyph, for shaped text, which may use glyphs
+        /// with no code point, such as ligatures
+        Char_info & use_glyph_index(const unsigned int face_i, const FT_UInt glyph_i, Resource_vector<Char_info *> * glyphs = nullptr);
+
+        /// Render a glyph by index and copy it into a free atlas cell
+        void load_glyph_index(const unsigned int face_i, ///< Face to render from, as in Char_info::face_i
+                              const FT_UInt glyph_i,     ///< Glyph index to render
+                              Char_info & c              ///< Info to fill in for the glyph
+                              );
+#endif
+
+        /// Build buffer of quads for and coordinate data for text display
+        void build_text(const std::string & utf8_input, ///< Text to build data for
+                        Text_layout & layout            ///< Layout to fill in. Existing contents are replaced
+                        )
+        {
+            build_text(utf8_input.data(), utf8_input.size(), layout);
+        }
 
         /// Load text into OpenGL vertex buffer object
-        void load_text_vbo(const std::vector<Vec2<float>> & coords ///< Vertex coordinates returned as part of \ref build_text
+        void load_text_vbo(const Resource_vector<Vec2<float>> & coords ///< Vertex coordinates returned as part of \ref build_text
                           ) const;
 
-        static std::unique_ptr<Font_common> common_data_; ///< Font data common to all instances of Font_sys
-        static unsigned int common_ref_cnt_; ///< Reference count for \ref common_data_
+        /// Get shared data for the current context, creating it if needed, and add a reference to it
+
+        /// The reference is held by the Font_sys, for the context it was created in
+        static Font_common & acquire_common();
+
+        /// Remove a reference to shared data for \p context, destroying it if unused and not kept alive
+
+        /// \p context must be current
+        static void release_common(Font_sys::Context_handle context ///< Context to release data for
+                                   );
+
+        /// Get shared data for the current context, creating it without a reference if needed
+
+        /// Used to render fonts in contexts other than the one they were created in
+        static Font_common & get_common();
+
+        /// Get shared data for the current context, without locking if it's \ref context_
+        Font_common & common() const
+        {
+            return current_context_ == context_ ? *common_ : get_common();
+        }
+
+        /// Bind a vertex array for \p vbo
+
+        /// \p vao is used if it belongs to the current context. Otherwise,
+        /// the current context's Font_common::vao is bound and set up for \p vbo
+        void bind_vertex_array(
+#ifndef USE_OPENGL_ES
+                               GLuint vao,                           ///< Vertex array object
+                               Font_sys::Context_handle vao_context, ///< Context \p vao was created in
+#endif
+                               GLuint vbo                            ///< Vertex buffer object
+                               ) const;
+
+        static std::mutex common_mutex_; ///< Lock for \ref common_data_, \ref keep_common_, and \ref program_cache_dir_
+        static std::unordered_map<Font_sys::Context_handle, Common_entry> common_data_; ///< Font data common to all instances of Font_sys, per context
+        static bool keep_common_;            ///< Keep \ref common_data_ when no Font_sys objects are using it
+        static std::string program_cache_dir_; ///< Directory for cached shader program binaries. Empty to disable
+        static thread_local Font_sys::Context_handle current_context_; ///< Context current on this thread, as set by Font_sys::set_current_context
+
+        Font_sys::Context_handle context_ = nullptr; ///< Context this font was created in
+        Font_common * common_ = nullptr;             ///< Shared data for \ref context_. Owned by \ref common_data_
 
         /// @name Font data
         /// @{
-        unsigned char * font_data_ = nullptr; ///< Font file data
+        FT_Library ft_lib_ = nullptr;         ///< Freetype library for fonts loaded with Font_sys::load_async. nullptr when using Font_common::ft_lib
         FT_Face face_;                        ///< Font face. [See Freetype documentation](https://www.freetype.org/freetype2/docs/reference/ft2-base_interface.html#FT_Face)
+        float face_scale_ = 1.0f;             ///< Scale for glyphs from \ref face_, as returned by \ref set_face_size
         bool has_kerning_info_;               ///< \c true if the font has kerning information available
-        Bbox<int> cell_bbox_;                 ///< Bounding box representing maximum extents of a glyph
+        std::vector<FT_Face> fallback_faces_; ///< Faces for \ref fallback_list_, in the same order
+        std::vector<float> fallback_scales_;  ///< Scale for each of \ref fallback_faces_
+        /// Fallback fonts. Replaced rather than modified, so workers can hold
+        /// on to the list they started with. Written under \ref layout_mutex_
+        std::shared_ptr<const Fallback_list> fallback_list_;
+        Bbox<int> cell_bbox_;                 ///< Bounding box representing maximum extents of a glyph, plus \ref style_padding_
+        unsigned int style_padding_ = 0;      ///< Extra space around glyphs in their atlas cells, for Text_style effects. Only grows
         int line_height_;                     ///< Spacing between baselines for each line of text
         /// @}
 
         /// @name Texture size
-        /// Width and height of the texture. Each font page will be rendered to a
+        /// Width and height of the texture. Each atlas will be rendered to a
         /// grid of 16x16 glyphs, with each cell in the grid being
         /// \ref cell_bbox_ sized + 2px for padding
         /// @{
@@ -262,8 +1341,72 @@ namespace textogl
         size_t tex_height_;
         /// @}
 
-        std::unordered_map<uint32_t, Page> page_map_; ///< Font pages
+        Counting_resource resource_; ///< Resource for all internal containers. Declared before the containers so it outlives them
+
+        Resource_map<uint32_t, Page> page_map_; ///< Font pages
+        Number_glyphs number_glyphs_;           ///< Entries in \ref page_map_ for writing numbers
+        Resource_map<GLuint, Atlas> atlases_;   ///< Glyph atlases, by texture
+
+        Arena arena_; ///< Scratch memory for building text. Reset by Font_sys::end_frame
+
+        Font_source source_;     ///< Where the font was loaded from
+        std::atomic<unsigned int> font_size_; ///< Font size (in pixels). Read by \ref layout_worker
+
+        /// @name Subpixel positioning
+        /// @{
+        std::atomic<unsigned int> subpixel_phases_{1}; ///< Offsets per pixel glyphs are rasterized at. 1 when off. Read by \ref layout_worker
+        Resource_map<uint64_t, Char_info> subpixel_glyphs_; ///< Variants at nonzero phases. Keyed by code point (or glyph index, past the end of Unicode, for shaped text) times 4, plus phase
+        /// @}
+
+        std::vector<std::unique_ptr<Preload_job>> preload_jobs_; ///< Preloads not yet uploaded
+
+        /// @name Asynchronous layout
+        /// @{
+        std::mutex layout_mutex_;                               ///< Guards the other members of this group
+        std::condition_variable layout_cv_;                     ///< Signaled when \ref layout_queue_ or \ref layout_stop_ changes
+        std::deque<std::shared_ptr<Async_layout>> layout_queue_; ///< Text waiting to be laid out
+        std::vector<std::thread> layout_threads_;               ///< Run \ref layout_worker. Started as needed
+        unsigned int max_layout_threads_ = 1;                   ///< Maximum size of \ref layout_threads_
+        unsigned int layout_idle_ = 0;                          ///< Number of workers waiting for text
+        std::shared_ptr<Metrics_cache> metrics_cache_;          ///< Metrics for the current font size
+        bool layout_stop_ = false;                              ///< Set to stop \ref layout_threads_
+        /// @}
+#ifdef TEXTOGL_USE_HARFBUZZ
+        /// @name Shaping
+        /// @{
+        hb_font_t * hb_font_ = nullptr;                     ///< HarfBuzz font for \ref face_
+        std::vector<hb_font_t *> fallback_hb_fonts_;        ///< HarfBuzz fonts for \ref fallback_faces_, in the same order
+        hb_buffer_t * hb_buffer_ = nullptr;                 ///< Buffer reused for every run shaped
+        bool complex_font_ = false;                         ///< \c true if the font has GSUB or GPOS tables, so even ASCII text must be shaped
+        Resource_vector<hb_feature_t> features_;            ///< Features set with Font_sys::set_shaping_features
+        Resource_map<uint64_t, Char_info> shaped_glyphs_;   ///< Glyphs used by shaped text, by face index (upper 32 bits) and glyph index
+        Shaped_run_list shaped_runs_;                       ///< Cached runs, most recently used first
+        Resource_map<std::size_t, Shaped_run_list::iterator> shaped_run_index_; ///< Cached runs, by hash of their text
+        static const std::size_t max_shaped_runs = 256;     ///< Size of the shaped run cache. The least recently used run is replaced once full
+        /// @}
+#endif
+#ifndef USE_OPENGL_ES
+        std::vector<std::unique_ptr<Upload_batch>> uploads_;     ///< Batches submitted to \ref upload_thread_ and not yet applied
+        static Upload_thread upload_thread_;                     ///< Thread for uploading preloaded glyphs. See Font_sys::start_upload_thread
+#endif
+
+        /// @name Usage recording
+        /// @{
+        bool record_usage_ = false;       ///< \c true when recording glyph usage
+        Resource_vector<uint32_t> usage_; ///< Code points in order of first use, from \ref use_glyph only. May contain duplicates after a resize
+        /// @}
+
+        /// @name Glyph residency
+        /// @{
+        std::size_t frame_ = 0;                ///< Current frame number. Advanced by Font_sys::end_frame
+        std::size_t op_ = 0;                   ///< Current build / render operation number. Glyphs used by the current operation are never evicted
+        std::size_t layout_generation_ = 0;    ///< Incremented whenever glyphs move or are evicted, invalidating built layouts
+        std::size_t resize_generation_ = 0;    ///< Incremented by \ref resize, which changes how glyphs are rendered. Invalidates preloaded glyphs
+        std::size_t atlas_memory_limit_ = 0;   ///< Maximum texture memory for atlases, in bytes. 0 for no limit
+        std::size_t atlas_memory_usage_ = 0;   ///< Texture memory currently used by atlases, in bytes
+        /// @}
 
+        bool gl_initialized_ = false; ///< \c true once \ref init_gl has run
 #ifndef USE_OPENGL_ES
         GLuint vao_; ///< OpenGL Vertex array object index
 #endif
@@ -0,0 +1,344 @@
+/// @file
+/// @brief Cached renders of text, drawn as a single quad
+
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "font_impl.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef USE_OPENGL_ES
+#include <GLES2/gl2.h>
+#else
+#include <GL/glew.h>
+#endif
+
+namespace textogl
+{
+    std::mutex Font_sys::Impl::Impostor::pool_mutex_;
+    std::size_t Font_sys::Impl::Impostor::memory_limit_ = 32 * 1024 * 1024;
+    std::size_t Font_sys::Impl::Impostor::memory_usage_ = 0;
+    std::list<Font_sys::Impl::Impostor *> Font_sys::Impl::Impostor::lru_;
+
+    Font_sys::Impl::Impostor::Impostor(Memory_resource * resource):
+        coord_data_(resource)
+    {
+        context_ = Font_sys::get_current_context();
+#ifndef USE_OPENGL_ES
+        glGenVertexArrays(1, &vao_);
+#endif
+        glGenBuffers(1, &vbo_);
+
+#ifndef USE_OPENGL_ES
+        GLint old_vao{0}, old_vbo{0};
+        glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &old_vao);
+        glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &old_vbo);
+
+        glBindVertexArray(vao_);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(Vec2<float>), NULL);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(Vec2<float>), (const GLvoid *)sizeof(Vec2<float>));
+        glEnableVertexAttribArray(1);
+
+        glBindVertexArray(old_vao);
+        glBindBuffer(GL_ARRAY_BUFFER, old_vbo);
+#endif
+    }
+
+    Font_sys::Impl::Impostor::~Impostor()
+    {
+        invalidate();
+
+        glDeleteBuffers(1, &vbo_);
+#ifndef USE_OPENGL_ES
+        glDeleteVertexArrays(1, &vao_);
+#endif
+    }
+
+    bool Font_sys::Impl::Impostor::valid(const Color & color, const float scale, const float scale_threshold) const
+    {
+        if(!valid_)
+            return false;
+
+        for(int i = 0; i < 4; ++i)
+        {
+            if(color[i] != color_[i])
+                return false;
+        }
+
+        return scale <= scale_ * scale_threshold && scale_ <= scale * scale_threshold;
+    }
+
+    void Font_sys::Impl::Impostor::invalidate()
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex_);
+        release();
+    }
+
+    void Font_sys::Impl::Impostor::release()
+    {
+        valid_ = false;
+        if(!tex_)
+            return;
+
+        glDeleteTextures(1, &tex_);
+        tex_ = 0;
+
+        memory_usage_ -= bytes_;
+        bytes_ = 0;
+        lru_.erase(lru_pos_);
+    }
+
+    bool Font_sys::Impl::Impostor::update(Font_sys::Impl & font, const Color & color, const float scale, const Bbox<float> & text_box,
+            const Resource_vector<Coord_data> & coord_data,
+#ifndef USE_OPENGL_ES
+            GLuint vao, Font_sys::Context_handle vao_context,
+#endif
+            GLuint vbo)
+    {
+        std::unique_lock<std::mutex> lock(pool_mutex_);
+        release();
+
+        color_ = color;
+        scale_ = scale;
+
+        // nothing to draw. there's no texture, but this is still up to date
+        if(coord_data.empty())
+        {
+            valid_ = true;
+            return true;
+        }
+
+        // shrink renders too big for a texture. they'll be blurry, but not re-rendered every frame
+        GLint max_size{0};
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+
+        float render_scale = std::max(scale, 1.0f / 64.0f);
+        float largest = std::max(text_box.width(), text_box.lr.y - text_box.ul.y) * render_scale + 3.0f;
+        if(largest > max_size)
+            render_scale *= (max_size - 3) / largest;
+
+        // snap the corner to a whole texel, and leave a texel of margin for filtering
+        Vec2<float> corner{std::floor(text_box.ul.x * render_scale) - 1.0f, std::floor(text_box.ul.y * render_scale) - 1.0f};
+        GLsizei width = static_cast<GLsizei>(std::ceil(text_box.lr.x * render_scale) - corner.x) + 1;
+        GLsizei height = static_cast<GLsizei>(std::ceil(text_box.lr.y * render_scale) - corner.y) + 1;
+        corner.x /= render_scale;
+        corner.y /= render_scale;
+
+        std::size_t bytes = static_cast<std::size_t>(width) * height * 4;
+        if(memory_limit_ && bytes > memory_limit_)
+            return false;
+
+        // make room, freeing the least recently drawn. only this context's textures can be deleted here
+        if(memory_limit_)
+        {
+            auto current_context = Font_sys::get_current_context();
+            auto victim = lru_.rbegin();
+            while(memory_usage_ + bytes > memory_limit_)
+            {
+                while(victim != lru_.rend() && (*victim)->context_ != current_context)
+                    ++victim;
+
+                if(victim == lru_.rend())
+                    return false;
+
+                // release erases the victim from lru_, so step past it first
+                Impostor * impostor = *victim++;
+                impostor->release();
+            }
+        }
+
+        memory_usage_ += bytes;
+        bytes_ = bytes;
+        lru_.push_front(this);
+        lru_pos_ = lru_.begin();
+        context_ = Font_sys::get_current_context();
+
+        lock.unlock();
+
+        // save old settings
+        GLint old_fbo{0}, old_active_texture{0}, old_texture_2d{0}, old_vbo{0};
+        GLint old_viewport[4]{0, 0, 0, 0};
+        GLfloat old_clear_color[4]{0.0f, 0.0f, 0.0f, 0.0f};
+
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_fbo);
+        glGetIntegerv(GL_ACTIVE_TEXTURE, &old_active_texture);
+        glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &old_vbo);
+        glGetIntegerv(GL_VIEWPORT, old_viewport);
+        glGetFloatv(GL_COLOR_CLEAR_VALUE, old_clear_color);
+
+        auto old_scissor_test = glIsEnabled(GL_SCISSOR_TEST);
+        auto old_stencil_test = glIsEnabled(GL_STENCIL_TEST);
+
+        glActiveTexture(GL_TEXTURE0);
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &old_texture_2d);
+
+        glGenTextures(1, &tex_);
+        glBindTexture(GL_TEXTURE_2D, tex_);
+#ifndef USE_OPENGL_ES
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+#else
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+#endif
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, old_texture_2d);
+
+        GLuint fbo;
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex_, 0);
+
+        glViewport(0, 0, width, height);
+        glDisable(GL_SCISSOR_TEST);
+        glDisable(GL_STENCIL_TEST);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        // text pixels to texels, with the corner at texel 0. texture rows run down the text
+        Mat4<float> model_view_projection
+        {
+            2.0f * render_scale / width, 0.0f,                          0.0f, 0.0f,
+            0.0f,                        2.0f * render_scale / height,  0.0f, 0.0f,
+            0.0f,                        0.0f,                          1.0f, 0.0f,
+           -1.0f - 2.0f * corner.x * render_scale / width, -1.0f - 2.0f * corner.y * render_scale / height, 0.0f, 1.0f
+        };
+
+        font.render_text_common(color, model_view_projection, coord_data,
+#ifndef USE_OPENGL_ES
+                vao, vao_context,
+#endif
+                vbo, nullptr, nullptr, Blend::TO_PREMULTIPLIED);
+
+        // restore old settings
+        glBindFramebuffer(GL_FRAMEBUFFER, old_fbo);
+        glDeleteFramebuffers(1, &fbo);
+
+        glViewport(old_viewport[0], old_viewport[1], old_viewport[2], old_viewport[3]);
+        glClearColor(old_clear_color[0], old_clear_color[1], old_clear_color[2], old_clear_color[3]);
+        if(old_scissor_test)
+            glEnable(GL_SCISSOR_TEST);
+        if(old_stencil_test)
+            glEnable(GL_STENCIL_TEST);
+        glActiveTexture(old_active_texture);
+
+        // one quad over the text's area, in the same order as Font_sys::Impl::add_quad
+        Vec2<float> far_corner{corner.x + width / render_scale, corner.y + height / render_scale};
+        Vec2<float> quad[]
+        {
+            {corner.x, far_corner.y},     {0.0f, 1.0f},
+            {far_corner.x, far_corner.y}, {1.0f, 1.0f},
+            {corner.x, corner.y},         {0.0f, 0.0f},
+
+            {corner.x, corner.y},         {0.0f, 0.0f},
+            {far_corner.x, far_corner.y}, {1.0f, 1.0f},
+            {far_corner.x, corner.y},     {1.0f, 0.0f}
+        };
+
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, old_vbo);
+
+        // the texture holds premultiplied color, drawn as a color glyph
+        coord_data_.clear();
+        coord_data_.emplace_back();
+        Coord_data & c = coord_data_.back();
+        c.tex = tex_;
+        c.color = true;
+        c.start = 0;
+        c.num_elements = 6;
+
+        valid_ = true;
+        return true;
+    }
+
+    void Font_sys::Impl::Impostor::render(Font_sys::Impl & font, const Vec2<float> & win_size, const Vec2<float> & pos,
+            const int align_flags, const float rotation, const Bbox<float> & text_box)
+    {
+        if(!tex_)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex_);
+            lru_.splice(lru_.begin(), lru_, lru_pos_);
+        }
+
+        font.render_text_common({1.0f, 1.0f, 1.0f, 1.0f}, win_size, pos, align_flags, rotation, text_box, coord_data_,
+#ifndef USE_OPENGL_ES
+                vao_, context_,
+#endif
+                vbo_, nullptr, nullptr, Blend::PREMULTIPLIED);
+    }
+
+    void Font_sys::Impl::Impostor::render(Font_sys::Impl & font, const Mat4<float> & model_view_projection)
+    {
+        if(!tex_)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex_);
+            lru_.splice(lru_.begin(), lru_, lru_pos_);
+        }
+
+        font.render_text_common({1.0f, 1.0f, 1.0f, 1.0f}, model_view_projection, coord_data_,
+#ifndef USE_OPENGL_ES
+                vao_, context_,
+#endif
+                vbo_, nullptr, nullptr, Blend::PREMULTIPLIED);
+    }
+
+    float Font_sys::Impl::Impostor::effective_scale(const Mat4<float> & model_view_projection, const Bbox<float> & text_box)
+    {
+        GLint viewport[4]{0, 0, 0, 0};
+        glGetIntegerv(GL_VIEWPORT, viewport);
+
+        // window position of a text-space point
+        auto to_window = [&](const Vec2<float> & point, bool & ok)
+        {
+            Vec4<float> clip{0.0f, 0.0f, 0.0f, 0.0f};
+            for(int i = 0; i < 4; ++i)
+                clip[i] = model_view_projection[0][i] * point.x + model_view_projection[1][i] * point.y + model_view_projection[3][i];
+
+            ok = ok && clip.w > 0.0f;
+            return Vec2<float>{clip.x / clip.w * viewport[2] / 2.0f, clip.y / clip.w * viewport[3] / 2.0f};
+        };
+
+        // how far a pixel step at the center of the text moves on screen
+        Vec2<float> center{(text_box.ul.x + text_box.lr.x) / 2.0f, (text_box.ul.y + text_box.lr.y) / 2.0f};
+        bool ok = true;
+        auto origin = to_window(center, ok);
+        auto x_step = to_window({center.x + 1.0f, center.y}, ok);
+        auto y_step = to_window({center.x, center.y + 1.0f}, ok);
+
+        // behind the camera. the text can't be seen, so any scale will do
+        if(!ok)
+            return 1.0f;
+
+        float x_scale = std::hypot(x_step.x - origin.x, x_step.y - origin.y);
+        float y_scale = std::hypot(y_step.x - origin.x, y_step.y - origin.y);
+
+        return std::max(x_scale, y_scale);
+    }
+}
@@ -0,0 +1,93 @@
+/// @file
+/// @brief Memory resources and allocators
+
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "memory_resource.hpp"
+
+#include <new>
+
+namespace textogl
+{
+#ifndef TEXTOGL_USE_PMR
+    namespace
+    {
+        /// Resource using operator new / delete
+        class New_delete_resource: public Memory_resource
+        {
+        private:
+            void * do_allocate(const std::size_t bytes, const std::size_t) override
+            {
+                return ::operator new(bytes);
+            }
+            void do_deallocate(void * p, const std::size_t, const std::size_t) override
+            {
+                ::operator delete(p);
+            }
+        };
+    }
+#endif
+
+    Memory_resource * default_resource()
+    {
+#ifdef TEXTOGL_USE_PMR
+        return std::pmr::get_default_resource();
+#else
+        static New_delete_resource resource;
+        return &resource;
+#endif
+    }
+
+    Counting_resource::Counting_resource(Memory_resource * upstream):
+        upstream_(upstream ? upstream : default_resource()),
+        bytes_in_use_(0)
+    {}
+
+    std::size_t Counting_resource::bytes_in_use() const
+    {
+        return bytes_in_use_;
+    }
+
+    Memory_resource * Counting_resource::upstream() const
+    {
+        return upstream_;
+    }
+
+    void * Counting_resource::do_allocate(const std::size_t bytes, const std::size_t alignment)
+    {
+        void * p = upstream_->allocate(bytes, alignment);
+        bytes_in_use_ += bytes;
+        return p;
+    }
+
+    void Counting_resource::do_deallocate(void * p, const std::size_t bytes, const std::size_t alignment)
+    {
+        upstream_->deallocate(p, bytes, alignment);
+        bytes_in_use_ -= bytes;
+    }
+
+#ifdef TEXTOGL_USE_PMR
+    bool Counting_resource::do_is_equal(const Memory_resource & other) const noexcept
+    {
+        return this == &other;
+    }
+#endif
+}
@@ -0,0 +1,167 @@
+/// @file
+/// @brief Memory resources and allocators
+
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef MEMORY_RESOURCE_HPP
+#define MEMORY_RESOURCE_HPP
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cstddef>
+
+#ifdef TEXTOGL_USE_PMR
+#include <memory_resource>
+#endif
+
+/// @cond INTERNAL
+
+/// @ingroup textogl
+namespace textogl
+{
+#ifdef TEXTOGL_USE_PMR
+    using Memory_resource = std::pmr::memory_resource;
+#else
+    /// Source of memory for internal containers
+
+    /// Same interface as C++17's std::pmr::memory_resource, which is used
+    /// instead when built with TEXTOGL_USE_PMR
+    class Memory_resource
+    {
+    public:
+        virtual ~Memory_resource() = default;
+
+        /// Allocate memory
+        void * allocate(const std::size_t bytes, const std::size_t alignment = alignof(std::max_align_t))
+        {
+            return do_allocate(bytes, alignment);
+        }
+
+        /// Free memory returned by \ref allocate
+        void deallocate(void * p, const std::size_t bytes, const std::size_t alignment = alignof(std::max_align_t))
+        {
+            do_deallocate(p, bytes, alignment);
+        }
+
+    private:
+        virtual void * do_allocate(const std::size_t bytes, const std::size_t alignment) = 0;
+        virtual void do_deallocate(void * p, const std::size_t bytes, const std::size_t alignment) = 0;
+    };
+#endif
+
+    /// Get the resource used when none is given
+
+    /// Uses operator new / delete, or std::pmr::get_default_resource when built with TEXTOGL_USE_PMR
+    Memory_resource * default_resource();
+
+    /// Memory resource that keeps track of how much memory is in use
+
+    /// All allocations are passed on to an upstream resource
+    class Counting_resource: public Memory_resource
+    {
+    public:
+        /// Create a counting resource
+        explicit Counting_resource(Memory_resource * upstream ///< Resource to allocate from. nullptr for \ref default_resource
+                                   );
+
+        /// @name Non-copyable, non-movable
+        /// @{
+        Counting_resource(const Counting_resource &) = delete;
+        Counting_resource & operator=(const Counting_resource &) = delete;
+
+        Counting_resource(Counting_resource &&) = delete;
+        Counting_resource & operator=(Counting_resource &&) = delete;
+        /// @}
+
+        /// Get the number of bytes currently allocated through this resource
+        std::size_t bytes_in_use() const;
+
+        /// Get the upstream resource
+        Memory_resource * upstream() const;
+
+    private:
+        void * do_allocate(const std::size_t bytes, const std::size_t alignment) override;
+        void do_deallocate(void * p, const std::size_t bytes, const std::size_t alignment) override;
+#ifdef TEXTOGL_USE_PMR
+        bool do_is_equal(const Memory_resource & other) const noexcept override;
+#endif
+
+        Memory_resource * upstream_;           ///< Resource to allocate from
+        std::atomic<std::size_t> bytes_in_use_; ///< Number of bytes currently allocated
+    };
+
+    /// Standard library allocator for Memory_resource
+
+    /// Copying a container using this allocator always gives a container using
+    /// \ref default_resource, (as with std::pmr::polymorphic_allocator) so that
+    /// scratch data can be safely copied into long-lived containers.
+    template<typename T>
+    struct Resource_allocator
+    {
+        using value_type = T;
+
+        Resource_allocator(Memory_resource * resource = nullptr): resource(resource ? resource : default_resource()) {}
+        template<typename U> Resource_allocator(const Resource_allocator<U> & other): resource(other.resource) {}
+
+        T * allocate(const std::size_t n)
+        {
+            return static_cast<T *>(resource->allocate(n * sizeof(T), alignof(T)));
+        }
+
+        void deallocate(T * p, const std::size_t n)
+        {
+            resource->deallocate(p, n * sizeof(T), alignof(T));
+        }
+
+        Resource_allocator select_on_container_copy_construction() const
+        {
+            return Resource_allocator();
+        }
+
+        Memory_resource * resource; ///< Resource to allocate from
+    };
+
+    template<typename T, typename U>
+    bool operator==(const Resource_allocator<T> & a, const Resource_allocator<U> & b)
+    {
+        return a.resource == b.resource;
+    }
+    template<typename T, typename U>
+    bool operator!=(const Resource_allocator<T> & a, const Resource_allocator<U> & b)
+    {
+        return a.resource != b.resource;
+    }
+
+    /// Vector allocating from a Memory_resource
+    template<typename T> using Resource_vector = std::vector<T, Resource_allocator<T>>;
+
+    /// String allocating from a Memory_resource
+    using Resource_string = std::basic_string<char, std::char_traits<char>, Resource_allocator<char>>;
+
+    /// Unordered map allocating from a Memory_resource
+    template<typename Key, typename T> using Resource_map =
+        std::unordered_map<Key, T, std::hash<Key>, std::equal_to<Key>, Resource_allocator<std::pair<const Key, T>>>;
+}
+/// @endcond INTERNAL
+#endif // MEMORY_RESOURCE_HPP
@@ -0,0 +1,241 @@
+/// @file
+/// @brief Number formatting and layout
+
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "font_impl.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace textogl
+{
+    namespace
+    {
+        /// Write a number from its parts
+        /// @returns Number of bytes written
+        std::size_t write_number(const bool negative,          ///< Write a '-' sign
+                                 uint64_t int_part,            ///< Integer part
+                                 uint64_t frac_part,           ///< Fractional part, as an integer with \p precision digits
+                                 const unsigned int precision, ///< Digits after the decimal point
+                                 const Number_format & format, ///< Formatting
+                                 char * out                    ///< Destination
+                                 )
+        {
+            char * p = out;
+
+            if(negative)
+                *p++ = '-';
+            else if(format.show_plus && (int_part != 0 || frac_part != 0))
+                *p++ = '+';
+
+            // digits come out lowest first
+            char digits[32];
+            unsigned int num_digits = 0;
+            do
+            {
+                digits[num_digits++] = static_cast<char>('0' + int_part % 10);
+                int_part /= 10;
+            } while(int_part != 0);
+
+            while(num_digits < std::min(format.min_digits, 32u))
+                digits[num_digits++] = '0';
+
+            for(unsigned int i = num_digits; i-- > 0;)
+            {
+                *p++ = digits[i];
+                if(format.group_thousands && i > 0 && i % 3 == 0)
+                    *p++ = ',';
+            }
+
+            if(precision > 0)
+            {
+                *p++ = '.';
+                for(unsigned int i = precision; i-- > 0;)
+                {
+                    p[i] = static_cast<char>('0' + frac_part % 10);
+                    frac_part /= 10;
+                }
+                p += precision;
+            }
+
+            return p - out;
+        }
+    }
+
+    void Font_sys::render_integer(const long long value, const Number_format & format, const Color & color,
+            const Vec2<float> & win_size, const Vec2<float> & pos, const int align_flags)
+    {
+        char text[Impl::max_number_size];
+        auto size = Impl::format_integer(value, format, text);
+        pimpl->render_number(text, size, format.fixed_width, color, win_size, pos, align_flags);
+    }
+
+    void Font_sys::render_integer_mat(const long long value, const Number_format & format, const Color & color,
+            const Mat4<float> & model_view_projection)
+    {
+        char text[Impl::max_number_size];
+        auto size = Impl::format_integer(value, format, text);
+        pimpl->render_number(text, size, format.fixed_width, color, model_view_projection);
+    }
+
+    void Font_sys::render_float(const double value, const Number_format & format, const Color & color,
+            const Vec2<float> & win_size, const Vec2<float> & pos, const int align_flags)
+    {
+        char text[Impl::max_number_size];
+        auto size = Impl::format_float(value, format, text);
+        pimpl->render_number(text, size, format.fixed_width, color, win_size, pos, align_flags);
+    }
+
+    void Font_sys::render_float_mat(const double value, const Number_format & format, const Color & color,
+            const Mat4<float> & model_view_projection)
+    {
+        char text[Impl::max_number_size];
+        auto size = Impl::format_float(value, format, text);
+        pimpl->render_number(text, size, format.fixed_width, color, model_view_projection);
+    }
+
+    void Font_sys::Impl::render_number(const char * text, const std::size_t size, const bool fixed_width, const Color & color,
+            const Vec2<float> & win_size, const Vec2<float> & pos, const int align_flags)
+    {
+        Arena::Scope scope(arena_);
+        Text_layout layout(&arena_);
+        build_number(text, size, fixed_width, layout);
+
+        load_text_vbo(layout.coords);
+
+        render_text_common(color, win_size, pos, align_flags, 0.0f, layout.text_box, layout.coord_data,
+#ifndef USE_OPENGL_ES
+                    vao_, context_,
+#endif
+                    vbo_);
+    }
+
+    void Font_sys::Impl::render_number(const char * text, const std::size_t size, const bool fixed_width, const Color & color,
+            const Mat4<float> & model_view_projection)
+    {
+        Arena::Scope scope(arena_);
+        Text_layout layout(&arena_);
+        build_number(text, size, fixed_width, layout);
+
+        load_text_vbo(layout.coords);
+
+        render_text_common(color, model_view_projection, layout.coord_data,
+#ifndef USE_OPENGL_ES
+                    vao_, context_,
+#endif
+                    vbo_);
+    }
+
+    std::size_t Font_sys::Impl::format_integer(const long long value, const Number_format & format, char * out)
+    {
+        // negate as unsigned, so the most negative value works too
+        const bool negative = value < 0;
+        const uint64_t magnitude = negative ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+
+        return write_number(negative, magnitude, 0, 0, format, out);
+    }
+
+    std::size_t Font_sys::Impl::format_float(const double value, const Number_format & format, char * out)
+    {
+        const unsigned int precision = std::min(format.precision, 9u);
+
+        uint64_t scale = 1;
+        for(unsigned int i = 0; i < precision; ++i)
+            scale *= 10;
+
+        // round once, at the last digit written, then split into integer and fractional parts
+        const double scaled = std::round(std::fabs(value) * scale);
+
+        if(!std::isfinite(scaled) || scaled >= 18446744073709551616.0) // 2^64
+        {
+            auto size = std::snprintf(out, max_number_size, "%.*e", precision, value);
+            return std::min(static_cast<std::size_t>(std::max(size, 0)), max_number_size - 1);
+        }
+
+        const auto whole = static_cast<uint64_t>(scaled);
+
+        // no sign on values that round to 0
+        return write_number(std::signbit(value) && whole != 0, whole / scale, whole % scale, precision, format, out);
+    }
+
+    void Font_sys::Impl::build_number(const char * text, const std::size_t size, const bool fixed_width, Text_layout & layout)
+    {
+        Resource_vector<Vec2<float>> screen_and_tex_coords(&arena_);
+        Resource_vector<GLuint> quad_tex(&arena_);
+
+        layout.glyphs.clear();
+
+        init_text_box(layout.text_box);
+
+        ++op_;
+
+        // look up the glyphs numbers use, and measure the digits, once per font size
+        if(!number_glyphs_.valid)
+        {
+            number_glyphs_.digit_advance = 0.0f;
+            for(char ch = '+'; ch <= '9'; ++ch)
+            {
+                Char_info & c = use_glyph(static_cast<uint32_t>(ch), &layout.glyphs);
+                number_glyphs_.glyphs[ch - '+'] = &c;
+
+                if(ch >= '0')
+                    number_glyphs_.digit_advance = std::max(number_glyphs_.digit_advance, c.advance.x / 64.0f);
+            }
+            number_glyphs_.valid = true;
+        }
+
+        screen_and_tex_coords.reserve(size * 12);
+        quad_tex.reserve(size);
+
+        Vec2<float> pen{0.0f, 0.0f};
+        for(std::size_t i = 0; i < size; ++i)
+        {
+            const char ch = text[i];
+            const auto code_pt = static_cast<uint32_t>(static_cast<unsigned char>(ch));
+
+            Char_info & c = ch >= '+' && ch <= '9'
+                ? use_glyph(*number_glyphs_.glyphs[ch - '+'], code_pt, &layout.glyphs)
+                : use_glyph(code_pt, &layout.glyphs);
+
+            auto quad_pen = pen;
+            auto advance = c.advance.x / 64.0f;
+
+            // center digits in the widest digit's advance. hinted glyphs stay on whole pixels
+            if(fixed_width && ch >= '0' && ch <= '9')
+            {
+                auto center = (number_glyphs_.digit_advance - advance) / 2.0f;
+                quad_pen.x += subpixel_phases_ > 1 ? center : std::round(center);
+                advance = number_glyphs_.digit_advance;
+            }
+
+            if(c.tex != 0)
+                add_quad(place_glyph(c, code_pt, false, quad_pen, &layout.glyphs), quad_pen, screen_and_tex_coords, quad_tex, layout.text_box);
+
+            pen.x += advance;
+        }
+
+        layout.pen = pen;
+
+        group_quads(screen_and_tex_coords, quad_tex, layout);
+    }
+}
@@ -0,0 +1,56 @@
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#version 330
+
+// one instance per glyph
+layout(location = 0) in vec4 anchor_scale; // world-space origin of the glyph's label, and the label's scale
+layout(location = 1) in vec2 offset;       // label's screen-space offset, in pixels. Y is down
+layout(location = 2) in vec4 quad;         // glyph quad around the label's origin, in pixels: upper left x, y, lower right x, y. Y is down
+layout(location = 3) in vec4 quad_tex;     // atlas texture coords of the quad, same layout
+layout(location = 4) in vec4 label_color;
+layout(location = 5) in uint atlas_slot;
+
+uniform mat4 view_projection;
+uniform vec2 viewport_size;
+uniform int atlas; // atlas slot being drawn
+
+out vec2 tex_coord;
+out vec4 color;
+
+void main()
+{
+    // triangle strip corners: (0, 0), (1, 0), (0, 1), (1, 1)
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+
+    // the quad is laid out in screen pixels around the projected anchor, so it
+    // always faces the camera, and is the same size at any distance
+    vec2 pixel = offset + mix(quad.xy, quad.zw, corner) * anchor_scale.w;
+
+    gl_Position = view_projection * vec4(anchor_scale.xyz, 1.0);
+    gl_Position.xy += pixel * vec2(2.0, -2.0) / viewport_size * gl_Position.w;
+
+    tex_coord = mix(quad_tex.xy, quad_tex.zw, corner);
+    color = label_color;
+
+    // glyphs not drawn in this pass, or behind the camera, collapse to a point outside of the clip volume
+    if(int(atlas_slot) != atlas || gl_Position.w <= 0.0)
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+}
@@ -24,11 +24,15 @@ in vec2 tex_coord;
 
 uniform sampler2D font_page;
 uniform vec4 color;
+uniform bool color_glyphs;
 
 out vec4 frag_color;
 
 void main()
 {
-    // get alpha from font texture
-    frag_color = vec4(color.rgb, color.a * textureLod(font_page, tex_coord, 0.0).r);
+    // color glyphs carry their own RGB, only the alpha is tinted
+    if(color_glyphs)
+        frag_color = textureLod(font_page, tex_coord, 0.0) * vec4(1.0, 1.0, 1.0, color.a);
+    else // get alpha from font texture
+        frag_color = vec4(color.rgb, color.a * textureLod(font_page, tex_coord, 0.0).r);
 }
@@ -24,9 +24,13 @@ varying vec2 tex_coord;
 
 uniform sampler2D font_page;
 uniform vec4 color;
+uniform bool color_glyphs;
 
 void main()
 {
-    // get alpha from font texture
-    gl_FragColor = vec4(color.rgb, color.a * texture2D(font_page, tex_coord).a);
+    // color glyphs carry their own RGB, only the alpha is tinted
+    if(color_glyphs)
+        gl_FragColor = texture2D(font_page, tex_coord) * vec4(1.0, 1.0, 1.0, color.a);
+    else // get alpha from font texture
+        gl_FragColor = vec4(color.rgb, color.a * texture2D(font_page, tex_coord).a);
 }
@@ -0,0 +1,45 @@
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+attribute vec2 vert_pos;
+attribute vec2 vert_tex_coords;
+attribute vec2 vert_glyph_ids; // glyph index, line index
+
+uniform mat4 model_view_projection;
+uniform float time;
+uniform vec4 params;
+
+varying vec2 tex_coord;
+varying vec4 effect_color;
+
+// the Text_effect's source replaces the next line. it defines:
+// void effect(inout vec2 pos, inout vec4 color, float glyph, float line)
+//TEXTOGL_EFFECT
+
+void main()
+{
+    vec2 pos = vert_pos;
+    vec4 color = vec4(1.0);
+    effect(pos, color, vert_glyph_ids.x, vert_glyph_ids.y);
+
+    tex_coord = vert_tex_coords;
+    effect_color = color;
+    gl_Position = model_view_projection * vec4(pos, 0.0, 1.0);
+}
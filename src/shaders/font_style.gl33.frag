@@ -0,0 +1,120 @@
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#version 130
+
+in vec2 tex_coord;
+in vec4 cell_box;
+
+uniform sampler2D font_page;
+uniform vec4 color;
+uniform bool color_glyphs;
+uniform vec2 texel_size; // size of an atlas pixel, in texture coordinates
+
+out vec4 frag_color;
+
+// glyph coverage at an offset (in pixels) from this fragment. Samples stay in the glyph's cell
+float coverage(vec2 offset)
+{
+    vec4 texel = textureLod(font_page, clamp(tex_coord + offset * texel_size, cell_box.xy + 0.5 * texel_size, cell_box.zw - 0.5 * texel_size), 0.0);
+    return color_glyphs ? texel.a : texel.r;
+}
+
+vec4 glyph_color()
+{
+    // color glyphs carry their own RGB, only the alpha is tinted
+    if(color_glyphs)
+        return textureLod(font_page, tex_coord, 0.0) * vec4(1.0, 1.0, 1.0, color.a);
+    else // get alpha from font texture
+        return vec4(color.rgb, color.a * textureLod(font_page, tex_coord, 0.0).r);
+}
+
+uniform vec4 outline_color;
+uniform float outline_width;   // pixels. 0 for none
+uniform vec4 shadow_color;     // transparent for none
+uniform vec2 shadow_offset;    // pixels, Y down
+uniform float shadow_softness; // blur radius, in pixels
+uniform vec4 glow_color;
+uniform float glow_radius;     // pixels. 0 for none
+
+// samples are taken on 2 rings of 8 directions. rotating by a fixed
+// matrix avoids trig (and const arrays, which GLSL ES 1.00 lacks)
+const int ring_samples = 8;
+const mat2 ring_step = mat2(0.7071068, 0.7071068, -0.7071068, 0.7071068); // 45 degrees
+
+// largest coverage within a radius, for outlines
+float max_coverage(vec2 center, float radius)
+{
+    float c = coverage(center);
+    vec2 dir = vec2(radius, 0.0);
+    for(int i = 0; i < ring_samples; ++i)
+    {
+        c = max(c, max(coverage(center + dir), coverage(center + 0.5 * dir)));
+        dir = ring_step * dir;
+    }
+    return c;
+}
+
+// average coverage within a radius, for soft shadows and glows
+float blur_coverage(vec2 center, float radius)
+{
+    float c = coverage(center);
+    vec2 dir = vec2(radius, 0.0);
+    for(int i = 0; i < ring_samples; ++i)
+    {
+        c += coverage(center + dir) + coverage(center + 0.5 * dir);
+        dir = ring_step * dir;
+    }
+    return c / float(2 * ring_samples + 1);
+}
+
+// composite a straight alpha color over a premultiplied one
+vec4 over(vec4 top, vec4 bottom)
+{
+    return vec4(top.rgb * top.a, top.a) + bottom * (1.0 - top.a);
+}
+
+vec4 styled_color()
+{
+    vec4 result = vec4(0.0);
+
+    // layers from the bottom up: glow, shadow, outline, then the glyph itself
+    if(glow_radius > 0.0)
+        result = over(vec4(glow_color.rgb, glow_color.a * min(1.0, 2.0 * blur_coverage(vec2(0.0), glow_radius))), result);
+
+    if(shadow_color.a > 0.0)
+    {
+        float shadow = shadow_softness > 0.0 ? blur_coverage(-shadow_offset, shadow_softness) : coverage(-shadow_offset);
+        result = over(vec4(shadow_color.rgb, shadow_color.a * shadow), result);
+    }
+
+    if(outline_width > 0.0)
+        result = over(vec4(outline_color.rgb, outline_color.a * max_coverage(vec2(0.0), outline_width)), result);
+
+    result = over(glyph_color(), result);
+
+    // blending expects straight alpha
+    return result.a > 0.0 ? vec4(result.rgb / result.a, result.a) : vec4(0.0);
+}
+
+void main()
+{
+    frag_color = styled_color();
+}
@@ -0,0 +1,41 @@
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#version 130
+
+in vec2 vert_pos;
+in vec2 vert_tex_coords;
+
+uniform mat4 model_view_projection;
+
+out vec2 tex_coord;
+out vec4 cell_box; // bounds of the glyph's atlas cell, in texture coordinates: min x, y, max x, y
+
+void main()
+{
+    tex_coord = vert_tex_coords;
+
+    // atlases are a 16x16 grid of cells, and quads stay inside their glyph's
+    // cell even when padded, so every vertex of a quad finds the same cell
+    vec2 cell = floor(vert_tex_coords * 16.0);
+    cell_box = vec4(cell / 16.0, (cell + 1.0) / 16.0);
+
+    gl_Position = model_view_projection * vec4(vert_pos, 0.0, 1.0);
+}
@@ -0,0 +1,40 @@
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#version 330
+
+in vec2 tex_coord;
+in vec4 color;
+
+uniform sampler2D font_page;
+uniform bool color_glyphs;
+uniform int atlas;
+
+out vec4 frag_color;
+
+void main()
+{
+    if(atlas < 0)
+        frag_color = color;
+    else if(color_glyphs) // color glyphs carry their own RGB, only the alpha is tinted
+        frag_color = textureLod(font_page, tex_coord, 0.0) * vec4(1.0, 1.0, 1.0, color.a);
+    else // get alpha from font texture
+        frag_color = vec4(color.rgb, color.a * textureLod(font_page, tex_coord, 0.0).r);
+}
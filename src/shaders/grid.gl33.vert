@@ -0,0 +1,67 @@
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#version 330
+
+// one instance per grid cell
+layout(location = 0) in uvec2 glyph;     // atlas cell index, atlas slot
+layout(location = 1) in vec4 glyph_box;  // glyph bounding box: upper left x, y, lower right x, y. Y is up
+layout(location = 2) in vec4 fg_color;
+layout(location = 3) in vec4 bg_color;
+
+uniform mat4 model_view_projection;
+uniform int cols;
+uniform vec2 cell_size;
+uniform float ascender;
+uniform vec4 atlas_cell_box; // atlas cell bounding box, same layout as glyph_box
+uniform vec2 atlas_size;
+uniform int atlas;       // atlas slot being drawn, or -1 for backgrounds
+
+out vec2 tex_coord;
+out vec4 color;
+
+void main()
+{
+    // triangle strip corners: (0, 0), (1, 0), (0, 1), (1, 1)
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    vec2 cell_pos = vec2(gl_InstanceID % cols, gl_InstanceID / cols) * cell_size;
+
+    if(atlas < 0)
+    {
+        color = bg_color;
+        tex_coord = vec2(0.0);
+        gl_Position = model_view_projection * vec4(cell_pos + corner * cell_size, 0.0, 1.0);
+    }
+    else
+    {
+        // glyph origin on the grid cell's baseline, and in the atlas
+        vec2 offset = mix(vec2(glyph_box.x, -glyph_box.y), vec2(glyph_box.z, -glyph_box.w), corner);
+        vec2 cell_dims = vec2(atlas_cell_box.z - atlas_cell_box.x, atlas_cell_box.y - atlas_cell_box.w);
+        vec2 tex_origin = vec2(glyph.x % 16u, glyph.x / 16u) * cell_dims + vec2(-atlas_cell_box.x, atlas_cell_box.y);
+
+        color = fg_color;
+        tex_coord = (tex_origin + offset) / atlas_size;
+        gl_Position = model_view_projection * vec4(cell_pos + vec2(0.0, ascender) + offset, 0.0, 1.0);
+    }
+
+    // cells not drawn in this pass collapse to a point outside of the clip volume
+    if((atlas < 0 && bg_color.a == 0.0) || (atlas >= 0 && int(glyph.y) != atlas))
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+}
@@ -0,0 +1,317 @@
+/// @file
+/// @brief Text shaping with HarfBuzz
+
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "font_impl.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <tuple>
+
+namespace textogl
+{
+#ifdef TEXTOGL_USE_HARFBUZZ
+    namespace
+    {
+        /// FNV-1a hash of a byte range, for looking up shaped runs without copying their text
+        std::size_t hash_run(const char * data, const std::size_t size)
+        {
+            uint64_t hash = 0xcbf29ce484222325ull;
+            for(std::size_t i = 0; i < size; ++i)
+            {
+                hash ^= static_cast<unsigned char>(data[i]);
+                hash *= 0x100000001b3ull;
+            }
+            return static_cast<std::size_t>(hash);
+        }
+    }
+
+    void Font_sys::set_shaping_features(const std::string & features)
+    {
+        Resource_vector<hb_feature_t> parsed(&pimpl->resource_);
+
+        for(std::size_t start = 0; start < features.size();)
+        {
+            auto end = features.find(',', start);
+            if(end == std::string::npos)
+                end = features.size();
+
+            if(end != start)
+            {
+                hb_feature_t feature;
+                if(!hb_feature_from_string(features.data() + start, static_cast<int>(end - start), &feature))
+                    throw std::invalid_argument("Invalid font feature: " + features.substr(start, end - start));
+                parsed.push_back(feature);
+            }
+
+            start = end + 1;
+        }
+
+        pimpl->features_.swap(parsed);
+
+        // cached runs were shaped with the old features
+        pimpl->shaped_runs_.clear();
+        pimpl->shaped_run_index_.clear();
+    }
+
+    void Font_sys::Impl::resize_shaping()
+    {
+        if(!hb_font_)
+        {
+            hb_font_ = hb_ft_font_create_referenced(face_);
+            hb_buffer_ = hb_buffer_create();
+
+            hb_face_t * hb_face = hb_font_get_face(hb_font_);
+            complex_font_ = hb_ot_layout_has_substitution(hb_face) || hb_ot_layout_has_positioning(hb_face);
+        }
+        else
+        {
+            hb_ft_font_changed(hb_font_);
+        }
+
+        // fallbacks may have been added or cleared. each font holds a reference to its face, so faces already closed are freed here
+        for(auto font: fallback_hb_fonts_)
+            hb_font_destroy(font);
+        fallback_hb_fonts_.clear();
+        for(auto face: fallback_faces_)
+            fallback_hb_fonts_.push_back(hb_ft_font_create_referenced(face));
+
+        // match the advances glyphs are rendered with. unhinted for subpixel positioning
+        hb_ft_font_set_load_flags(hb_font_, subpixel_phases_ > 1 ? FT_LOAD_NO_HINTING : FT_LOAD_DEFAULT);
+        for(auto font: fallback_hb_fonts_)
+            hb_ft_font_set_load_flags(font, subpixel_phases_ > 1 ? FT_LOAD_NO_HINTING : FT_LOAD_DEFAULT);
+
+        // glyph atlases are cleared by resize, and positions depend on size
+        shaped_glyphs_.clear();
+        shaped_runs_.clear();
+        shaped_run_index_.clear();
+    }
+
+    bool Font_sys::Impl::needs_shaping(const char * utf8_input, const std::size_t utf8_size) const
+    {
+        if(complex_font_ || !features_.empty())
+            return true;
+
+        return std::any_of(utf8_input, utf8_input + utf8_size, [](const char c){ return (c & 0x80) != 0; });
+    }
+
+    const Resource_vector<Font_sys::Impl::Shaped_glyph> & Font_sys::Impl::shape_run(const char * utf8_input, const std::size_t utf8_size)
+    {
+        auto hash = hash_run(utf8_input, utf8_size);
+
+        auto found = shaped_run_index_.find(hash);
+        if(found != shaped_run_index_.end())
+        {
+            auto run = found->second;
+            if(run->text.size() == utf8_size && std::equal(run->text.begin(), run->text.end(), utf8_input))
+            {
+                // move to the front, to mark as most recently used
+                shaped_runs_.splice(shaped_runs_.begin(), shaped_runs_, run);
+                return run->glyphs;
+            }
+
+            // hash collision. replace the old run
+            shaped_runs_.erase(run);
+            shaped_run_index_.erase(found);
+        }
+
+        // reuse the least recently used run once the cache is full, to keep its memory
+        if(shaped_runs_.size() >= max_shaped_runs)
+        {
+            shaped_run_index_.erase(shaped_runs_.back().hash);
+            shaped_runs_.splice(shaped_runs_.begin(), shaped_runs_, std::prev(shaped_runs_.end()));
+        }
+        else
+        {
+            shaped_runs_.emplace_front(&resource_);
+        }
+
+        Shaped_run & run = shaped_runs_.front();
+        run.text.assign(utf8_input, utf8_size);
+        run.hash = hash;
+        run.glyphs.clear();
+        shaped_run_index_[hash] = shaped_runs_.begin();
+
+        // split into runs by face. before shaping, the buffer holds code points, with clusters at their byte offsets
+        hb_buffer_clear_contents(hb_buffer_);
+        hb_buffer_add_utf8(hb_buffer_, utf8_input, static_cast<int>(utf8_size), 0, static_cast<int>(utf8_size));
+
+        unsigned int num_code_pts = 0;
+        const hb_glyph_info_t * code_pts = hb_buffer_get_glyph_infos(hb_buffer_, &num_code_pts);
+
+        // start of a run of text from a single face
+        struct Face_run
+        {
+            unsigned int face_i; // as in Char_info::face_i
+            unsigned int start;  // byte offset
+        };
+        Resource_vector<Face_run> face_runs(&arena_);
+
+        hb_unicode_funcs_t * unicode_funcs = hb_unicode_funcs_get_default();
+        for(unsigned int i = 0; i < num_code_pts; ++i)
+        {
+            const uint32_t code_pt = code_pts[i].codepoint;
+
+            // spaces, punctuation, and combining marks stay with the text around them when possible
+            if(!face_runs.empty())
+            {
+                hb_script_t script = hb_unicode_script(unicode_funcs, code_pt);
+                if((script == HB_SCRIPT_COMMON || script == HB_SCRIPT_INHERITED) && face_has(face_runs.back().face_i, code_pt))
+                    continue;
+            }
+
+            unsigned int face_i = 0;
+            FT_UInt glyph_i = 0;
+            std::tie(face_i, glyph_i) = find_glyph(face_, fallback_faces_, fallback_list_.get(), code_pt);
+
+            // no face has it. leave it in the current run, to be drawn as that face's missing glyph
+            if(glyph_i == 0 && !face_runs.empty())
+                continue;
+
+            if(face_runs.empty() || face_runs.back().face_i != face_i)
+                face_runs.push_back({face_i, code_pts[i].cluster});
+        }
+
+        for(std::size_t run_i = 0; run_i < face_runs.size(); ++run_i)
+        {
+            const unsigned int face_i = face_runs[run_i].face_i;
+            const unsigned int start = face_runs[run_i].start;
+            const unsigned int end = run_i + 1 < face_runs.size() ? face_runs[run_i + 1].start : static_cast<unsigned int>(utf8_size);
+            const float scale = scale_for(face_i);
+
+            // the whole line is given as context, so joining and mark placement work across run boundaries
+            hb_buffer_clear_contents(hb_buffer_);
+            hb_buffer_add_utf8(hb_buffer_, utf8_input, static_cast<int>(utf8_size), start, static_cast<int>(end - start));
+            hb_buffer_guess_segment_properties(hb_buffer_);
+
+            hb_shape(hb_font_for(face_i), hb_buffer_, features_.data(), static_cast<unsigned int>(features_.size()));
+
+            unsigned int num_glyphs = 0;
+            const hb_glyph_info_t * info = hb_buffer_get_glyph_infos(hb_buffer_, &num_glyphs);
+            const hb_glyph_position_t * pos = hb_buffer_get_glyph_positions(hb_buffer_, &num_glyphs);
+
+            // HarfBuzz uses 26.6 fixed point, with Y up
+            run.glyphs.reserve(run.glyphs.size() + num_glyphs);
+            for(unsigned int i = 0; i < num_glyphs; ++i)
+            {
+                run.glyphs.push_back({face_i, info[i].codepoint,
+                                      {pos[i].x_offset * scale / 64.0f, -pos[i].y_offset * scale / 64.0f},
+                                      {pos[i].x_advance * scale / 64.0f, -pos[i].y_advance * scale / 64.0f}});
+            }
+        }
+
+        return run.glyphs;
+    }
+
+    void Font_sys::Impl::build_shaped_text(const char * utf8_input, const std::size_t utf8_size, Text_layout & layout)
+    {
+        Vec2<float> pen{0.0f, 0.0f};
+
+        Resource_vector<Vec2<float>> screen_and_tex_coords(&arena_);
+        Resource_vector<GLuint> quad_tex(&arena_);
+        Resource_vector<GLushort> quad_ids(&arena_);
+
+        layout.glyphs.clear();
+
+        init_text_box(layout.text_box);
+
+        ++op_;
+
+        screen_and_tex_coords.reserve(utf8_size * 12);
+        quad_tex.reserve(utf8_size);
+
+        // shape and cache each line separately
+        const char * end = utf8_input + utf8_size;
+        std::size_t glyph_index = 0, line_index = 0;
+        for(const char * line = utf8_input;; ++line, ++line_index)
+        {
+            const char * line_end = std::find(line, end, '\n');
+
+            for(auto & glyph: shape_run(line, line_end - line))
+            {
+                // get glyph info, loading if needed
+                Font_sys::Impl::Char_info & c = use_glyph_index(glyph.face_i, glyph.glyph_i, &layout.glyphs);
+
+                if(c.tex != 0)
+                {
+                    Vec2<float> quad_pen{pen.x + glyph.offset.x, pen.y + glyph.offset.y};
+                    add_quad(place_glyph(c, glyph.glyph_i, true, quad_pen, &layout.glyphs), quad_pen, screen_and_tex_coords, quad_tex, layout.text_box, layout.padding);
+                    if(layout.want_glyph_ids)
+                        add_quad_ids(glyph_index, line_index, quad_ids);
+                }
+                ++glyph_index;
+
+                pen.x += glyph.advance.x;
+                pen.y += glyph.advance.y;
+            }
+
+            if(line_end == end)
+                break;
+
+            // handle newlines
+            pen.x = 0;
+            pen.y += line_height_;
+            line = line_end;
+        }
+
+        layout.pen = pen;
+
+        group_quads(screen_and_tex_coords, quad_tex, layout, &quad_ids);
+    }
+
+    Font_sys::Impl::Char_info & Font_sys::Impl::use_glyph_index(const unsigned int face_i, const FT_UInt glyph_i, Resource_vector<Char_info *> * glyphs)
+    {
+        Char_info & c = shaped_glyphs_[(uint64_t{face_i} << 32) | glyph_i];
+
+        if(glyphs && c.last_op != op_)
+            glyphs->push_back(&c);
+
+        c.last_frame = frame_;
+        c.last_op = op_;
+
+        // render glyph if not already in an atlas
+        if(c.tex == 0 && !c.failed)
+            load_glyph_index(face_i, glyph_i, c);
+
+        return c;
+    }
+
+    void Font_sys::Impl::load_glyph_index(const unsigned int face_i, const FT_UInt glyph_i, Char_info & c)
+    {
+        FT_Face face = face_for(face_i);
+        FT_GlyphSlot slot = face->glyph;
+
+        if(FT_Load_Glyph(face, glyph_i, FT_LOAD_RENDER | FT_LOAD_COLOR | load_flags(subpixel_phases_ > 1)) != FT_Err_Ok)
+        {
+            std::cerr<<"Err loading glyph index: "<<glyph_i<<std::endl;
+            c.failed = true;
+            return;
+        }
+
+        c.face_i = face_i;
+        set_metrics(slot, glyph_i, scale_for(face_i), subpixel_phases_ > 1, c);
+        store_glyph(c, render_cell(slot, cell_bbox_, scale_for(face_i), &resource_));
+    }
+#endif
+}
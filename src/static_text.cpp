@@ -23,7 +23,13 @@
 
 #include "textogl/static_text.hpp"
 #include "font_impl.hpp"
+#include "text_effect_impl.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <mutex>
+#include <new>
 #include <vector>
 
 #ifdef USE_OPENGL_ES
@@ -43,21 +49,21 @@ namespace textogl
         ///        to this is stored internally, so the Font_sys object must
         ///        remain valid for the life of the Static_text object
         /// @param utf8_input Text to render, in UTF-8 encoding. For best performance, normalize the string before rendering
+        /// @param resource Resource for internal containers. nullptr for \ref default_resource
         Impl(Font_sys & font,
-                    const std::string & utf8_input
+                    const std::string & utf8_input,
+                    Memory_resource * resource = nullptr
                    );
         ~Impl();
 
-        /// @name Non-copyable
+        /// @name Non-copyable, non-movable
+        /// Containers hold pointers into \ref resource_, so this can't be moved
         /// @{
         Impl(const Impl &) = delete;
         Impl & operator=(const Impl &) = delete;
-        /// @}
 
-        /// @name Movable
-        /// @{
-        Impl(Impl && other);
-        Impl & operator=(Impl && other);
+        Impl(Impl &&) = delete;
+        Impl & operator=(Impl &&) = delete;
         /// @}
 
         /// Recreate text object with new Font_sys
@@ -74,12 +80,23 @@ namespace textogl
         /// @param utf8_input Text to render, in UTF-8 encoding. For best performance, normalize the string before rendering
         void set_text(const std::string & utf8_input);
 
+        /// Change the text, laying it out on a worker thread
+        void set_text_async(const std::string & utf8_input ///< Text to render, in UTF-8 encoding
+                            );
+
+        /// Swap in text from \ref set_text_async, if ready
+        /// @returns \c true if new text was swapped in
+        bool commit(const bool wait ///< If \c true, wait for layout to finish
+                    );
+
         /// Render the previously set text
         void render_text(const Color & color,          ///< Text Color
                          const Vec2<float> & win_size, ///< Window dimensions. A Vec2 with X = width and Y = height
                          const Vec2<float> & pos,      ///< Render position, in screen pixels
                          const float rotation,         ///< Clockwise text rotation (in radians) around origin as defined in align_flags. 0 is vertical
-                         const int align_flags         ///< Text Alignment. Should be #Text_origin flags bitwise-OR'd together
+                         const int align_flags,        ///< Text Alignment. Should be #Text_origin flags bitwise-OR'd together
+                         const Font_sys::Impl::Effect_draw * effect = nullptr, ///< Animation effect to draw with. nullptr for none
+                         const Text_style * style = nullptr ///< Style to draw with. nullptr for none. \ref pad_for must have been called with it
                         );
 
         /// Render the previously set text, using a model view projection matrix
@@ -88,29 +105,115 @@ namespace textogl
 
                          /// The text will be rendered as quads, one for each glyph, with vertex coordinates centered on the baselines and sized in pixels.
                          /// This matrix will be used to transform that geometry
-                         const Mat4<float> & model_view_projection
+                         const Mat4<float> & model_view_projection,
+                         const Font_sys::Impl::Effect_draw * effect = nullptr, ///< Animation effect to draw with. nullptr for none
+                         const Text_style * style = nullptr ///< Style to draw with. nullptr for none. \ref pad_for must have been called with it
+                        );
+
+        /// Bring \ref impostor_ up to date for drawing with \p color at \p scale
+        /// @returns \c true if \ref impostor_ can be drawn instead of the text
+        bool update_impostor(const Color & color, ///< Text Color
+                             const float scale    ///< Screen pixels per text pixel
+                             );
+
+        /// Move \ref lod_level_ toward the level for \p size, within \ref lod_'s hysteresis
+        void update_lod(const float size ///< Font's em size on screen, in pixels
                         );
 
+        /// Draw \ref bar_vbo_, creating it if needed
+        void render_bars(const Color & color,                     ///< Text Color
+                         const Mat4<float> & model_view_projection ///< Model view projection matrix
+                         );
+
+        /// Create \ref glyph_ids_vbo_ and rebuild to fill it, if not already done
+        void enable_glyph_ids();
+
+        /// Grow \ref padding_ and the font's style padding to fit \p style, rebuilding if needed
+        void pad_for(const Text_style & style);
+
         void rebuild(); ///< Rebuild text data
 
+        /// Build a bar across each line of \p layout, and load them into \ref bar_vbo_
+        void store_bars(const Font_sys::Impl::Text_layout & layout ///< Layout to build bars for. Must have Text_layout::glyph_ids
+                        );
+
+        /// Store a built layout, and load it into \ref vbo_
+        void store_layout(const Font_sys::Impl::Text_layout & layout ///< Layout to store
+                          );
+
         /// Points to Font_sys chosen at construction.
         std::shared_ptr<Font_sys::Impl> font_;
 
-        std::string text_; ///< Text to render, in UTF-8 encoding.
+        Counting_resource resource_; ///< Resource for all internal containers. Declared before the containers so it outlives them
+
+        Resource_string text_; ///< Text to render, in UTF-8 encoding.
 
 #ifndef USE_OPENGL_ES
         GLuint vao_; ///< OpenGL Vertex array object index
+        Font_sys::Context_handle context_; ///< Context \ref vao_ was created in
 #endif
         GLuint vbo_; ///< OpenGL Vertex buffer object index
+        GLuint glyph_ids_vbo_ = 0; ///< OpenGL Vertex buffer object index for Text_layout::glyph_ids. 0 until an effect is first used
+        std::unique_ptr<Font_sys::Impl::Impostor> impostor_; ///< Cached render of the text. nullptr until needed
+        bool impostor_enabled_ = false;                      ///< \c true when enabled with Static_text::set_impostor. Otherwise \ref impostor_ is only for Text_lod::IMPOSTOR
+        float impostor_threshold_ = 1.25f;                   ///< Largest change in scale before \ref impostor_ is rendered again
+
+        Text_lod lod_;                               ///< Level of detail thresholds. All 0 when disabled
+        Text_lod::Level lod_level_ = Text_lod::FULL; ///< Level \ref render_text last drew with, for hysteresis
+#ifndef USE_OPENGL_ES
+        GLuint bar_vao_ = 0; ///< OpenGL Vertex array object index for \ref bar_vbo_
+#endif
+        GLuint bar_vbo_ = 0; ///< One quad across each line, for Text_lod::BAR. 0 until first needed
+        Resource_vector<Font_sys::Impl::Coord_data> bar_coord_data_; ///< Range of \ref bar_vbo_ to draw. Empty if no line has glyphs
+        unsigned int padding_ = 0; ///< Quad padding for the biggest Text_style drawn so far. Built with up to Font_sys::Impl::style_padding_ of it
+
+        Resource_vector<Font_sys::Impl::Coord_data> coord_data_; ///< Start and end indexs into \ref vbo_
+        Font_sys::Impl::Bbox<float> text_box_;                   ///< Bounding box for the text
 
-        std::vector<Font_sys::Impl::Coord_data> coord_data_; ///< Start and end indexs into \ref vbo_
-        Font_sys::Impl::Bbox<float> text_box_;               ///< Bounding box for the text
+        Resource_vector<Font_sys::Impl::Char_info *> glyphs_; ///< Glyphs used by the text
+        std::size_t layout_generation_;                       ///< Font_sys::Impl::layout_generation_ when the text was built
+
+        std::mutex pending_mutex_;                              ///< Guards \ref pending_
+        std::shared_ptr<Font_sys::Impl::Async_layout> pending_; ///< Latest text from \ref set_text_async, not yet committed
+        std::atomic<bool> has_pending_{false};                  ///< \c true when \ref pending_ is set. Checked without locking
     };
 
     Static_text::Static_text(Font_sys & font, const std::string & utf8_input): pimpl(new Impl(font, utf8_input), [](Impl * impl){ delete impl; }) {}
-    Static_text::Impl::Impl(Font_sys & font, const std::string & utf8_input): font_(font.pimpl),  text_(utf8_input)
+#ifdef TEXTOGL_USE_PMR
+    Static_text::Static_text(Font_sys & font, const std::string & utf8_input, std::pmr::memory_resource * resource):
+        pimpl([&]()
+              {
+                  // allocate the Impl itself from the resource too
+                  std::pmr::polymorphic_allocator<Impl> alloc(resource ? resource : std::pmr::get_default_resource());
+                  Impl * impl = alloc.allocate(1);
+                  try
+                  {
+                      return new(impl) Impl(font, utf8_input, resource);
+                  }
+                  catch(...)
+                  {
+                      alloc.deallocate(impl, 1);
+                      throw;
+                  }
+              }(),
+              [](Impl * impl)
+              {
+                  auto upstream = impl->resource_.upstream();
+                  impl->~Impl();
+                  upstream->deallocate(impl, sizeof(Impl), alignof(Impl));
+              })
+    {}
+#endif
+    Static_text::Impl::Impl(Font_sys & font, const std::string & utf8_input, Memory_resource * resource):
+        font_(font.pimpl),
+        resource_(resource),
+        text_(utf8_input.data(), utf8_input.size(), &resource_),
+        bar_coord_data_(&resource_),
+        coord_data_(&resource_),
+        glyphs_(&resource_)
     {
 #ifndef USE_OPENGL_ES
+        context_ = Font_sys::get_current_context();
         glGenVertexArrays(1, &vao_);
         glBindVertexArray(vao_);
 #endif
@@ -135,47 +238,17 @@ namespace textogl
     {
         // destroy VAO/VBO
         glDeleteBuffers(1, &vbo_);
+        if(glyph_ids_vbo_)
+            glDeleteBuffers(1, &glyph_ids_vbo_);
+        if(bar_vbo_)
+            glDeleteBuffers(1, &bar_vbo_);
 #ifndef USE_OPENGL_ES
         glDeleteVertexArrays(1, &vao_);
+        if(bar_vao_)
+            glDeleteVertexArrays(1, &bar_vao_);
 #endif
     }
 
-    Static_text::Impl::Impl(Impl && other):
-        font_(other.font_),
-        text_(other.text_),
-#ifndef USE_OPENGL_ES
-        vao_(other.vao_),
-#endif
-        vbo_(other.vbo_),
-        coord_data_(std::move(other.coord_data_)),
-        text_box_(std::move(other.text_box_))
-    {
-#ifndef USE_OPENGL_ES
-        other.vao_ = 0;
-#endif
-        other.vbo_ = 0;
-    }
-    Static_text::Impl & Static_text::Impl::operator=(Impl && other)
-    {
-        if(this != &other)
-        {
-            font_ = other.font_;
-            text_ = other.text_;
-#ifndef USE_OPENGL_ES
-            vao_ = other.vao_;
-#endif
-            vbo_ = other.vbo_;
-            coord_data_ = std::move(other.coord_data_);
-            text_box_ = std::move(other.text_box_);
-
-#ifndef USE_OPENGL_ES
-            other.vao_ = 0;
-#endif
-            other.vbo_ = 0;
-        }
-        return *this;
-    }
-
     void Static_text::set_font_sys(Font_sys & font)
     {
         pimpl->set_font_sys(font);
@@ -192,10 +265,98 @@ namespace textogl
     }
     void Static_text::Impl::set_text(const std::string & utf8_input)
     {
-        text_ = utf8_input;
+        // this replaces any text still pending from set_text_async
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex_);
+            pending_.reset();
+            has_pending_ = false;
+        }
+
+        text_.assign(utf8_input.data(), utf8_input.size());
         rebuild();
     }
 
+    void Static_text::set_text_async(const std::string & utf8_input)
+    {
+        pimpl->set_text_async(utf8_input);
+    }
+    void Static_text::Impl::set_text_async(const std::string & utf8_input)
+    {
+        auto layout = std::make_shared<Font_sys::Impl::Async_layout>();
+        layout->text = utf8_input;
+
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex_);
+            pending_ = layout;
+            has_pending_ = true;
+        }
+
+        font_->layout_async(std::move(layout));
+    }
+
+    bool Static_text::commit(const bool wait)
+    {
+        return pimpl->commit(wait);
+    }
+    bool Static_text::Impl::commit(const bool wait)
+    {
+        if(!has_pending_)
+            return false;
+
+        std::shared_ptr<Font_sys::Impl::Async_layout> layout;
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex_);
+            layout = pending_;
+        }
+        if(!layout)
+            return false;
+
+        // wait without the lock, so set_text_async isn't blocked
+        if(!wait && layout->future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return false;
+        layout->future.wait();
+
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex_);
+
+            // a newer text may have been set while waiting. it stays pending
+            if(pending_ == layout)
+            {
+                pending_.reset();
+                has_pending_ = false;
+            }
+        }
+
+        text_.assign(layout->text.data(), layout->text.size());
+
+        // the font may have been resized or had its fallbacks changed since, or the worker failed. lay out here instead
+        bool ok = true;
+        try
+        {
+            layout->future.get();
+        }
+        catch(...)
+        {
+            ok = false;
+        }
+
+        if(!ok || layout->font_size != font_->font_size_ || layout->subpixel_phases != font_->subpixel_phases_
+                || layout->fallbacks != font_->fallback_list_)
+        {
+            rebuild();
+            return true;
+        }
+
+        Arena::Scope scope(font_->arena_);
+        Font_sys::Impl::Text_layout built(&font_->arena_);
+        built.padding = static_cast<int>(std::min(padding_, font_->style_padding_));
+        built.want_glyph_ids = glyph_ids_vbo_ != 0 || bar_vbo_ != 0;
+        font_->build_text(layout->glyphs, built);
+        store_layout(built);
+
+        return true;
+    }
+
     void Static_text::render_text(const Color & color, const Vec2<float> & win_size,
             const Vec2<float> & pos, const int align_flags)
     {
@@ -207,50 +368,341 @@ namespace textogl
         pimpl->render_text(color, win_size, pos, rotation, align_flags);
     }
     void Static_text::Impl::render_text(const Color & color, const Vec2<float> & win_size,
-            const Vec2<float> & pos, const float rotation, const int align_flags)
+            const Vec2<float> & pos, const float rotation, const int align_flags, const Font_sys::Impl::Effect_draw * effect,
+            const Text_style * style)
     {
+        commit(false);
+
+        if(impostor_enabled_ && !effect && !style && update_impostor(color, 1.0f))
+        {
+            impostor_->render(*font_, win_size, pos, align_flags, rotation, text_box_);
+            return;
+        }
+
+        // glyphs may have been evicted or moved since the text was built
+        if(!font_->use_glyphs(glyphs_, layout_generation_))
+            rebuild();
+
         font_->render_text_common(color, win_size, pos, align_flags, rotation, text_box_, coord_data_,
 #ifndef USE_OPENGL_ES
-            vao_,
+            vao_, context_,
 #endif
-            vbo_);
+            vbo_, effect, style);
     }
 
     void Static_text::render_text_mat(const Color & color, const Mat4<float> & model_view_projection)
     {
         pimpl->render_text(color, model_view_projection);
     }
-    void Static_text::Impl::render_text(const Color & color, const Mat4<float> & model_view_projection)
+    void Static_text::Impl::render_text(const Color & color, const Mat4<float> & model_view_projection, const Font_sys::Impl::Effect_draw * effect,
+            const Text_style * style)
     {
+        commit(false);
+
+        const bool lod = lod_.impostor_below > 0.0f || lod_.bar_below > 0.0f || lod_.hide_below > 0.0f;
+        if((impostor_enabled_ || lod) && !effect && !style)
+        {
+            const float scale = Font_sys::Impl::Impostor::effective_scale(model_view_projection, text_box_);
+
+            bool use_impostor = impostor_enabled_;
+            if(lod)
+            {
+                update_lod(scale * font_->font_size_);
+                switch(lod_level_)
+                {
+                    case Text_lod::FULL:
+                        break;
+                    case Text_lod::IMPOSTOR:
+                        if(!impostor_)
+                            impostor_.reset(new Font_sys::Impl::Impostor(&resource_));
+                        use_impostor = true;
+                        break;
+                    case Text_lod::BAR:
+                        render_bars(color, model_view_projection);
+                        return;
+                    case Text_lod::HIDDEN:
+                        return;
+                }
+            }
+
+            if(use_impostor && update_impostor(color, scale))
+            {
+                impostor_->render(*font_, model_view_projection);
+                return;
+            }
+        }
+
+        // glyphs may have been evicted or moved since the text was built
+        if(!font_->use_glyphs(glyphs_, layout_generation_))
+            rebuild();
+
         font_->render_text_common(color, model_view_projection, coord_data_,
 #ifndef USE_OPENGL_ES
-            vao_,
+            vao_, context_,
+#endif
+            vbo_, effect, style);
+    }
+
+    void Static_text::render_text_effect(const Text_effect & effect, const float time, const Vec4<float> & params,
+            const Color & color, const Vec2<float> & win_size, const Vec2<float> & pos, const int align_flags)
+    {
+        pimpl->enable_glyph_ids();
+        Font_sys::Impl::Effect_draw draw{effect.pimpl->program, time, params, pimpl->glyph_ids_vbo_};
+        pimpl->render_text(color, win_size, pos, 0.0f, align_flags, &draw);
+    }
+    void Static_text::render_text_effect_mat(const Text_effect & effect, const float time, const Vec4<float> & params,
+            const Color & color, const Mat4<float> & model_view_projection)
+    {
+        pimpl->enable_glyph_ids();
+        Font_sys::Impl::Effect_draw draw{effect.pimpl->program, time, params, pimpl->glyph_ids_vbo_};
+        pimpl->render_text(color, model_view_projection, &draw);
+    }
+
+    void Static_text::render_text_styled(const Text_style & style, const Color & color, const Vec2<float> & win_size,
+            const Vec2<float> & pos, const int align_flags)
+    {
+        pimpl->pad_for(style);
+        pimpl->render_text(color, win_size, pos, 0.0f, align_flags, nullptr, &style);
+    }
+    void Static_text::render_text_styled_mat(const Text_style & style, const Color & color, const Mat4<float> & model_view_projection)
+    {
+        pimpl->pad_for(style);
+        pimpl->render_text(color, model_view_projection, nullptr, &style);
+    }
+
+    void Static_text::Impl::pad_for(const Text_style & style)
+    {
+        auto padding = Font_sys::Impl::style_padding(style);
+
+        // growing the font's padding re-creates its atlases, which the render call will notice and rebuild for
+        font_->set_style_padding(padding);
+
+        if(padding > padding_)
+        {
+            padding_ = padding;
+            rebuild();
+        }
+    }
+
+    void Static_text::set_impostor(const bool enable, const float scale_threshold)
+    {
+        if(enable)
+        {
+            if(!pimpl->impostor_)
+                pimpl->impostor_.reset(new Font_sys::Impl::Impostor(&pimpl->resource_));
+            pimpl->impostor_threshold_ = scale_threshold;
+        }
+        else
+            pimpl->impostor_.reset();
+
+        pimpl->impostor_enabled_ = enable;
+    }
+
+    void Static_text::set_impostor_memory_limit(const std::size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(Font_sys::Impl::Impostor::pool_mutex_);
+        Font_sys::Impl::Impostor::memory_limit_ = bytes;
+    }
+
+    std::size_t Static_text::get_impostor_memory_usage()
+    {
+        std::lock_guard<std::mutex> lock(Font_sys::Impl::Impostor::pool_mutex_);
+        return Font_sys::Impl::Impostor::memory_usage_;
+    }
+
+    bool Static_text::Impl::update_impostor(const Color & color, const float scale)
+    {
+        // a font resize leaves the cache showing the old size, so check for that as rendering directly would
+        if(layout_generation_ == font_->layout_generation_ && impostor_->valid(color, scale, impostor_threshold_))
+            return true;
+
+        if(!font_->use_glyphs(glyphs_, layout_generation_))
+            rebuild();
+
+        return impostor_->update(*font_, color, scale, text_box_, coord_data_,
+#ifndef USE_OPENGL_ES
+            vao_, context_,
 #endif
             vbo_);
     }
 
-    void Static_text::Impl::rebuild()
+    void Static_text::set_lod(const Text_lod & lod)
     {
-        // build the text
-        std::vector<Vec2<float>> coords;
-        std::tie(coords, coord_data_, text_box_) = font_->build_text(text_);
+        pimpl->lod_ = lod;
+        pimpl->lod_level_ = Text_lod::FULL;
+    }
 
-        glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+    Text_lod::Level Static_text::get_lod_level() const
+    {
+        return pimpl->lod_level_;
+    }
+
+    void Static_text::Impl::update_lod(const float size)
+    {
+        auto level_for = [this](const float size)
+        {
+            if(size < lod_.hide_below)
+                return Text_lod::HIDDEN;
+            if(size < lod_.bar_below)
+                return Text_lod::BAR;
+            if(size < lod_.impostor_below)
+                return Text_lod::IMPOSTOR;
+            return Text_lod::FULL;
+        };
+
+        // shrinking past a threshold drops detail right away. growing has to clear it by the hysteresis margin
+        auto most_detail = level_for(size);
+        auto least_detail = level_for(size / (1.0f + lod_.hysteresis));
+
+        if(lod_level_ < most_detail)
+            lod_level_ = most_detail;
+        else if(lod_level_ > least_detail)
+            lod_level_ = least_detail;
+    }
+
+    void Static_text::Impl::render_bars(const Color & color, const Mat4<float> & model_view_projection)
+    {
+        if(!bar_vbo_)
+        {
 #ifndef USE_OPENGL_ES
-        glBindVertexArray(vao_);
-#else
-        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(Vec2<float>), NULL);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(Vec2<float>), (const GLvoid *)sizeof(Vec2<float>));
-        glEnableVertexAttribArray(1);
+            glGenVertexArrays(1, &bar_vao_);
+            glBindVertexArray(bar_vao_);
 #endif
+            glGenBuffers(1, &bar_vbo_);
+            glBindBuffer(GL_ARRAY_BUFFER, bar_vbo_);
 
-        // reload vertex data
-        glBufferData(GL_ARRAY_BUFFER, sizeof(Vec2<float>) * coords.size(), coords.data(), GL_STATIC_DRAW);
+#ifndef USE_OPENGL_ES
+            glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(Vec2<float>), NULL);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(Vec2<float>), (const GLvoid *)sizeof(Vec2<float>));
+            glEnableVertexAttribArray(1);
 
+            glBindVertexArray(0);
+#endif
+            // bars are made from the line indexes in the glyph ids
+            rebuild();
+        }
+        else if(layout_generation_ != font_->layout_generation_)
+            rebuild();
+
+        if(bar_coord_data_.empty())
+            return;
+
+        auto & common = font_->common();
+        common.init_solid();
+        bar_coord_data_.front().tex = common.solid_tex;
+
+        // a solid bar is much darker than a line of text, which only covers part of its area
+        Color bar_color = color;
+        bar_color.a *= 0.5f;
+
+        font_->render_text_common(bar_color, model_view_projection, bar_coord_data_,
 #ifndef USE_OPENGL_ES
-        glBindVertexArray(0);
+            bar_vao_, context_,
 #endif
+            bar_vbo_);
+    }
+
+    void Static_text::Impl::enable_glyph_ids()
+    {
+        if(glyph_ids_vbo_)
+            return;
+
+        glGenBuffers(1, &glyph_ids_vbo_);
+        rebuild();
+    }
+
+    std::size_t Static_text::get_memory_usage() const
+    {
+        return pimpl->resource_.bytes_in_use();
+    }
+
+    void Static_text::Impl::rebuild()
+    {
+        // build the text
+        Arena::Scope scope(font_->arena_);
+        Font_sys::Impl::Text_layout layout(&font_->arena_);
+        layout.padding = static_cast<int>(std::min(padding_, font_->style_padding_));
+        layout.want_glyph_ids = glyph_ids_vbo_ != 0 || bar_vbo_ != 0;
+        font_->build_text(text_.data(), text_.size(), layout);
+
+        store_layout(layout);
+    }
+
+    void Static_text::Impl::store_layout(const Font_sys::Impl::Text_layout & layout)
+    {
+        // keep what's needed for rendering. these are copied into resource_
+        coord_data_ = layout.coord_data;
+        text_box_ = layout.text_box;
+        glyphs_ = layout.glyphs;
+        layout_generation_ = font_->layout_generation_;
+
+        if(impostor_)
+            impostor_->invalidate();
+
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+
+        // reload vertex data
+        glBufferData(GL_ARRAY_BUFFER, sizeof(Vec2<float>) * layout.coords.size(), layout.coords.data(), GL_STATIC_DRAW);
+
+        if(glyph_ids_vbo_)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, glyph_ids_vbo_);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(GLushort) * layout.glyph_ids.size(), layout.glyph_ids.data(), GL_STATIC_DRAW);
+        }
+
+        if(bar_vbo_)
+            store_bars(layout);
     }
 
+    void Static_text::Impl::store_bars(const Font_sys::Impl::Text_layout & layout)
+    {
+        // find the extents of each line's glyphs. scratch space is freed by the caller's Arena::Scope
+        const Font_sys::Impl::Bbox<float> empty{{std::numeric_limits<float>::max(), std::numeric_limits<float>::max()},
+                                                {std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest()}};
+        Resource_vector<Font_sys::Impl::Bbox<float>> lines(&font_->arena_);
+        for(std::size_t i = 0; i < layout.coords.size() / 2; ++i)
+        {
+            std::size_t line = layout.glyph_ids[i * 2 + 1];
+            if(line >= lines.size())
+                lines.resize(line + 1, empty);
+
+            auto & box = lines[line];
+            const auto & pos = layout.coords[i * 2];
+            box.ul.x = std::min(box.ul.x, pos.x);
+            box.ul.y = std::min(box.ul.y, pos.y);
+            box.lr.x = std::max(box.lr.x, pos.x);
+            box.lr.y = std::max(box.lr.y, pos.y);
+        }
+
+        // a band through the middle of each line, in the same vertex order as Font_sys::Impl::add_quad
+        Resource_vector<Vec2<float>> bars(&font_->arena_);
+        const Vec2<float> tex{0.5f, 0.5f};
+        for(const auto & box: lines)
+        {
+            if(box.ul.x > box.lr.x)
+                continue;
+
+            float top = box.ul.y + (box.lr.y - box.ul.y) / 4.0f;
+            float bottom = box.lr.y - (box.lr.y - box.ul.y) / 4.0f;
+
+            bars.insert(bars.end(), {{box.ul.x, bottom}, tex, {box.lr.x, bottom}, tex, {box.ul.x, top}, tex,
+                                     {box.ul.x, top}, tex, {box.lr.x, bottom}, tex, {box.lr.x, top}, tex});
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, bar_vbo_);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(Vec2<float>) * bars.size(), bars.data(), GL_STATIC_DRAW);
+
+        // the solid texture belongs to the context drawn in, so it's filled in by render_bars
+        bar_coord_data_.clear();
+        if(!bars.empty())
+        {
+            bar_coord_data_.emplace_back();
+            auto & c = bar_coord_data_.back();
+            c.tex = 0;
+            c.color = false;
+            c.start = 0;
+            c.num_elements = bars.size() / 2;
+        }
+    }
 }
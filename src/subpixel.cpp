@@ -0,0 +1,123 @@
+/// @file
+/// @brief Subpixel glyph positioning
+
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "font_impl.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+#include FT_OUTLINE_H
+
+namespace textogl
+{
+    void Font_sys::set_subpixel_positioning(const unsigned int phases)
+    {
+        if(phases > 4)
+            throw std::invalid_argument("Too many subpixel phases: " + std::to_string(phases));
+
+        const unsigned int new_phases = std::max(phases, 1u);
+        if(new_phases == pimpl->subpixel_phases_)
+            return;
+
+        pimpl->subpixel_phases_ = new_phases;
+
+        // advances change, so every glyph needs to be rendered again
+        pimpl->resize(pimpl->font_size_);
+    }
+
+    FT_Int32 Font_sys::Impl::load_flags(const bool subpixel)
+    {
+        // full hinting snaps stems horizontally, which would undo the subpixel offset
+        return subpixel ? FT_LOAD_TARGET_LIGHT : FT_LOAD_DEFAULT;
+    }
+
+    const Font_sys::Impl::Char_info & Font_sys::Impl::place_glyph(const Char_info & c, const uint32_t id, const bool shaped,
+            Vec2<float> & pen, Resource_vector<Char_info *> * glyphs)
+    {
+        if(subpixel_phases_ == 1)
+            return c;
+
+        // snap to the pixel, and round the remainder to the nearest phase
+        const unsigned int phases = subpixel_phases_;
+        float x = std::floor(pen.x);
+        auto phase = static_cast<unsigned int>(std::lround((pen.x - x) * phases));
+        if(phase == phases)
+        {
+            phase = 0;
+            x += 1.0f;
+        }
+        pen.x = x;
+
+        // only outlines can be offset
+        if(phase == 0 || c.color || !FT_IS_SCALABLE(face_for(c.face_i)) || scale_for(c.face_i) != 1.0f)
+            return c;
+
+        // glyph indices are keyed past the end of Unicode, so they can't collide with code points, and by face above that
+        const uint64_t key = ((shaped ? 0x110000ull + id + (uint64_t{c.face_i} << 32) : id) << 2) | phase;
+        Char_info & v = subpixel_glyphs_[key];
+
+        if(glyphs && v.last_op != op_)
+            glyphs->push_back(&v);
+
+        v.last_frame = frame_;
+        v.last_op = op_;
+
+        if(v.tex == 0 && !v.failed)
+            load_subpixel_glyph(c, phase, v);
+
+        // draw at the whole pixel if the variant can't be loaded
+        return v.tex != 0 ? v : c;
+    }
+
+    void Font_sys::Impl::load_subpixel_glyph(const Char_info & base, const unsigned int phase, Char_info & c)
+    {
+        FT_Face face = face_for(base.face_i);
+
+        if(!render_subpixel(face, base.glyph_i, phase))
+        {
+            std::cerr<<"Err loading subpixel glyph: "<<base.glyph_i<<std::endl;
+            c.failed = true;
+            return;
+        }
+
+        // the variant's bitmap differs, but it's laid out the same as the base glyph
+        set_metrics(face->glyph, base.glyph_i, 1.0f, true, c);
+        c.advance = base.advance;
+        c.face_i = base.face_i;
+        c.phase = phase;
+        store_glyph(c, render_cell(face->glyph, cell_bbox_, 1.0f, &resource_));
+    }
+
+    bool Font_sys::Impl::render_subpixel(FT_Face face, const FT_UInt glyph_i, const unsigned int phase) const
+    {
+        if(FT_Load_Glyph(face, glyph_i, load_flags(true)) != FT_Err_Ok || face->glyph->format != FT_GLYPH_FORMAT_OUTLINE)
+            return false;
+
+        // shift the outline right before rasterizing it. 26.6 fixed point
+        FT_Outline_Translate(&face->glyph->outline, static_cast<FT_Pos>(64 * phase / subpixel_phases_), 0);
+
+        return FT_Render_Glyph(face->glyph, FT_RENDER_MODE_LIGHT) == FT_Err_Ok;
+    }
+}
@@ -0,0 +1,30 @@
+/// @file
+/// @brief Per-glyph animation effects
+
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+
+#include "text_effect_impl.hpp"
+
+namespace textogl
+{
+    Text_effect::Text_effect(const std::string & glsl_src): pimpl(new Impl(glsl_src)) {}
+    Text_effect::~Text_effect() = default;
+
+    Text_effect::Text_effect(Text_effect &&) = default;
+    Text_effect & Text_effect::operator=(Text_effect &&) = default;
+}
@@ -0,0 +1,55 @@
+/// @file
+/// @brief Text_effect implementation details
+
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+
+#ifndef TEXT_EFFECT_IMPL_HPP
+#define TEXT_EFFECT_IMPL_HPP
+
+#include "textogl/text_effect.hpp"
+#include "font_impl.hpp"
+
+/// @cond INTERNAL
+namespace textogl
+{
+    /// Implementation details for text effects
+    struct Text_effect::Impl
+    {
+        /// Compile an effect
+        explicit Impl(const std::string & glsl_src ///< GLSL source defining the effect function
+                      ): program(Font_sys::Impl::Font_common::create_effect_program(glsl_src))
+        {}
+        ~Impl()
+        {
+            glDeleteProgram(program.prog);
+        }
+
+        /// @name Non-copyable, non-movable
+        /// @{
+        Impl(const Impl &) = delete;
+        Impl & operator=(const Impl &) = delete;
+
+        Impl(Impl &&) = delete;
+        Impl & operator=(Impl &&) = delete;
+        /// @}
+
+        const Font_sys::Impl::Effect_program program; ///< Shader program and uniform locations
+    };
+}
+/// @endcond INTERNAL
+#endif // TEXT_EFFECT_IMPL_HPP
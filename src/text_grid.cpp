@@ -0,0 +1,502 @@
+/// @file
+/// @brief Grid of fixed-pitch text
+
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "textogl/text_grid.hpp"
+#include "font_impl.hpp"
+
+#ifndef USE_OPENGL_ES
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+
+#include <GL/glew.h>
+
+namespace textogl
+{
+    /// Implementation details for the text grid
+    struct Text_grid::Impl
+    {
+        /// Instance record for a single cell
+        struct Cell
+        {
+            uint8_t atlas_cell = 0;       ///< Cell index of the glyph within its atlas
+            uint8_t atlas_slot = no_glyph; ///< Index of the glyph's atlas into \ref atlases_. \ref no_glyph for empty cells
+            uint8_t padding[2] = {0, 0};  ///< Unused. Keeps the rest aligned
+            int16_t bbox[4] = {0, 0, 0, 0}; ///< Glyph bounding box, relative to its origin: upper left x, y, lower right x, y. Y is up
+            uint8_t fg[4] = {0, 0, 0, 0}; ///< Text color. RGBA
+            uint8_t bg[4] = {0, 0, 0, 0}; ///< Background color. RGBA
+        };
+
+        static const uint8_t no_glyph = 255; ///< Cell::atlas_slot for cells that draw no glyph. Also the limit on \ref atlases_
+
+        /// Create an empty grid
+        Impl(Font_sys & font, const std::size_t rows, const std::size_t cols);
+        ~Impl();
+
+        /// @name Non-copyable, non-movable
+        /// @{
+        Impl(const Impl &) = delete;
+        Impl & operator=(const Impl &) = delete;
+
+        Impl(Impl &&) = delete;
+        Impl & operator=(Impl &&) = delete;
+        /// @}
+
+        /// Change the grid's size, keeping cells that still fit
+        void resize(const std::size_t rows, const std::size_t cols);
+
+        /// Set a cell's code point and colors, and mark it for upload
+        void write_cell(const std::size_t i,     ///< Cell index
+                        const uint32_t code_pt, ///< Unicode code point. 0 for an empty cell
+                        const Color & fg,       ///< Text color
+                        const Color & bg        ///< Background color
+                        );
+
+        /// Point a cell's record at its glyph, loading it if needed
+
+        /// If the glyph's atlas has no slot, the cell is left blank
+        void resolve_glyph(const std::size_t i,          ///< Cell index
+                           const bool can_rebuild = true ///< If \c true, \ref rebuild to free slots first, unless the last rebuild was already out of them
+                           );
+
+        /// Extend the range of records to upload at the next render
+        void mark_dirty(const std::size_t begin, ///< First cell
+                        const std::size_t end    ///< One past the last cell
+                        );
+
+        /// Look up every cell's glyph again
+
+        /// Needed when glyphs have been evicted or moved, or the font has
+        /// been resized or changed. Uploads every record at the next render
+        void rebuild();
+
+        /// Render the grid
+        void render(const Mat4<float> & model_view_projection ///< Model view projection matrix
+                    );
+
+        /// Point the bound vertex array at \ref vbo_'s records
+        void set_attributes() const;
+
+        /// Convert a color to RGBA bytes
+        static void pack_color(const Color & color, uint8_t * rgba);
+
+        std::shared_ptr<Font_sys::Impl> font_; ///< Font the grid is drawn with
+
+        Counting_resource resource_; ///< Resource for all internal containers. Declared before the containers so it outlives them
+
+        std::size_t rows_; ///< Number of rows
+        std::size_t cols_; ///< Number of columns
+
+        Resource_vector<uint32_t> code_pts_; ///< Code point of each cell
+        Resource_vector<Cell> cells_;        ///< Instance record for each cell, as uploaded to \ref vbo_
+        std::size_t num_backgrounds_ = 0;    ///< Number of cells with a visible background. The background pass is skipped when 0
+
+        Resource_vector<GLuint> atlases_;                     ///< Atlas textures used by the grid. Cell::atlas_slot indexes this
+        Resource_vector<Font_sys::Impl::Char_info *> glyphs_; ///< Glyphs used by the grid. May have duplicates, until the next \ref rebuild
+        std::size_t layout_generation_ = 0;                   ///< Font_sys::Impl::layout_generation_ when the glyphs were looked up
+        bool out_of_slots_ = false;                           ///< Set if the last \ref rebuild couldn't fit every glyph's atlas into \ref atlases_
+
+        std::size_t dirty_begin_ = 0; ///< First record to upload at the next render
+        std::size_t dirty_end_ = 0;   ///< One past the last record to upload. No upload needed when equal to \ref dirty_begin_
+
+        Vec2<float> cell_size_; ///< Size of each cell, in pixels
+        float ascender_ = 0.0f; ///< Distance from the top of a cell to its baseline, in pixels
+
+        GLuint vao_;                       ///< OpenGL Vertex array object index
+        Font_sys::Context_handle context_; ///< Context \ref vao_ was created in
+        GLuint vbo_;                       ///< OpenGL instance buffer object index
+    };
+
+    Text_grid::Text_grid(Font_sys & font, const std::size_t rows, const std::size_t cols): pimpl(new Impl(font, rows, cols)) {}
+    Text_grid::~Text_grid() = default;
+
+    Text_grid::Impl::Impl(Font_sys & font, const std::size_t rows, const std::size_t cols):
+        font_(font.pimpl),
+        resource_(nullptr),
+        rows_(0),
+        cols_(0),
+        code_pts_(&resource_),
+        cells_(&resource_),
+        atlases_(&resource_),
+        glyphs_(&resource_)
+    {
+        font_->common().init_grid();
+
+        context_ = Font_sys::get_current_context();
+        glGenVertexArrays(1, &vao_);
+        glGenBuffers(1, &vbo_);
+
+        glBindVertexArray(vao_);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+        set_attributes();
+        glBindVertexArray(0);
+
+        resize(rows, cols);
+    }
+
+    Text_grid::Impl::~Impl()
+    {
+        glDeleteBuffers(1, &vbo_);
+        glDeleteVertexArrays(1, &vao_);
+    }
+
+    void Text_grid::set_font_sys(Font_sys & font)
+    {
+        pimpl->font_ = font.pimpl;
+        pimpl->font_->common().init_grid();
+        pimpl->rebuild();
+    }
+
+    void Text_grid::resize(const std::size_t rows, const std::size_t cols)
+    {
+        pimpl->resize(rows, cols);
+    }
+    void Text_grid::Impl::resize(const std::size_t rows, const std::size_t cols)
+    {
+        Resource_vector<uint32_t> code_pts(rows * cols, 0, &resource_);
+        Resource_vector<Cell> cells(rows * cols, Cell{}, &resource_);
+
+        num_backgrounds_ = 0;
+        for(std::size_t row = 0; row < std::min(rows, rows_); ++row)
+        {
+            for(std::size_t col = 0; col < std::min(cols, cols_); ++col)
+            {
+                code_pts[row * cols + col] = code_pts_[row * cols_ + col];
+                cells[row * cols + col] = cells_[row * cols_ + col];
+                if(cells_[row * cols_ + col].bg[3] != 0)
+                    ++num_backgrounds_;
+            }
+        }
+
+        rows_ = rows;
+        cols_ = cols;
+        code_pts_.swap(code_pts);
+        cells_.swap(cells);
+
+        // the buffer is reallocated, and rebuild uploads every record into it
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(Cell) * cells_.size(), NULL, GL_DYNAMIC_DRAW);
+
+        rebuild();
+    }
+
+    std::size_t Text_grid::get_rows() const
+    {
+        return pimpl->rows_;
+    }
+
+    std::size_t Text_grid::get_cols() const
+    {
+        return pimpl->cols_;
+    }
+
+    Vec2<float> Text_grid::get_cell_size() const
+    {
+        return pimpl->cell_size_;
+    }
+
+    void Text_grid::set_cell(const std::size_t row, const std::size_t col, const uint32_t code_pt, const Color & fg, const Color & bg)
+    {
+        if(row >= pimpl->rows_ || col >= pimpl->cols_)
+            throw std::out_of_range("Grid cell out of range: " + std::to_string(row) + ", " + std::to_string(col));
+
+        auto i = row * pimpl->cols_ + col;
+        pimpl->write_cell(i, code_pt, fg, bg);
+        pimpl->mark_dirty(i, i + 1);
+    }
+
+    std::size_t Text_grid::set_text(const std::size_t row, const std::size_t col, const std::string & utf8_input, const Color & fg, const Color & bg)
+    {
+        if(row >= pimpl->rows_ || col >= pimpl->cols_)
+            throw std::out_of_range("Grid cell out of range: " + std::to_string(row) + ", " + std::to_string(col));
+
+        Arena::Scope scope(pimpl->font_->arena_);
+        Resource_vector<char32_t> utf32(&pimpl->font_->arena_);
+        utf8_to_utf32(utf8_input.data(), utf8_input.size(), utf32);
+
+        auto count = std::min(utf32.size(), pimpl->cols_ - col);
+        auto start = row * pimpl->cols_ + col;
+        for(std::size_t i = 0; i < count; ++i)
+            pimpl->write_cell(start + i, utf32[i], fg, bg);
+
+        pimpl->mark_dirty(start, start + count);
+
+        return count;
+    }
+
+    void Text_grid::clear(const Color & bg)
+    {
+        for(std::size_t i = 0; i < pimpl->cells_.size(); ++i)
+            pimpl->write_cell(i, 0, {0.0f, 0.0f, 0.0f, 0.0f}, bg);
+
+        pimpl->mark_dirty(0, pimpl->cells_.size());
+    }
+
+    void Text_grid::Impl::write_cell(const std::size_t i, const uint32_t code_pt, const Color & fg, const Color & bg)
+    {
+        auto & cell = cells_[i];
+
+        if(cell.bg[3] != 0)
+            --num_backgrounds_;
+
+        pack_color(fg, cell.fg);
+        pack_color(bg, cell.bg);
+
+        if(cell.bg[3] != 0)
+            ++num_backgrounds_;
+
+        code_pts_[i] = code_pt;
+        resolve_glyph(i);
+    }
+
+    void Text_grid::Impl::resolve_glyph(const std::size_t i, const bool can_rebuild)
+    {
+        auto & cell = cells_[i];
+        cell.atlas_slot = no_glyph;
+
+        if(code_pts_[i] == 0)
+            return;
+
+        auto & c = font_->use_glyph(code_pts_[i], &glyphs_);
+        if(c.tex == 0)
+            return;
+
+        auto slot = std::find(atlases_.begin(), atlases_.end(), c.tex);
+        if(slot == atlases_.end())
+        {
+            // out of slots. rebuilding drops atlases no longer in use, and slot numbers will be valid again.
+            // if this is the rebuild, or the last one didn't have room either, the grid really does use too many atlases. leave the cell blank
+            if(atlases_.size() == no_glyph)
+            {
+                if(can_rebuild && !out_of_slots_)
+                    rebuild();
+                else
+                    out_of_slots_ = true;
+                return;
+            }
+
+            slot = atlases_.insert(atlases_.end(), c.tex);
+        }
+
+        cell.atlas_cell = static_cast<uint8_t>(c.cell);
+        cell.atlas_slot = static_cast<uint8_t>(slot - atlases_.begin());
+        cell.bbox[0] = static_cast<int16_t>(c.bbox.ul.x);
+        cell.bbox[1] = static_cast<int16_t>(c.bbox.ul.y);
+        cell.bbox[2] = static_cast<int16_t>(c.bbox.lr.x);
+        cell.bbox[3] = static_cast<int16_t>(c.bbox.lr.y);
+    }
+
+    void Text_grid::Impl::mark_dirty(const std::size_t begin, const std::size_t end)
+    {
+        if(begin >= end)
+            return;
+
+        if(dirty_begin_ == dirty_end_)
+        {
+            dirty_begin_ = begin;
+            dirty_end_ = end;
+        }
+        else
+        {
+            dirty_begin_ = std::min(dirty_begin_, begin);
+            dirty_end_ = std::max(dirty_end_, end);
+        }
+    }
+
+    void Text_grid::Impl::rebuild()
+    {
+        auto face = font_->face_;
+        cell_size_.x = std::ceil(face->size->metrics.max_advance / 64.0f * font_->face_scale_);
+        cell_size_.y = static_cast<float>(font_->line_height_);
+        ascender_ = std::round(face->size->metrics.ascender / 64.0f * font_->face_scale_);
+
+        atlases_.clear();
+        glyphs_.clear();
+        out_of_slots_ = false;
+
+        // a new op, so each glyph is only added to glyphs_ once
+        ++font_->op_;
+        for(std::size_t i = 0; i < cells_.size(); ++i)
+            resolve_glyph(i, false);
+
+        layout_generation_ = font_->layout_generation_;
+
+        mark_dirty(0, cells_.size());
+    }
+
+    void Text_grid::render(const Vec2<float> & win_size, const Vec2<float> & pos)
+    {
+        // projection(0, win_size.x, win_size.y, 0) * translate(pos)
+        pimpl->render(Mat4<float>
+        {
+            2.0f / win_size.x,               0.0f,                            0.0f, 0.0f,
+            0.0f,                           -2.0f / win_size.y,               0.0f, 0.0f,
+            0.0f,                            0.0f,                            1.0f, 0.0f,
+           -1.0f + 2.0f * pos.x / win_size.x, 1.0f - 2.0f * pos.y / win_size.y, 0.0f, 1.0f
+        });
+    }
+
+    void Text_grid::render_mat(const Mat4<float> & model_view_projection)
+    {
+        pimpl->render(model_view_projection);
+    }
+
+    void Text_grid::Impl::render(const Mat4<float> & model_view_projection)
+    {
+        // glyphs may have been evicted or moved since they were looked up.
+        // set_cell adds glyphs without checking for duplicates, so clear those out too once they pile up
+        if(glyphs_.size() > 2 * cells_.size() + 256 || !font_->use_glyphs(glyphs_, layout_generation_))
+            rebuild();
+
+        if(cells_.empty())
+            return;
+
+        // save old settings
+        GLint old_vao{0}, old_vbo{0}, old_prog{0};
+        GLint old_blend_src{0}, old_blend_dst{0};
+        GLint old_active_texture{0}, old_texture_2d{0};
+
+        glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &old_vao);
+        glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &old_vbo);
+        glGetIntegerv(GL_CURRENT_PROGRAM, &old_prog);
+        glGetIntegerv(GL_BLEND_SRC_RGB, &old_blend_src);
+        glGetIntegerv(GL_BLEND_DST_RGB, &old_blend_dst);
+        glGetIntegerv(GL_ACTIVE_TEXTURE, &old_active_texture);
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &old_texture_2d);
+
+        auto old_depth_test = glIsEnabled(GL_DEPTH_TEST);
+        auto old_blend = glIsEnabled(GL_BLEND);
+
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+
+        // upload only the records changed since the last render
+        if(dirty_begin_ != dirty_end_)
+        {
+            glBufferSubData(GL_ARRAY_BUFFER, sizeof(Cell) * dirty_begin_, sizeof(Cell) * (dirty_end_ - dirty_begin_), &cells_[dirty_begin_]);
+            dirty_begin_ = dirty_end_ = 0;
+        }
+
+        // VAOs aren't shared, so in another context use that context's, set up for instancing just for this draw
+        const bool own_vao = context_ == font_->current_context_;
+        auto & common_data = font_->common();
+        if(own_vao)
+        {
+            glBindVertexArray(vao_);
+        }
+        else
+        {
+            glBindVertexArray(common_data.vao);
+            set_attributes();
+        }
+
+        const auto & uniforms = common_data.grid_uniforms;
+        glUseProgram(common_data.grid_prog);
+        glUniformMatrix4fv(uniforms.model_view_projection, 1, GL_FALSE, &model_view_projection[0][0]);
+        glUniform1i(uniforms.cols, static_cast<GLint>(cols_));
+        glUniform2f(uniforms.cell_size, cell_size_.x, cell_size_.y);
+        glUniform1f(uniforms.ascender, ascender_);
+        glUniform4f(uniforms.atlas_cell_box, static_cast<float>(font_->cell_bbox_.ul.x), static_cast<float>(font_->cell_bbox_.ul.y),
+                static_cast<float>(font_->cell_bbox_.lr.x), static_cast<float>(font_->cell_bbox_.lr.y));
+        glUniform2f(uniforms.atlas_size, static_cast<float>(font_->tex_width_), static_cast<float>(font_->tex_height_));
+
+        glDisable(GL_DEPTH_TEST);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glActiveTexture(GL_TEXTURE0 + font_->max_tu_count_);
+
+        const auto num_cells = static_cast<GLsizei>(cells_.size());
+
+        // backgrounds first, so glyphs overhanging their cells aren't covered by the next cell's background
+        if(num_backgrounds_ != 0)
+        {
+            glUniform1i(uniforms.atlas, -1);
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, num_cells);
+        }
+
+        // one pass per atlas. each skips cells with glyphs from other atlases
+        for(std::size_t slot = 0; slot < atlases_.size(); ++slot)
+        {
+            glUniform1i(uniforms.atlas, static_cast<GLint>(slot));
+            glUniform1i(uniforms.color_glyphs, font_->atlases_.at(atlases_[slot]).color);
+            glBindTexture(GL_TEXTURE_2D, atlases_[slot]);
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, num_cells);
+        }
+
+        if(!own_vao)
+        {
+            // the shared VAO is used for non-instanced text too
+            for(GLuint i = 0; i < 4; ++i)
+                glVertexAttribDivisor(i, 0);
+            glDisableVertexAttribArray(2);
+            glDisableVertexAttribArray(3);
+        }
+
+        // restore old settings
+        glBindVertexArray(old_vao);
+        glBindBuffer(GL_ARRAY_BUFFER, old_vbo);
+        glUseProgram(old_prog);
+
+        if(old_depth_test)
+            glEnable(GL_DEPTH_TEST);
+        else
+            glDisable(GL_DEPTH_TEST);
+
+        if(old_blend)
+            glEnable(GL_BLEND);
+        else
+            glDisable(GL_BLEND);
+
+        glBlendFunc(old_blend_src, old_blend_dst);
+        glActiveTexture(old_active_texture);
+        glBindTexture(GL_TEXTURE_2D, old_texture_2d);
+    }
+
+    void Text_grid::Impl::set_attributes() const
+    {
+        glVertexAttribIPointer(0, 2, GL_UNSIGNED_BYTE, sizeof(Cell), (const GLvoid *)offsetof(Cell, atlas_cell));
+        glVertexAttribPointer(1, 4, GL_SHORT, GL_FALSE, sizeof(Cell), (const GLvoid *)offsetof(Cell, bbox));
+        glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Cell), (const GLvoid *)offsetof(Cell, fg));
+        glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Cell), (const GLvoid *)offsetof(Cell, bg));
+
+        for(GLuint i = 0; i < 4; ++i)
+        {
+            glEnableVertexAttribArray(i);
+            glVertexAttribDivisor(i, 1);
+        }
+    }
+
+    void Text_grid::Impl::pack_color(const Color & color, uint8_t * rgba)
+    {
+        for(int i = 0; i < 4; ++i)
+            rgba[i] = static_cast<uint8_t>(std::lround(std::min(std::max(color[i], 0.0f), 1.0f) * 255.0f));
+    }
+
+    std::size_t Text_grid::get_memory_usage() const
+    {
+        return pimpl->resource_.bytes_in_use();
+    }
+}
+
+#endif
@@ -0,0 +1,53 @@
+/// @file
+/// @brief Outline, shadow, and glow styles
+
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+
+#include "font_impl.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace textogl
+{
+    void Font_sys::set_style_padding(const unsigned int padding)
+    {
+        pimpl->set_style_padding(padding);
+    }
+    void Font_sys::Impl::set_style_padding(const unsigned int padding)
+    {
+        if(padding <= style_padding_)
+            return;
+
+        style_padding_ = padding;
+
+        // cells grow, so every glyph needs to be rendered again
+        resize(font_size_);
+    }
+
+    unsigned int Font_sys::Impl::style_padding(const Text_style & style)
+    {
+        // quads need to cover everything the effects can reach. samples
+        // further out than that only ever see the empty rest of the cell
+        float padding = std::max(style.outline_width, style.glow_radius);
+        if(style.shadow_color.a > 0.0f)
+            padding = std::max(padding, std::max(std::abs(style.shadow_offset.x), std::abs(style.shadow_offset.y)) + style.shadow_softness);
+
+        return static_cast<unsigned int>(std::ceil(std::max(padding, 0.0f)));
+    }
+}
@@ -0,0 +1,542 @@
+/// @file
+/// @brief Text built from a template with updatable slots
+
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "textogl/text_template.hpp"
+#include "font_impl.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+
+#ifdef USE_OPENGL_ES
+#include <GLES2/gl2.h>
+#else
+#include <GL/glew.h>
+#endif
+
+namespace textogl
+{
+    /// Implementation details for templated text
+    struct Text_template::Impl
+    {
+        /// Part of the template that is laid out on its own: a slot, or the fixed text between slots and newlines
+        struct Segment
+        {
+            /// Create an empty segment
+            explicit Segment(Memory_resource * resource ///< Resource to allocate from
+                             ): name(resource), text(resource), coords(resource), coord_data(resource), advance(0.0f, 0.0f), glyphs(resource)
+            {}
+
+            Resource_string name;     ///< Slot name. Empty for fixed text
+            std::size_t width = 0;    ///< Most code points the slot can hold. 0 for fixed text
+            bool new_line = false;    ///< \c true if the segment starts a new line
+            Resource_string text;     ///< Text to lay out, in UTF-8 encoding. For text slots, already cut to \ref width
+            bool number = false;      ///< \c true if \ref text is a number from Font_sys::Impl::format_integer or Font_sys::Impl::format_float
+            bool fixed_width = false; ///< Number_format::fixed_width, for numbers
+
+            std::size_t start = 0;    ///< First vertex of the segment in \ref vbo_
+            std::size_t capacity = 0; ///< Number of vertices reserved for the segment in \ref vbo_
+
+            Resource_vector<Vec2<float>> coords;                    ///< Copy of the slot's part of \ref vbo_, to find what changed. Empty for fixed text
+            Resource_vector<Font_sys::Impl::Coord_data> coord_data; ///< Start and end indexs, relative to \ref start
+            Font_sys::Impl::Bbox<float> text_box;                   ///< Bounding box, relative to the segment's origin
+            Vec2<float> advance;                                    ///< Pen position after the segment, relative to its origin
+            Resource_vector<Font_sys::Impl::Char_info *> glyphs;    ///< Glyphs used by the segment
+        };
+
+        /// Create and build text object
+        Impl(Font_sys & font, const std::string & utf8_template);
+        ~Impl();
+
+        /// @name Non-copyable, non-movable
+        /// @{
+        Impl(const Impl &) = delete;
+        Impl & operator=(const Impl &) = delete;
+
+        Impl(Impl &&) = delete;
+        Impl & operator=(Impl &&) = delete;
+        /// @}
+
+        /// Split a template into segments
+        /// @throws std::invalid_argument if the template is malformed
+        void parse(const std::string & utf8_template ///< Template text
+                   );
+
+        /// Get a slot's segment
+        /// @throws std::out_of_range if \p index is not a slot index
+        Segment & slot(const std::size_t index ///< Slot index
+                       );
+
+        /// Change a slot's text, cutting it to fit
+        void set_slot(const std::size_t index,       ///< Slot index
+                      const std::string & utf8_input ///< Text to put in the slot
+                      );
+
+        /// Change a slot's contents, laying out and uploading only that slot if possible
+        void update_slot(Segment & segment,      ///< Slot's segment
+                         const char * text,      ///< New text. Already cut to fit, for text
+                         const std::size_t size, ///< Size of \p text
+                         const bool number,      ///< \c true if \p text is a formatted number
+                         const bool fixed_width  ///< Number_format::fixed_width, for numbers
+                         );
+
+        /// Render the text
+        void render_text(const Color & color,          ///< Text Color
+                         const Vec2<float> & win_size, ///< Window dimensions. A Vec2 with X = width and Y = height
+                         const Vec2<float> & pos,      ///< Render position, in screen pixels
+                         const float rotation,         ///< Clockwise text rotation (in radians) around origin as defined in align_flags. 0 is vertical
+                         const int align_flags         ///< Text Alignment. Should be #Text_origin flags bitwise-OR'd together
+                         );
+
+        /// Render the text, using a model view projection matrix
+        void render_text(const Color & color,                      ///< Text Color
+                         const Mat4<float> & model_view_projection ///< Model view projection matrix
+                         );
+
+        /// Rebuild every segment, and reload \ref vbo_
+        void rebuild();
+
+        /// Lay out a segment's text
+        void build_segment(const Segment & segment,              ///< Segment to build
+                           Font_sys::Impl::Text_layout & layout ///< Layout to fill in
+                           );
+
+        /// Keep what's needed to render a segment from its layout
+        void store_segment(Segment & segment,                          ///< Segment to update
+                           const Font_sys::Impl::Text_layout & layout ///< Layout built from the segment's text
+                           );
+
+        /// Position each segment after the one before it, and gather up the ranges to draw
+        void place_segments();
+
+        /// Points to Font_sys chosen at construction.
+        std::shared_ptr<Font_sys::Impl> font_;
+
+        Counting_resource resource_; ///< Resource for all internal containers. Declared before the containers so it outlives them
+
+        Resource_vector<Segment> segments_;  ///< Segments, in the order they appear in the template
+        Resource_vector<std::size_t> slots_; ///< Index into \ref segments_ of each slot
+
+#ifndef USE_OPENGL_ES
+        GLuint vao_; ///< OpenGL Vertex array object index
+        Font_sys::Context_handle context_; ///< Context \ref vao_ was created in
+#endif
+        GLuint vbo_; ///< OpenGL Vertex buffer object index
+
+        Resource_vector<Font_sys::Impl::Coord_data> coord_data_; ///< Start and end indexs into \ref vbo_ for every segment, with each segment's offset
+        Font_sys::Impl::Bbox<float> text_box_;                   ///< Bounding box for the whole text
+
+        std::size_t layout_generation_ = 0; ///< Font_sys::Impl::layout_generation_ when the segments were built
+    };
+
+    Text_template::Text_template(Font_sys & font, const std::string & utf8_template): pimpl(new Impl(font, utf8_template)) {}
+    Text_template::~Text_template() = default;
+
+    Text_template::Impl::Impl(Font_sys & font, const std::string & utf8_template):
+        font_(font.pimpl),
+        resource_(nullptr),
+        segments_(&resource_),
+        slots_(&resource_),
+        coord_data_(&resource_)
+    {
+        parse(utf8_template);
+
+#ifndef USE_OPENGL_ES
+        context_ = Font_sys::get_current_context();
+        glGenVertexArrays(1, &vao_);
+        glBindVertexArray(vao_);
+#endif
+        glGenBuffers(1, &vbo_);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+
+        // set up buffer obj properties, load vertex data
+        rebuild();
+
+#ifndef USE_OPENGL_ES
+        glBindVertexArray(vao_);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(Vec2<float>), NULL);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(Vec2<float>), (const GLvoid *)sizeof(Vec2<float>));
+        glEnableVertexAttribArray(1);
+
+        glBindVertexArray(0);
+#endif
+    }
+
+    Text_template::Impl::~Impl()
+    {
+        // destroy VAO/VBO
+        glDeleteBuffers(1, &vbo_);
+#ifndef USE_OPENGL_ES
+        glDeleteVertexArrays(1, &vao_);
+#endif
+    }
+
+    void Text_template::Impl::parse(const std::string & utf8_template)
+    {
+        segments_.clear();
+        slots_.clear();
+
+        segments_.emplace_back(&resource_);
+
+        for(std::size_t i = 0; i < utf8_template.size(); ++i)
+        {
+            const char ch = utf8_template[i];
+
+            if(ch == '\n')
+            {
+                // newlines start a new segment, so segments are always single lines
+                segments_.emplace_back(&resource_);
+                segments_.back().new_line = true;
+            }
+            else if((ch == '{' || ch == '}') && i + 1 < utf8_template.size() && utf8_template[i + 1] == ch)
+            {
+                // escaped brace
+                segments_.back().text.push_back(ch);
+                ++i;
+            }
+            else if(ch == '{')
+            {
+                auto close = utf8_template.find('}', i);
+                if(close == std::string::npos)
+                    throw std::invalid_argument("Unterminated slot in text template: " + utf8_template);
+
+                auto colon = utf8_template.find(':', i);
+                if(colon > close)
+                    throw std::invalid_argument("Text template slot has no width: " + utf8_template.substr(i, close - i + 1));
+
+                auto name = utf8_template.substr(i + 1, colon - i - 1);
+                auto width = utf8_template.substr(colon + 1, close - colon - 1);
+
+                if(name.empty())
+                    throw std::invalid_argument("Text template slot has no name: " + utf8_template.substr(i, close - i + 1));
+                if(width.empty() || width.find_first_not_of("0123456789") != std::string::npos || std::stoul(width) == 0)
+                    throw std::invalid_argument("Invalid text template slot width: " + utf8_template.substr(i, close - i + 1));
+
+                for(auto slot: slots_)
+                {
+                    if(segments_[slot].name.compare(name.c_str()) == 0)
+                        throw std::invalid_argument("Duplicate text template slot: " + name);
+                }
+
+                segments_.emplace_back(&resource_);
+                segments_.back().name.assign(name.data(), name.size());
+                segments_.back().width = std::stoul(width);
+                slots_.push_back(segments_.size() - 1);
+
+                // fixed text after the slot
+                segments_.emplace_back(&resource_);
+
+                i = close;
+            }
+            else if(ch == '}')
+            {
+                throw std::invalid_argument("Unmatched '}' in text template: " + utf8_template);
+            }
+            else
+            {
+                segments_.back().text.push_back(ch);
+            }
+        }
+    }
+
+    void Text_template::set_font_sys(Font_sys & font)
+    {
+        pimpl->font_ = font.pimpl;
+        pimpl->rebuild();
+    }
+
+    std::size_t Text_template::get_slot_index(const std::string & name) const
+    {
+        for(std::size_t i = 0; i < pimpl->slots_.size(); ++i)
+        {
+            if(pimpl->segments_[pimpl->slots_[i]].name.compare(name.c_str()) == 0)
+                return i;
+        }
+
+        throw std::out_of_range("No text template slot named: " + name);
+    }
+
+    void Text_template::set_slot(const std::string & name, const std::string & utf8_input)
+    {
+        pimpl->set_slot(get_slot_index(name), utf8_input);
+    }
+    void Text_template::set_slot(const std::size_t index, const std::string & utf8_input)
+    {
+        pimpl->set_slot(index, utf8_input);
+    }
+    void Text_template::set_slot_integer(const std::size_t index, const long long value, const Number_format & format)
+    {
+        char text[Font_sys::Impl::max_number_size];
+        auto size = Font_sys::Impl::format_integer(value, format, text);
+        pimpl->update_slot(pimpl->slot(index), text, size, true, format.fixed_width);
+    }
+
+    void Text_template::set_slot_float(const std::size_t index, const double value, const Number_format & format)
+    {
+        char text[Font_sys::Impl::max_number_size];
+        auto size = Font_sys::Impl::format_float(value, format, text);
+        pimpl->update_slot(pimpl->slot(index), text, size, true, format.fixed_width);
+    }
+
+    Text_template::Impl::Segment & Text_template::Impl::slot(const std::size_t index)
+    {
+        if(index >= slots_.size())
+            throw std::out_of_range("Text template slot index out of range: " + std::to_string(index));
+
+        return segments_[slots_[index]];
+    }
+
+    void Text_template::Impl::set_slot(const std::size_t index, const std::string & utf8_input)
+    {
+        auto & segment = slot(index);
+
+        Arena::Scope scope(font_->arena_);
+
+        // cut to the slot's width, dropping newlines
+        Resource_string text(&font_->arena_);
+        std::size_t num_code_pts = 0;
+        bool keep = false;
+        for(auto ch: utf8_input)
+        {
+            // continuation bytes go with the code point they belong to
+            if((ch & 0xC0) != 0x80)
+            {
+                keep = ch != '\n' && num_code_pts < segment.width;
+                if(keep)
+                    ++num_code_pts;
+            }
+
+            if(keep)
+                text.push_back(ch);
+        }
+
+        update_slot(segment, text.data(), text.size(), false, false);
+    }
+
+    void Text_template::Impl::update_slot(Segment & segment, const char * text, const std::size_t size, const bool number, const bool fixed_width)
+    {
+        // setting the same value every frame is common, and costs nothing
+        if(segment.number == number && segment.fixed_width == fixed_width && segment.text.compare(0, segment.text.size(), text, size) == 0)
+            return;
+
+        segment.text.assign(text, size);
+        segment.number = number;
+        segment.fixed_width = fixed_width;
+
+        // other segments' glyphs have moved, so everything needs to be rebuilt anyway
+        if(font_->layout_generation_ != layout_generation_)
+        {
+            rebuild();
+            return;
+        }
+
+        Arena::Scope scope(font_->arena_);
+        Font_sys::Impl::Text_layout layout(&font_->arena_);
+        build_segment(segment, layout);
+
+        // rebuild if the new glyphs pushed other segments' glyphs out, or if
+        // there are more quads than there is room for
+        if(font_->layout_generation_ != layout_generation_ || layout.coords.size() / 2 > segment.capacity)
+        {
+            rebuild();
+            return;
+        }
+
+        // only upload the vertices that changed. anything past the new end is left unused
+        auto same = [](const Vec2<float> & a, const Vec2<float> & b){ return a.x == b.x && a.y == b.y; };
+
+        const auto & old_coords = segment.coords;
+        const auto & new_coords = layout.coords;
+
+        std::size_t begin = 0;
+        while(begin < std::min(old_coords.size(), new_coords.size()) && same(old_coords[begin], new_coords[begin]))
+            ++begin;
+
+        std::size_t end = new_coords.size();
+        if(old_coords.size() == new_coords.size())
+        {
+            while(end > begin && same(old_coords[end - 1], new_coords[end - 1]))
+                --end;
+        }
+
+        if(end > begin)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+            glBufferSubData(GL_ARRAY_BUFFER, sizeof(Vec2<float>) * (2 * segment.start + begin), sizeof(Vec2<float>) * (end - begin), new_coords.data() + begin);
+        }
+
+        store_segment(segment, layout);
+
+        place_segments();
+    }
+
+    void Text_template::render_text(const Color & color, const Vec2<float> & win_size,
+            const Vec2<float> & pos, const int align_flags)
+    {
+        pimpl->render_text(color, win_size, pos, 0.0f, align_flags);
+    }
+    void Text_template::render_text_rotate(const Color & color, const Vec2<float> & win_size,
+            const Vec2<float> & pos, const float rotation, const int align_flags)
+    {
+        pimpl->render_text(color, win_size, pos, rotation, align_flags);
+    }
+    void Text_template::Impl::render_text(const Color & color, const Vec2<float> & win_size,
+            const Vec2<float> & pos, const float rotation, const int align_flags)
+    {
+        // glyphs may have been evicted or moved since the text was built
+        for(const auto & segment: segments_)
+        {
+            if(!font_->use_glyphs(segment.glyphs, layout_generation_))
+            {
+                rebuild();
+                break;
+            }
+        }
+
+        font_->render_text_common(color, win_size, pos, align_flags, rotation, text_box_, coord_data_,
+#ifndef USE_OPENGL_ES
+            vao_, context_,
+#endif
+            vbo_);
+    }
+
+    void Text_template::render_text_mat(const Color & color, const Mat4<float> & model_view_projection)
+    {
+        pimpl->render_text(color, model_view_projection);
+    }
+    void Text_template::Impl::render_text(const Color & color, const Mat4<float> & model_view_projection)
+    {
+        // glyphs may have been evicted or moved since the text was built
+        for(const auto & segment: segments_)
+        {
+            if(!font_->use_glyphs(segment.glyphs, layout_generation_))
+            {
+                rebuild();
+                break;
+            }
+        }
+
+        font_->render_text_common(color, model_view_projection, coord_data_,
+#ifndef USE_OPENGL_ES
+            vao_, context_,
+#endif
+            vbo_);
+    }
+
+    std::size_t Text_template::get_memory_usage() const
+    {
+        return pimpl->resource_.bytes_in_use();
+    }
+
+    void Text_template::Impl::rebuild()
+    {
+        // if building a later segment evicts an earlier one's glyphs, this
+        // won't match, and the next render rebuilds again
+        auto generation = font_->layout_generation_;
+
+        Arena::Scope scope(font_->arena_);
+        Resource_vector<Vec2<float>> coords(&font_->arena_);
+
+        for(auto & segment: segments_)
+        {
+            Font_sys::Impl::Text_layout layout(&font_->arena_);
+            build_segment(segment, layout);
+
+            store_segment(segment, layout);
+
+            // slots get room for their widest value, at one quad per code point
+            segment.start = coords.size() / 2;
+            segment.capacity = std::max(segment.width * 6, layout.coords.size() / 2);
+
+            coords.insert(coords.end(), layout.coords.begin(), layout.coords.end());
+            coords.resize(2 * (segment.start + segment.capacity), Vec2<float>{0.0f, 0.0f});
+        }
+
+        layout_generation_ = generation;
+
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+
+        // reload vertex data
+        glBufferData(GL_ARRAY_BUFFER, sizeof(Vec2<float>) * coords.size(), coords.data(), GL_DYNAMIC_DRAW);
+
+        place_segments();
+    }
+
+    void Text_template::Impl::build_segment(const Segment & segment, Font_sys::Impl::Text_layout & layout)
+    {
+        if(segment.number)
+            font_->build_number(segment.text.data(), segment.text.size(), segment.fixed_width, layout);
+        else
+            font_->build_text(segment.text.data(), segment.text.size(), layout);
+    }
+
+    void Text_template::Impl::store_segment(Segment & segment, const Font_sys::Impl::Text_layout & layout)
+    {
+        // these are copied into resource_
+        if(segment.width > 0)
+            segment.coords = layout.coords;
+        segment.coord_data = layout.coord_data;
+        segment.text_box = layout.text_box;
+        segment.advance = layout.pen;
+        segment.glyphs = layout.glyphs;
+    }
+
+    void Text_template::Impl::place_segments()
+    {
+        coord_data_.clear();
+        Font_sys::Impl::init_text_box(text_box_);
+
+        Vec2<float> pen{0.0f, 0.0f};
+        for(const auto & segment: segments_)
+        {
+            if(segment.new_line)
+            {
+                pen.x = 0.0f;
+                pen.y += font_->line_height_;
+            }
+
+            // start on a whole pixel, so glyphs keep the pixel alignment they were laid out with
+            Vec2<float> offset{std::round(pen.x), std::round(pen.y)};
+
+            for(const auto & cd: segment.coord_data)
+            {
+                coord_data_.push_back(cd);
+                coord_data_.back().start += segment.start;
+                coord_data_.back().offset = offset;
+            }
+
+            if(!segment.coord_data.empty())
+            {
+                text_box_.ul.x = std::min(text_box_.ul.x, offset.x + segment.text_box.ul.x);
+                text_box_.ul.y = std::min(text_box_.ul.y, offset.y + segment.text_box.ul.y);
+                text_box_.lr.x = std::max(text_box_.lr.x, offset.x + segment.text_box.lr.x);
+                text_box_.lr.y = std::max(text_box_.lr.y, offset.y + segment.text_box.lr.y);
+            }
+
+            pen.x = offset.x + segment.advance.x;
+            pen.y = offset.y + segment.advance.y;
+        }
+    }
+}
@@ -0,0 +1,199 @@
+/// @file
+/// @brief Background glyph uploads
+
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "font_impl.hpp"
+
+#include <algorithm>
+
+#include <cstring>
+
+namespace textogl
+{
+#ifndef USE_OPENGL_ES
+    Font_sys::Impl::Upload_thread::~Upload_thread()
+    {
+        stop();
+    }
+
+    void Font_sys::Impl::Upload_thread::start(std::function<void()> make_current, std::function<void()> release_current)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(running_)
+            return;
+
+        // a previous thread may have been stopped without being joined
+        if(thread_.joinable())
+            thread_.join();
+
+        running_ = true;
+        stopping_ = false;
+        thread_ = std::thread(&Upload_thread::run, this, std::move(make_current), std::move(release_current));
+    }
+
+    void Font_sys::Impl::Upload_thread::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_ = false;
+            stopping_ = true;
+        }
+        cv_.notify_all();
+
+        if(thread_.joinable())
+            thread_.join();
+    }
+
+    bool Font_sys::Impl::Upload_thread::running()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return running_;
+    }
+
+    void Font_sys::Impl::Upload_thread::submit(Upload_batch & batch)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            batch.state = Upload_batch::State::QUEUED;
+            queue_.push_back(&batch);
+        }
+        cv_.notify_all();
+    }
+
+    void Font_sys::Impl::Upload_thread::cancel(Upload_batch & batch)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        auto queued = std::find(queue_.begin(), queue_.end(), &batch);
+        if(queued != queue_.end())
+        {
+            queue_.erase(queued);
+            return;
+        }
+
+        cv_.wait(lock, [&batch](){ return batch.state == Upload_batch::State::DONE; });
+    }
+
+    void Font_sys::Impl::Upload_thread::wait(Upload_batch & batch)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&batch](){ return batch.state == Upload_batch::State::DONE; });
+    }
+
+    bool Font_sys::Impl::Upload_thread::done(Upload_batch & batch)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return batch.state == Upload_batch::State::DONE;
+    }
+
+    void Font_sys::Impl::Upload_thread::run(std::function<void()> make_current, std::function<void()> release_current)
+    {
+        make_current();
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+        // one PBO is reused for every batch. it's orphaned before each write, so this doesn't wait on the previous upload
+        GLuint pbo;
+        glGenBuffers(1, &pbo);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        while(true)
+        {
+            cv_.wait(lock, [this](){ return stopping_ || !queue_.empty(); });
+
+            // finish everything queued before stopping, so no font is left waiting
+            if(queue_.empty())
+                break;
+
+            Upload_batch & batch = *queue_.front();
+            queue_.pop_front();
+            batch.state = Upload_batch::State::UPLOADING;
+
+            lock.unlock();
+            upload(batch, pbo);
+            lock.lock();
+
+            batch.state = Upload_batch::State::DONE;
+            cv_.notify_all();
+        }
+        lock.unlock();
+
+        glDeleteBuffers(1, &pbo);
+
+        if(release_current)
+            release_current();
+    }
+
+    void Font_sys::Impl::Upload_thread::upload(Upload_batch & batch, const GLuint pbo)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, batch.data.size(), NULL, GL_STREAM_DRAW);
+
+        // if the PBO can't be written, the batch is marked failed and the rendering thread uploads it instead
+        void * buffer = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, batch.data.size(), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if(!buffer)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            batch.failed = true;
+            return;
+        }
+
+        std::memcpy(buffer, batch.data.data(), batch.data.size());
+
+        // the buffer contents are undefined if unmapping fails (video mode change, for ex.)
+        if(glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) != GL_TRUE)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            batch.failed = true;
+            return;
+        }
+
+        // copy each cell from the PBO
+        std::size_t cell_size = batch.cell_width * batch.cell_height;
+        for(std::size_t i = 0; i < batch.regions.size(); ++i)
+        {
+            auto & region = batch.regions[i];
+            glBindTexture(GL_TEXTURE_2D, region.tex);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, (region.cell % 16) * batch.cell_width, (region.cell / 16) * batch.cell_height,
+                    batch.cell_width, batch.cell_height, GL_RED, GL_UNSIGNED_BYTE, reinterpret_cast<const GLvoid *>(i * cell_size));
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        // the fence must be flushed to be visible to the rendering context
+        batch.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+    }
+
+    void Font_sys::start_upload_thread(std::function<void()> make_current, std::function<void()> release_current)
+    {
+        Impl::upload_thread_.start(std::move(make_current), std::move(release_current));
+    }
+
+    void Font_sys::stop_upload_thread()
+    {
+        Impl::upload_thread_.stop();
+    }
+
+    Font_sys::Impl::Upload_thread Font_sys::Impl::upload_thread_;
+#endif
+}
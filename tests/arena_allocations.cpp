@@ -0,0 +1,115 @@
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Checks that immediate-mode rendering stops allocating once Font_sys::end_frame
+// has merged the scratch arena's blocks
+
+#include <iostream>
+#include <new>
+#include <string>
+
+#include <cstdlib>
+
+#include <GL/glew.h>
+
+#include "textogl/font.hpp"
+#include "textogl/static_text.hpp"
+
+#include "headless_context.hpp"
+
+namespace
+{
+    bool counting = false;
+    std::size_t num_allocations = 0;
+}
+
+// count every global allocation made while counting is on
+void * operator new(std::size_t size)
+{
+    if(counting)
+        ++num_allocations;
+
+    if(void * ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+void * operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+void operator delete(void * ptr) noexcept
+{
+    std::free(ptr);
+}
+void operator delete[](void * ptr) noexcept
+{
+    std::free(ptr);
+}
+void operator delete(void * ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+void operator delete[](void * ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+int main(int argc, char * argv[])
+{
+    auto font_path = test_font_path(argc, argv);
+
+    Headless_context context;
+
+    textogl::Font_sys font(font_path, 32);
+    textogl::Static_text static_text(font, "Static text");
+
+    const std::string text = "Dynamic text: 123.456 fps\nand a second, longer line of text";
+    const textogl::Color color{1.0f, 1.0f, 1.0f, 1.0f};
+    const textogl::Vec2<float> win_size{static_cast<float>(context.get_width()), static_cast<float>(context.get_height())};
+    const textogl::Mat4<float> mvp{2.0f / win_size.x, 0.0f, 0.0f, 0.0f,
+                                   0.0f, -2.0f / win_size.y, 0.0f, 0.0f,
+                                   0.0f, 0.0f, 1.0f, 0.0f,
+                                   -1.0f, 1.0f, 0.0f, 1.0f};
+
+    auto frame = [&]()
+    {
+        glClear(GL_COLOR_BUFFER_BIT);
+        font.render_text(text, color, win_size, {10.0f, 10.0f});
+        font.render_text_mat(text, color, mvp);
+        static_text.render_text(color, win_size, {10.0f, 100.0f});
+        static_text.render_text_mat(color, mvp);
+        font.end_frame();
+    };
+
+    // the first frames load glyphs, grow the arena, and compile shaders
+    for(int i = 0; i < 3; ++i)
+        frame();
+
+    counting = true;
+    for(int i = 0; i < 100; ++i)
+        frame();
+    counting = false;
+
+    bool passed = check(context.count_lit_pixels() > 0, "text was drawn");
+    passed &= check(num_allocations == 0, "no allocations in 100 steady-state frames (got " + std::to_string(num_allocations) + ")");
+    passed &= check(glGetError() == GL_NO_ERROR, "no GL errors");
+
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
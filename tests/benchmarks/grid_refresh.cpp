@@ -0,0 +1,157 @@
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Checks that immediate-mode rendering stops allocating once Font_sys::end_frame
+// has merged the scratch arena's blocks
+
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <cstdlib>
+
+#include <GL/glew.h>
+
+#include "textogl/font.hpp"
+#include "textogl/static_text.hpp"
+#include "textogl/text_grid.hpp"
+
+#include "headless_context.hpp"
+
+// Refreshes a 300x100 cell screen, as a terminal scrolling full screens of
+// output would. Compares a Text_grid with every cell rewritten, a Text_grid
+// with a single cell changed, and one Static_text per row. Changing the text
+// is timed on its own, and with drawing and a glFinish for the whole frame
+
+int main(int argc, char * argv[])
+{
+    auto font_path = test_font_path(argc, argv);
+
+    const std::size_t rows = 100, cols = 300;
+    const int num_frames = 50;
+
+    Headless_context context(2048, 1024);
+    const textogl::Vec2<float> win_size{static_cast<float>(context.get_width()), static_cast<float>(context.get_height())};
+    // no backgrounds, so the grid draws the same as Static_text
+    const textogl::Color fg{0.8f, 0.8f, 0.8f, 1.0f}, bg{0.0f, 0.0f, 0.0f, 0.0f};
+
+    textogl::Font_sys font(font_path, 8);
+
+    // printable ASCII, wider than a row, so every offset gives a full row
+    std::string source;
+    while(source.size() < 2 * cols)
+    {
+        for(char c = '!'; c <= '~'; ++c)
+            source += c;
+    }
+
+    // each frame shifts every row by a character, so every cell changes
+    auto row_text = [&](std::size_t row, int frame)
+    {
+        return source.substr((row + frame) % (source.size() - cols), cols);
+    };
+
+    // milliseconds per frame: changing the text, and the whole frame including drawing
+    struct Timing
+    {
+        double update_ms;
+        double frame_ms;
+    };
+
+    auto time_frames = [&](const std::function<void(int)> & update, const std::function<void()> & draw)
+    {
+        // warm up: load glyphs and allocate buffers
+        for(int i = 0; i < 3; ++i)
+        {
+            update(i);
+            draw();
+        }
+        glFinish();
+
+        std::chrono::duration<double, std::milli> update_time{0.0};
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < num_frames; ++i)
+        {
+            glClear(GL_COLOR_BUFFER_BIT);
+
+            auto update_start = std::chrono::steady_clock::now();
+            update(i + 3);
+            update_time += std::chrono::steady_clock::now() - update_start;
+
+            draw();
+            font.end_frame();
+            glFinish();
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        return Timing{update_time.count() / num_frames, elapsed.count() / num_frames};
+    };
+
+    textogl::Text_grid grid(font, rows, cols);
+    auto draw_grid = [&](){ grid.render(win_size, {0.0f, 0.0f}); };
+
+    auto grid_full = time_frames([&](int frame)
+    {
+        for(std::size_t row = 0; row < rows; ++row)
+            grid.set_text(row, 0, row_text(row, frame), fg, bg);
+    }, draw_grid);
+
+    auto grid_cell = time_frames([&](int frame)
+    {
+        grid.set_cell(frame % rows, frame % cols, static_cast<uint32_t>('!' + frame % 94), fg, bg);
+    }, draw_grid);
+
+    std::vector<std::unique_ptr<textogl::Static_text>> lines;
+    for(std::size_t row = 0; row < rows; ++row)
+        lines.emplace_back(new textogl::Static_text(font, ""));
+
+    const float line_height = grid.get_cell_size().y;
+    auto static_text = time_frames([&](int frame)
+    {
+        for(std::size_t row = 0; row < rows; ++row)
+            lines[row]->set_text(row_text(row, frame));
+    }, [&]()
+    {
+        for(std::size_t row = 0; row < rows; ++row)
+            lines[row]->render_text(fg, win_size, {0.0f, row * line_height});
+    });
+
+    std::cout<<rows<<" rows x "<<cols<<" columns, ms per frame\n";
+    std::cout<<"                                   update      frame\n";
+    std::cout<<std::fixed<<std::setprecision(3);
+    auto print = [](const char * name, const Timing & timing)
+    {
+        std::cout<<"  "<<std::left<<std::setw(30)<<name<<std::right<<std::setw(9)<<timing.update_ms<<std::setw(11)<<timing.frame_ms<<"\n";
+    };
+    print("Text_grid, every cell", grid_full);
+    print("Text_grid, one cell", grid_cell);
+    print("Static_text per row, every row", static_text);
+
+    if(glGetError() != GL_NO_ERROR)
+    {
+        std::cerr<<"GL error"<<std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,157 @@
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Checks that immediate-mode rendering stops allocating once Font_sys::end_frame
+// has merged the scratch arena's blocks
+
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <cstdlib>
+
+#include <GL/glew.h>
+
+#include "textogl/font.hpp"
+#include "textogl/static_text.hpp"
+
+#include "headless_context.hpp"
+
+// Draws 10,000 labels spread over a ground plane in a perspective view, from
+// a few units in front of the camera out to the far plane, with and without
+// Static_text::set_lod. Frames end with glFinish, so GPU time is included
+
+int main(int argc, char * argv[])
+{
+    auto font_path = test_font_path(argc, argv);
+
+    const int labels_per_side = 100;
+    const int num_frames = 20;
+
+    Headless_context context(1280, 720);
+    const textogl::Color color{1.0f, 1.0f, 1.0f, 1.0f};
+
+    textogl::Font_sys font(font_path, 32);
+
+    // camera 5 units above the plane, looking down -Z. column-major, as OpenGL expects
+    const float fov_y = 60.0f * 3.14159265f / 180.0f, aspect = static_cast<float>(context.get_width()) / context.get_height();
+    const float near_plane = 0.5f, far_plane = 500.0f;
+    const float f = 1.0f / std::tan(fov_y / 2.0f);
+    const textogl::Mat4<float> projection{f / aspect, 0.0f, 0.0f, 0.0f,
+                                          0.0f, f, 0.0f, 0.0f,
+                                          0.0f, 0.0f, (far_plane + near_plane) / (near_plane - far_plane), -1.0f,
+                                          0.0f, 0.0f, 2.0f * far_plane * near_plane / (near_plane - far_plane), 0.0f};
+    const textogl::Mat4<float> view{1.0f, 0.0f, 0.0f, 0.0f,
+                                    0.0f, 1.0f, 0.0f, 0.0f,
+                                    0.0f, 0.0f, 1.0f, 0.0f,
+                                    0.0f, -5.0f, 0.0f, 1.0f};
+    const textogl::Mat4<float> view_projection = projection * view;
+
+    // text is laid out in pixels with Y down. scale it to world units, with Y up
+    const float scale = 0.02f;
+
+    struct Label
+    {
+        std::unique_ptr<textogl::Static_text> text;
+        textogl::Mat4<float> mvp;
+    };
+
+    std::vector<Label> labels;
+    for(int row = 0; row < labels_per_side; ++row)
+    {
+        for(int col = 0; col < labels_per_side; ++col)
+        {
+            // rows spread from 3 to 400 units away, columns across a 100 unit wide strip
+            const float x = -50.0f + col * (100.0f / labels_per_side);
+            const float z = -3.0f - row * (397.0f / labels_per_side);
+            const textogl::Mat4<float> model{scale, 0.0f, 0.0f, 0.0f,
+                                             0.0f, -scale, 0.0f, 0.0f,
+                                             0.0f, 0.0f, scale, 0.0f,
+                                             x, 0.0f, z, 1.0f};
+
+            labels.push_back({std::unique_ptr<textogl::Static_text>(new textogl::Static_text(font, "Label " + std::to_string(row * labels_per_side + col))),
+                              view_projection * model});
+        }
+    }
+
+    auto time_frames = [&]()
+    {
+        auto frame = [&]()
+        {
+            glClear(GL_COLOR_BUFFER_BIT);
+            for(auto & label: labels)
+                label.text->render_text_mat(color, label.mvp);
+            font.end_frame();
+            glFinish();
+        };
+
+        // warm up: render impostors and settle on levels
+        for(int i = 0; i < 3; ++i)
+            frame();
+
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < num_frames; ++i)
+            frame();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count() / num_frames;
+    };
+
+    auto count_levels = [&]()
+    {
+        std::size_t counts[4] = {0, 0, 0, 0};
+        for(auto & label: labels)
+            ++counts[label.text->get_lod_level()];
+
+        std::cout<<"    full "<<counts[textogl::Text_lod::FULL]<<", impostor "<<counts[textogl::Text_lod::IMPOSTOR]
+                 <<", bar "<<counts[textogl::Text_lod::BAR]<<", hidden "<<counts[textogl::Text_lod::HIDDEN]<<"\n";
+    };
+
+    std::cout<<labels.size()<<" labels, "<<context.get_width()<<"x"<<context.get_height()<<", ms per frame\n";
+    std::cout<<std::fixed<<std::setprecision(3);
+
+    std::cout<<"  no LOD:                 "<<std::setw(9)<<time_frames()<<"\n";
+
+    textogl::Text_lod bars;
+    bars.bar_below = 6.0f;
+    bars.hide_below = 2.0f;
+    for(auto & label: labels)
+        label.text->set_lod(bars);
+    std::cout<<"  bars and hiding:        "<<std::setw(9)<<time_frames()<<"\n";
+    count_levels();
+
+    textogl::Text_lod impostors = bars;
+    impostors.impostor_below = 12.0f;
+    for(auto & label: labels)
+        label.text->set_lod(impostors);
+    std::cout<<"  impostors, bars, hiding:"<<std::setw(9)<<time_frames()<<"\n";
+    count_levels();
+
+    if(glGetError() != GL_NO_ERROR)
+    {
+        std::cerr<<"GL error"<<std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
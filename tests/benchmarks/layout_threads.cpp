@@ -0,0 +1,122 @@
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Checks that immediate-mode rendering stops allocating once Font_sys::end_frame
+// has merged the scratch arena's blocks
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstdlib>
+
+#include <GL/glew.h>
+
+#include "textogl/font.hpp"
+#include "textogl/static_text.hpp"
+
+#include "headless_context.hpp"
+
+// Lays out mixed-script text for many Static_text objects at once through
+// set_text_async, with 1-32 layout threads sharing the glyph metrics cache.
+// Timing covers queueing every object and committing it, so the rendering
+// thread's vertex buffer uploads are included
+
+int main(int argc, char * argv[])
+{
+    auto font_path = test_font_path(argc, argv);
+
+    const std::size_t num_objects = 256;
+    const int num_rounds = 20;
+
+    // the default font needs to cover all of these. DejaVu Sans does
+    const std::vector<std::string> lines =
+    {
+        "Latin: The quick brown fox jumps over the lazy dog 0123456789",
+        "Greek: Γαζέες καὶ μυρτιὲς δὲν θὰ βρῶ πιὰ στὸ χρυσαφὶ ξέφωτο",
+        "Cyrillic: Съешь же ещё этих мягких французских булок, да выпей чаю",
+        "Arabic: نص حكيم له سر قاطع وذو شأن عظيم مكتوب على ثوب أخضر",
+        "Hebrew: דג סקרן שט בים מאוכזב ולפתע מצא חברה",
+        "Armenian: Բարեւ աշխարհ, ինչպես ես այսօր",
+        "Georgian: სწრაფი ყავისფერი მელა ახტება ზარმაც ძაღლს"
+    };
+
+    // each object gets a different rotation of the lines, changing every round
+    auto text_for = [&lines](std::size_t object, int round)
+    {
+        std::string text;
+        for(std::size_t i = 0; i < lines.size(); ++i)
+            text += lines[(object + round + i) % lines.size()] + "\n";
+        return text;
+    };
+
+    Headless_context context;
+
+    textogl::Font_sys font(font_path, 16);
+
+    std::vector<std::unique_ptr<textogl::Static_text>> objects;
+    for(std::size_t i = 0; i < num_objects; ++i)
+        objects.emplace_back(new textogl::Static_text(font, ""));
+
+    // load every glyph into the atlases up front, so only layout is measured
+    for(std::size_t i = 0; i < lines.size(); ++i)
+        objects[0]->set_text(text_for(0, static_cast<int>(i)));
+
+    auto run_round = [&](int round)
+    {
+        for(std::size_t i = 0; i < num_objects; ++i)
+            objects[i]->set_text_async(text_for(i, round));
+        for(auto & object: objects)
+            object->commit(true);
+    };
+
+    std::cout<<num_objects<<" objects, "<<lines.size()<<" lines each, "
+             <<std::thread::hardware_concurrency()<<" hardware threads\n";
+    std::cout<<std::setw(8)<<"threads"<<std::setw(14)<<"ms/round"<<std::setw(16)<<"layouts/s"<<"\n";
+
+    for(unsigned int num_threads: {1u, 2u, 4u, 8u, 16u, 32u})
+    {
+        font.set_layout_threads(num_threads);
+
+        // starts the new threads
+        run_round(0);
+
+        auto start = std::chrono::steady_clock::now();
+        for(int round = 1; round <= num_rounds; ++round)
+            run_round(round);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::cout<<std::setw(8)<<num_threads
+                 <<std::setw(14)<<std::fixed<<std::setprecision(3)<<elapsed.count() * 1000.0 / num_rounds
+                 <<std::setw(16)<<std::setprecision(0)<<num_objects * num_rounds / elapsed.count()<<"\n";
+    }
+
+    if(glGetError() != GL_NO_ERROR)
+    {
+        std::cerr<<"GL error"<<std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,120 @@
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Checks that immediate-mode rendering stops allocating once Font_sys::end_frame
+// has merged the scratch arena's blocks
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <cstdlib>
+
+#include <GL/glew.h>
+
+#include "textogl/font.hpp"
+
+#include "headless_context.hpp"
+
+// Compares layout of shaped text when every line is found in the shaped run
+// cache against when none are. Misses are forced by cycling through more
+// distinct lines than the cache holds. Glyphs are loaded into the atlases
+// first, so both cases only shape (or look up) and build quads
+
+int main(int argc, char * argv[])
+{
+    auto font_path = test_font_path(argc, argv);
+
+    const int num_iterations = 20000;
+
+    // more distinct lines than the shaped run cache holds, so cycling through all of them always misses
+    const std::size_t num_lines = 1024;
+
+    const std::vector<std::string> samples =
+    {
+        "Latin with ligatures: office affine fluffy waffle",
+        "Greek: Γαζέες καὶ μυρτιὲς δὲν θὰ βρῶ πιὰ",
+        "Arabic: نص حكيم له سر قاطع وذو شأن عظيم",
+        "Hebrew: דג סקרן שט בים מאוכזב ולפתע מצא חברה"
+    };
+
+    std::vector<std::string> lines;
+    for(std::size_t i = 0; i < num_lines; ++i)
+        lines.push_back(samples[i % samples.size()] + " " + std::to_string(i));
+
+    Headless_context context;
+
+    textogl::Font_sys font(font_path, 16);
+
+    // counts vertices, so the layout isn't optimized out
+    struct Counting_sink: public textogl::Vertex_sink
+    {
+        std::size_t num_vertices = 0;
+        void write(const unsigned int, const void *, const std::size_t num_vertices) override
+        {
+            this->num_vertices += num_vertices;
+        }
+    } sink;
+
+    auto layout = [&](const std::string & line)
+    {
+        return font.layout_text(line, textogl::VERTEX_POS2F_UV2F, sink);
+    };
+
+    // load every glyph used
+    for(auto & line: lines)
+        layout(line);
+
+    auto time_lines = [&](std::size_t line_count)
+    {
+        std::size_t num_vertices = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < num_iterations; ++i)
+            num_vertices += layout(lines[i % line_count]);
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+
+        if(num_vertices == 0)
+        {
+            std::cerr<<"no vertices built"<<std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        return elapsed.count() / num_iterations;
+    };
+
+    // a handful of lines stays in the cache
+    auto hit_us = time_lines(samples.size());
+    auto miss_us = time_lines(num_lines);
+
+    std::cout<<"us per line, "<<num_iterations<<" lines\n";
+    std::cout<<std::fixed<<std::setprecision(2);
+    std::cout<<"  cache hit:  "<<std::setw(8)<<hit_us<<"\n";
+    std::cout<<"  cache miss: "<<std::setw(8)<<miss_us<<"\n";
+    std::cout<<"  speedup:    "<<std::setw(8)<<miss_us / hit_us<<"x\n";
+
+    if(glGetError() != GL_NO_ERROR)
+    {
+        std::cerr<<"GL error"<<std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,162 @@
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "headless_context.hpp"
+
+#include <iostream>
+#include <stdexcept>
+
+#include <cstdlib>
+
+#include <GL/glew.h>
+
+#include <EGL/eglext.h>
+
+Headless_context::Headless_context(const int width, const int height): width_(width), height_(height)
+{
+    auto get_platform_display = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    if(!get_platform_display)
+        throw std::runtime_error("eglGetPlatformDisplayEXT is not available");
+
+    display_ = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if(display_ == EGL_NO_DISPLAY || !eglInitialize(display_, nullptr, nullptr))
+        throw std::runtime_error("Could not initialize a surfaceless EGL display");
+
+    if(!eglBindAPI(EGL_OPENGL_API))
+        throw std::runtime_error("EGL has no desktop OpenGL support");
+
+    const EGLint config_attribs[] =
+    {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLint num_configs = 0;
+    if(!eglChooseConfig(display_, config_attribs, &config_, 1, &num_configs) || num_configs < 1)
+        config_ = nullptr; // EGL_KHR_no_config_context
+
+    const EGLint context_attribs[] =
+    {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_NONE
+    };
+    context_ = eglCreateContext(display_, config_, EGL_NO_CONTEXT, context_attribs);
+    if(context_ == EGL_NO_CONTEXT)
+        throw std::runtime_error("Could not create an OpenGL 3.3 context");
+
+    if(!eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, context_))
+        throw std::runtime_error("Could not make the context current");
+
+    glewExperimental = GL_TRUE;
+    GLenum glew_err = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    // GLEW built for GLX loads the GL entry points, then fails to find a GLX display
+    if(glew_err == GLEW_ERROR_NO_GLX_DISPLAY)
+        glew_err = GLEW_OK;
+#endif
+    if(glew_err != GLEW_OK)
+        throw std::runtime_error("Error loading glew");
+
+    glGenFramebuffers(1, &fbo_);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+
+    glGenRenderbuffers(1, &renderbuffer_);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer_);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width_, height_);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffer_);
+
+    glViewport(0, 0, width_, height_);
+}
+
+Headless_context::~Headless_context()
+{
+    eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, context_);
+    glDeleteRenderbuffers(1, &renderbuffer_);
+    glDeleteFramebuffers(1, &fbo_);
+
+    eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    for(auto & context: shared_contexts_)
+        eglDestroyContext(display_, context);
+    eglDestroyContext(display_, context_);
+    eglTerminate(display_);
+}
+
+EGLContext Headless_context::create_shared_context()
+{
+    const EGLint context_attribs[] =
+    {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_NONE
+    };
+    EGLContext context = eglCreateContext(display_, config_, context_, context_attribs);
+    if(context == EGL_NO_CONTEXT)
+        throw std::runtime_error("Could not create a shared OpenGL context");
+
+    shared_contexts_.push_back(context);
+    return context;
+}
+
+bool Headless_context::make_current(EGLContext context)
+{
+    return eglBindAPI(EGL_OPENGL_API) && eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, context);
+}
+
+bool Headless_context::release_current()
+{
+    return eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+std::vector<unsigned char> Headless_context::read_pixels() const
+{
+    std::vector<unsigned char> pixels(width_ * height_ * 4);
+    glReadPixels(0, 0, width_, height_, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    return pixels;
+}
+
+std::size_t Headless_context::count_lit_pixels(const unsigned char threshold) const
+{
+    auto pixels = read_pixels();
+
+    std::size_t count = 0;
+    for(std::size_t i = 0; i < pixels.size(); i += 4)
+    {
+        if(pixels[i] > threshold || pixels[i + 1] > threshold || pixels[i + 2] > threshold)
+            ++count;
+    }
+    return count;
+}
+
+std::string test_font_path(int argc, char * argv[], const int index)
+{
+    if(argc <= index)
+    {
+        std::cerr<<"no font specified"<<std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    return argv[index];
+}
+
+bool check(const bool passed, const std::string & description)
+{
+    std::cout<<(passed ? "PASS: " : "FAIL: ")<<description<<std::endl;
+    return passed;
+}
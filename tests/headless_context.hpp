@@ -0,0 +1,90 @@
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Offscreen OpenGL context for tests and benchmarks
+
+// Uses EGL without a window system (EGL_MESA_platform_surfaceless), so tests
+// run headless, for instance on Mesa's llvmpipe. Rendering goes to a
+// framebuffer object, since surfaceless contexts have no default framebuffer
+
+#ifndef HEADLESS_CONTEXT_HPP
+#define HEADLESS_CONTEXT_HPP
+
+#include <string>
+#include <vector>
+
+#include <EGL/egl.h>
+
+class Headless_context
+{
+public:
+    /// Create a desktop OpenGL 3.3 context, make it current, and bind a width x height RGBA framebuffer
+
+    /// @throws std::runtime_error if no context could be created
+    Headless_context(const int width = 256, const int height = 256);
+    ~Headless_context();
+
+    Headless_context(const Headless_context &) = delete;
+    Headless_context & operator=(const Headless_context &) = delete;
+
+    /// Create another context in the same share group. Not current on any thread
+
+    /// Owned by this object, and destroyed with it
+    EGLContext create_shared_context();
+
+    /// Make a context returned by \ref create_shared_context current on the calling thread
+    bool make_current(EGLContext context);
+
+    /// Release the calling thread's current context
+    bool release_current();
+
+    EGLDisplay get_display() const { return display_; }
+    EGLContext get_context() const { return context_; }
+
+    int get_width() const { return width_; }
+    int get_height() const { return height_; }
+
+    /// Read back the framebuffer, as RGBA8, bottom row first
+    std::vector<unsigned char> read_pixels() const;
+
+    /// Count pixels with red, green, or blue above \p threshold
+    std::size_t count_lit_pixels(const unsigned char threshold = 128) const;
+
+private:
+    EGLDisplay display_ = EGL_NO_DISPLAY;
+    EGLConfig config_ = nullptr;
+    EGLContext context_ = EGL_NO_CONTEXT;
+    std::vector<EGLContext> shared_contexts_;
+
+    unsigned int fbo_ = 0;
+    unsigned int renderbuffer_ = 0;
+
+    int width_ = 0;
+    int height_ = 0;
+};
+
+/// Get the test font path from the command line, or exit with an error
+std::string test_font_path(int argc, char * argv[], const int index = 1);
+
+/// Print a check's result
+/// @returns \p passed
+bool check(const bool passed, const std::string & description);
+
+#endif // HEADLESS_CONTEXT_HPP
@@ -0,0 +1,125 @@
+// Copyright 2022 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Checks that immediate-mode rendering stops allocating once Font_sys::end_frame
+// has merged the scratch arena's blocks
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <cstdlib>
+
+#include <GL/glew.h>
+
+#include "textogl/font.hpp"
+
+#include "headless_context.hpp"
+
+// Glyphs preloaded through the upload thread, from a second context in the
+// same share group, must draw exactly like glyphs loaded on demand
+
+int main(int argc, char * argv[])
+{
+    auto font_path = test_font_path(argc, argv);
+
+    Headless_context context;
+    EGLContext loader_context = context.create_shared_context();
+
+    const std::string text = "Upload thread: ÀÉÎÕÜ àéîõü ©®±µ¶ 0123456789";
+    const textogl::Color color{1.0f, 1.0f, 1.0f, 1.0f};
+    const textogl::Vec2<float> win_size{static_cast<float>(context.get_width()), static_cast<float>(context.get_height())};
+
+    auto draw = [&](textogl::Font_sys & font)
+    {
+        glClear(GL_COLOR_BUFFER_BIT);
+        font.render_text(text, color, win_size, {5.0f, 100.0f});
+        return context.read_pixels();
+    };
+
+    bool passed = true;
+
+    // reference, loaded on demand on this thread
+    std::vector<unsigned char> expected;
+    {
+        textogl::Font_sys font(font_path, 16);
+        expected = draw(font);
+    }
+    passed &= check(context.count_lit_pixels() > 0, "reference text was drawn");
+
+    textogl::Font_sys::start_upload_thread([&](){ context.make_current(loader_context); },
+                                           [&](){ context.release_current(); });
+
+    // uploads applied by end_frame, once their fence is signaled
+    {
+        textogl::Font_sys font(font_path, 16);
+        auto loaded = font.preload(textogl::GLYPHS_LATIN1, 2);
+
+        auto start = std::chrono::steady_clock::now();
+        while(loaded.wait_for(std::chrono::milliseconds(1)) != std::future_status::ready &&
+                std::chrono::steady_clock::now() - start < std::chrono::seconds(30))
+        {
+            font.end_frame();
+        }
+
+        passed &= check(loaded.wait_for(std::chrono::seconds(0)) == std::future_status::ready, "preload finished through end_frame");
+        if(loaded.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        {
+            auto num_loaded = loaded.get();
+            passed &= check(num_loaded > 0 && font.get_atlas_stats().num_glyphs == num_loaded,
+                    "preloaded glyphs are resident before drawing (" + std::to_string(num_loaded) + " glyphs)");
+        }
+        passed &= check(draw(font) == expected, "uploaded glyphs match glyphs loaded on demand");
+    }
+
+    // uploads waited for by finish_preload
+    {
+        textogl::Font_sys font(font_path, 16);
+        auto loaded = font.preload(textogl::GLYPHS_LATIN1, 2);
+        font.finish_preload();
+
+        passed &= check(loaded.wait_for(std::chrono::seconds(0)) == std::future_status::ready, "finish_preload made the future ready");
+        passed &= check(draw(font) == expected, "glyphs from finish_preload match glyphs loaded on demand");
+    }
+
+    // a font destroyed with uploads still queued or in flight must cancel them cleanly
+    for(int i = 0; i < 10; ++i)
+    {
+        textogl::Font_sys font(font_path, 16);
+        font.preload(textogl::GLYPHS_LATIN1, 2);
+        font.end_frame();
+    }
+    passed &= check(true, "fonts destroyed with pending uploads");
+
+    textogl::Font_sys::stop_upload_thread();
+
+    // back to uploading on the rendering thread
+    {
+        textogl::Font_sys font(font_path, 16);
+        font.preload(textogl::GLYPHS_LATIN1, 2);
+        font.finish_preload();
+        passed &= check(draw(font) == expected, "glyphs match after stopping the upload thread");
+    }
+
+    passed &= check(glGetError() == GL_NO_ERROR, "no GL errors");
+
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}